@@ -0,0 +1,121 @@
+// Measures what host:encrypt costs per packet: sealing and opening with ChaCha20-Poly1305
+// next to the copy into a packet every send pays anyway, for common payload sizes.
+//
+// usage: aead [milliseconds per size (default 200)]
+
+#include "aead.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <chrono>
+
+// Sealed packets carry a type byte, the 64 bits nonce and the tag, see main.cpp.
+static const size_t header_size = 1 + sizeof( uint64_t );
+static const size_t overhead = header_size + aead::tag_size;
+
+// Results are accumulated here so the calls being measured can't be optimized out.
+static volatile uint8_t sink = 0;
+
+struct buffers
+{
+	std::vector<uint8_t> payload;
+	std::vector<uint8_t> packet;
+	uint8_t key[aead::key_size];
+	uint64_t counter;
+};
+
+static void Copy( buffers &b, size_t len )
+{
+	std::memcpy( b.packet.data( ), b.payload.data( ), len );
+	sink = sink + b.packet[len - 1];
+}
+
+static void Seal( buffers &b, size_t len )
+{
+	uint8_t *output = b.packet.data( );
+	output[0] = 2;
+	std::memcpy( output + 1, &++b.counter, sizeof( b.counter ) );
+
+	uint8_t aad[header_size + 1];
+	std::memcpy( aad, output, header_size );
+	aad[header_size] = 0;
+	aead::Seal( b.key, b.counter, aad, sizeof( aad ), b.payload.data( ), len, output + header_size, output + header_size + len );
+	sink = sink + output[header_size + len];
+}
+
+// Opens the packet sealed last, into a scratch copy since opening happens in place.
+static void Open( buffers &b, size_t len )
+{
+	uint8_t aad[header_size + 1];
+	std::memcpy( aad, b.packet.data( ), header_size );
+	aad[header_size] = 0;
+
+	const uint8_t *input = b.packet.data( ) + header_size;
+	bool valid = aead::Open( b.key, b.counter, aad, sizeof( aad ), input, len, input + len, b.payload.data( ) );
+	sink = sink + ( valid ? 1 : 0 );
+}
+
+// Returns nanoseconds per call.
+static double Measure( void ( *operation )( buffers &, size_t ), buffers &b, size_t len, double milliseconds )
+{
+	typedef std::chrono::steady_clock clock;
+	auto deadline = clock::now( ) + std::chrono::microseconds( static_cast<int64_t>( milliseconds * 1000.0 ) );
+	uint64_t calls = 0;
+	auto start = clock::now( ), now = start;
+	do
+	{
+		for( size_t k = 0; k < 256; ++k )
+			operation( b, len );
+
+		calls += 256;
+		now = clock::now( );
+	}
+	while( now < deadline );
+
+	return std::chrono::duration<double, std::nano>( now - start ).count( ) / static_cast<double>( calls );
+}
+
+int main( int argc, char **argv )
+{
+	double milliseconds = argc > 1 ? std::atof( argv[1] ) : 200.0;
+	if( milliseconds <= 0.0 )
+	{
+		std::fprintf( stderr, "usage: %s [milliseconds per size]\n", argv[0] );
+		return 1;
+	}
+
+	buffers b;
+	b.payload.resize( 4096 );
+	b.packet.resize( 4096 + overhead );
+	b.counter = 0;
+	for( size_t k = 0; k < sizeof( b.key ); ++k )
+		b.key[k] = static_cast<uint8_t>( k * 29 + 1 );
+
+	std::printf( "%u bytes of overhead per packet\n", static_cast<unsigned int>( overhead ) );
+	std::printf( "%8s %10s %10s %10s %12s %10s %10s\n", "bytes", "copy ns", "seal ns", "open ns", "overhead ns", "seal MB/s", "open MB/s" );
+
+	const size_t sizes[] = { 16, 64, 256, 576, 1200, 1400, 4096 };
+	for( size_t size : sizes )
+	{
+		for( size_t k = 0; k < size; ++k )
+			b.payload[k] = static_cast<uint8_t>( k * 131 + 7 );
+
+		double copy = Measure( Copy, b, size, milliseconds );
+		double seal = Measure( Seal, b, size, milliseconds );
+		double open = Measure( Open, b, size, milliseconds );
+		std::printf(
+			"%8zu %10.1f %10.1f %10.1f %12.1f %10.1f %10.1f\n",
+			size,
+			copy,
+			seal,
+			open,
+			seal + open - copy,
+			static_cast<double>( size ) * 1000.0 / seal,
+			static_cast<double>( size ) * 1000.0 / open
+		);
+	}
+
+	return 0;
+}
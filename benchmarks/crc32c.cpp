@@ -0,0 +1,92 @@
+// Compares the checksum host:checksum("crc32c") installs with ENet's bundled enet_crc32,
+// over datagrams split in two buffers like ENet's own (protocol header, then commands).
+//
+// usage: crc32c [milliseconds per size (default 200)]
+
+#include <enet/enet.h>
+#include "crc32c.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+
+// Results are accumulated here so the calls being measured can't be optimized out.
+static volatile uint32_t sink = 0;
+
+static enet_uint32 ENET_CALLBACK ChecksumCRC32C( const ENetBuffer *buffers, size_t bufferCount )
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for( ; bufferCount > 0; --bufferCount, ++buffers )
+		crc = crc32c::Update( crc, buffers->data, buffers->dataLength );
+
+	return ENET_HOST_TO_NET_32( ~crc );
+}
+
+// Returns nanoseconds per call.
+static double Measure( ENetChecksumCallback checksum, const ENetBuffer *buffers, double milliseconds )
+{
+	typedef std::chrono::steady_clock clock;
+	auto deadline = clock::now( ) + std::chrono::microseconds( static_cast<int64_t>( milliseconds * 1000.0 ) );
+	uint64_t calls = 0;
+	auto start = clock::now( ), now = start;
+	do
+	{
+		for( size_t k = 0; k < 1024; ++k )
+			sink = sink + checksum( buffers, 2 );
+
+		calls += 1024;
+		now = clock::now( );
+	}
+	while( now < deadline );
+
+	return std::chrono::duration<double, std::nano>( now - start ).count( ) / static_cast<double>( calls );
+}
+
+int main( int argc, char **argv )
+{
+	double milliseconds = argc > 1 ? std::atof( argv[1] ) : 200.0;
+	if( milliseconds <= 0.0 )
+	{
+		std::fprintf( stderr, "usage: %s [milliseconds per size]\n", argv[0] );
+		return 1;
+	}
+
+	const char check[] = "123456789";
+	if( ~crc32c::Update( 0xFFFFFFFF, check, sizeof( check ) - 1 ) != 0xE3069283 )
+	{
+		std::fprintf( stderr, "CRC32C check value mismatch\n" );
+		return 1;
+	}
+
+	std::printf( "crc32c implementation: %s\n", crc32c::GetImplementation( ) );
+	std::printf( "%8s %14s %14s %10s %10s %8s\n", "bytes", "enet_crc32 ns", "crc32c ns", "enet GB/s", "crc GB/s", "speedup" );
+
+	const size_t sizes[] = { 64, 256, 576, 1200, 1400, 4096 };
+	std::vector<uint8_t> data( 4096 );
+	for( size_t k = 0; k < data.size( ); ++k )
+		data[k] = static_cast<uint8_t>( k * 131 + 7 );
+
+	for( size_t size : sizes )
+	{
+		ENetBuffer buffers[2];
+		buffers[0].data = data.data( );
+		buffers[0].dataLength = sizeof( ENetProtocolHeader ) + sizeof( enet_uint32 );
+		buffers[1].data = data.data( ) + buffers[0].dataLength;
+		buffers[1].dataLength = size - buffers[0].dataLength;
+
+		double bundled = Measure( enet_crc32, buffers, milliseconds );
+		double accelerated = Measure( ChecksumCRC32C, buffers, milliseconds );
+		std::printf(
+			"%8zu %14.1f %14.1f %10.2f %10.2f %7.1fx\n",
+			size,
+			bundled,
+			accelerated,
+			static_cast<double>( size ) / bundled,
+			static_cast<double>( size ) / accelerated,
+			bundled / accelerated
+		);
+	}
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+-- Compares sending and receiving through the Lua bindings with the same through the
+-- LuaJIT FFI functions declared by enet.ffi_cdef, on two hosts talking over loopback.
+-- Both paths pay the same socket costs, so the difference is the binding overhead.
+--
+-- Needs the module loaded and LuaJIT's ffi library, which Garry's Mod only exposes to
+-- modules and menu state scripts. Run it from a place that has both, e.g.:
+--   lua_run include("benchmarks/ffi.lua")
+-- after copying this file into garrysmod/lua/benchmarks.
+
+local ffi = ffi or require("ffi")
+local clock = SysTime or os.clock
+
+local PORT = 27315
+local ROUNDS = 200
+local BATCH = 100
+local RELIABLE = 1
+
+local sizes = {16, 256, 1200}
+
+ffi.cdef(enet.ffi_cdef)
+local lib = ffi.load(assert(enet.ffi_path()))
+
+local server = assert(enet.host_create("127.0.0.1:" .. PORT, 1, 2))
+local client = assert(enet.host_create(nil, 1, 2))
+server:peer_ids(true)
+client:peer_ids(true)
+
+local server_handle = server:ffi_handle()
+local client_handle = client:ffi_handle()
+
+assert(client:connect("127.0.0.1:" .. PORT, 2))
+local server_id
+
+-- both ends have to see the connect before anything can be sent
+local deadline = clock() + 5
+while server_id == nil and clock() < deadline do
+	client:service(1)
+	local event = server:service(1)
+	if event ~= nil and event.type == "connect" then
+		server_id = event.id
+	end
+end
+
+assert(server_id ~= nil, "failed to connect over loopback")
+while client:service(10) ~= nil do end
+
+local function ReceiveLua(count)
+	local received = 0
+	while received < count do
+		local event = client:service(1)
+		if event ~= nil and event.type == "receive" then
+			received = received + 1
+		end
+	end
+end
+
+local event = ffi.new("enet_ffi_event")
+local function ReceiveFFI(count)
+	local received = 0
+	while received < count do
+		local ret = lib.enet_ffi_poll(client_handle, 1, event)
+		assert(ret >= 0, "enet_ffi_poll failed")
+		if ret > 0 and event.type == 3 then
+			received = received + 1
+		end
+	end
+end
+
+-- Returns nanoseconds per send and per receive, the receive loop includes the socket read.
+local function Measure(send, receive)
+	local sending, receiving = 0, 0
+	for _ = 1, ROUNDS do
+		local start = clock()
+		for _ = 1, BATCH do
+			send()
+		end
+
+		sending = sending + clock() - start
+		server:flush()
+
+		start = clock()
+		receive(BATCH)
+		receiving = receiving + clock() - start
+	end
+
+	local calls = ROUNDS * BATCH
+	return sending * 1e9 / calls, receiving * 1e9 / calls
+end
+
+print(string.format("%8s %14s %14s %14s %14s", "bytes", "lua send ns", "ffi send ns", "lua recv ns", "ffi recv ns"))
+
+for _, size in ipairs(sizes) do
+	local data = string.rep("x", size)
+	local buffer = ffi.new("uint8_t[?]", size)
+	ffi.fill(buffer, size, 120)
+
+	local lua_send, lua_receive = Measure(function()
+		server:send_to(server_id, data, 0, "reliable")
+	end, ReceiveLua)
+
+	local ffi_send, ffi_receive = Measure(function()
+		assert(lib.enet_ffi_send(server_handle, server_id, 0, RELIABLE, buffer, size) == 0)
+	end, ReceiveFFI)
+
+	print(string.format("%8d %14.1f %14.1f %14.1f %14.1f", size, lua_send, ffi_send, lua_receive, ffi_receive))
+end
+
+-- the handle must stop working with its host
+server:destroy()
+assert(lib.enet_ffi_flush(server_handle) == lib.ENET_FFI_INVALID_HOST)
+client:destroy()
@@ -0,0 +1,291 @@
+// Compares the "shm://" transport with UDP over the loopback interface, through
+// ENet's socket layer: round trip time of a ping echoed by another thread, and how
+// many packets per second one thread can stream to another. Both sides busy poll,
+// so the numbers are the transports' floor rather than what a ticking server sees.
+// ENet's protocol costs come on top of the UDP numbers.
+//
+// usage: shm [milliseconds per measurement (default 500)]
+
+#include <enet/enet.h>
+#include "shm.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+typedef std::chrono::steady_clock clock_type;
+
+struct result
+{
+	double round_trip_us;
+	double packets_per_second;
+};
+
+// The measurements only need these from either transport.
+class transport
+{
+public:
+	virtual ~transport( )
+	{ }
+
+	// Returns false when the packet couldn't be queued, the receiver is behind.
+	virtual bool Send( const void *data, size_t len ) = 0;
+
+	// Returns the received length, 0 when nothing is waiting.
+	virtual size_t Receive( void *data, size_t len ) = 0;
+};
+
+class shared_transport : public transport
+{
+public:
+	shared_transport( shm::host &link, size_t peer ) :
+		link( link ),
+		peer( peer )
+	{ }
+
+	bool Send( const void *data, size_t len )
+	{
+		return link.Send( peer, 0, 0, data, len );
+	}
+
+	size_t Receive( void *data, size_t len )
+	{
+		if( !link.Poll( ev ) || ev.type != shm::EVENT_RECEIVE )
+			return 0;
+
+		size_t size = ev.payload.size( ) < len ? ev.payload.size( ) : len;
+		ev.payload.copy( static_cast<char *>( data ), size );
+		return size;
+	}
+
+private:
+	shm::host &link;
+	size_t peer;
+	shm::event ev;
+};
+
+class udp_transport : public transport
+{
+public:
+	udp_transport( ENetSocket socket, const ENetAddress &remote ) :
+		socket( socket ),
+		remote( remote )
+	{ }
+
+	bool Send( const void *data, size_t len )
+	{
+		ENetBuffer buffer;
+		buffer.data = const_cast<void *>( data );
+		buffer.dataLength = len;
+		return enet_socket_send( socket, &remote, &buffer, 1 ) > 0;
+	}
+
+	size_t Receive( void *data, size_t len )
+	{
+		ENetAddress sender;
+		ENetBuffer buffer;
+		buffer.data = data;
+		buffer.dataLength = len;
+		int received = enet_socket_receive( socket, &sender, &buffer, 1 );
+		return received > 0 ? static_cast<size_t>( received ) : 0;
+	}
+
+private:
+	ENetSocket socket;
+	ENetAddress remote;
+};
+
+// Idle loops yield, so the numbers stay meaningful with fewer cores than threads.
+// Echoes every packet back until stopped.
+static void Echo( transport &t, std::atomic<bool> &stop )
+{
+	std::vector<uint8_t> buffer( 65536 );
+	while( !stop.load( std::memory_order_relaxed ) )
+	{
+		size_t len = t.Receive( buffer.data( ), buffer.size( ) );
+		if( len == 0 )
+			std::this_thread::yield( );
+		else
+			while( !t.Send( buffer.data( ), len ) && !stop.load( std::memory_order_relaxed ) )
+				std::this_thread::yield( );
+	}
+}
+
+// Counts received packets until stopped.
+static void Drain( transport &t, std::atomic<bool> &stop, std::atomic<uint64_t> &received )
+{
+	std::vector<uint8_t> buffer( 65536 );
+	while( !stop.load( std::memory_order_relaxed ) )
+		if( t.Receive( buffer.data( ), buffer.size( ) ) != 0 )
+			received.fetch_add( 1, std::memory_order_relaxed );
+		else
+			std::this_thread::yield( );
+}
+
+// Drops whatever a measurement left queued, so the next one starts empty.
+static void Flush( transport &t )
+{
+	std::vector<uint8_t> buffer( 65536 );
+	auto quiet = clock_type::now( ) + std::chrono::milliseconds( 20 );
+	while( clock_type::now( ) < quiet )
+		if( t.Receive( buffer.data( ), buffer.size( ) ) != 0 )
+			quiet = clock_type::now( ) + std::chrono::milliseconds( 20 );
+		else
+			std::this_thread::yield( );
+}
+
+static double MeasureRoundTrip( transport &local, transport &remote, size_t size, double milliseconds )
+{
+	std::atomic<bool> stop( false );
+	std::thread echo( Echo, std::ref( remote ), std::ref( stop ) );
+
+	std::vector<uint8_t> payload( size, 0x5A ), reply( 65536 );
+	auto deadline = clock_type::now( ) + std::chrono::microseconds( static_cast<int64_t>( milliseconds * 1000.0 ) );
+	uint64_t trips = 0;
+	auto start = clock_type::now( ), now = start;
+	do
+	{
+		if( local.Send( payload.data( ), payload.size( ) ) )
+		{
+			// UDP may drop under pressure, a ping that takes this long is sent again
+			auto expiry = clock_type::now( ) + std::chrono::milliseconds( 100 );
+			while( local.Receive( reply.data( ), reply.size( ) ) == 0 && clock_type::now( ) < expiry )
+				std::this_thread::yield( );
+
+			++trips;
+		}
+
+		now = clock_type::now( );
+	}
+	while( now < deadline );
+
+	stop = true;
+	echo.join( );
+	return std::chrono::duration<double, std::micro>( now - start ).count( ) / static_cast<double>( trips );
+}
+
+static double MeasureStream( transport &local, transport &remote, size_t size, double milliseconds )
+{
+	std::atomic<bool> stop( false );
+	std::atomic<uint64_t> received( 0 );
+	std::thread drain( Drain, std::ref( remote ), std::ref( stop ), std::ref( received ) );
+
+	std::vector<uint8_t> payload( size, 0xA5 );
+	auto start = clock_type::now( );
+	auto deadline = start + std::chrono::microseconds( static_cast<int64_t>( milliseconds * 1000.0 ) );
+	while( clock_type::now( ) < deadline )
+		for( size_t k = 0; k < 64; ++k )
+			if( !local.Send( payload.data( ), payload.size( ) ) )
+				std::this_thread::yield( );
+
+	// packets still in flight at the deadline aren't counted
+	uint64_t count = received.load( );
+	double seconds = std::chrono::duration<double>( clock_type::now( ) - start ).count( );
+	stop = true;
+	drain.join( );
+	return static_cast<double>( count ) / seconds;
+}
+
+static result Measure( transport &local, transport &remote, size_t size, double milliseconds )
+{
+	result r;
+	r.round_trip_us = MeasureRoundTrip( local, remote, size, milliseconds );
+	Flush( local );
+	Flush( remote );
+	r.packets_per_second = MeasureStream( local, remote, size, milliseconds );
+	Flush( remote );
+	return r;
+}
+
+static ENetSocket CreateSocket( ENetAddress &address )
+{
+	address.port = ENET_PORT_ANY;
+	enet_address_set_host( &address, "127.0.0.1" );
+
+	ENetSocket socket = enet_socket_create( ENET_SOCKET_TYPE_DATAGRAM );
+	if( socket == ENET_SOCKET_NULL )
+		return socket;
+
+	if( enet_socket_bind( socket, &address ) != 0 ||
+		enet_socket_set_option( socket, ENET_SOCKOPT_NONBLOCK, 1 ) != 0 ||
+		enet_socket_get_address( socket, &address ) != 0 )
+	{
+		enet_socket_destroy( socket );
+		return ENET_SOCKET_NULL;
+	}
+
+	return socket;
+}
+
+int main( int argc, char **argv )
+{
+	double milliseconds = argc > 1 ? std::atof( argv[1] ) : 500.0;
+	if( milliseconds <= 0.0 )
+	{
+		std::fprintf( stderr, "usage: %s [milliseconds per measurement]\n", argv[0] );
+		return 1;
+	}
+
+	if( enet_initialize( ) != 0 )
+	{
+		std::fprintf( stderr, "failed to initialize ENet\n" );
+		return 1;
+	}
+
+	char name[64];
+	std::snprintf( name, sizeof( name ), "benchmark-%llu",
+		static_cast<unsigned long long>( clock_type::now( ).time_since_epoch( ).count( ) ) );
+
+	shm::host server, client;
+	shm::event ev;
+	int32_t peer = -1;
+	if( !server.Listen( name, 1, shm::default_ring_size ) || !client.Client( 1 ) ||
+		( peer = client.Connect( name, 0 ) ) < 0 )
+	{
+		std::fprintf( stderr, "failed to set up the shared memory segment\n" );
+		return 1;
+	}
+
+	while( !server.Poll( ev ) || ev.type != shm::EVENT_CONNECT )
+		std::this_thread::yield( );
+
+	while( !client.Poll( ev ) || ev.type != shm::EVENT_CONNECT )
+		std::this_thread::yield( );
+
+	ENetAddress first_address, second_address;
+	ENetSocket first = CreateSocket( first_address ), second = CreateSocket( second_address );
+	if( first == ENET_SOCKET_NULL || second == ENET_SOCKET_NULL )
+	{
+		std::fprintf( stderr, "failed to create loopback sockets\n" );
+		return 1;
+	}
+
+	shared_transport shared_local( client, static_cast<size_t>( peer ) ), shared_remote( server, ev.peer );
+	udp_transport udp_local( first, second_address ), udp_remote( second, first_address );
+
+	std::printf( "%8s %14s %14s %16s %16s\n", "bytes", "shm rtt us", "udp rtt us", "shm packets/s", "udp packets/s" );
+
+	const size_t sizes[] = { 16, 64, 256, 1200, 4096 };
+	for( size_t size : sizes )
+	{
+		result shared = Measure( shared_local, shared_remote, size, milliseconds );
+		result udp = Measure( udp_local, udp_remote, size, milliseconds );
+		std::printf(
+			"%8zu %14.2f %14.2f %16.0f %16.0f\n",
+			size,
+			shared.round_trip_us,
+			udp.round_trip_us,
+			shared.packets_per_second,
+			udp.packets_per_second
+		);
+	}
+
+	enet_socket_destroy( first );
+	enet_socket_destroy( second );
+	enet_deinitialize( );
+	return 0;
+}
@@ -0,0 +1,197 @@
+newoption({
+	trigger = "gmcommon",
+	description = "Sets the path to the garrysmod_common (https://github.com/danielga/garrysmod_common) directory",
+	value = "path to garrysmod_common directory"
+})
+
+local gmcommon = _OPTIONS.gmcommon or os.getenv("GARRYSMOD_COMMON")
+if gmcommon == nil then
+	error("you didn't provide a path to your garrysmod_common (https://github.com/danielga/garrysmod_common) directory")
+end
+
+include(gmcommon)
+
+local ENET_DIRECTORY = "../enet"
+
+CreateWorkspace({name = "enet"})
+	CreateProject({serverside = true})
+		includedirs(ENET_DIRECTORY .. "/include")
+		links("enet")
+		IncludeLuaShared()
+
+		filter("system:windows")
+			links({"ws2_32", "winmm"})
+
+		filter("system:linux or macosx")
+			defines({
+				"HAS_GETADDRINFO",
+				"HAS_GETNAMEINFO",
+				"HAS_GETHOSTBYADDR_R",
+				"HAS_GETHOSTBYNAME_R",
+				"HAS_POLL",
+				"HAS_FCNTL",
+				"HAS_INET_PTON",
+				"HAS_INET_NTOP",
+				"HAS_MSGHDR_FLAGS",
+				"HAS_SOCKLEN_T"
+			})
+
+		filter("system:linux")
+			links("rt")
+
+	CreateProject({serverside = false})
+		includedirs(ENET_DIRECTORY .. "/include")
+		links("enet")
+		IncludeLuaShared()
+
+		filter("system:windows")
+			links({"ws2_32", "winmm"})
+
+		filter("system:linux or macosx")
+			defines({
+				"HAS_GETADDRINFO",
+				"HAS_GETNAMEINFO",
+				"HAS_GETHOSTBYADDR_R",
+				"HAS_GETHOSTBYNAME_R",
+				"HAS_POLL",
+				"HAS_FCNTL",
+				"HAS_INET_PTON",
+				"HAS_INET_NTOP",
+				"HAS_MSGHDR_FLAGS",
+				"HAS_SOCKLEN_T"
+			})
+
+		filter("system:linux")
+			links("rt")
+
+	project("enet")
+		kind("StaticLib")
+		includedirs(ENET_DIRECTORY .. "/include")
+		vpaths({
+			["Header files"] = ENET_DIRECTORY .. "/**.h",
+			["Source files"] = ENET_DIRECTORY .. "/**.c"
+		})
+		files({
+			ENET_DIRECTORY .. "/callbacks.c",
+			ENET_DIRECTORY .. "/compress.c",
+			ENET_DIRECTORY .. "/host.c",
+			ENET_DIRECTORY .. "/list.c",
+			ENET_DIRECTORY .. "/packet.c",
+			ENET_DIRECTORY .. "/peer.c",
+			ENET_DIRECTORY .. "/protocol.c"
+		})
+
+		filter("system:windows")
+			files(ENET_DIRECTORY .. "/win32.c")
+			links({"ws2_32", "winmm"})
+
+		filter("system:linux or macosx")
+			defines({
+				"HAS_GETADDRINFO",
+				"HAS_GETNAMEINFO",
+				"HAS_GETHOSTBYADDR_R",
+				"HAS_GETHOSTBYNAME_R",
+				"HAS_POLL",
+				"HAS_FCNTL",
+				"HAS_INET_PTON",
+				"HAS_INET_NTOP",
+				"HAS_MSGHDR_FLAGS",
+				"HAS_SOCKLEN_T"
+			})
+			files(ENET_DIRECTORY .. "/unix.c")
+
+	-- standalone replay of host:capture_start files, see tools/replay.cpp
+	project("replay")
+		filter({})
+		kind("ConsoleApp")
+		language("C++")
+		cppdialect("C++11")
+		includedirs({ENET_DIRECTORY .. "/include", "../source"})
+		files({
+			"../tools/replay.cpp",
+			"../source/capture.cpp",
+			"../source/crc32c.cpp"
+		})
+		links("enet")
+
+		filter("system:windows")
+			links({"ws2_32", "winmm"})
+
+	-- host:checksum("crc32c") against enet_crc32, see benchmarks/crc32c.cpp
+	project("benchmark_crc32c")
+		filter({})
+		kind("ConsoleApp")
+		language("C++")
+		cppdialect("C++11")
+		optimize("Speed")
+		includedirs({ENET_DIRECTORY .. "/include", "../source"})
+		files({
+			"../benchmarks/crc32c.cpp",
+			"../source/crc32c.cpp"
+		})
+		links("enet")
+
+		filter("system:windows")
+			links({"ws2_32", "winmm"})
+
+	-- unit tests of the helper modules, run the resulting executable
+	project("tests")
+		filter({})
+		kind("ConsoleApp")
+		language("C++")
+		cppdialect("C++11")
+		includedirs({ENET_DIRECTORY .. "/include", "../source", "../tests"})
+		files({
+			"../tests/*.hpp",
+			"../tests/*.cpp",
+			"../source/crc32c.cpp",
+			"../source/aead.cpp",
+			"../source/shm.cpp",
+			"../source/overload.cpp",
+			"../source/jitter.cpp",
+			"../source/mtu.cpp",
+			"../source/pool.cpp",
+			"../source/bitstream.cpp",
+			"../source/capture.cpp",
+			"../source/nonce.cpp"
+		})
+		links("enet")
+
+		filter("system:windows")
+			links({"ws2_32", "winmm"})
+
+		filter("system:linux")
+			links({"rt", "pthread"})
+
+	-- host:encrypt cost per packet, see benchmarks/aead.cpp
+	project("benchmark_aead")
+		filter({})
+		kind("ConsoleApp")
+		language("C++")
+		cppdialect("C++11")
+		optimize("Speed")
+		includedirs("../source")
+		files({
+			"../benchmarks/aead.cpp",
+			"../source/aead.cpp"
+		})
+
+	-- "shm://" hosts against UDP over loopback, see benchmarks/shm.cpp
+	project("benchmark_shm")
+		filter({})
+		kind("ConsoleApp")
+		language("C++")
+		cppdialect("C++11")
+		optimize("Speed")
+		includedirs({ENET_DIRECTORY .. "/include", "../source"})
+		files({
+			"../benchmarks/shm.cpp",
+			"../source/shm.cpp"
+		})
+		links("enet")
+
+		filter("system:windows")
+			links({"ws2_32", "winmm"})
+
+		filter("system:linux")
+			links({"rt", "pthread"})
@@ -0,0 +1,391 @@
+#include "aead.hpp"
+#include <cstring>
+
+#if defined _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <ntsecapi.h>
+
+#else
+
+#include <cstdio>
+
+#endif
+
+namespace aead
+{
+
+inline uint32_t Load32( const uint8_t *data )
+{
+	return static_cast<uint32_t>( data[0] ) |
+		static_cast<uint32_t>( data[1] ) << 8 |
+		static_cast<uint32_t>( data[2] ) << 16 |
+		static_cast<uint32_t>( data[3] ) << 24;
+}
+
+inline void Store32( uint8_t *data, uint32_t value )
+{
+	data[0] = static_cast<uint8_t>( value );
+	data[1] = static_cast<uint8_t>( value >> 8 );
+	data[2] = static_cast<uint8_t>( value >> 16 );
+	data[3] = static_cast<uint8_t>( value >> 24 );
+}
+
+inline void Store64( uint8_t *data, uint64_t value )
+{
+	Store32( data, static_cast<uint32_t>( value ) );
+	Store32( data + 4, static_cast<uint32_t>( value >> 32 ) );
+}
+
+inline uint32_t Rotate( uint32_t value, int bits )
+{
+	return ( value << bits ) | ( value >> ( 32 - bits ) );
+}
+
+#define QUARTER_ROUND( a, b, c, d ) \
+	a += b; d = Rotate( d ^ a, 16 ); \
+	c += d; b = Rotate( b ^ c, 12 ); \
+	a += b; d = Rotate( d ^ a, 8 ); \
+	c += d; b = Rotate( b ^ c, 7 )
+
+static void Rounds( uint32_t *x )
+{
+	for( int k = 0; k < 10; ++k )
+	{
+		QUARTER_ROUND( x[0], x[4], x[8], x[12] );
+		QUARTER_ROUND( x[1], x[5], x[9], x[13] );
+		QUARTER_ROUND( x[2], x[6], x[10], x[14] );
+		QUARTER_ROUND( x[3], x[7], x[11], x[15] );
+		QUARTER_ROUND( x[0], x[5], x[10], x[15] );
+		QUARTER_ROUND( x[1], x[6], x[11], x[12] );
+		QUARTER_ROUND( x[2], x[7], x[8], x[13] );
+		QUARTER_ROUND( x[3], x[4], x[9], x[14] );
+	}
+}
+
+#undef QUARTER_ROUND
+
+static void Setup( uint32_t *input, const uint8_t *key )
+{
+	input[0] = 0x61707865;
+	input[1] = 0x3320646e;
+	input[2] = 0x79622d32;
+	input[3] = 0x6b206574;
+	for( int k = 0; k < 8; ++k )
+		input[4 + k] = Load32( key + k * 4 );
+}
+
+static void Block( const uint32_t *input, uint8_t *output )
+{
+	uint32_t x[16];
+	std::memcpy( x, input, sizeof( x ) );
+	Rounds( x );
+	for( int k = 0; k < 16; ++k )
+		Store32( output + k * 4, x[k] + input[k] );
+}
+
+static void Xor(
+	const uint8_t *key,
+	uint64_t nonce,
+	uint32_t counter,
+	const uint8_t *input,
+	size_t len,
+	uint8_t *output
+)
+{
+	uint32_t state[16];
+	Setup( state, key );
+	state[12] = counter;
+	state[13] = 0;
+	state[14] = static_cast<uint32_t>( nonce );
+	state[15] = static_cast<uint32_t>( nonce >> 32 );
+
+	uint8_t stream[64];
+	while( len > 0 )
+	{
+		Block( state, stream );
+		++state[12];
+
+		size_t count = len < sizeof( stream ) ? len : sizeof( stream );
+		for( size_t k = 0; k < count; ++k )
+			output[k] = input[k] ^ stream[k];
+
+		input += count;
+		output += count;
+		len -= count;
+	}
+}
+
+class poly1305
+{
+public:
+	explicit poly1305( const uint8_t *key ) :
+		leftover( 0 )
+	{
+		r[0] = Load32( key ) & 0x3ffffff;
+		r[1] = ( Load32( key + 3 ) >> 2 ) & 0x3ffff03;
+		r[2] = ( Load32( key + 6 ) >> 4 ) & 0x3ffc0ff;
+		r[3] = ( Load32( key + 9 ) >> 6 ) & 0x3f03fff;
+		r[4] = ( Load32( key + 12 ) >> 8 ) & 0x00fffff;
+
+		for( int k = 0; k < 5; ++k )
+			h[k] = 0;
+
+		for( int k = 0; k < 4; ++k )
+			pad[k] = Load32( key + 16 + k * 4 );
+	}
+
+	void Update( const uint8_t *data, size_t len )
+	{
+		if( leftover != 0 )
+		{
+			size_t count = 16 - leftover;
+			if( count > len )
+				count = len;
+
+			std::memcpy( buffer + leftover, data, count );
+			leftover += count;
+			data += count;
+			len -= count;
+			if( leftover < 16 )
+				return;
+
+			Blocks( buffer, 16, 1 << 24 );
+			leftover = 0;
+		}
+
+		size_t whole = len & ~static_cast<size_t>( 15 );
+		if( whole != 0 )
+		{
+			Blocks( data, whole, 1 << 24 );
+			data += whole;
+			len -= whole;
+		}
+
+		if( len != 0 )
+		{
+			std::memcpy( buffer, data, len );
+			leftover = len;
+		}
+	}
+
+	// Zero pads the data fed so far to a multiple of 16 bytes.
+	void Pad( )
+	{
+		if( leftover == 0 )
+			return;
+
+		std::memset( buffer + leftover, 0, 16 - leftover );
+		Blocks( buffer, 16, 1 << 24 );
+		leftover = 0;
+	}
+
+	void Finish( uint8_t *tag )
+	{
+		if( leftover != 0 )
+		{
+			buffer[leftover] = 1;
+			std::memset( buffer + leftover + 1, 0, 15 - leftover );
+			Blocks( buffer, 16, 0 );
+		}
+
+		uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4], c = 0;
+		c = h1 >> 26; h1 &= 0x3ffffff;
+		h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+		h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+		h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+		h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+		h1 += c;
+
+		uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+		uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+		uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+		uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+		uint32_t g4 = h4 + c - ( 1 << 26 );
+
+		uint32_t mask = ( g4 >> 31 ) - 1;
+		g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+		mask = ~mask;
+		h0 = ( h0 & mask ) | g0;
+		h1 = ( h1 & mask ) | g1;
+		h2 = ( h2 & mask ) | g2;
+		h3 = ( h3 & mask ) | g3;
+		h4 = ( h4 & mask ) | g4;
+
+		h0 = h0 | ( h1 << 26 );
+		h1 = ( h1 >> 6 ) | ( h2 << 20 );
+		h2 = ( h2 >> 12 ) | ( h3 << 14 );
+		h3 = ( h3 >> 18 ) | ( h4 << 8 );
+
+		uint64_t f = static_cast<uint64_t>( h0 ) + pad[0];
+		Store32( tag, static_cast<uint32_t>( f ) );
+		f = static_cast<uint64_t>( h1 ) + pad[1] + ( f >> 32 );
+		Store32( tag + 4, static_cast<uint32_t>( f ) );
+		f = static_cast<uint64_t>( h2 ) + pad[2] + ( f >> 32 );
+		Store32( tag + 8, static_cast<uint32_t>( f ) );
+		f = static_cast<uint64_t>( h3 ) + pad[3] + ( f >> 32 );
+		Store32( tag + 12, static_cast<uint32_t>( f ) );
+	}
+
+private:
+	void Blocks( const uint8_t *data, size_t len, uint32_t hibit )
+	{
+		const uint32_t r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3], r4 = r[4];
+		const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+		uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+
+		for( ; len >= 16; len -= 16, data += 16 )
+		{
+			h0 += Load32( data ) & 0x3ffffff;
+			h1 += ( Load32( data + 3 ) >> 2 ) & 0x3ffffff;
+			h2 += ( Load32( data + 6 ) >> 4 ) & 0x3ffffff;
+			h3 += ( Load32( data + 9 ) >> 6 ) & 0x3ffffff;
+			h4 += ( Load32( data + 12 ) >> 8 ) | hibit;
+
+			uint64_t d0 = static_cast<uint64_t>( h0 ) * r0 + static_cast<uint64_t>( h1 ) * s4 +
+				static_cast<uint64_t>( h2 ) * s3 + static_cast<uint64_t>( h3 ) * s2 +
+				static_cast<uint64_t>( h4 ) * s1;
+			uint64_t d1 = static_cast<uint64_t>( h0 ) * r1 + static_cast<uint64_t>( h1 ) * r0 +
+				static_cast<uint64_t>( h2 ) * s4 + static_cast<uint64_t>( h3 ) * s3 +
+				static_cast<uint64_t>( h4 ) * s2;
+			uint64_t d2 = static_cast<uint64_t>( h0 ) * r2 + static_cast<uint64_t>( h1 ) * r1 +
+				static_cast<uint64_t>( h2 ) * r0 + static_cast<uint64_t>( h3 ) * s4 +
+				static_cast<uint64_t>( h4 ) * s3;
+			uint64_t d3 = static_cast<uint64_t>( h0 ) * r3 + static_cast<uint64_t>( h1 ) * r2 +
+				static_cast<uint64_t>( h2 ) * r1 + static_cast<uint64_t>( h3 ) * r0 +
+				static_cast<uint64_t>( h4 ) * s4;
+			uint64_t d4 = static_cast<uint64_t>( h0 ) * r4 + static_cast<uint64_t>( h1 ) * r3 +
+				static_cast<uint64_t>( h2 ) * r2 + static_cast<uint64_t>( h3 ) * r1 +
+				static_cast<uint64_t>( h4 ) * r0;
+
+			uint32_t c = static_cast<uint32_t>( d0 >> 26 ); h0 = static_cast<uint32_t>( d0 ) & 0x3ffffff;
+			d1 += c; c = static_cast<uint32_t>( d1 >> 26 ); h1 = static_cast<uint32_t>( d1 ) & 0x3ffffff;
+			d2 += c; c = static_cast<uint32_t>( d2 >> 26 ); h2 = static_cast<uint32_t>( d2 ) & 0x3ffffff;
+			d3 += c; c = static_cast<uint32_t>( d3 >> 26 ); h3 = static_cast<uint32_t>( d3 ) & 0x3ffffff;
+			d4 += c; c = static_cast<uint32_t>( d4 >> 26 ); h4 = static_cast<uint32_t>( d4 ) & 0x3ffffff;
+			h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+			h1 += c;
+		}
+
+		h[0] = h0;
+		h[1] = h1;
+		h[2] = h2;
+		h[3] = h3;
+		h[4] = h4;
+	}
+
+	uint32_t r[5];
+	uint32_t h[5];
+	uint32_t pad[4];
+	uint8_t buffer[16];
+	size_t leftover;
+};
+
+static void Authenticate(
+	const uint8_t *key,
+	uint64_t nonce,
+	const uint8_t *aad,
+	size_t aad_len,
+	const uint8_t *ciphertext,
+	size_t len,
+	uint8_t *tag
+)
+{
+	uint8_t block[64];
+	uint32_t state[16];
+	Setup( state, key );
+	state[12] = 0;
+	state[13] = 0;
+	state[14] = static_cast<uint32_t>( nonce );
+	state[15] = static_cast<uint32_t>( nonce >> 32 );
+	Block( state, block );
+
+	poly1305 mac( block );
+	mac.Update( aad, aad_len );
+	mac.Pad( );
+	mac.Update( ciphertext, len );
+	mac.Pad( );
+
+	uint8_t lengths[16];
+	Store64( lengths, aad_len );
+	Store64( lengths + 8, len );
+	mac.Update( lengths, sizeof( lengths ) );
+	mac.Finish( tag );
+}
+
+void Seal(
+	const uint8_t *key,
+	uint64_t nonce,
+	const uint8_t *aad,
+	size_t aad_len,
+	const uint8_t *input,
+	size_t len,
+	uint8_t *output,
+	uint8_t *tag
+)
+{
+	Xor( key, nonce, 1, input, len, output );
+	Authenticate( key, nonce, aad, aad_len, output, len, tag );
+}
+
+bool Open(
+	const uint8_t *key,
+	uint64_t nonce,
+	const uint8_t *aad,
+	size_t aad_len,
+	const uint8_t *input,
+	size_t len,
+	const uint8_t *tag,
+	uint8_t *output
+)
+{
+	uint8_t expected[tag_size];
+	Authenticate( key, nonce, aad, aad_len, input, len, expected );
+
+	uint8_t difference = 0;
+	for( size_t k = 0; k < tag_size; ++k )
+		difference |= expected[k] ^ tag[k];
+
+	if( difference != 0 )
+		return false;
+
+	Xor( key, nonce, 1, input, len, output );
+	return true;
+}
+
+void DeriveKey( uint8_t *output, const uint8_t *key, const uint8_t *input )
+{
+	uint32_t x[16];
+	Setup( x, key );
+	for( int k = 0; k < 4; ++k )
+		x[12 + k] = Load32( input + k * 4 );
+
+	Rounds( x );
+	for( int k = 0; k < 4; ++k )
+	{
+		Store32( output + k * 4, x[k] );
+		Store32( output + 16 + k * 4, x[12 + k] );
+	}
+}
+
+bool Random( void *output, size_t len )
+{
+#if defined _WIN32
+
+	return RtlGenRandom( output, static_cast<ULONG>( len ) ) != FALSE;
+
+#else
+
+	FILE *file = std::fopen( "/dev/urandom", "rb" );
+	if( file == nullptr )
+		return false;
+
+	bool success = std::fread( output, 1, len, file ) == len;
+	std::fclose( file );
+	return success;
+
+#endif
+}
+
+}
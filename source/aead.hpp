@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace aead
+{
+
+// ChaCha20-Poly1305 as described in RFC 8439, with the 96 bits nonce built from
+// four zero bytes followed by a 64 bits little endian counter.
+static const size_t key_size = 32;
+static const size_t tag_size = 16;
+
+void Seal(
+	const uint8_t *key,
+	uint64_t nonce,
+	const uint8_t *aad,
+	size_t aad_len,
+	const uint8_t *input,
+	size_t len,
+	uint8_t *output,
+	uint8_t *tag
+);
+
+// Verifies the tag before decrypting anything. The output may overlap the input
+// as long as it doesn't start after it.
+bool Open(
+	const uint8_t *key,
+	uint64_t nonce,
+	const uint8_t *aad,
+	size_t aad_len,
+	const uint8_t *input,
+	size_t len,
+	const uint8_t *tag,
+	uint8_t *output
+);
+
+// HChaCha20, used to derive session keys from a long term key and 16 bytes of input.
+void DeriveKey( uint8_t *output, const uint8_t *key, const uint8_t *input );
+
+// Fills the buffer with bytes from the operating system's secure random generator.
+bool Random( void *output, size_t len );
+
+}
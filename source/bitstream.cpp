@@ -0,0 +1,132 @@
+#include "bitstream.hpp"
+#include <cstring>
+
+namespace bitstream
+{
+
+inline uint64_t GetMask( size_t bits )
+{
+	return bits >= 64 ? ~static_cast<uint64_t>( 0 ) : ( static_cast<uint64_t>( 1 ) << bits ) - 1;
+}
+
+writer::writer( ) :
+	accumulator( 0 ),
+	pending( 0 )
+{ }
+
+void writer::Write( uint32_t value, size_t bits )
+{
+	accumulator |= ( value & GetMask( bits ) ) << pending;
+	pending += bits;
+	while( pending >= 8 )
+	{
+		buffer.push_back( static_cast<uint8_t>( accumulator ) );
+		accumulator >>= 8;
+		pending -= 8;
+	}
+}
+
+void writer::WriteVarint( uint32_t value )
+{
+	while( value >= 0x80 )
+	{
+		Write( ( value & 0x7F ) | 0x80, 8 );
+		value >>= 7;
+	}
+
+	Write( value, 8 );
+}
+
+void writer::WriteBytes( const void *data, size_t len )
+{
+	const uint8_t *bytes = static_cast<const uint8_t *>( data );
+	if( pending == 0 )
+	{
+		buffer.insert( buffer.end( ), bytes, bytes + len );
+		return;
+	}
+
+	for( size_t k = 0; k < len; ++k )
+		Write( bytes[k], 8 );
+}
+
+const std::vector<uint8_t> &writer::Finish( )
+{
+	if( pending != 0 )
+	{
+		buffer.push_back( static_cast<uint8_t>( accumulator ) );
+		accumulator = 0;
+		pending = 0;
+	}
+
+	return buffer;
+}
+
+reader::reader( const uint8_t *data, size_t len ) :
+	data( data ),
+	len( len ),
+	offset( 0 ),
+	accumulator( 0 ),
+	available( 0 )
+{ }
+
+bool reader::Read( uint32_t &value, size_t bits )
+{
+	while( available < bits )
+	{
+		if( offset >= len )
+			return false;
+
+		accumulator |= static_cast<uint64_t>( data[offset++] ) << available;
+		available += 8;
+	}
+
+	value = static_cast<uint32_t>( accumulator & GetMask( bits ) );
+	accumulator >>= bits;
+	available -= bits;
+	return true;
+}
+
+bool reader::ReadVarint( uint32_t &value )
+{
+	value = 0;
+	for( size_t shift = 0; shift < 35; shift += 7 )
+	{
+		uint32_t byte = 0;
+		if( !Read( byte, 8 ) )
+			return false;
+
+		value |= ( byte & 0x7F ) << shift;
+		if( ( byte & 0x80 ) == 0 )
+			return true;
+	}
+
+	return false;
+}
+
+bool reader::ReadBytes( void *output, size_t count )
+{
+	uint8_t *bytes = static_cast<uint8_t *>( output );
+	if( available == 0 )
+	{
+		if( len - offset < count )
+			return false;
+
+		std::memcpy( bytes, data + offset, count );
+		offset += count;
+		return true;
+	}
+
+	for( size_t k = 0; k < count; ++k )
+	{
+		uint32_t byte = 0;
+		if( !Read( byte, 8 ) )
+			return false;
+
+		bytes[k] = static_cast<uint8_t>( byte );
+	}
+
+	return true;
+}
+
+}
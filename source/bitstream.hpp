@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace bitstream
+{
+
+// Bits are packed least significant first, so a value never needs to be byte
+// aligned and a message only takes as many bytes as its fields need.
+class writer
+{
+public:
+	writer( );
+
+	void Write( uint32_t value, size_t bits );
+	void WriteVarint( uint32_t value );
+	void WriteBytes( const void *data, size_t len );
+
+	// Pads the last byte with zeroes and returns the whole buffer.
+	const std::vector<uint8_t> &Finish( );
+
+private:
+	std::vector<uint8_t> buffer;
+	uint64_t accumulator;
+	size_t pending;
+};
+
+class reader
+{
+public:
+	reader( const uint8_t *data, size_t len );
+
+	// Every read returns false once the input is exhausted.
+	bool Read( uint32_t &value, size_t bits );
+	bool ReadVarint( uint32_t &value );
+	bool ReadBytes( void *data, size_t len );
+
+private:
+	const uint8_t *data;
+	size_t len;
+	size_t offset;
+	uint64_t accumulator;
+	size_t available;
+};
+
+}
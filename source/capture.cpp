@@ -0,0 +1,463 @@
+#include "capture.hpp"
+#include <cstring>
+#include <chrono>
+
+#if defined _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#else
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#endif
+
+namespace capture
+{
+
+static const char magic[8] = { 'E', 'N', 'E', 'T', 'C', 'A', 'P', '1' };
+static const uint32_t version = 1;
+static const uint32_t wrap_marker = 0xFFFFFFFF;
+
+struct header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t capacity;
+	uint64_t head;
+	uint64_t tail;
+	uint64_t count;
+	uint64_t records;
+	uint64_t dropped;
+};
+
+inline uint64_t Align( uint64_t value )
+{
+	return ( value + 7 ) & ~static_cast<uint64_t>( 7 );
+}
+
+static const uint64_t header_size = Align( sizeof( header ) );
+
+mapping::mapping( ) :
+	data( nullptr ),
+	size( 0 ),
+#if defined _WIN32
+	file( INVALID_HANDLE_VALUE ),
+	map( nullptr )
+#else
+	fd( -1 )
+#endif
+{ }
+
+mapping::~mapping( )
+{
+	Close( );
+}
+
+bool mapping::Open( const std::string &path, size_t length, bool writable )
+{
+	Close( );
+
+#if defined _WIN32
+
+	file = CreateFileA(
+		path.c_str( ),
+		writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+		FILE_SHARE_READ,
+		nullptr,
+		writable ? CREATE_ALWAYS : OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		nullptr
+	);
+	if( file == INVALID_HANDLE_VALUE )
+		return false;
+
+	if( !writable )
+	{
+		LARGE_INTEGER filesize;
+		if( GetFileSizeEx( file, &filesize ) == 0 )
+		{
+			Close( );
+			return false;
+		}
+
+		length = static_cast<size_t>( filesize.QuadPart );
+	}
+
+	uint64_t length64 = length;
+	map = CreateFileMappingA(
+		file,
+		nullptr,
+		writable ? PAGE_READWRITE : PAGE_READONLY,
+		static_cast<DWORD>( length64 >> 32 ),
+		static_cast<DWORD>( length64 & 0xFFFFFFFF ),
+		nullptr
+	);
+	if( map == nullptr )
+	{
+		Close( );
+		return false;
+	}
+
+	data = static_cast<uint8_t *>(
+		MapViewOfFile( map, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, length )
+	);
+	if( data == nullptr )
+	{
+		Close( );
+		return false;
+	}
+
+#else
+
+	fd = open( path.c_str( ), writable ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644 );
+	if( fd == -1 )
+		return false;
+
+	if( writable )
+	{
+		if( ftruncate( fd, static_cast<off_t>( length ) ) != 0 )
+		{
+			Close( );
+			return false;
+		}
+	}
+	else
+	{
+		struct stat info;
+		if( fstat( fd, &info ) != 0 )
+		{
+			Close( );
+			return false;
+		}
+
+		length = static_cast<size_t>( info.st_size );
+	}
+
+	void *addr = mmap(
+		nullptr,
+		length,
+		writable ? PROT_READ | PROT_WRITE : PROT_READ,
+		MAP_SHARED,
+		fd,
+		0
+	);
+	if( addr == MAP_FAILED )
+	{
+		Close( );
+		return false;
+	}
+
+	data = static_cast<uint8_t *>( addr );
+
+#endif
+
+	size = length;
+	return true;
+}
+
+void mapping::Close( )
+{
+#if defined _WIN32
+
+	if( data != nullptr )
+		UnmapViewOfFile( data );
+
+	if( map != nullptr )
+		CloseHandle( map );
+
+	if( file != INVALID_HANDLE_VALUE )
+		CloseHandle( file );
+
+	map = nullptr;
+	file = INVALID_HANDLE_VALUE;
+
+#else
+
+	if( data != nullptr )
+		munmap( data, size );
+
+	if( fd != -1 )
+		close( fd );
+
+	fd = -1;
+
+#endif
+
+	data = nullptr;
+	size = 0;
+}
+
+bool writer::Open( const std::string &path, size_t size )
+{
+	size = static_cast<size_t>( Align( size ) );
+	if( size <= header_size + sizeof( record ) || !file.Open( path, size, true ) )
+		return false;
+
+	header *hdr = reinterpret_cast<header *>( file.Data( ) );
+	std::memset( hdr, 0, sizeof( header ) );
+	std::memcpy( hdr->magic, magic, sizeof( magic ) );
+	hdr->version = version;
+	hdr->capacity = size - header_size;
+	return true;
+}
+
+void writer::Close( )
+{
+	file.Close( );
+}
+
+// Drops the oldest records while they start inside [start, end).
+void writer::Evict( uint64_t start, uint64_t end )
+{
+	header *hdr = reinterpret_cast<header *>( file.Data( ) );
+	uint8_t *area = file.Data( ) + header_size;
+	while( hdr->count != 0 && hdr->tail >= start && hdr->tail < end )
+	{
+		const record *rec = reinterpret_cast<const record *>( area + hdr->tail );
+		hdr->tail += Align( sizeof( record ) + rec->size );
+		--hdr->count;
+
+		if( hdr->tail + sizeof( uint32_t ) > hdr->capacity ||
+			*reinterpret_cast<const uint32_t *>( area + hdr->tail ) == wrap_marker )
+			hdr->tail = 0;
+	}
+}
+
+void writer::Append( uint32_t host, uint16_t port, const void *data, size_t len )
+{
+	header *hdr = reinterpret_cast<header *>( file.Data( ) );
+	uint8_t *area = file.Data( ) + header_size;
+	uint64_t needed = Align( sizeof( record ) + len );
+	if( needed > hdr->capacity )
+	{
+		++hdr->dropped;
+		return;
+	}
+
+	if( hdr->head + needed > hdr->capacity )
+	{
+		Evict( hdr->head, hdr->capacity );
+		if( hdr->head + sizeof( uint32_t ) <= hdr->capacity )
+			*reinterpret_cast<uint32_t *>( area + hdr->head ) = wrap_marker;
+
+		hdr->head = 0;
+	}
+
+	Evict( hdr->head, hdr->head + needed );
+
+	record *rec = reinterpret_cast<record *>( area + hdr->head );
+	rec->size = static_cast<uint32_t>( len );
+	rec->host = host;
+	rec->port = port;
+	rec->reserved = 0;
+	rec->padding = 0;
+	rec->timestamp = GetTimestamp( );
+	std::memcpy( rec + 1, data, len );
+
+	if( hdr->count == 0 )
+		hdr->tail = hdr->head;
+
+	hdr->head += needed;
+	++hdr->count;
+	++hdr->records;
+}
+
+uint64_t writer::Records( ) const
+{
+	return reinterpret_cast<const header *>( file.Data( ) )->records;
+}
+
+uint64_t writer::Dropped( ) const
+{
+	return reinterpret_cast<const header *>( file.Data( ) )->dropped;
+}
+
+bool reader::Open( const std::string &path )
+{
+	if( !file.Open( path, 0, false ) )
+		return false;
+
+	const header *hdr = reinterpret_cast<const header *>( file.Data( ) );
+	if( file.Size( ) < header_size ||
+		std::memcmp( hdr->magic, magic, sizeof( magic ) ) != 0 ||
+		hdr->version != version ||
+		hdr->capacity != file.Size( ) - header_size )
+	{
+		file.Close( );
+		return false;
+	}
+
+	offset = hdr->tail;
+	remaining = hdr->count;
+	return true;
+}
+
+void reader::Close( )
+{
+	file.Close( );
+	offset = 0;
+	remaining = 0;
+}
+
+bool reader::Next( const record *&rec, const uint8_t *&data )
+{
+	if( remaining == 0 )
+		return false;
+
+	const header *hdr = reinterpret_cast<const header *>( file.Data( ) );
+	const uint8_t *area = file.Data( ) + header_size;
+	if( offset + sizeof( uint32_t ) > hdr->capacity ||
+		*reinterpret_cast<const uint32_t *>( area + offset ) == wrap_marker )
+		offset = 0;
+
+	rec = reinterpret_cast<const record *>( area + offset );
+	if( offset + sizeof( record ) + rec->size > hdr->capacity )
+	{
+		remaining = 0;
+		return false;
+	}
+
+	data = reinterpret_cast<const uint8_t *>( rec + 1 );
+	offset += Align( sizeof( record ) + rec->size );
+	--remaining;
+	return true;
+}
+
+player::player( ) :
+	speed( 1.0 ),
+	start( 0 ),
+	base( 0 ),
+	next( nullptr ),
+	next_data( nullptr ),
+	sent( 0 )
+{
+	target.host = ENET_HOST_ANY;
+	target.port = ENET_PORT_ANY;
+}
+
+player::~player( )
+{
+	Close( );
+}
+
+bool player::Open( const std::string &path, const ENetAddress &address, double rate )
+{
+	Close( );
+	if( !file.Open( path ) )
+		return false;
+
+	target = address;
+	speed = rate;
+	return true;
+}
+
+void player::Close( )
+{
+	for( auto &pair : sockets )
+		if( pair.second != ENET_SOCKET_NULL )
+			enet_socket_destroy( pair.second );
+
+	sockets.clear( );
+	file.Close( );
+	start = 0;
+	base = 0;
+	next = nullptr;
+	next_data = nullptr;
+	sent = 0;
+}
+
+ENetSocket player::GetSocket( uint32_t host, uint16_t port )
+{
+	uint64_t key = static_cast<uint64_t>( host ) << 16 | port;
+	auto it = sockets.find( key );
+	if( it != sockets.end( ) )
+		return it->second;
+
+	ENetSocket socket = enet_socket_create( ENET_SOCKET_TYPE_DATAGRAM );
+	if( socket != ENET_SOCKET_NULL )
+	{
+		ENetAddress address = { ENET_HOST_ANY, ENET_PORT_ANY };
+		if( enet_socket_bind( socket, &address ) < 0 ||
+			enet_socket_set_option( socket, ENET_SOCKOPT_NONBLOCK, 1 ) < 0 )
+		{
+			enet_socket_destroy( socket );
+			socket = ENET_SOCKET_NULL;
+		}
+	}
+
+	sockets[key] = socket;
+	return socket;
+}
+
+// Replies from the target are of no use, don't let them pile up in the socket buffers.
+void player::Discard( )
+{
+	uint8_t discard[ENET_PROTOCOL_MAXIMUM_MTU];
+	for( auto &pair : sockets )
+		if( pair.second != ENET_SOCKET_NULL )
+		{
+			ENetAddress address;
+			ENetBuffer buffer;
+			buffer.data = discard;
+			buffer.dataLength = sizeof( discard );
+			while( enet_socket_receive( pair.second, &address, &buffer, 1 ) > 0 )
+				/* do nothing */;
+		}
+}
+
+size_t player::Pump( size_t limit, uint64_t elapsed )
+{
+	size_t count = 0;
+	while( limit == 0 || count < limit )
+	{
+		if( next == nullptr && !file.Next( next, next_data ) )
+			break;
+
+		if( base == 0 )
+			base = next->timestamp;
+
+		if( speed > 0.0 && next->timestamp > base &&
+			( next->timestamp - base ) / speed > static_cast<double>( elapsed ) )
+			break;
+
+		ENetSocket socket = GetSocket( next->host, next->port );
+		if( socket != ENET_SOCKET_NULL )
+		{
+			ENetBuffer buffer;
+			buffer.data = const_cast<uint8_t *>( next_data );
+			buffer.dataLength = next->size;
+			if( enet_socket_send( socket, &target, &buffer, 1 ) > 0 )
+				++sent;
+		}
+
+		next = nullptr;
+		++count;
+	}
+
+	Discard( );
+	return count;
+}
+
+size_t player::Pump( size_t limit )
+{
+	uint64_t now = GetTimestamp( );
+	if( start == 0 )
+		start = now;
+
+	return Pump( limit, now - start );
+}
+
+uint64_t GetTimestamp( )
+{
+	return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now( ).time_since_epoch( )
+	).count( ) );
+}
+
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+namespace capture
+{
+
+// Capture files are a fixed size ring of datagram records, mapped into memory
+// so appending a record costs a couple of memcpy calls and no system calls.
+// When the ring is full, the oldest records are overwritten.
+struct record
+{
+	uint32_t size;
+	uint32_t host;
+	uint16_t port;
+	uint16_t reserved;
+	uint32_t padding;
+	uint64_t timestamp;
+};
+
+class mapping
+{
+public:
+	mapping( );
+	~mapping( );
+
+	bool Open( const std::string &path, size_t size, bool writable );
+	void Close( );
+
+	uint8_t *Data( ) const
+	{
+		return data;
+	}
+
+	size_t Size( ) const
+	{
+		return size;
+	}
+
+private:
+	mapping( const mapping & );
+	mapping &operator=( const mapping & );
+
+	uint8_t *data;
+	size_t size;
+#if defined _WIN32
+	void *file;
+	void *map;
+#else
+	int fd;
+#endif
+};
+
+class writer
+{
+public:
+	bool Open( const std::string &path, size_t size );
+	void Close( );
+
+	bool IsOpen( ) const
+	{
+		return file.Data( ) != nullptr;
+	}
+
+	void Append( uint32_t host, uint16_t port, const void *data, size_t len );
+
+	uint64_t Records( ) const;
+	uint64_t Dropped( ) const;
+
+private:
+	void Evict( uint64_t start, uint64_t end );
+
+	mapping file;
+};
+
+class reader
+{
+public:
+	reader( ) :
+		offset( 0 ),
+		remaining( 0 )
+	{ }
+
+	bool Open( const std::string &path );
+	void Close( );
+
+	// Returns false once every record has been read.
+	bool Next( const record *&rec, const uint8_t *&data );
+
+	uint64_t Remaining( ) const
+	{
+		return remaining;
+	}
+
+private:
+	mapping file;
+	uint64_t offset;
+	uint64_t remaining;
+};
+
+// Feeds a capture file back to a target address, sending each recorded datagram from a
+// dedicated socket per recorded source address so the target sees the same peers.
+class player
+{
+public:
+	player( );
+	~player( );
+
+	bool Open( const std::string &path, const ENetAddress &target, double speed );
+	void Close( );
+
+	// Sends up to limit datagrams (0 for no limit) recorded at most elapsed microseconds
+	// times the speed after the first one, or all of them with a speed of 0 or less.
+	size_t Pump( size_t limit, uint64_t elapsed );
+
+	// Same, with the time elapsed since the first call.
+	size_t Pump( size_t limit );
+
+	bool Finished( ) const
+	{
+		return next == nullptr && file.Remaining( ) == 0;
+	}
+
+	uint64_t Remaining( ) const
+	{
+		return file.Remaining( ) + ( next != nullptr ? 1 : 0 );
+	}
+
+	uint64_t Sent( ) const
+	{
+		return sent;
+	}
+
+private:
+	player( const player & );
+	player &operator=( const player & );
+
+	ENetSocket GetSocket( uint32_t host, uint16_t port );
+	void Discard( );
+
+	reader file;
+	ENetAddress target;
+	double speed;
+	uint64_t start;
+	uint64_t base;
+	const record *next;
+	const uint8_t *next_data;
+	uint64_t sent;
+	std::unordered_map<uint64_t, ENetSocket> sockets;
+};
+
+uint64_t GetTimestamp( );
+
+}
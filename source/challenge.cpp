@@ -0,0 +1,188 @@
+#include "challenge.hpp"
+#include "aead.hpp"
+#include <cstring>
+
+namespace challenge
+{
+
+static const uint8_t challenge_magic[8] = { 0xFF, 0xFF, 'E', 'N', 'C', 'H', 'A', 'L' };
+static const uint8_t response_magic[8] = { 0xFF, 0xFF, 'E', 'N', 'R', 'E', 'S', 'P' };
+static const size_t magic_size = sizeof( challenge_magic );
+static const size_t cookie_size = message_size - magic_size;
+
+// Cookies are valid for the epoch they were issued in and the next one.
+static const enet_uint32 epoch_length = 5000;
+static const enet_uint32 allowed_lifetime = 10000;
+
+inline size_t Hash( enet_uint32 value )
+{
+	value ^= value >> 16;
+	value *= 0x7FEB352D;
+	value ^= value >> 15;
+	value *= 0x846CA68B;
+	value ^= value >> 16;
+	return value;
+}
+
+static void Send( ENetSocket socket, const ENetAddress &address, const uint8_t *magic, const uint8_t *cookie )
+{
+	uint8_t message[message_size];
+	std::memcpy( message, magic, magic_size );
+	std::memcpy( message + magic_size, cookie, cookie_size );
+
+	ENetBuffer buffer;
+	buffer.data = message;
+	buffer.dataLength = sizeof( message );
+	enet_socket_send( socket, &address, &buffer, 1 );
+}
+
+guard::guard( ) :
+	enabled( false ),
+	per_prefix( 0 ),
+	issued( 0 ),
+	passed( 0 ),
+	limited( 0 ),
+	rejected( 0 )
+{
+	std::memset( secret, 0, sizeof( secret ) );
+	std::memset( allowlist, 0, sizeof( allowlist ) );
+	std::memset( prefixes, 0, sizeof( prefixes ) );
+}
+
+bool guard::Enable( uint32_t limit )
+{
+	if( !enabled && !aead::Random( secret, sizeof( secret ) ) )
+		return false;
+
+	per_prefix = limit;
+	enabled = true;
+	return true;
+}
+
+void guard::Disable( )
+{
+	enabled = false;
+	std::memset( secret, 0, sizeof( secret ) );
+	std::memset( allowlist, 0, sizeof( allowlist ) );
+	std::memset( prefixes, 0, sizeof( prefixes ) );
+}
+
+void guard::GetCookie( const ENetAddress &address, enet_uint32 epoch, uint8_t *cookie ) const
+{
+	uint8_t input[16] = { 0 };
+	std::memcpy( input, &address.host, sizeof( address.host ) );
+	std::memcpy( input + 4, &address.port, sizeof( address.port ) );
+	std::memcpy( input + 8, &epoch, sizeof( epoch ) );
+
+	uint8_t output[32];
+	aead::DeriveKey( output, secret, input );
+	std::memcpy( cookie, output, cookie_size );
+}
+
+bool guard::IsAllowed( const ENetAddress &address, enet_uint32 now ) const
+{
+	const allowed &entry = allowlist[Hash( address.host ^ address.port * 0x9E3779B1 ) % allowlist_size];
+	return entry.host == address.host && entry.port == address.port &&
+		ENET_TIME_LESS( now, entry.expires );
+}
+
+void guard::Allow( const ENetAddress &address, enet_uint32 now )
+{
+	allowed &entry = allowlist[Hash( address.host ^ address.port * 0x9E3779B1 ) % allowlist_size];
+	entry.host = address.host;
+	entry.port = address.port;
+	entry.expires = now + allowed_lifetime;
+}
+
+// Counts challenges per /24 network and second, colliding networks share a budget.
+bool guard::Throttle( const ENetAddress &address, enet_uint32 now )
+{
+	if( per_prefix == 0 )
+		return true;
+
+	enet_uint32 network = ENET_NET_TO_HOST_32( address.host ) >> 8;
+	enet_uint32 window = now / 1000;
+	prefix &entry = prefixes[Hash( network ) % prefix_count];
+	if( entry.network != network || entry.window != window )
+	{
+		entry.network = network;
+		entry.window = window;
+		entry.count = 0;
+	}
+
+	if( entry.count >= per_prefix )
+		return false;
+
+	++entry.count;
+	return true;
+}
+
+bool guard::Check( ENetSocket socket, const ENetAddress &address, const uint8_t *data, size_t len )
+{
+	enet_uint32 now = enet_time_get( );
+	if( len == message_size && std::memcmp( data, response_magic, magic_size ) == 0 )
+	{
+		enet_uint32 epoch = now / epoch_length;
+		uint8_t current[cookie_size], previous[cookie_size];
+		GetCookie( address, epoch, current );
+		GetCookie( address, epoch - 1, previous );
+
+		uint8_t diff_current = 0, diff_previous = 0;
+		for( size_t k = 0; k < cookie_size; ++k )
+		{
+			diff_current |= current[k] ^ data[magic_size + k];
+			diff_previous |= previous[k] ^ data[magic_size + k];
+		}
+
+		if( diff_current == 0 || diff_previous == 0 )
+		{
+			Allow( address, now );
+			++passed;
+		}
+		else
+			++rejected;
+
+		return true;
+	}
+
+	if( len < sizeof( ENetProtocolHeader ) )
+		return false;
+
+	enet_uint16 peer_id = 0;
+	std::memcpy( &peer_id, data, sizeof( peer_id ) );
+	peer_id = ENET_NET_TO_HOST_16( peer_id ) &
+		~( ENET_PROTOCOL_HEADER_FLAG_MASK | ENET_PROTOCOL_HEADER_SESSION_MASK );
+	if( peer_id != ENET_PROTOCOL_MAXIMUM_PEER_ID || IsAllowed( address, now ) )
+		return false;
+
+	if( !Throttle( address, now ) )
+	{
+		++limited;
+		return true;
+	}
+
+	uint8_t cookie[cookie_size];
+	GetCookie( address, now / epoch_length, cookie );
+	Send( socket, address, challenge_magic, cookie );
+	++issued;
+	return true;
+}
+
+bool Answer( ENetHost *host, const ENetAddress &address, const uint8_t *data, size_t len )
+{
+	if( len != message_size || std::memcmp( data, challenge_magic, magic_size ) != 0 )
+		return false;
+
+	for( ENetPeer *peer = host->peers; peer < host->peers + host->peerCount; ++peer )
+		if( peer->state == ENET_PEER_STATE_CONNECTING &&
+			peer->address.host == address.host &&
+			peer->address.port == address.port )
+		{
+			Send( host->socket, address, response_magic, data + magic_size );
+			break;
+		}
+
+	return true;
+}
+
+}
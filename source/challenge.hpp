@@ -0,0 +1,93 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <cstdint>
+#include <cstddef>
+
+namespace challenge
+{
+
+// Stateless connect challenge. While enabled, connection requests from addresses
+// that haven't proven they can receive datagrams are answered with a cookie
+// derived from a secret, the source address and the current epoch, instead of
+// reaching ENet and taking a peer slot. Connecting hosts echo the cookie back,
+// which adds their address to a fixed size allowlist for a few seconds, long
+// enough for the next retransmission of the connect command to go through.
+// Memory use is constant regardless of how many addresses are involved.
+static const size_t message_size = 24;
+
+class guard
+{
+public:
+	guard( );
+
+	bool Enable( uint32_t per_prefix );
+	void Disable( );
+
+	bool IsEnabled( ) const
+	{
+		return enabled;
+	}
+
+	// Returns true when the datagram was consumed and must not reach ENet.
+	bool Check( ENetSocket socket, const ENetAddress &address, const uint8_t *data, size_t len );
+
+	uint64_t Issued( ) const
+	{
+		return issued;
+	}
+
+	uint64_t Passed( ) const
+	{
+		return passed;
+	}
+
+	uint64_t Limited( ) const
+	{
+		return limited;
+	}
+
+	uint64_t Rejected( ) const
+	{
+		return rejected;
+	}
+
+private:
+	struct allowed
+	{
+		enet_uint32 host;
+		enet_uint16 port;
+		enet_uint32 expires;
+	};
+
+	struct prefix
+	{
+		enet_uint32 network;
+		enet_uint32 window;
+		uint32_t count;
+	};
+
+	static const size_t allowlist_size = 4096;
+	static const size_t prefix_count = 1024;
+
+	void GetCookie( const ENetAddress &address, enet_uint32 epoch, uint8_t *cookie ) const;
+	bool IsAllowed( const ENetAddress &address, enet_uint32 now ) const;
+	void Allow( const ENetAddress &address, enet_uint32 now );
+	bool Throttle( const ENetAddress &address, enet_uint32 now );
+
+	bool enabled;
+	uint32_t per_prefix;
+	uint8_t secret[32];
+	allowed allowlist[allowlist_size];
+	prefix prefixes[prefix_count];
+	uint64_t issued;
+	uint64_t passed;
+	uint64_t limited;
+	uint64_t rejected;
+};
+
+// Echoes a challenge back when the host is connecting to the address it came from.
+// Returns true when the datagram was a challenge, answered or not.
+bool Answer( ENetHost *host, const ENetAddress &address, const uint8_t *data, size_t len );
+
+}
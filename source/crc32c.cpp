@@ -0,0 +1,192 @@
+#include "crc32c.hpp"
+#include <cstring>
+
+#if defined _MSC_VER && ( defined _M_X64 || defined _M_IX86 )
+
+#include <intrin.h>
+#include <nmmintrin.h>
+
+#define CRC32C_X86
+#define CRC32C_TARGET
+
+#elif ( defined __GNUC__ || defined __clang__ ) && ( defined __x86_64__ || defined __i386__ )
+
+#include <nmmintrin.h>
+
+#define CRC32C_X86
+#define CRC32C_TARGET __attribute__( ( target( "sse4.2" ) ) )
+
+#elif defined __ARM_FEATURE_CRC32
+
+#include <arm_acle.h>
+
+#define CRC32C_ARM
+
+#endif
+
+namespace crc32c
+{
+
+typedef uint32_t ( *update_function )( uint32_t crc, const uint8_t *data, size_t len );
+
+static const uint32_t polynomial = 0x82F63B78;
+
+// slicing-by-8 tables, table[0] is the classic byte at a time table
+static uint32_t table[8][256];
+
+static void BuildTable( )
+{
+	for( uint32_t n = 0; n < 256; ++n )
+	{
+		uint32_t crc = n;
+		for( int k = 0; k < 8; ++k )
+			crc = crc & 1 ? ( crc >> 1 ) ^ polynomial : crc >> 1;
+
+		table[0][n] = crc;
+	}
+
+	for( uint32_t n = 0; n < 256; ++n )
+		for( int k = 1; k < 8; ++k )
+			table[k][n] = ( table[k - 1][n] >> 8 ) ^ table[0][table[k - 1][n] & 0xFF];
+}
+
+static uint32_t UpdateSoftware( uint32_t crc, const uint8_t *data, size_t len )
+{
+	for( ; len >= 8; len -= 8, data += 8 )
+	{
+		uint32_t low = 0, high = 0;
+		std::memcpy( &low, data, sizeof( low ) );
+		std::memcpy( &high, data + 4, sizeof( high ) );
+#if defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		low = __builtin_bswap32( low );
+		high = __builtin_bswap32( high );
+#endif
+		low ^= crc;
+		crc = table[7][low & 0xFF] ^ table[6][( low >> 8 ) & 0xFF] ^
+			table[5][( low >> 16 ) & 0xFF] ^ table[4][low >> 24] ^
+			table[3][high & 0xFF] ^ table[2][( high >> 8 ) & 0xFF] ^
+			table[1][( high >> 16 ) & 0xFF] ^ table[0][high >> 24];
+	}
+
+	for( ; len > 0; --len, ++data )
+		crc = ( crc >> 8 ) ^ table[0][( crc ^ *data ) & 0xFF];
+
+	return crc;
+}
+
+#if defined CRC32C_X86
+
+CRC32C_TARGET static uint32_t UpdateHardware( uint32_t crc, const uint8_t *data, size_t len )
+{
+#if defined _M_X64 || defined __x86_64__
+
+	uint64_t crc64 = crc;
+	for( ; len >= 8; len -= 8, data += 8 )
+	{
+		uint64_t value = 0;
+		std::memcpy( &value, data, sizeof( value ) );
+		crc64 = _mm_crc32_u64( crc64, value );
+	}
+
+	crc = static_cast<uint32_t>( crc64 );
+
+#else
+
+	for( ; len >= 4; len -= 4, data += 4 )
+	{
+		uint32_t value = 0;
+		std::memcpy( &value, data, sizeof( value ) );
+		crc = _mm_crc32_u32( crc, value );
+	}
+
+#endif
+
+	for( ; len > 0; --len, ++data )
+		crc = _mm_crc32_u8( crc, *data );
+
+	return crc;
+}
+
+static bool HasHardwareSupport( )
+{
+#if defined _MSC_VER
+
+	int info[4] = { 0 };
+	__cpuid( info, 1 );
+	return ( info[2] & ( 1 << 20 ) ) != 0;
+
+#else
+
+	__builtin_cpu_init( );
+	return __builtin_cpu_supports( "sse4.2" ) != 0;
+
+#endif
+}
+
+static const char *hardware_name = "sse4.2";
+
+#elif defined CRC32C_ARM
+
+static uint32_t UpdateHardware( uint32_t crc, const uint8_t *data, size_t len )
+{
+	for( ; len >= 8; len -= 8, data += 8 )
+	{
+		uint64_t value = 0;
+		std::memcpy( &value, data, sizeof( value ) );
+		crc = __crc32cd( crc, value );
+	}
+
+	for( ; len > 0; --len, ++data )
+		crc = __crc32cb( crc, *data );
+
+	return crc;
+}
+
+// the compiler was told the CRC extension is available, no need for a runtime check
+static bool HasHardwareSupport( )
+{
+	return true;
+}
+
+static const char *hardware_name = "armv8";
+
+#endif
+
+static const char *implementation = nullptr;
+
+static update_function Select( )
+{
+	BuildTable( );
+
+#if defined CRC32C_X86 || defined CRC32C_ARM
+
+	if( HasHardwareSupport( ) )
+	{
+		implementation = hardware_name;
+		return UpdateHardware;
+	}
+
+#endif
+
+	implementation = "software";
+	return UpdateSoftware;
+}
+
+static update_function selected = Select( );
+
+uint32_t Update( uint32_t crc, const void *data, size_t len )
+{
+	return selected( crc, static_cast<const uint8_t *>( data ), len );
+}
+
+uint32_t UpdatePortable( uint32_t crc, const void *data, size_t len )
+{
+	return UpdateSoftware( crc, static_cast<const uint8_t *>( data ), len );
+}
+
+const char *GetImplementation( )
+{
+	return implementation;
+}
+
+}
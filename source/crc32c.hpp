@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace crc32c
+{
+
+// Continues a CRC32C (Castagnoli) computation. Start with 0xFFFFFFFF and invert the
+// final value, as usual. The fastest implementation available on the running CPU
+// is selected the first time this is called.
+uint32_t Update( uint32_t crc, const void *data, size_t len );
+
+// The software implementation Update falls back to, whatever the CPU supports.
+uint32_t UpdatePortable( uint32_t crc, const void *data, size_t len );
+
+// Name of the implementation selected by Update ("sse4.2", "armv8" or "software").
+const char *GetImplementation( );
+
+}
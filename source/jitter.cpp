@@ -0,0 +1,116 @@
+#include "jitter.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace jitter
+{
+
+buffer::buffer( ) :
+	primed( false ),
+	released( false ),
+	last_tick( 0 ),
+	base_transit( 0.0 ),
+	window_min( 0.0 ),
+	window_count( 0 ),
+	last_transit( 0.0 ),
+	deviation( 0.0 ),
+	late( 0 ),
+	overflow( 0 ),
+	scheduled( false ),
+	scheduled_due( 0.0 )
+{ }
+
+bool buffer::Add( const playout &p, uint32_t tick, double now, const void *data, size_t len )
+{
+	double transit = now - tick * p.tick_interval;
+	if( !primed )
+	{
+		primed = true;
+		base_transit = transit;
+		window_min = transit;
+		last_transit = transit;
+	}
+	else
+	{
+		// interarrival jitter as in RFC 3550, the base follows the window minimum so clock drift is tracked
+		deviation += ( std::fabs( transit - last_transit ) - deviation ) / 16.0;
+		last_transit = transit;
+		base_transit = std::min( base_transit, transit );
+		window_min = std::min( window_min, transit );
+		if( ++window_count >= transit_window )
+		{
+			base_transit = window_min;
+			window_min = transit;
+			window_count = 0;
+		}
+	}
+
+	if( ( released && tick <= last_tick ) || snapshots.count( tick ) != 0 )
+	{
+		++late;
+		return false;
+	}
+
+	if( snapshots.size( ) >= p.capacity )
+	{
+		snapshots.erase( snapshots.begin( ) );
+		++overflow;
+	}
+
+	snapshots[tick].assign( static_cast<const char *>( data ), len );
+	return true;
+}
+
+double buffer::Delay( const playout &p ) const
+{
+	return std::min( std::max( p.factor * deviation, p.min_delay ), p.max_delay );
+}
+
+double buffer::Due( const playout &p ) const
+{
+	return base_transit + snapshots.begin( )->first * p.tick_interval + Delay( p );
+}
+
+uint32_t buffer::Pop( std::string &data )
+{
+	auto first = snapshots.begin( );
+	uint32_t tick = first->first;
+	data.swap( first->second );
+	snapshots.erase( first );
+	released = true;
+	last_tick = tick;
+	return tick;
+}
+
+bool buffer::Schedule( const playout &p )
+{
+	if( snapshots.empty( ) )
+		return false;
+
+	double due = Due( p );
+	if( scheduled && scheduled_due <= due )
+		return false;
+
+	scheduled = true;
+	scheduled_due = due;
+	return true;
+}
+
+static bool Later( const entry &a, const entry &b )
+{
+	return a.due > b.due;
+}
+
+void schedule::Push( const entry &e )
+{
+	heap.push_back( e );
+	std::push_heap( heap.begin( ), heap.end( ), Later );
+}
+
+void schedule::Pop( )
+{
+	std::pop_heap( heap.begin( ), heap.end( ), Later );
+	heap.pop_back( );
+}
+
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <map>
+#include <vector>
+
+namespace jitter
+{
+
+// A snapshot is due at its tick time plus the lowest transit time (arrival minus tick
+// time) seen recently, plus a playout delay that follows the measured jitter between
+// both bounds. Times are milliseconds.
+static const size_t transit_window = 128;
+
+struct playout
+{
+	double tick_interval;
+	double min_delay;
+	double max_delay;
+	double factor;
+	size_t capacity;
+};
+
+// Snapshots of one peer's channel, ordered by tick.
+class buffer
+{
+public:
+	buffer( );
+
+	// Measures the arrival and keeps the snapshot, returns false when it's dropped for
+	// coming after a later one was released or twice.
+	bool Add( const playout &p, uint32_t tick, double now, const void *data, size_t len );
+
+	bool IsEmpty( ) const
+	{
+		return snapshots.empty( );
+	}
+
+	// Due time of the oldest snapshot, on the clock Add was given.
+	double Due( const playout &p ) const;
+
+	// Moves the oldest snapshot out and returns its tick, later ones can't be added anymore.
+	uint32_t Pop( std::string &data );
+
+	// Returns whether the oldest snapshot needs a new schedule entry, because it has
+	// none or it's now due before its entry, which then gets the due time.
+	bool Schedule( const playout &p );
+
+	bool IsScheduled( double due ) const
+	{
+		return scheduled && scheduled_due == due;
+	}
+
+	void Unschedule( )
+	{
+		scheduled = false;
+	}
+
+	double Scheduled( ) const
+	{
+		return scheduled_due;
+	}
+
+	double Delay( const playout &p ) const;
+
+	double Deviation( ) const
+	{
+		return deviation;
+	}
+
+	size_t Buffered( ) const
+	{
+		return snapshots.size( );
+	}
+
+	uint64_t Late( ) const
+	{
+		return late;
+	}
+
+	uint64_t Overflow( ) const
+	{
+		return overflow;
+	}
+
+private:
+	std::map<uint32_t, std::string> snapshots;
+	bool primed;
+	bool released;
+	uint32_t last_tick;
+	double base_transit;
+	double window_min;
+	size_t window_count;
+	double last_transit;
+	double deviation;
+	uint64_t late;
+	uint64_t overflow;
+	bool scheduled;
+	double scheduled_due;
+};
+
+struct entry
+{
+	double due;
+	size_t index;
+	enet_uint16 generation;
+	enet_uint8 channel;
+};
+
+// Min-heap of the due times of a host's buffers, by slot index and generation. Entries
+// stay behind when their buffer changes: a buffer's live entry is the one it reports as
+// scheduled, never due later than its oldest snapshot, and the others are skipped.
+class schedule
+{
+public:
+	void Push( const entry &e );
+	void Pop( );
+
+	const entry &Top( ) const
+	{
+		return heap.front( );
+	}
+
+	bool IsEmpty( ) const
+	{
+		return heap.empty( );
+	}
+
+	size_t Size( ) const
+	{
+		return heap.size( );
+	}
+
+	void Clear( )
+	{
+		heap.clear( );
+	}
+
+private:
+	std::vector<entry> heap;
+};
+
+}
@@ -1,10 +1,59 @@
 #include <GarrysMod/Lua/Interface.h>
 #include <enet/enet.h>
 #include <lua.hpp>
+#include "capture.hpp"
+#include "crc32c.hpp"
+#include "aead.hpp"
+#include "challenge.hpp"
+#include "bitstream.hpp"
+#include "shm.hpp"
+#include "profile.hpp"
+#include "mtu.hpp"
+#include "pool.hpp"
+#include "overload.hpp"
+#include "jitter.hpp"
+#include "timing.hpp"
+#include "nonce.hpp"
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <algorithm>
 #include <string>
 #include <stdexcept>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+
+#if !defined _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <cstdio>
+#endif
+
+#if defined _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#if defined __linux__
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <time.h>
+#endif
 
 namespace enet
 {
@@ -15,7 +64,7 @@ static bool ParseAddress( lua_State *state, const char *addr, ENetAddress &addre
 	size_t pos = addr_str.find( ':' );
 	if( pos != addr_str.npos )
 	{
-		host_str = addr_str.substr( 0, pos - 1 );
+		host_str = addr_str.substr( 0, pos );
 		port_str = addr_str.substr( pos + 1 );
 	}
 
@@ -89,539 +138,5333 @@ static bool GetPacketFlags( lua_State *state, const char *type, enet_uint32 &fla
 	return true;
 }
 
-namespace host
+static enet_uint32 ENET_CALLBACK ChecksumCRC32C( const ENetBuffer *buffers, size_t bufferCount )
 {
+	uint32_t crc = 0xFFFFFFFF;
+	for( ; bufferCount > 0; --bufferCount, ++buffers )
+		crc = crc32c::Update( crc, buffers->data, buffers->dataLength );
 
-static bool Create( lua_State *state, ENetHost *host, bool onlyexisting = false );
-
+	return ENET_HOST_TO_NET_32( ~crc );
 }
 
-namespace peer
+// Reads the optional channel and flags arguments, starting at index.
+static bool GetChannelAndFlags( lua_State *state, int32_t index, enet_uint8 &channel, enet_uint32 &flags )
 {
+	channel = 1;
+	flags = 0;
 
-static const char *metaname = "ENetPeer";
-static uint8_t metatype = 231;
-static const char *tablename = "enet_peers";
-static const char *invalid_error = "invalid ENetPeer";
+	switch( LUA->Top( ) - index )
+	{
+		default:
+			if( !LUA->IsType( index + 1, GarrysMod::Lua::Type::NIL ) &&
+				!GetPacketFlags( state, LUA->CheckString( index + 1 ), flags ) )
+				return false;
 
-struct userdata
-{
-	ENetPeer *peer;
-	uint8_t type;
-	ENetHost *host;
-	size_t index;
-};
+		case 0:
+			if( !LUA->IsType( index, GarrysMod::Lua::Type::NIL ) )
+				channel = static_cast<enet_uint8>( LUA->CheckNumber( index ) );
 
-inline void Check( lua_State *state, int32_t index )
-{
-	if( !LUA->IsType( index, metatype ) )
-		luaL_typerror( state, index, metaname );
+		case -1:
+			/* do nothing */;
+	}
+
+	return true;
 }
 
-inline userdata *GetUserdata( lua_State *state, int32_t index )
+static bool GetSendArguments(
+	lua_State *state,
+	int32_t index,
+	const char *&data,
+	size_t &len,
+	enet_uint8 &channel,
+	enet_uint32 &flags
+)
 {
-	return static_cast<userdata *>( LUA->GetUserdata( index ) );
+	LUA->CheckType( index, GarrysMod::Lua::Type::STRING );
+	data = LUA->GetString( index, &len );
+	return GetChannelAndFlags( state, index + 1, channel, flags );
 }
 
-static ENetPeer *GetAndValidate( lua_State *state, int32_t index )
+// Group masks are 32 bits, negative numbers are taken as their two's complement so
+// masks built with the bit library, which returns signed results, work unchanged.
+static uint32_t GetGroupMask( lua_State *state, int32_t index )
 {
-	Check( state, index );
-	ENetPeer *peer = GetUserdata( state, index )->peer;
-	if( peer == nullptr )
-		LUA->ArgError( index, invalid_error );
+	double mask = LUA->CheckNumber( index );
+	if( mask < -2147483648.0 || mask > 4294967295.0 || mask != std::floor( mask ) )
+		LUA->ArgError( index, "group mask must be an integer between -2^31 and 2^32 - 1" );
 
-	return peer;
+	return static_cast<uint32_t>( static_cast<int64_t>( mask ) );
 }
 
-static bool Create( lua_State *state, ENetPeer *peer )
+// Peer IDs pack the peer slot index in the lower 16 bits and the slot generation
+// in the upper 16 bits. The generation is bumped every time a slot changes occupant,
+// so IDs held by Lua after a disconnect can't address whoever reuses the slot.
+static const enet_uint32 slot_bits = 16;
+static const enet_uint32 slot_mask = ( 1 << slot_bits ) - 1;
+
+// Encrypted hosts exchange a hello packet holding 8 random bytes right after connecting.
+// Each direction's session key is derived from the host key and both peers' random
+// bytes, every other packet is sealed with ChaCha20-Poly1305 under a 64 bits nonce, see
+// nonce::sender for how they're numbered.
+static const enet_uint8 secure_hello = 1;
+static const enet_uint8 secure_data = 2;
+static const size_t secure_nonce_size = 8;
+static const size_t secure_header_size = 1 + sizeof( uint64_t );
+static const size_t secure_overhead = secure_header_size + aead::tag_size;
+
+struct session
 {
-	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+	bool started;
+	bool established;
+	bool resend;
+	uint8_t local_nonce[secure_nonce_size];
+	uint8_t tx_key[aead::key_size];
+	uint8_t rx_key[aead::key_size];
+	nonce::sender tx_nonces;
+	nonce::receiver rx_nonces;
+};
 
-	LUA->GetField( -1, tablename );
+// Cells of the interest management grid are keyed by their 16 bits signed coordinates
+// on each axis, which keeps keys below 2^48 and exactly representable as Lua numbers.
+// Cell coordinates are clamped to +-2^30 so ranges of cells and loops over them can't
+// overflow 32 bits integers, positions further away share the outermost cells.
+static const double default_cell_size = 512.0;
+static const uint64_t cell_axis_mask = 0xFFFF;
+static const double cell_key_limit = 281474976710656.0;
+static const double cell_coordinate_limit = 1073741824.0;
+
+// Events raised by the binding itself, queued next to the ones coming from ENet.
+enum
+{
+	EVENT_TYPE_RATE_EXCEEDED = ENET_EVENT_TYPE_RECEIVE + 1,
+	EVENT_TYPE_DRAIN,
+	EVENT_TYPE_OVERLOADED
+};
 
-	LUA->Remove( -2 );
+struct context;
+struct bridge;
 
-	LUA->PushUserdata( peer );
-	LUA->GetTable( -2 );
+// Arrival to dispatch latency histogram, bucket k counts delays below 2^k microseconds.
+static const size_t latency_buckets = 32;
 
-	if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
-	{
-		LUA->Remove( -2 );
-		return false;
-	}
+// Incoming token buckets hold up to burst seconds worth of packets and bytes.
+struct limit
+{
+	double packets_per_second;
+	double bytes_per_second;
+	double burst;
+	bool per_channel;
+	bool drop;
+	bool notify;
+};
 
-	LUA->Pop( 1 );
+// Outgoing backlog of a slot's occupant. Packets sent to a single peer point at it, so
+// the backlog is known without walking ENet's command queues. Queued means not yet
+// acknowledged for reliable packets and not yet sent for the others. The slot lets go
+// of it when the occupant changes, and the last of its packets to be freed deletes it.
+struct backlog
+{
+	context *owner;
+	size_t index;
+	enet_uint32 connect_id;
+	size_t queued_bytes;
+	size_t queued_packets;
+	size_t high_watermark;
+	size_t low_watermark;
+	bool draining;
+};
 
-	userdata *udata = static_cast<userdata *>( LUA->NewUserdata( sizeof( userdata ) ) );
-	udata->type = metatype;
-	udata->peer = peer;
-	udata->host = peer->host;
-	udata->index = 0;
-	for( size_t k = 0; k < peer->host->peerCount; ++k )
-		if( &peer->host->peers[k] == peer )
-			udata->index = k;
+struct bucket
+{
+	double packets;
+	double bytes;
+	enet_uint32 last_update;
+	bool primed;
+};
 
-	LUA->CreateMetaTableType( metaname, metatype );
-	LUA->SetMetaTable( -2 );
+// Logical streams are multiplexed over the channels starting at the host's first
+// stream channel. Stream packets start with the stream ID as a varint and a 16 bits
+// sequence, used to drop unreliable packets older than the newest one received.
+// Packets for streams a peer doesn't have yet are dropped once it has stream_limit,
+// since every ID the other end comes up with would otherwise get its own state.
+static const size_t stream_header_size = 5 + sizeof( enet_uint16 );
+static const size_t default_stream_limit = 64;
 
-	LUA->CreateTable( );
-	lua_setfenv( state, -2 );
+struct stream
+{
+	bool open;
+	bool received;
+	enet_uint16 tx_sequence;
+	enet_uint16 rx_sequence;
+	uint64_t sent_packets;
+	uint64_t sent_bytes;
+	uint64_t received_packets;
+	uint64_t received_bytes;
+	uint64_t stale;
+};
 
-	LUA->PushUserdata( peer );
-	LUA->Push( -2 );
-	LUA->SetTable( -4 );
+// Latest value messages keep only the newest payload per key until flush time,
+// and hold it back while the previous one for the same key hasn't left yet. They're
+// left out of the peer's backlog, which would otherwise count them until the flush
+// releasing the binding's reference, and only one per key is ever queued anyway.
+struct latest
+{
+	std::string data;
+	enet_uint8 channel;
+	enet_uint32 flags;
+	bool pending;
+	ENetPacket *in_flight;
+};
 
-	LUA->Remove( -2 );
-	return true;
-}
+// Jitter buffered channels carry snapshots behind a 32 bits little endian tick, played
+// out when due, see jitter::buffer.
+static const size_t snapshot_header_size = sizeof( uint32_t );
 
-LUA_FUNCTION_STATIC( tostring )
+// Path MTU discovery probes each connected peer's path, see mtu::discovery, and sets the
+// peer's MTU to the largest probe acknowledged. A cap drops every incoming datagram
+// larger than it, emulating a narrower path for testing.
+static const enet_uint32 probe_update_interval = 10;
+
+struct slot
 {
-	lua_pushfstring( state, "%s: %p", metaname, GetAndValidate( state, 1 ) );
-	return 1;
-}
+	enet_uint16 generation;
+	enet_uint32 connect_id;
+	session secure;
+	bool positioned;
+	float position[3];
+	uint64_t cell;
+	uint32_t cell_index;
+	bucket incoming;
+	std::vector<bucket> channel_incoming;
+	bool rate_exceeded;
+	uint64_t incoming_dropped;
+	backlog *queue;
+	size_t subscriptions;
+	std::unordered_map<uint32_t, stream> streams;
+	uint64_t arrival;
+	uint32_t groups;
+	std::unordered_map<std::string, latest> latest_values;
+	bool latest_dirty;
+	uint64_t latest_replaced;
+	std::unordered_map<enet_uint8, jitter::buffer> jitter_buffers;
+	mtu::prober probes;
+};
 
-LUA_FUNCTION_STATIC( eq )
+typedef std::unordered_map<uint64_t, std::vector<enet_uint16>> grid;
+
+// Topic members are kept as a bitset indexed by peer slot.
+struct topic
 {
-	LUA->PushBool( GetAndValidate( state, 1 ) == GetAndValidate( state, 2 ) );
-	return 1;
-}
+	std::vector<uint64_t> members;
+	size_t count;
+};
 
-LUA_FUNCTION_STATIC( index )
+typedef std::unordered_map<std::string, topic> topics;
+
+struct context
 {
-	LUA->GetMetaTable( 1 );
-	LUA->Push( 2 );
-	LUA->RawGet( -2 );
-	if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
-		return 1;
+	ENetHost *host;
+	std::vector<slot> slots;
+	bool peer_ids;
+	capture::writer capture;
+	bool encrypted;
+	uint8_t key[aead::key_size];
+	uint64_t secure_rejected;
+	double cell_size;
+	grid cells;
+	size_t positioned;
+	std::deque<ENetEvent> pending;
+	bool limited;
+	limit incoming_limit;
+	challenge::guard guard;
+	bridge *forward;
+	topics subscribed;
+	bool streamed;
+	enet_uint8 stream_channel;
+	size_t stream_limit;
+	uint64_t streams_refused;
+	bool timestamps;
+	uint64_t latency[latency_buckets];
+	std::vector<size_t> latest_dirty;
+	std::string persistent;
+	bool orphaned;
+	int32_t lua_ref;
+	uint64_t gap_dropped;
+	ENetPacket *ffi_packet;
+	uint32_t ffi_id;
+	overload::monitor load;
+	std::unordered_map<enet_uint8, jitter::playout> playouts;
+	jitter::schedule snapshots_due;
+	bool discovering;
+	mtu::discovery mtu_policy;
+	enet_uint32 probes_updated;
+	uint32_t mtu_cap;
+	mtu::fragmentation fragmentation;
+	size_t parallel_minimum;
+};
 
-	LUA->Pop( 2 );
+static std::unordered_map<ENetHost *, context *> contexts;
 
-	lua_getfenv( state, 1 );
-	LUA->Push( 2 );
-	LUA->RawGet( -2 );
-	return 1;
-}
+// Handles given to FFI callers, IDs are never reused so a stale one can't reach
+// another host, see host:ffi_handle.
+static std::unordered_map<uint32_t, context *> ffi_handles;
+static uint32_t ffi_next_id = 1;
 
-LUA_FUNCTION_STATIC( newindex )
+// Shared by every host sealing its fanouts in parallel, created on first use.
+static pool::workers *sealers = nullptr;
+
+// Set while the background thread services hosts left behind by a closed Lua state,
+// so the intercept callback doesn't touch the contexts map the Lua thread may modify.
+static thread_local context *servicing = nullptr;
+
+static context *GetContext( ENetHost *host )
 {
-	lua_getfenv( state, 1 );
-	LUA->Push( 2 );
-	LUA->Push( 3 );
-	LUA->RawSet( -3 );
-	return 0;
+	auto it = contexts.find( host );
+	return it != contexts.end( ) ? it->second : nullptr;
 }
 
-LUA_FUNCTION_STATIC( valid )
+// Kernel receive timestamps and the clock they're compared with, in microseconds
+// since the epoch. Only Linux has a way to get them without owning the recvmsg call.
+static bool EnableTimestamps( ENetSocket socket, bool enable )
 {
-	Check( state, 1 );
-	LUA->PushBool( GetUserdata( state, 1 )->peer != nullptr );
-	return 1;
+#if defined __linux__
+	// SO_TIMESTAMPNS would deliver the timestamp as ancillary data to ENet's recvmsg,
+	// which discards it. Querying SIOCGSTAMPNS once instead has the kernel keep the
+	// last datagram's timestamp on the socket, failing with ENOENT this first time.
+	// Nothing turns that back off short of closing the socket (SO_TIMESTAMPNS only
+	// clears the ancillary data flags), so disabling just stops reading the stamps.
+	if( enable )
+	{
+		timespec ts;
+		return ioctl( socket, SIOCGSTAMPNS, &ts ) == 0 || errno == ENOENT;
+	}
+
+	return true;
+#else
+	( void )socket;
+	return !enable;
+#endif
 }
 
-LUA_FUNCTION_STATIC( disconnect )
+static uint64_t GetArrivalTime( ENetSocket socket )
 {
-	ENetPeer *peer = GetAndValidate( state, 1 );
-	enet_uint32 data = LUA->Top( ) > 1 ? static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) : 0;
-	enet_peer_disconnect( peer, data );
+#if defined __linux__
+	timespec ts;
+	if( ioctl( socket, SIOCGSTAMPNS, &ts ) != 0 )
+		return 0;
+
+	return static_cast<uint64_t>( ts.tv_sec ) * 1000000 + static_cast<uint64_t>( ts.tv_nsec ) / 1000;
+#else
+	( void )socket;
 	return 0;
+#endif
 }
 
-LUA_FUNCTION_STATIC( disconnect_now )
+static uint64_t GetWallTime( )
 {
-	ENetPeer *peer = GetAndValidate( state, 1 );
-	enet_uint32 data = LUA->Top( ) > 1 ? static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) : 0;
-	enet_peer_disconnect_now( peer, data );
+#if defined __linux__
+	timespec ts;
+	clock_gettime( CLOCK_REALTIME, &ts );
+	return static_cast<uint64_t>( ts.tv_sec ) * 1000000 + static_cast<uint64_t>( ts.tv_nsec ) / 1000;
+#else
 	return 0;
+#endif
 }
 
-LUA_FUNCTION_STATIC( disconnect_later )
+// Remembers when the last datagram addressed to each peer reached the kernel. ENet
+// hands packets over without saying which datagram carried them, so the stamp is
+// per peer: receive events from one service call all get the newest datagram's.
+static void StampArrival( context *ctx, ENetHost *host )
 {
-	ENetPeer *peer = GetAndValidate( state, 1 );
-	enet_uint32 data = LUA->Top( ) > 1 ? static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) : 0;
-	enet_peer_disconnect_later( peer, data );
-	return 0;
+	if( host->receivedDataLength < sizeof( ENetProtocolHeader ) )
+		return;
+
+	enet_uint16 peer_id = 0;
+	std::memcpy( &peer_id, host->receivedData, sizeof( peer_id ) );
+	peer_id = ENET_NET_TO_HOST_16( peer_id ) &
+		~( ENET_PROTOCOL_HEADER_FLAG_MASK | ENET_PROTOCOL_HEADER_SESSION_MASK );
+	if( peer_id < ctx->slots.size( ) )
+		ctx->slots[peer_id].arrival = GetArrivalTime( host->socket );
 }
 
-LUA_FUNCTION_STATIC( reset )
+static bool ReceiveAcknowledgement( context *ctx, ENetHost *host )
 {
-	enet_peer_reset( GetAndValidate( state, 1 ) );
-	return 0;
+	uint32_t size = 0, token = 0;
+	if( !mtu::ParseAcknowledgement( host->receivedData, host->receivedDataLength, size, token ) )
+		return false;
+
+	// tokens carry the slot index in their low bits, see UpdateProbes
+	size_t index = token & slot_mask;
+	if( index >= host->peerCount )
+		return true;
+
+	const ENetPeer &peer = host->peers[index];
+	if( peer.address.host == host->receivedAddress.host && peer.address.port == host->receivedAddress.port )
+		ctx->slots[index].probes.Acknowledge( size, token );
+
+	return true;
 }
 
-LUA_FUNCTION_STATIC( ping )
+static int ENET_CALLBACK Intercept( ENetHost *host, ENetEvent * )
 {
-	enet_peer_ping( GetAndValidate( state, 1 ) );
+	profile::scope profiled( "intercept" );
+	context *ctx = servicing != nullptr ? servicing : GetContext( host );
+	if( ctx == nullptr )
+		return 0;
+
+	if( ctx->capture.IsOpen( ) )
+		ctx->capture.Append(
+			host->receivedAddress.host,
+			host->receivedAddress.port,
+			host->receivedData,
+			host->receivedDataLength
+		);
+
+	if( ctx->mtu_cap != 0 && host->receivedDataLength > ctx->mtu_cap )
+		return 1;
+
+	if( challenge::Answer( host, host->receivedAddress, host->receivedData, host->receivedDataLength ) )
+		return 1;
+
+	if( mtu::Answer( host, host->receivedAddress, host->receivedData, host->receivedDataLength ) )
+		return 1;
+
+	if( ctx->discovering && ReceiveAcknowledgement( ctx, host ) )
+		return 1;
+
+	ctx->load.CountDatagram( );
+	if( ctx->timestamps )
+		StampArrival( ctx, host );
+
+	if( ctx->guard.IsEnabled( ) && ctx->guard.Check(
+		host->socket,
+		host->receivedAddress,
+		host->receivedData,
+		host->receivedDataLength
+	) )
+		return 1;
+
 	return 0;
 }
 
-LUA_FUNCTION_STATIC( receive )
+inline size_t GetSlotIndex( const ENetPeer *peer )
 {
-	enet_uint8 channel = 0;
-	ENetPacket *packet = enet_peer_receive( GetAndValidate( state, 1 ), &channel );
-	if( packet == nullptr )
-		return 0;
+	return static_cast<size_t>( peer - peer->host->peers );
+}
 
-	LUA->PushString( reinterpret_cast<char *>( packet->data ), packet->dataLength );
-	LUA->PushNumber( channel );
-	LUA->PushNumber( packet->flags );
-	enet_packet_destroy( packet );
-	return 3;
+inline int32_t GetCellCoordinate( context *ctx, double value )
+{
+	double cell = std::floor( value / ctx->cell_size );
+	return static_cast<int32_t>( std::max( -cell_coordinate_limit, std::min( cell, cell_coordinate_limit ) ) );
 }
 
-LUA_FUNCTION_STATIC( send )
+// Positions and radii can't be placed in the grid unless they're finite.
+static double CheckFinite( lua_State *state, int32_t index )
 {
-	ENetPeer *peer = GetAndValidate( state, 1 );
-	LUA->CheckType( 2, GarrysMod::Lua::Type::STRING );
-	size_t len = 0;
-	const char *data = LUA->GetString( 2, &len );
-	enet_uint8 channel = 1;
-	enet_uint32 flags = 0;
+	double value = LUA->CheckNumber( index );
+	if( !std::isfinite( value ) )
+		LUA->ArgError( index, "number must be finite" );
 
-	switch( LUA->Top( ) )
-	{
-		default:
-			if( !GetPacketFlags( state, LUA->CheckString( 4 ), flags ) )
-				return 2;
+	return value;
+}
 
-		case 3:
-			if( !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
-				channel = static_cast<enet_uint8>( LUA->CheckNumber( 3 ) );
+inline uint64_t GetCellKey( int32_t x, int32_t y, int32_t z )
+{
+	return ( static_cast<uint64_t>( x ) & cell_axis_mask ) |
+		( static_cast<uint64_t>( y ) & cell_axis_mask ) << 16 |
+		( static_cast<uint64_t>( z ) & cell_axis_mask ) << 32;
+}
 
-		case 2:
-			/* do nothing */;
-	}
+static void RemovePosition( context *ctx, size_t index )
+{
+	slot &s = ctx->slots[index];
+	if( !s.positioned )
+		return;
 
-	ENetPacket *packet = enet_packet_create( data, len, flags );
-	if( enet_peer_send( peer, channel, packet ) != 0 )
+	auto it = ctx->cells.find( s.cell );
+	if( it != ctx->cells.end( ) )
 	{
-		enet_packet_destroy( packet );
-		LUA->PushNil( );
-		LUA->PushString( "failed to send packet" );
-		return 2;
+		std::vector<enet_uint16> &members = it->second;
+		members[s.cell_index] = members.back( );
+		ctx->slots[members.back( )].cell_index = s.cell_index;
+		members.pop_back( );
+		if( members.empty( ) )
+			ctx->cells.erase( it );
 	}
 
-	enet_packet_destroy( packet );
-	LUA->PushBool( true );
-	return 1;
+	s.positioned = false;
+	--ctx->positioned;
 }
 
-LUA_FUNCTION_STATIC( throttle_configure )
+static void SetPosition( context *ctx, size_t index, double x, double y, double z )
 {
-	ENetPeer *peer = GetAndValidate( state, 1 );
-
-	enet_uint32 interval = peer->packetThrottleInterval,
-		acceleration = peer->packetThrottleAcceleration,
-		deceleration = peer->packetThrottleDeceleration;
-	bool set = false;
-	switch( LUA->Top( ) )
+	slot &s = ctx->slots[index];
+	uint64_t cell = GetCellKey(
+		GetCellCoordinate( ctx, x ),
+		GetCellCoordinate( ctx, y ),
+		GetCellCoordinate( ctx, z )
+	);
+	if( !s.positioned || s.cell != cell )
 	{
-		default:
-			set = true;
-			deceleration = static_cast<enet_uint32>( LUA->CheckNumber( 4 ) );
+		RemovePosition( ctx, index );
+
+		std::vector<enet_uint16> &members = ctx->cells[cell];
+		s.positioned = true;
+		s.cell = cell;
+		s.cell_index = static_cast<uint32_t>( members.size( ) );
+		members.push_back( static_cast<enet_uint16>( index ) );
+		++ctx->positioned;
+	}
 
-		case 3:
-			if( !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
-			{
-				set = true;
-				acceleration = static_cast<enet_uint32>( LUA->CheckNumber( 3 ) );
-			}
+	s.position[0] = static_cast<float>( x );
+	s.position[1] = static_cast<float>( y );
+	s.position[2] = static_cast<float>( z );
+}
 
-		case 2:
-			if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
-			{
-				set = true;
-				interval = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
-			}
+inline size_t CountTrailingZeros( uint64_t value )
+{
+#if defined _MSC_VER && defined _WIN64
+	unsigned long index = 0;
+	_BitScanForward64( &index, value );
+	return index;
+#elif defined _MSC_VER
+	unsigned long index = 0;
+	if( _BitScanForward( &index, static_cast<unsigned long>( value ) ) )
+		return index;
+
+	_BitScanForward( &index, static_cast<unsigned long>( value >> 32 ) );
+	return index + 32;
+#else
+	return static_cast<size_t>( __builtin_ctzll( value ) );
+#endif
+}
 
-		case 1:
-			/* do nothing */;
-	}
+static bool Unsubscribe( context *ctx, topics::iterator it, size_t index )
+{
+	topic &t = it->second;
+	uint64_t &word = t.members[index / 64];
+	uint64_t bit = static_cast<uint64_t>( 1 ) << ( index % 64 );
+	if( ( word & bit ) == 0 )
+		return false;
 
-	if( set )
+	word &= ~bit;
+	--ctx->slots[index].subscriptions;
+	if( --t.count == 0 )
+		ctx->subscribed.erase( it );
+
+	return true;
+}
+
+static void UnsubscribeAll( context *ctx, size_t index )
+{
+	for( auto it = ctx->subscribed.begin( ); it != ctx->subscribed.end( ) && ctx->slots[index].subscriptions != 0; )
 	{
-		enet_peer_throttle_configure( peer, interval, acceleration, deceleration );
-		return 0;
+		auto current = it++;
+		Unsubscribe( ctx, current, index );
 	}
+}
 
-	LUA->PushNumber( interval );
-	LUA->PushNumber( acceleration );
-	LUA->PushNumber( deceleration );
-	return 3;
+// Drops the reference held on a latest value packet, which ENet may be done with.
+static void ReleaseInFlight( latest &value )
+{
+	if( value.in_flight == nullptr )
+		return;
+
+	if( --value.in_flight->referenceCount == 0 )
+		enet_packet_destroy( value.in_flight );
+
+	value.in_flight = nullptr;
 }
 
-LUA_FUNCTION_STATIC( ping_interval )
+static void ReleaseLatest( slot &s )
 {
-	ENetPeer *peer = GetAndValidate( state, 1 );
+	for( auto &pair : s.latest_values )
+		ReleaseInFlight( pair.second );
 
-	if( LUA->Top( ) > 1 )
-	{
-		enet_peer_ping_interval( peer, static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) );
-		return 0;
-	}
+	s.latest_values.clear( );
+}
 
-	LUA->PushNumber( peer->pingInterval );
-	return 1;
+static void DetachBacklog( slot &s )
+{
+	backlog *b = s.queue;
+	if( b == nullptr )
+		return;
+
+	if( b->queued_packets == 0 )
+		delete b;
+	else
+		b->owner = nullptr;
+
+	s.queue = nullptr;
 }
 
-LUA_FUNCTION_STATIC( timeout )
+// Clears everything the binding keeps for the slot's previous occupant.
+static void ResetSlot( context *ctx, size_t index, enet_uint32 connect_id )
 {
-	ENetPeer *peer = GetAndValidate( state, 1 );
+	RemovePosition( ctx, index );
+	DetachBacklog( ctx->slots[index] );
+	ReleaseLatest( ctx->slots[index] );
+	if( ctx->slots[index].subscriptions != 0 )
+		UnsubscribeAll( ctx, index );
+
+	slot &s = ctx->slots[index];
+	enet_uint16 generation = s.generation + 1;
+	s = slot( );
+	s.generation = generation;
+	s.connect_id = connect_id;
+}
 
-	enet_uint32 timeout_limit = peer->timeoutLimit,
-		timeout_minimum = peer->timeoutMinimum,
-		timeout_maximum = peer->timeoutMaximum;
-	bool set = false;
-	switch( LUA->Top( ) )
+static slot &AcquireSlot( context *ctx, ENetPeer *peer )
+{
+	// ENet zeroes the connect ID when resetting a peer, by which point the slot still
+	// belongs to the previous occupant until ReleaseSlot is called
+	size_t index = GetSlotIndex( peer );
+	if( peer->connectID != 0 && ctx->slots[index].connect_id != peer->connectID )
+		ResetSlot( ctx, index, peer->connectID );
+
+	return ctx->slots[index];
+}
+
+static void ReleaseSlot( context *ctx, ENetPeer *peer )
+{
+	ResetSlot( ctx, GetSlotIndex( peer ), 0 );
+}
+
+static enet_uint32 GetPeerID( context *ctx, ENetPeer *peer )
+{
+	return static_cast<enet_uint32>( AcquireSlot( ctx, peer ).generation ) << slot_bits |
+		static_cast<enet_uint32>( GetSlotIndex( peer ) );
+}
+
+// Disconnect events are filtered (and their slot released) before reaching Lua,
+// which still needs the ID the peer had while it was connected.
+static enet_uint32 GetReleasedPeerID( context *ctx, ENetPeer *peer )
+{
+	size_t index = GetSlotIndex( peer );
+	enet_uint16 generation = ctx->slots[index].generation - 1;
+	return static_cast<enet_uint32>( generation ) << slot_bits | static_cast<enet_uint32>( index );
+}
+
+static ENetPeer *GetPeerFromID( context *ctx, enet_uint32 id )
+{
+	size_t index = id & slot_mask;
+	if( index >= ctx->host->peerCount )
+		return nullptr;
+
+	ENetPeer *peer = &ctx->host->peers[index];
+	const slot &s = ctx->slots[index];
+	if( s.generation != id >> slot_bits || s.connect_id != peer->connectID ||
+		peer->state == ENET_PEER_STATE_DISCONNECTED || peer->state == ENET_PEER_STATE_ZOMBIE )
+		return nullptr;
+
+	return peer;
+}
+
+inline void Store64( uint8_t *data, uint64_t value )
+{
+	for( size_t k = 0; k < sizeof( value ); ++k )
+		data[k] = static_cast<uint8_t>( value >> ( k * 8 ) );
+}
+
+inline uint64_t Load64( const uint8_t *data )
+{
+	uint64_t value = 0;
+	for( size_t k = 0; k < sizeof( value ); ++k )
+		value |= static_cast<uint64_t>( data[k] ) << ( k * 8 );
+
+	return value;
+}
+
+static bool SendHello( ENetPeer *peer, const slot &s )
+{
+	uint8_t hello[1 + secure_nonce_size] = { secure_hello };
+	std::memcpy( hello + 1, s.secure.local_nonce, secure_nonce_size );
+	ENetPacket *packet = enet_packet_create( hello, sizeof( hello ), ENET_PACKET_FLAG_RELIABLE );
+	if( packet == nullptr )
+		return false;
+
+	if( enet_peer_send( peer, 0, packet ) != 0 )
 	{
-		default:
-			set = true;
-			timeout_maximum = static_cast<enet_uint32>( LUA->CheckNumber( 4 ) );
+		enet_packet_destroy( packet );
+		return false;
+	}
 
-		case 3:
-			if( !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
+	return true;
+}
+
+static void StartSession( ENetPeer *peer, slot &s )
+{
+	if( s.secure.started || !aead::Random( s.secure.local_nonce, secure_nonce_size ) )
+		return;
+
+	s.secure.started = SendHello( peer, s );
+}
+
+// Whether any connected peer has started a session, which turning encryption off or
+// changing the key would leave sealing packets this host can't open anymore.
+static bool HasSessions( context *ctx )
+{
+	for( size_t k = 0; k < ctx->host->peerCount; ++k )
+	{
+		const ENetPeer &peer = ctx->host->peers[k];
+		const slot &s = ctx->slots[k];
+		if( peer.state != ENET_PEER_STATE_DISCONNECTED && peer.state != ENET_PEER_STATE_ZOMBIE &&
+			s.connect_id == peer.connectID && s.secure.started )
+			return true;
+	}
+
+	return false;
+}
+
+static void FinishSession( context *ctx, slot &s, const uint8_t *remote_nonce )
+{
+	uint8_t input[secure_nonce_size * 2];
+	std::memcpy( input, s.secure.local_nonce, secure_nonce_size );
+	std::memcpy( input + secure_nonce_size, remote_nonce, secure_nonce_size );
+	aead::DeriveKey( s.secure.tx_key, ctx->key, input );
+
+	std::memcpy( input, remote_nonce, secure_nonce_size );
+	std::memcpy( input + secure_nonce_size, s.secure.local_nonce, secure_nonce_size );
+	aead::DeriveKey( s.secure.rx_key, ctx->key, input );
+
+	s.secure.established = true;
+}
+
+// Allocates a sealed packet and writes its header, SealPayload fills in the rest. Large
+// unreliable packets ENet ends up sending as reliable fragments keep unreliable nonces,
+// which the other end accepts whichever way they came.
+static ENetPacket *PreparePacket( slot &s, enet_uint8 channel, size_t len, enet_uint32 flags )
+{
+	ENetPacket *packet = enet_packet_create( nullptr, len + secure_overhead, flags );
+	if( packet == nullptr )
+		return nullptr;
+
+	packet->data[0] = secure_data;
+	Store64( packet->data + 1, s.secure.tx_nonces.Next( channel, ( flags & ENET_PACKET_FLAG_RELIABLE ) != 0 ) );
+	return packet;
+}
+
+// Destroys a sealed packet ENet refused, giving its nonce back.
+static void DiscardPacket( slot &s, ENetPacket *packet )
+{
+	s.secure.tx_nonces.Cancel( Load64( packet->data + 1 ) );
+	enet_packet_destroy( packet );
+}
+
+// Only reads the slot, so packets for different peers can be sealed concurrently.
+static void SealPayload( const slot &s, ENetPacket *packet, enet_uint8 channel, const char *data, size_t len )
+{
+	uint8_t *output = packet->data;
+	uint8_t aad[secure_header_size + 1];
+	std::memcpy( aad, output, secure_header_size );
+	aad[secure_header_size] = channel;
+
+	aead::Seal(
+		s.secure.tx_key,
+		Load64( output + 1 ),
+		aad,
+		sizeof( aad ),
+		reinterpret_cast<const uint8_t *>( data ),
+		len,
+		output + secure_header_size,
+		output + secure_header_size + len
+	);
+}
+
+static ENetPacket *SealPacket(
+	slot &s,
+	enet_uint8 channel,
+	const char *data,
+	size_t len,
+	enet_uint32 flags
+)
+{
+	ENetPacket *packet = PreparePacket( s, channel, len, flags );
+	if( packet != nullptr )
+		SealPayload( s, packet, channel, data, len );
+
+	return packet;
+}
+
+// Decrypts the packet in place, rejecting forgeries and replays, see nonce::receiver.
+static bool OpenPacket( slot &s, enet_uint8 channel, ENetPacket *packet )
+{
+	if( !s.secure.established || packet->dataLength < secure_overhead ||
+		packet->data[0] != secure_data )
+		return false;
+
+	// ENet marks every packet it delivered through its reliable commands
+	uint64_t counter = Load64( packet->data + 1 );
+	if( !s.secure.rx_nonces.Check( counter, channel, ( packet->flags & ENET_PACKET_FLAG_RELIABLE ) != 0 ) )
+		return false;
+
+	uint8_t aad[secure_header_size + 1];
+	std::memcpy( aad, packet->data, secure_header_size );
+	aad[secure_header_size] = channel;
+
+	size_t len = packet->dataLength - secure_overhead;
+	if( !aead::Open(
+		s.secure.rx_key,
+		counter,
+		aad,
+		sizeof( aad ),
+		packet->data + secure_header_size,
+		len,
+		packet->data + secure_header_size + len,
+		packet->data
+	) )
+		return false;
+
+	s.secure.rx_nonces.Accept( counter );
+	packet->dataLength = len;
+	return true;
+}
+
+static backlog &GetBacklog( context *ctx, ENetPeer *peer )
+{
+	slot &s = AcquireSlot( ctx, peer );
+	if( s.queue == nullptr )
+	{
+		s.queue = new backlog( );
+		s.queue->owner = ctx;
+		s.queue->index = GetSlotIndex( peer );
+		s.queue->connect_id = s.connect_id;
+	}
+
+	return *s.queue;
+}
+
+// Successful single peer sends return true followed by what's queued for the peer.
+static int32_t PushQueued( lua_State *state, context *ctx, ENetPeer *peer )
+{
+	const backlog &b = GetBacklog( ctx, peer );
+	LUA->PushBool( true );
+	LUA->PushNumber( static_cast<double>( b.queued_bytes ) );
+	LUA->PushNumber( static_cast<double>( b.queued_packets ) );
+	return 3;
+}
+
+static void ENET_CALLBACK ReleasePacket( ENetPacket *packet )
+{
+	backlog &b = *static_cast<backlog *>( packet->userData );
+	b.queued_bytes -= std::min( b.queued_bytes, packet->dataLength );
+	b.queued_packets -= std::min<size_t>( b.queued_packets, 1 );
+	if( b.owner == nullptr )
+	{
+		if( b.queued_packets == 0 )
+			delete &b;
+
+		return;
+	}
+
+	if( b.draining && b.queued_bytes <= b.low_watermark )
+	{
+		b.draining = false;
+
+		// peers being reset get their queues freed, which isn't the backlog draining
+		context *ctx = b.owner;
+		ENetPeer *peer = ctx->host->peers + b.index;
+		if( peer->connectID != b.connect_id || peer->state == ENET_PEER_STATE_DISCONNECTED ||
+			peer->state == ENET_PEER_STATE_ZOMBIE )
+			return;
+
+		ENetEvent ev;
+		ev.type = static_cast<ENetEventType>( EVENT_TYPE_DRAIN );
+		ev.peer = peer;
+		ev.channelID = 0;
+		ev.data = static_cast<enet_uint32>( b.queued_bytes );
+		ev.packet = nullptr;
+		ctx->pending.push_back( ev );
+	}
+}
+
+static void TrackPacket( context *ctx, ENetPeer *peer, ENetPacket *packet )
+{
+	backlog &b = GetBacklog( ctx, peer );
+	b.queued_bytes += packet->dataLength;
+	++b.queued_packets;
+	if( b.high_watermark != 0 && b.queued_bytes >= b.high_watermark )
+		b.draining = true;
+
+	packet->userData = &b;
+	packet->freeCallback = ReleasePacket;
+}
+
+// Returns the queued packet, or null on failure. Untracked packets aren't counted in
+// the peer's backlog.
+static ENetPacket *Send(
+	context *ctx,
+	ENetPeer *peer,
+	enet_uint8 channel,
+	const char *data,
+	size_t len,
+	enet_uint32 flags,
+	bool tracked = true
+)
+{
+	profile::scope profiled( "send_packet" );
+	ENetPacket *packet = nullptr;
+	if( ctx->encrypted )
+	{
+		slot &s = ctx->slots[GetSlotIndex( peer )];
+		if( !s.secure.established || peer->connectID != s.connect_id )
+			return nullptr;
+
+		packet = SealPacket( s, channel, data, len, flags );
+	}
+	else
+		packet = enet_packet_create( data, len, flags );
+
+	if( packet == nullptr )
+		return nullptr;
+
+	if( enet_peer_send( peer, channel, packet ) != 0 )
+	{
+		if( ctx->encrypted )
+			DiscardPacket( ctx->slots[GetSlotIndex( peer )], packet );
+		else
+			enet_packet_destroy( packet );
+
+		return nullptr;
+	}
+
+	if( tracked )
+		TrackPacket( ctx, peer, packet );
+
+	return packet;
+}
+
+// Queues the pending latest values whose previous packet has been sent, dropped or
+// released by ENet. The others wait for a later flush.
+static void FlushLatest( context *ctx )
+{
+	profile::scope profiled( "flush_latest" );
+	size_t kept = 0;
+	for( size_t k = 0; k < ctx->latest_dirty.size( ); ++k )
+	{
+		size_t index = ctx->latest_dirty[k];
+		slot &s = ctx->slots[index];
+		ENetPeer *peer = &ctx->host->peers[index];
+		bool waiting = false;
+		for( auto &pair : s.latest_values )
+		{
+			latest &value = pair.second;
+			if( !value.pending )
+				continue;
+
+			ENetPacket *previous = value.in_flight;
+			if( previous != nullptr && previous->referenceCount > 1 &&
+				( previous->flags & ENET_PACKET_FLAG_SENT ) == 0 )
 			{
-				set = true;
-				timeout_minimum = static_cast<enet_uint32>( LUA->CheckNumber( 3 ) );
+				waiting = true;
+				continue;
 			}
 
-		case 2:
-			if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+			ReleaseInFlight( value );
+			value.pending = false;
+
+			ENetPacket *packet = Send( ctx, peer, value.channel, value.data.data( ), value.data.size( ), value.flags, false );
+			if( packet != nullptr )
 			{
-				set = true;
-				timeout_limit = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
+				++packet->referenceCount;
+				value.in_flight = packet;
 			}
+		}
 
-		case 1:
-			/* do nothing */;
+		s.latest_dirty = waiting;
+		if( waiting )
+			ctx->latest_dirty[kept++] = index;
+	}
+
+	ctx->latest_dirty.resize( kept );
+}
+
+// Queues the same payload to several peers. They all share a single packet, unless
+// the host is encrypted and every peer needs its own ciphertext. With parallel sealing
+// on, Send only reserves each peer's packet and nonce, and Flush seals them all on the
+// worker pool before queueing them in order. Count and the destructor flush.
+class fanout
+{
+public:
+	fanout( context *ctx, enet_uint8 channel, const char *data, size_t len, enet_uint32 flags ) :
+		ctx( ctx ),
+		channel( channel ),
+		data( data ),
+		len( len ),
+		flags( flags ),
+		packet( nullptr ),
+		count( 0 ),
+		parallel( ctx->encrypted && ctx->parallel_minimum != 0 && sealers != nullptr )
+	{ }
+
+	~fanout( )
+	{
+		Flush( );
+		if( packet != nullptr && packet->referenceCount == 0 )
+			enet_packet_destroy( packet );
+	}
+
+	bool Send( ENetPeer *peer )
+	{
+		if( peer->state != ENET_PEER_STATE_CONNECTED )
+			return false;
+
+		if( parallel )
+		{
+			slot &s = ctx->slots[GetSlotIndex( peer )];
+			if( !s.secure.established || peer->connectID != s.connect_id )
+				return false;
+
+			ENetPacket *sealed = PreparePacket( s, channel, len, flags );
+			if( sealed == nullptr )
+				return false;
+
+			sealing.push_back( std::make_pair( peer, sealed ) );
+			++count;
+			return true;
+		}
+
+		if( ctx->encrypted )
+		{
+			if( !enet::Send( ctx, peer, channel, data, len, flags ) )
+				return false;
+
+			++count;
+			return true;
+		}
+
+		if( packet == nullptr )
+		{
+			packet = enet_packet_create( data, len, flags );
+			if( packet == nullptr )
+				return false;
+		}
+
+		if( enet_peer_send( peer, channel, packet ) != 0 )
+			return false;
+
+		++count;
+		return true;
+	}
+
+	size_t Count( )
+	{
+		Flush( );
+		return count;
+	}
+
+	void Flush( )
+	{
+		if( sealing.empty( ) )
+			return;
+
+		profile::scope profiled( "seal_fanout" );
+		auto seal = [this]( size_t k )
+		{
+			ENetPeer *peer = sealing[k].first;
+			SealPayload( ctx->slots[GetSlotIndex( peer )], sealing[k].second, channel, data, len );
+		};
+
+		if( sealing.size( ) >= ctx->parallel_minimum )
+			sealers->Run( sealing.size( ), seal );
+		else
+			for( size_t k = 0; k < sealing.size( ); ++k )
+				seal( k );
+
+		for( auto &pair : sealing )
+		{
+			if( enet_peer_send( pair.first, channel, pair.second ) != 0 )
+			{
+				DiscardPacket( ctx->slots[GetSlotIndex( pair.first )], pair.second );
+				--count;
+				continue;
+			}
+
+			TrackPacket( ctx, pair.first, pair.second );
+		}
+
+		sealing.clear( );
+	}
+
+private:
+	fanout( const fanout & );
+	fanout &operator=( const fanout & );
+
+	context *ctx;
+	enet_uint8 channel;
+	const char *data;
+	size_t len;
+	enet_uint32 flags;
+	ENetPacket *packet;
+	size_t count;
+	bool parallel;
+	std::vector<std::pair<ENetPeer *, ENetPacket *>> sealing;
+};
+
+static void Broadcast(
+	context *ctx,
+	enet_uint8 channel,
+	const char *data,
+	size_t len,
+	enet_uint32 flags
+)
+{
+	profile::scope profiled( "broadcast_packet" );
+	if( !ctx->encrypted )
+	{
+		// enet_host_broadcast takes ownership of the packet and frees it once every peer is done with it
+		enet_host_broadcast( ctx->host, channel, enet_packet_create( data, len, flags ) );
+		return;
+	}
+
+	fanout recipients( ctx, channel, data, len, flags );
+	for( size_t k = 0; k < ctx->host->peerCount; ++k )
+		recipients.Send( &ctx->host->peers[k] );
+}
+
+static bool Consume( context *ctx, bucket &b, size_t bytes )
+{
+	const limit &lim = ctx->incoming_limit;
+	enet_uint32 now = ctx->host->serviceTime;
+	if( !b.primed )
+	{
+		b.packets = lim.packets_per_second * lim.burst;
+		b.bytes = lim.bytes_per_second * lim.burst;
+		b.last_update = now;
+		b.primed = true;
+	}
+	else if( now != b.last_update )
+	{
+		double elapsed = ( now - b.last_update ) / 1000.0;
+		b.packets = std::min( b.packets + elapsed * lim.packets_per_second, lim.packets_per_second * lim.burst );
+		b.bytes = std::min( b.bytes + elapsed * lim.bytes_per_second, lim.bytes_per_second * lim.burst );
+		b.last_update = now;
+	}
+
+	bool allowed = ( lim.packets_per_second <= 0.0 || b.packets >= 1.0 ) &&
+		( lim.bytes_per_second <= 0.0 || b.bytes >= static_cast<double>( bytes ) );
+	if( allowed )
+	{
+		b.packets -= 1.0;
+		b.bytes -= static_cast<double>( bytes );
+	}
+
+	return allowed;
+}
+
+// Applies the incoming limits to a received packet, returns false when it should be dropped.
+static bool Throttle( context *ctx, ENetPeer *peer, slot &s, enet_uint8 channel, size_t bytes )
+{
+	const limit &lim = ctx->incoming_limit;
+	bool allowed = Consume( ctx, s.incoming, bytes );
+	if( lim.per_channel )
+	{
+		if( s.channel_incoming.size( ) < peer->channelCount )
+			s.channel_incoming.resize( peer->channelCount, bucket( ) );
+
+		if( channel < s.channel_incoming.size( ) )
+			allowed = Consume( ctx, s.channel_incoming[channel], bytes ) && allowed;
+	}
+
+	if( allowed )
+	{
+		s.rate_exceeded = false;
+		return true;
+	}
+
+	++s.incoming_dropped;
+	if( lim.notify && !s.rate_exceeded )
+	{
+		ENetEvent ev;
+		ev.type = static_cast<ENetEventType>( EVENT_TYPE_RATE_EXCEEDED );
+		ev.peer = peer;
+		ev.channelID = channel;
+		ev.data = static_cast<enet_uint32>( s.incoming_dropped );
+		ev.packet = nullptr;
+		ctx->pending.push_back( ev );
+	}
+
+	s.rate_exceeded = true;
+	return !lim.drop;
+}
+
+// Pairs every peer connecting to the front host with a new connection from the back
+// host, then forwards received packets between the pair as they are, without Lua.
+struct link
+{
+	ENetPeer *peer;
+	enet_uint32 connect_id;
+};
+
+struct bridge
+{
+	context *front;
+	context *back;
+	ENetAddress address;
+	size_t channels;
+	enet_uint32 data;
+	std::vector<link> front_links;
+	std::vector<link> back_links;
+	std::vector<std::deque<ENetEvent>> waiting;
+	uint64_t forwarded;
+	uint64_t dropped;
+	int32_t front_ref;
+	int32_t back_ref;
+};
+
+// Packets from front peers whose backend connection isn't established yet.
+static const size_t relay_waiting_limit = 1024;
+
+inline std::vector<link> &GetLinks( bridge *r, context *ctx )
+{
+	return ctx == r->front ? r->front_links : r->back_links;
+}
+
+// Returns the peer paired with the given one, as long as both sides agree.
+static ENetPeer *GetPaired( bridge *r, context *ctx, ENetPeer *peer )
+{
+	context *other = ctx == r->front ? r->back : r->front;
+	if( other == nullptr )
+		return nullptr;
+
+	const link &forward = GetLinks( r, ctx )[GetSlotIndex( peer )];
+	if( forward.peer == nullptr || forward.peer->connectID != forward.connect_id )
+		return nullptr;
+
+	const link &backward = GetLinks( r, other )[GetSlotIndex( forward.peer )];
+	if( backward.peer != peer || backward.connect_id != peer->connectID )
+		return nullptr;
+
+	return forward.peer;
+}
+
+static void ClearWaiting( bridge *r, size_t index )
+{
+	for( const ENetEvent &ev : r->waiting[index] )
+		enet_packet_destroy( ev.packet );
+
+	r->dropped += r->waiting[index].size( );
+	r->waiting[index].clear( );
+}
+
+static void ForwardPacket( bridge *r, context *ctx, ENetPeer *peer, enet_uint8 channel, ENetPacket *packet )
+{
+	if( peer->channelCount != 0 && channel >= peer->channelCount )
+		channel = static_cast<enet_uint8>( channel % peer->channelCount );
+
+	if( ctx->encrypted )
+	{
+		// every peer of an encrypted host needs its own ciphertext
+		if( Send( ctx, peer, channel, reinterpret_cast<const char *>( packet->data ), packet->dataLength, packet->flags ) )
+			++r->forwarded;
+		else
+			++r->dropped;
+
+		enet_packet_destroy( packet );
+		return;
+	}
+
+	if( enet_peer_send( peer, channel, packet ) != 0 )
+	{
+		enet_packet_destroy( packet );
+		++r->dropped;
+		return;
 	}
 
-	if( set )
-	{
-		enet_peer_timeout( peer, timeout_limit, timeout_minimum, timeout_maximum );
-		return 0;
-	}
+	TrackPacket( ctx, peer, packet );
+	++r->forwarded;
+}
+
+static void RelayConnect( bridge *r, context *ctx, ENetPeer *peer )
+{
+	if( r->front == nullptr || r->back == nullptr )
+		return;
+
+	size_t index = GetSlotIndex( peer );
+	if( ctx == r->front )
+	{
+		ClearWaiting( r, index );
+
+		ENetPeer *backend = enet_host_connect( r->back->host, &r->address, r->channels, r->data );
+		if( backend == nullptr )
+		{
+			r->front_links[index].peer = nullptr;
+			enet_peer_disconnect( peer, 0 );
+			return;
+		}
+
+		link &forward = r->front_links[index];
+		forward.peer = backend;
+		forward.connect_id = backend->connectID;
+
+		link &backward = r->back_links[GetSlotIndex( backend )];
+		backward.peer = peer;
+		backward.connect_id = peer->connectID;
+		return;
+	}
+
+	ENetPeer *client = GetPaired( r, ctx, peer );
+	if( client == nullptr )
+		return;
+
+	std::deque<ENetEvent> &waiting = r->waiting[GetSlotIndex( client )];
+	while( !waiting.empty( ) )
+	{
+		ForwardPacket( r, ctx, peer, waiting.front( ).channelID, waiting.front( ).packet );
+		waiting.pop_front( );
+	}
+}
+
+static void RelayDisconnect( bridge *r, context *ctx, ENetPeer *peer )
+{
+	ENetPeer *paired = GetPaired( r, ctx, peer );
+	if( ctx == r->front )
+		ClearWaiting( r, GetSlotIndex( peer ) );
+	else if( paired != nullptr )
+		ClearWaiting( r, GetSlotIndex( paired ) );
+
+	GetLinks( r, ctx )[GetSlotIndex( peer )].peer = nullptr;
+	if( paired == nullptr )
+		return;
+
+	context *other = ctx == r->front ? r->back : r->front;
+	GetLinks( r, other )[GetSlotIndex( paired )].peer = nullptr;
+	enet_peer_disconnect( paired, 0 );
+}
+
+// Returns true when the packet was taken care of by the relay.
+static bool RelayReceive( bridge *r, context *ctx, ENetEvent &ev )
+{
+	ENetPeer *paired = GetPaired( r, ctx, ev.peer );
+	if( paired == nullptr )
+		return false;
+
+	context *other = ctx == r->front ? r->back : r->front;
+	if( paired->state == ENET_PEER_STATE_CONNECTED )
+	{
+		ForwardPacket( r, other, paired, ev.channelID, ev.packet );
+		return true;
+	}
+
+	std::deque<ENetEvent> &waiting = r->waiting[GetSlotIndex( ev.peer )];
+	if( ctx == r->front && waiting.size( ) < relay_waiting_limit )
+		waiting.push_back( ev );
+	else
+	{
+		enet_packet_destroy( ev.packet );
+		++r->dropped;
+	}
+
+	return true;
+}
+
+// Forgets about the relay's packets and peers on this host, before it goes away.
+static void DetachRelay( context *ctx )
+{
+	bridge *r = ctx->forward;
+	if( ctx == r->front )
+	{
+		for( size_t k = 0; k < r->waiting.size( ); ++k )
+			ClearWaiting( r, k );
+
+		r->front = nullptr;
+	}
+	else
+		r->back = nullptr;
+
+	ctx->forward = nullptr;
+}
+
+// Strips the stream header from a received packet, keeping the stream ID in the event.
+static bool ReceiveStream( context *ctx, slot &s, ENetEvent &ev )
+{
+	ENetPacket *packet = ev.packet;
+	uint32_t id = 0;
+	size_t offset = 0;
+	bool complete = false;
+	for( size_t shift = 0; !complete && offset < packet->dataLength && shift < 35; shift += 7 )
+	{
+		enet_uint8 byte = packet->data[offset++];
+		id |= static_cast<uint32_t>( byte & 0x7F ) << shift;
+		complete = ( byte & 0x80 ) == 0;
+	}
+
+	if( !complete || offset + sizeof( enet_uint16 ) > packet->dataLength )
+	{
+		enet_packet_destroy( packet );
+		return false;
+	}
+
+	enet_uint16 sequence = static_cast<enet_uint16>( packet->data[offset] | packet->data[offset + 1] << 8 );
+	offset += sizeof( enet_uint16 );
+
+	auto it = s.streams.find( id );
+	if( it == s.streams.end( ) )
+	{
+		if( s.streams.size( ) >= ctx->stream_limit )
+		{
+			++ctx->streams_refused;
+			enet_packet_destroy( packet );
+			return false;
+		}
+
+		it = s.streams.insert( std::make_pair( id, stream( ) ) ).first;
+	}
+
+	stream &st = it->second;
+	if( ( packet->flags & ENET_PACKET_FLAG_RELIABLE ) == 0 && st.received &&
+		static_cast<int16_t>( sequence - st.rx_sequence ) <= 0 )
+	{
+		++st.stale;
+		enet_packet_destroy( packet );
+		return false;
+	}
+
+	if( !st.received || static_cast<int16_t>( sequence - st.rx_sequence ) > 0 )
+		st.rx_sequence = sequence;
+
+	st.received = true;
+	++st.received_packets;
+	st.received_bytes += packet->dataLength - offset;
+
+	std::memmove( packet->data, packet->data + offset, packet->dataLength - offset );
+	packet->dataLength -= offset;
+	ev.data = id;
+	return true;
+}
+
+// Last step of a received packet, after the incoming limits and decryption.
+// Queues the buffer's oldest snapshot for pop_snapshot, unless it's queued already.
+static void ScheduleSnapshot( context *ctx, size_t index, enet_uint8 channel, const jitter::playout &p, jitter::buffer &b )
+{
+	if( !b.Schedule( p ) )
+		return;
+
+	jitter::entry e;
+	e.due = b.Scheduled( );
+	e.index = index;
+	e.generation = ctx->slots[index].generation;
+	e.channel = channel;
+	ctx->snapshots_due.Push( e );
+}
+
+// Queues every buffer again, once the outdated entries outnumber the buffers or the
+// playouts changed.
+static void RescheduleSnapshots( context *ctx )
+{
+	ctx->snapshots_due.Clear( );
+	for( size_t k = 0; k < ctx->slots.size( ); ++k )
+		for( auto &pair : ctx->slots[k].jitter_buffers )
+		{
+			auto pit = ctx->playouts.find( pair.first );
+			pair.second.Unschedule( );
+			if( pit != ctx->playouts.end( ) )
+				ScheduleSnapshot( ctx, k, pair.first, pit->second, pair.second );
+		}
+}
+
+// Keeps the snapshot until pop_snapshot finds it due, snapshots without a full tick
+// header are delivered as regular packets.
+static bool BufferSnapshot( context *ctx, const jitter::playout &p, slot &s, ENetEvent &ev )
+{
+	ENetPacket *packet = ev.packet;
+	if( packet->dataLength < snapshot_header_size )
+		return true;
+
+	uint32_t tick = 0;
+	for( size_t k = 0; k < snapshot_header_size; ++k )
+		tick |= static_cast<uint32_t>( packet->data[k] ) << ( k * 8 );
+
+	jitter::buffer &b = s.jitter_buffers[ev.channelID];
+	b.Add(
+		p,
+		tick,
+		timing::GetMilliseconds( ),
+		packet->data + snapshot_header_size,
+		packet->dataLength - snapshot_header_size
+	);
+	enet_packet_destroy( packet );
+
+	ScheduleSnapshot( ctx, GetSlotIndex( ev.peer ), ev.channelID, p, b );
+	if( ctx->snapshots_due.Size( ) > 2 * ctx->slots.size( ) * ctx->playouts.size( ) + 64 )
+		RescheduleSnapshots( ctx );
+
+	return false;
+}
+
+static bool Deliver( context *ctx, slot &s, ENetEvent &ev )
+{
+	if( ctx->forward != nullptr && RelayReceive( ctx->forward, ctx, ev ) )
+		return false;
+
+	if( !ctx->playouts.empty( ) )
+	{
+		auto it = ctx->playouts.find( ev.channelID );
+		if( it != ctx->playouts.end( ) )
+			return BufferSnapshot( ctx, it->second, s, ev );
+	}
+
+	if( ctx->streamed && ev.channelID >= ctx->stream_channel )
+		return ReceiveStream( ctx, s, ev );
+
+	return true;
+}
+
+// Handles everything the binding does natively with an event before it reaches Lua.
+// Returns false when the event was consumed.
+static bool Filter( context *ctx, ENetEvent &ev )
+{
+	profile::scope profiled( "filter" );
+	switch( ev.type )
+	{
+		case ENET_EVENT_TYPE_CONNECT:
+		{
+			slot &s = AcquireSlot( ctx, ev.peer );
+			if( ctx->encrypted )
+				StartSession( ev.peer, s );
+
+			if( ctx->forward != nullptr )
+				RelayConnect( ctx->forward, ctx, ev.peer );
+
+			return true;
+		}
+
+		case ENET_EVENT_TYPE_DISCONNECT:
+			if( ctx->forward != nullptr )
+				RelayDisconnect( ctx->forward, ctx, ev.peer );
+
+			ReleaseSlot( ctx, ev.peer );
+			return true;
+
+		case ENET_EVENT_TYPE_RECEIVE:
+		{
+			slot &s = AcquireSlot( ctx, ev.peer );
+			ENetPacket *packet = ev.packet;
+			if( ctx->limited && !Throttle( ctx, ev.peer, s, ev.channelID, packet->dataLength ) )
+			{
+				enet_packet_destroy( packet );
+				return false;
+			}
+
+			if( !ctx->encrypted )
+				return Deliver( ctx, s, ev );
+
+			// hellos are shorter than any sealed packet, late duplicates are simply dropped
+			if( packet->dataLength == 1 + secure_nonce_size && packet->data[0] == secure_hello )
+			{
+				if( !s.secure.established )
+				{
+					// sessions started by encrypt on a live connection may have sent their
+					// hello before the other end was encrypted, which got it as plain data
+					if( s.secure.resend )
+					{
+						s.secure.resend = false;
+						SendHello( ev.peer, s );
+					}
+
+					StartSession( ev.peer, s );
+					if( s.secure.started )
+						FinishSession( ctx, s, packet->data + 1 );
+				}
+
+				enet_packet_destroy( packet );
+				return false;
+			}
+
+			if( !OpenPacket( s, ev.channelID, packet ) )
+			{
+				++ctx->secure_rejected;
+				enet_packet_destroy( packet );
+				return false;
+			}
+
+			return Deliver( ctx, s, ev );
+		}
+
+		default:
+			return true;
+	}
+}
+
+static int32_t ServiceHost( context *ctx, ENetEvent &ev, enet_uint32 timeout, bool check_only )
+{
+	profile::scope profiled( check_only ? "enet_host_check_events" : "enet_host_service" );
+	return check_only ?
+		enet_host_check_events( ctx->host, &ev ) :
+		enet_host_service( ctx->host, &ev, timeout );
+}
+
+static int32_t PollEvent( context *ctx, ENetEvent &ev, enet_uint32 timeout, bool check_only )
+{
+	if( !check_only && !ctx->latest_dirty.empty( ) )
+		FlushLatest( ctx );
+
+	int32_t ret = ServiceHost( ctx, ev, timeout, check_only );
+	while( ret > 0 && !Filter( ctx, ev ) )
+		ret = ServiceHost( ctx, ev, 0, check_only );
+
+	return ret;
+}
+
+// Drains a batch of events into the pending queue, measuring the backlog on the way,
+// and sheds unreliable packets from it while the backlog is over the thresholds.
+static void CheckOverload( context *ctx )
+{
+	profile::scope profiled( "check_overload" );
+	overload::monitor &load = ctx->load;
+
+	std::vector<ENetEvent> &batch = load.Batch( );
+	ENetEvent ev;
+	while( batch.size( ) < load.Policy( ).drain_limit && PollEvent( ctx, ev, 0, false ) > 0 )
+		batch.push_back( ev );
+
+	bool overloaded = load.Measure( enet_time_get( ) );
+	if( overloaded && load.IsShedding( ) )
+	{
+		// walked backwards, coalescing keeps the newest packet of every peer, channel and stream
+		for( size_t k = batch.size( ); k-- > 0; )
+		{
+			ENetEvent &e = batch[k];
+			if( e.type != ENET_EVENT_TYPE_RECEIVE || ( e.packet->flags & ENET_PACKET_FLAG_RELIABLE ) != 0 )
+				continue;
+
+			uint64_t key = static_cast<uint64_t>( GetSlotIndex( e.peer ) ) << 40 |
+				static_cast<uint64_t>( e.channelID ) << 32;
+			if( ctx->streamed && e.channelID >= ctx->stream_channel )
+				key |= e.data;
+
+			if( !load.Drop( key ) )
+				continue;
+
+			enet_packet_destroy( e.packet );
+			e.packet = nullptr;
+			e.type = ENET_EVENT_TYPE_NONE;
+		}
+	}
+
+	for( const ENetEvent &e : batch )
+		if( e.type != ENET_EVENT_TYPE_NONE )
+			ctx->pending.push_back( e );
+
+	// the transitions are reported ahead of the batch
+	if( load.Update( overloaded ) )
+	{
+		ENetEvent notice;
+		notice.type = static_cast<ENetEventType>( EVENT_TYPE_OVERLOADED );
+		notice.peer = nullptr;
+		notice.channelID = 0;
+		notice.data = overloaded ? 1 : 0;
+		notice.packet = nullptr;
+		ctx->pending.push_front( notice );
+	}
+}
+
+// Sends, retries and concludes the probes of every connected peer, see mtu::search.
+static void UpdateProbes( context *ctx )
+{
+	enet_uint32 now = enet_time_get( );
+	if( ENET_TIME_DIFFERENCE( now, ctx->probes_updated ) < probe_update_interval )
+		return;
+
+	profile::scope profiled( "update_probes" );
+	ctx->probes_updated = now;
+	for( size_t k = 0; k < ctx->host->peerCount; ++k )
+	{
+		ENetPeer *peer = &ctx->host->peers[k];
+		if( peer->state != ENET_PEER_STATE_CONNECTED )
+			continue;
+
+		// tokens carry the slot index in their low bits, see ReceiveAcknowledgement
+		mtu::prober &probes = AcquireSlot( ctx, peer ).probes;
+		switch( probes.Update( ctx->mtu_policy, now, peer->roundTripTime, peer->connectID, static_cast<uint32_t>( k ), slot_bits ) )
+		{
+			case mtu::PROBE_SEND:
+				// oversized probes fail right away once fragmentation is forbidden
+				if( !mtu::SendProbe( ctx->host->socket, peer->address, probes.Size( ), probes.Token( ) ) )
+					probes.Failed( );
+
+				break;
+
+			case mtu::PROBE_DONE:
+				peer->mtu = probes.Result( );
+				break;
+
+			case mtu::PROBE_IDLE:
+				break;
+		}
+	}
+}
+
+static int32_t NextEvent( context *ctx, ENetEvent &ev, enet_uint32 timeout, bool check_only )
+{
+	if( ctx->discovering && !check_only )
+		UpdateProbes( ctx );
+
+	if( ctx->load.IsEnabled( ) && !check_only && ctx->pending.empty( ) )
+		CheckOverload( ctx );
+
+	if( !ctx->pending.empty( ) )
+	{
+		ev = ctx->pending.front( );
+		ctx->pending.pop_front( );
+		return 1;
+	}
+
+	return PollEvent( ctx, ev, timeout, check_only );
+}
+
+namespace host
+{
+
+static bool Create( lua_State *state, ENetHost *host, bool onlyexisting = false );
+static context *CreateContext( ENetHost *host );
+static void Push( lua_State *state, ENetHost *host );
+static void PushShared( lua_State *state, ::shm::host *link );
+
+}
+
+namespace persistent
+{
+
+static void Orphan( lua_State *state, context *ctx );
+static void Release( context *ctx );
+
+}
+
+namespace schema
+{
+
+struct compiled;
+
+static const compiled *GetAndValidate( lua_State *state, int32_t index );
+static void Encode( lua_State *state, const compiled *layout, int32_t index, bitstream::writer &output );
+
+}
+
+namespace peer
+{
+
+static const char *metaname = "ENetPeer";
+static uint8_t metatype = 231;
+static const char *tablename = "enet_peers";
+static const char *invalid_error = "invalid ENetPeer";
+static const char *shared_error = "not supported by shared memory peers";
+
+// Peers of shared memory hosts have no ENetPeer, they're the link index on shared.
+struct userdata
+{
+	ENetPeer *peer;
+	uint8_t type;
+	ENetHost *host;
+	size_t index;
+	::shm::host *shared;
+};
+
+inline void Check( lua_State *state, int32_t index )
+{
+	if( !LUA->IsType( index, metatype ) )
+		luaL_typerror( state, index, metaname );
+}
+
+inline userdata *GetUserdata( lua_State *state, int32_t index )
+{
+	return static_cast<userdata *>( LUA->GetUserdata( index ) );
+}
+
+static ENetPeer *GetAndValidate( lua_State *state, int32_t index )
+{
+	Check( state, index );
+	userdata *udata = GetUserdata( state, index );
+	if( udata->shared != nullptr )
+		LUA->ArgError( index, shared_error );
+
+	if( udata->peer == nullptr )
+		LUA->ArgError( index, invalid_error );
+
+	return udata->peer;
+}
+
+// Returns the userdata of a shared memory peer, or nullptr for a valid ENetPeer, so
+// the methods both kinds support can branch before GetAndValidate.
+static userdata *GetShared( lua_State *state, int32_t index )
+{
+	Check( state, index );
+	userdata *udata = GetUserdata( state, index );
+	if( udata->peer == nullptr && udata->shared == nullptr )
+		LUA->ArgError( index, invalid_error );
+
+	return udata->shared != nullptr ? udata : nullptr;
+}
+
+static bool Create( lua_State *state, ENetPeer *peer )
+{
+	profile::scope profiled( "peer_create" );
+	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+
+	LUA->GetField( -1, tablename );
+
+	LUA->Remove( -2 );
+
+	LUA->PushUserdata( peer );
+	LUA->GetTable( -2 );
+
+	if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+	{
+		LUA->Remove( -2 );
+		return false;
+	}
+
+	LUA->Pop( 1 );
+
+	userdata *udata = static_cast<userdata *>( LUA->NewUserdata( sizeof( userdata ) ) );
+	udata->type = metatype;
+	udata->peer = peer;
+	udata->host = peer->host;
+	udata->index = GetSlotIndex( peer );
+	udata->shared = nullptr;
+
+	LUA->CreateMetaTableType( metaname, metatype );
+	LUA->SetMetaTable( -2 );
+
+	LUA->CreateTable( );
+	lua_setfenv( state, -2 );
+
+	LUA->PushUserdata( peer );
+	LUA->Push( -2 );
+	LUA->SetTable( -4 );
+
+	LUA->Remove( -2 );
+	return true;
+}
+
+// Same as Create for a peer of the shared memory host at host_index, which the peer
+// keeps alive through its environment table.
+static bool CreateShared( lua_State *state, int32_t host_index, ::shm::host *link, size_t index )
+{
+	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+
+	LUA->GetField( -1, tablename );
+
+	LUA->Remove( -2 );
+
+	LUA->PushUserdata( const_cast<void *>( link->GetKey( index ) ) );
+	LUA->GetTable( -2 );
+
+	if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+	{
+		LUA->Remove( -2 );
+		return false;
+	}
+
+	LUA->Pop( 1 );
+
+	userdata *udata = static_cast<userdata *>( LUA->NewUserdata( sizeof( userdata ) ) );
+	udata->type = metatype;
+	udata->peer = nullptr;
+	udata->host = nullptr;
+	udata->index = index;
+	udata->shared = link;
+
+	LUA->CreateMetaTableType( metaname, metatype );
+	LUA->SetMetaTable( -2 );
+
+	LUA->CreateTable( );
+	LUA->Push( host_index );
+	LUA->SetField( -2, "host" );
+	lua_setfenv( state, -2 );
+
+	LUA->PushUserdata( const_cast<void *>( link->GetKey( index ) ) );
+	LUA->Push( -2 );
+	LUA->SetTable( -4 );
+
+	LUA->Remove( -2 );
+	return true;
+}
+
+LUA_FUNCTION_STATIC( tostring )
+{
+	userdata *shared = GetShared( state, 1 );
+	if( shared != nullptr )
+	{
+		lua_pushfstring( state, "%s: %p [%d]", metaname, shared->shared, static_cast<int>( shared->index ) );
+		return 1;
+	}
+
+	lua_pushfstring( state, "%s: %p", metaname, GetAndValidate( state, 1 ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( eq )
+{
+	userdata *first = GetShared( state, 1 ), *second = GetShared( state, 2 );
+	if( first != nullptr || second != nullptr )
+	{
+		LUA->PushBool( first != nullptr && second != nullptr &&
+			first->shared == second->shared && first->index == second->index );
+		return 1;
+	}
+
+	LUA->PushBool( GetAndValidate( state, 1 ) == GetAndValidate( state, 2 ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( index )
+{
+	LUA->GetMetaTable( 1 );
+	LUA->Push( 2 );
+	LUA->RawGet( -2 );
+	if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+		return 1;
+
+	LUA->Pop( 2 );
+
+	lua_getfenv( state, 1 );
+	LUA->Push( 2 );
+	LUA->RawGet( -2 );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( newindex )
+{
+	lua_getfenv( state, 1 );
+	LUA->Push( 2 );
+	LUA->Push( 3 );
+	LUA->RawSet( -3 );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( valid )
+{
+	Check( state, 1 );
+	userdata *udata = GetUserdata( state, 1 );
+	LUA->PushBool( udata->peer != nullptr || udata->shared != nullptr );
+	return 1;
+}
+
+// Shared memory peers disconnect the same way whichever variant is called, there's
+// nothing queued on their side to wait for or drop.
+static bool DisconnectShared( lua_State *state )
+{
+	userdata *shared = GetShared( state, 1 );
+	if( shared == nullptr )
+		return false;
+
+	enet_uint32 data = LUA->Top( ) > 1 ? static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) : 0;
+	shared->shared->Disconnect( shared->index, data );
+	return true;
+}
+
+LUA_FUNCTION_STATIC( disconnect )
+{
+	if( DisconnectShared( state ) )
+		return 0;
+
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	enet_uint32 data = LUA->Top( ) > 1 ? static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) : 0;
+	enet_peer_disconnect( peer, data );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( disconnect_now )
+{
+	if( DisconnectShared( state ) )
+		return 0;
+
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	enet_uint32 data = LUA->Top( ) > 1 ? static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) : 0;
+	enet_peer_disconnect_now( peer, data );
+	ReleaseSlot( GetContext( peer->host ), peer );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( disconnect_later )
+{
+	if( DisconnectShared( state ) )
+		return 0;
+
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	enet_uint32 data = LUA->Top( ) > 1 ? static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) : 0;
+	enet_peer_disconnect_later( peer, data );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( reset )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	enet_peer_reset( peer );
+	ReleaseSlot( GetContext( peer->host ), peer );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( ping )
+{
+	enet_peer_ping( GetAndValidate( state, 1 ) );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( receive )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	context *ctx = GetContext( peer->host );
+
+	ENetEvent ev;
+	ev.type = ENET_EVENT_TYPE_RECEIVE;
+	ev.peer = peer;
+	ev.data = 0;
+	do
+	{
+		ev.channelID = 0;
+		ev.packet = enet_peer_receive( peer, &ev.channelID );
+		if( ev.packet == nullptr )
+			return 0;
+	}
+	while( !Filter( ctx, ev ) );
+
+	ENetPacket *packet = ev.packet;
+	LUA->PushString( reinterpret_cast<char *>( packet->data ), packet->dataLength );
+	LUA->PushNumber( ev.channelID );
+	LUA->PushNumber( packet->flags );
+	enet_packet_destroy( packet );
+	return 3;
+}
+
+LUA_FUNCTION_STATIC( send )
+{
+	userdata *shared = GetShared( state, 1 );
+	ENetPeer *peer = shared == nullptr ? GetAndValidate( state, 1 ) : nullptr;
+	const char *data = nullptr;
+	size_t len = 0;
+	enet_uint8 channel = 1;
+	enet_uint32 flags = 0;
+	if( !GetSendArguments( state, 2, data, len, channel, flags ) )
+		return 2;
+
+	// a full ring is reported like a failed send, the receiving process is behind
+	if( shared != nullptr )
+	{
+		if( !shared->shared->Send( shared->index, channel, flags, data, len ) )
+		{
+			LUA->PushNil( );
+			LUA->PushString( "failed to send packet" );
+			return 2;
+		}
+
+		LUA->PushBool( true );
+		return 1;
+	}
+
+	context *ctx = GetContext( peer->host );
+	if( !Send( ctx, peer, channel, data, len, flags ) )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "failed to send packet" );
+		return 2;
+	}
+
+	return PushQueued( state, ctx, peer );
+}
+
+LUA_FUNCTION_STATIC( throttle_configure )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+
+	enet_uint32 interval = peer->packetThrottleInterval,
+		acceleration = peer->packetThrottleAcceleration,
+		deceleration = peer->packetThrottleDeceleration;
+	bool set = false;
+	switch( LUA->Top( ) )
+	{
+		default:
+			set = true;
+			deceleration = static_cast<enet_uint32>( LUA->CheckNumber( 4 ) );
+
+		case 3:
+			if( !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
+			{
+				set = true;
+				acceleration = static_cast<enet_uint32>( LUA->CheckNumber( 3 ) );
+			}
+
+		case 2:
+			if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+			{
+				set = true;
+				interval = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
+			}
+
+		case 1:
+			/* do nothing */;
+	}
+
+	if( set )
+	{
+		enet_peer_throttle_configure( peer, interval, acceleration, deceleration );
+		return 0;
+	}
+
+	LUA->PushNumber( interval );
+	LUA->PushNumber( acceleration );
+	LUA->PushNumber( deceleration );
+	return 3;
+}
+
+LUA_FUNCTION_STATIC( ping_interval )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		enet_peer_ping_interval( peer, static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) );
+		return 0;
+	}
+
+	LUA->PushNumber( peer->pingInterval );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( timeout )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+
+	enet_uint32 timeout_limit = peer->timeoutLimit,
+		timeout_minimum = peer->timeoutMinimum,
+		timeout_maximum = peer->timeoutMaximum;
+	bool set = false;
+	switch( LUA->Top( ) )
+	{
+		default:
+			set = true;
+			timeout_maximum = static_cast<enet_uint32>( LUA->CheckNumber( 4 ) );
+
+		case 3:
+			if( !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
+			{
+				set = true;
+				timeout_minimum = static_cast<enet_uint32>( LUA->CheckNumber( 3 ) );
+			}
+
+		case 2:
+			if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+			{
+				set = true;
+				timeout_limit = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
+			}
+
+		case 1:
+			/* do nothing */;
+	}
+
+	if( set )
+	{
+		enet_peer_timeout( peer, timeout_limit, timeout_minimum, timeout_maximum );
+		return 0;
+	}
+
+	LUA->PushNumber( timeout_limit );
+	LUA->PushNumber( timeout_minimum );
+	LUA->PushNumber( timeout_maximum );
+	return 3;
+}
+
+LUA_FUNCTION_STATIC( peer_index )
+{
+	Check( state, 1 );
+	LUA->PushNumber( GetUserdata( state, 1 )->index );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( peer_state )
+{
+	userdata *shared = GetShared( state, 1 );
+	if( shared != nullptr )
+	{
+		LUA->PushString( shared->shared->IsConnected( shared->index ) ? "connected" : "disconnected" );
+		return 1;
+	}
+
+	switch( GetAndValidate( state, 1 )->state )
+	{
+		case ENET_PEER_STATE_DISCONNECTED:
+			LUA->PushString( "disconnected" );
+			break;
+
+		case ENET_PEER_STATE_CONNECTING:
+			LUA->PushString( "connecting" );
+			break;
+
+		case ENET_PEER_STATE_ACKNOWLEDGING_CONNECT:
+			LUA->PushString( "acknowledging_connect" );
+			break;
+
+		case ENET_PEER_STATE_CONNECTION_PENDING:
+			LUA->PushString( "connection_pending" );
+			break;
+
+		case ENET_PEER_STATE_CONNECTION_SUCCEEDED:
+			LUA->PushString( "connection_succeeded" );
+			break;
+
+		case ENET_PEER_STATE_CONNECTED:
+			LUA->PushString( "connected" );
+			break;
+
+		case ENET_PEER_STATE_DISCONNECT_LATER:
+			LUA->PushString( "disconnect_later" );
+			break;
+
+		case ENET_PEER_STATE_DISCONNECTING:
+			LUA->PushString( "disconnecting" );
+			break;
+
+		case ENET_PEER_STATE_ACKNOWLEDGING_DISCONNECT:
+			LUA->PushString( "acknowledging_disconnect" );
+			break;
+
+		case ENET_PEER_STATE_ZOMBIE:
+			LUA->PushString( "zombie" );
+			break;
+
+		default:
+			LUA->PushString( "unknown" );
+	}
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( connect_id )
+{
+	LUA->PushNumber( GetAndValidate( state, 1 )->connectID );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( round_trip_time )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		peer->roundTripTime = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
+		return 0;
+	}
+
+	LUA->PushNumber( peer->roundTripTime );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( last_round_trip_time )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		peer->lastRoundTripTime = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
+		return 0;
+	}
+
+	LUA->PushNumber( peer->lastRoundTripTime );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( host )
+{
+	if( GetShared( state, 1 ) != nullptr )
+	{
+		lua_getfenv( state, 1 );
+		LUA->GetField( -1, "host" );
+		return 1;
+	}
+
+	host::Create( state, GetAndValidate( state, 1 )->host, true );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( local_address )
+{
+	const ENetAddress &address = GetAndValidate( state, 1 )->host->address;
+	lua_pushfstring(
+		state,
+		"%d.%d.%d.%d:%d",
+		( ( address.host ) & 0xFF ),
+		( ( address.host >> 8 ) & 0xFF ),
+		( ( address.host >> 16 ) & 0xFF ),
+		( address.host >> 24 & 0xFF ),
+		address.port
+	);
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( remote_address )
+{
+	const ENetAddress &address = GetAndValidate( state, 1 )->address;
+	lua_pushfstring(
+		state,
+		"%d.%d.%d.%d:%d",
+		( ( address.host ) & 0xFF ),
+		( ( address.host >> 8 ) & 0xFF ),
+		( ( address.host >> 16 ) & 0xFF ),
+		( address.host >> 24 & 0xFF ),
+		address.port
+	);
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( secure )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	context *ctx = GetContext( peer->host );
+	const slot &s = ctx->slots[GetSlotIndex( peer )];
+	LUA->PushBool( ctx->encrypted && s.secure.established && s.connect_id == peer->connectID );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( set_position )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	double x = CheckFinite( state, 2 ), y = CheckFinite( state, 3 ), z = CheckFinite( state, 4 );
+	context *ctx = GetContext( peer->host );
+	AcquireSlot( ctx, peer );
+	SetPosition( ctx, GetSlotIndex( peer ), x, y, z );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( clear_position )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	RemovePosition( GetContext( peer->host ), GetSlotIndex( peer ) );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( position )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	const slot &s = GetContext( peer->host )->slots[GetSlotIndex( peer )];
+	if( !s.positioned )
+		return 0;
+
+	LUA->PushNumber( s.position[0] );
+	LUA->PushNumber( s.position[1] );
+	LUA->PushNumber( s.position[2] );
+	return 3;
+}
+
+LUA_FUNCTION_STATIC( incoming_dropped )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	context *ctx = GetContext( peer->host );
+	LUA->PushNumber( static_cast<double>( AcquireSlot( ctx, peer ).incoming_dropped ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( set_watermarks )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	backlog &b = GetBacklog( GetContext( peer->host ), peer );
+
+	if( LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+	{
+		b.high_watermark = 0;
+		b.low_watermark = 0;
+		b.draining = false;
+		return 0;
+	}
+
+	double high = LUA->CheckNumber( 2 );
+	double low = LUA->CheckNumber( 3 );
+	if( high < 1.0 )
+		LUA->ArgError( 2, "high watermark must be positive" );
+
+	if( low < 0.0 || low >= high )
+		LUA->ArgError( 3, "low watermark must be between 0 and the high watermark" );
+
+	b.high_watermark = static_cast<size_t>( high );
+	b.low_watermark = static_cast<size_t>( low );
+	b.draining = b.queued_bytes >= b.high_watermark;
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( queued )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	const backlog &b = GetBacklog( GetContext( peer->host ), peer );
+	LUA->PushNumber( static_cast<double>( b.queued_bytes ) );
+	LUA->PushNumber( static_cast<double>( b.queued_packets ) );
+	return 2;
+}
+
+LUA_FUNCTION_STATIC( send_struct )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	const schema::compiled *layout = schema::GetAndValidate( state, 2 );
+	LUA->CheckType( 3, GarrysMod::Lua::Type::TABLE );
+	enet_uint8 channel = 1;
+	enet_uint32 flags = 0;
+	if( !GetChannelAndFlags( state, 4, channel, flags ) )
+		return 2;
+
+	bitstream::writer output;
+	schema::Encode( state, layout, 3, output );
+	const std::vector<uint8_t> &data = output.Finish( );
+
+	context *ctx = GetContext( peer->host );
+	if( !Send( ctx, peer, channel, reinterpret_cast<const char *>( data.data( ) ), data.size( ), flags ) )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "failed to send packet" );
+		return 2;
+	}
+
+	return PushQueued( state, ctx, peer );
+}
+
+static stream *GetStream( lua_State *state, ENetPeer *peer, int32_t index, bool create )
+{
+	context *ctx = GetContext( peer->host );
+	if( !ctx->streamed )
+		LUA->ThrowError( "streams are not enabled on this host" );
+
+	double id = LUA->CheckNumber( index );
+	if( id < 0.0 || id > 4294967295.0 || id != std::floor( id ) )
+		LUA->ArgError( index, "stream ID must be an integer between 0 and 2^32 - 1" );
+
+	slot &s = AcquireSlot( ctx, peer );
+	if( create )
+		return &s.streams[static_cast<uint32_t>( id )];
+
+	auto it = s.streams.find( static_cast<uint32_t>( id ) );
+	return it != s.streams.end( ) ? &it->second : nullptr;
+}
+
+LUA_FUNCTION_STATIC( open_stream )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	GetStream( state, peer, 2, true )->open = true;
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( close_stream )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	stream *st = GetStream( state, peer, 2, false );
+	if( st != nullptr )
+		AcquireSlot( GetContext( peer->host ), peer ).streams.erase( static_cast<uint32_t>( LUA->GetNumber( 2 ) ) );
+
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( send_stream )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	stream *st = GetStream( state, peer, 2, false );
+	LUA->CheckType( 3, GarrysMod::Lua::Type::STRING );
+	size_t len = 0;
+	const char *data = LUA->GetString( 3, &len );
+	enet_uint32 flags = 0;
+	if( LUA->Top( ) > 3 && !GetPacketFlags( state, LUA->CheckString( 4 ), flags ) )
+		return 2;
+
+	if( st == nullptr || !st->open )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "stream is not open" );
+		return 2;
+	}
+
+	context *ctx = GetContext( peer->host );
+	if( peer->channelCount <= ctx->stream_channel )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "peer has no stream channels" );
+		return 2;
+	}
+
+	// ENet drops sequenced unreliable packets older than the newest one on the channel,
+	// which would have streams sharing a channel drop each other's packets
+	if( ( flags & ENET_PACKET_FLAG_RELIABLE ) == 0 )
+		flags |= ENET_PACKET_FLAG_UNSEQUENCED;
+
+	uint32_t id = static_cast<uint32_t>( LUA->GetNumber( 2 ) );
+	std::string buffer;
+	buffer.reserve( stream_header_size + len );
+	for( uint32_t value = id; ; value >>= 7 )
+	{
+		if( value < 0x80 )
+		{
+			buffer.push_back( static_cast<char>( value ) );
+			break;
+		}
+
+		buffer.push_back( static_cast<char>( ( value & 0x7F ) | 0x80 ) );
+	}
+
+	enet_uint16 sequence = ++st->tx_sequence;
+	buffer.push_back( static_cast<char>( sequence & 0xFF ) );
+	buffer.push_back( static_cast<char>( sequence >> 8 ) );
+	buffer.append( data, len );
+
+	enet_uint8 channel = static_cast<enet_uint8>(
+		ctx->stream_channel + id % ( peer->channelCount - ctx->stream_channel )
+	);
+	if( !Send( ctx, peer, channel, buffer.data( ), buffer.size( ), flags ) )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "failed to send packet" );
+		return 2;
+	}
+
+	++st->sent_packets;
+	st->sent_bytes += len;
+	return PushQueued( state, ctx, peer );
+}
+
+LUA_FUNCTION_STATIC( stream_stats )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	const stream *st = GetStream( state, peer, 2, false );
+	if( st == nullptr )
+		return 0;
+
+	LUA->CreateTable( );
+
+	LUA->PushBool( st->open );
+	LUA->SetField( -2, "open" );
+
+	LUA->PushNumber( static_cast<double>( st->sent_packets ) );
+	LUA->SetField( -2, "sent_packets" );
+
+	LUA->PushNumber( static_cast<double>( st->sent_bytes ) );
+	LUA->SetField( -2, "sent_bytes" );
+
+	LUA->PushNumber( static_cast<double>( st->received_packets ) );
+	LUA->SetField( -2, "received_packets" );
+
+	LUA->PushNumber( static_cast<double>( st->received_bytes ) );
+	LUA->SetField( -2, "received_bytes" );
+
+	LUA->PushNumber( static_cast<double>( st->stale ) );
+	LUA->SetField( -2, "stale" );
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( set_groups )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	AcquireSlot( GetContext( peer->host ), peer ).groups = GetGroupMask( state, 2 );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( groups )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	LUA->PushNumber( AcquireSlot( GetContext( peer->host ), peer ).groups );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( send_latest )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	if( !LUA->IsType( 2, GarrysMod::Lua::Type::STRING ) && !LUA->IsType( 2, GarrysMod::Lua::Type::NUMBER ) )
+		luaL_typerror( state, 2, "string or number" );
+
+	size_t key_len = 0;
+	const char *key = lua_tolstring( state, 2, &key_len );
+	const char *data = nullptr;
+	size_t len = 0;
+	enet_uint8 channel = 1;
+	enet_uint32 flags = 0;
+	if( !GetSendArguments( state, 3, data, len, channel, flags ) )
+		return 2;
+
+	context *ctx = GetContext( peer->host );
+	size_t index = GetSlotIndex( peer );
+	slot &s = AcquireSlot( ctx, peer );
+	latest &value = s.latest_values[std::string( key, key_len )];
+	if( value.pending )
+		++s.latest_replaced;
+
+	value.data.assign( data, len );
+	value.channel = channel;
+	value.flags = flags;
+	value.pending = true;
+	if( !s.latest_dirty )
+	{
+		s.latest_dirty = true;
+		ctx->latest_dirty.push_back( index );
+	}
+
+	LUA->PushBool( true );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( latest_replaced )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	LUA->PushNumber( static_cast<double>( AcquireSlot( GetContext( peer->host ), peer ).latest_replaced ) );
+	return 1;
+}
+
+// Sends data behind the tick header read by jitter buffered channels, unreliable by default.
+LUA_FUNCTION_STATIC( send_snapshot )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	uint32_t tick = static_cast<uint32_t>( LUA->CheckNumber( 2 ) );
+	const char *data = nullptr;
+	size_t len = 0;
+	enet_uint8 channel = 1;
+	enet_uint32 flags = 0;
+	if( !GetSendArguments( state, 3, data, len, channel, flags ) )
+		return 2;
+
+	std::string snapshot( snapshot_header_size, '\0' );
+	for( size_t k = 0; k < snapshot_header_size; ++k )
+		snapshot[k] = static_cast<char>( tick >> ( k * 8 ) );
+
+	snapshot.append( data, len );
+	context *ctx = GetContext( peer->host );
+	if( Send( ctx, peer, channel, snapshot.data( ), snapshot.size( ), flags ) == nullptr )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "failed to send packet" );
+		return 2;
+	}
+
+	return PushQueued( state, ctx, peer );
+}
+
+LUA_FUNCTION_STATIC( jitter_stats )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+	enet_uint8 channel = static_cast<enet_uint8>( LUA->CheckNumber( 2 ) );
+	context *ctx = GetContext( peer->host );
+	auto pit = ctx->playouts.find( channel );
+	if( pit == ctx->playouts.end( ) )
+		return 0;
+
+	slot &s = AcquireSlot( ctx, peer );
+	auto jit = s.jitter_buffers.find( channel );
+	if( jit == s.jitter_buffers.end( ) )
+		return 0;
+
+	const jitter::buffer &b = jit->second;
+	LUA->CreateTable( );
+
+	LUA->PushNumber( b.Delay( pit->second ) );
+	LUA->SetField( -2, "delay" );
+
+	LUA->PushNumber( b.Deviation( ) );
+	LUA->SetField( -2, "jitter" );
+
+	LUA->PushNumber( static_cast<double>( b.Buffered( ) ) );
+	LUA->SetField( -2, "buffered" );
+
+	LUA->PushNumber( static_cast<double>( b.Late( ) ) );
+	LUA->SetField( -2, "late" );
+
+	LUA->PushNumber( static_cast<double>( b.Overflow( ) ) );
+	LUA->SetField( -2, "overflow" );
+
+	return 1;
+}
+
+// Returns the MTU with the discovery state and probe counters, or sets the MTU.
+LUA_FUNCTION_STATIC( peer_mtu )
+{
+	ENetPeer *peer = GetAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		enet_uint32 value = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
+		if( value < ENET_PROTOCOL_MINIMUM_MTU || value > ENET_PROTOCOL_MAXIMUM_MTU )
+			LUA->ArgError( 2, "MTU out of ENet's range" );
+
+		peer->mtu = value;
+		return 0;
+	}
+
+	const mtu::prober &probes = AcquireSlot( GetContext( peer->host ), peer ).probes;
+	LUA->PushNumber( peer->mtu );
+	LUA->PushBool( probes.IsRunning( ) );
+	LUA->PushNumber( static_cast<double>( probes.Sent( ) ) );
+	LUA->PushNumber( static_cast<double>( probes.Lost( ) ) );
+	return 4;
+}
+
+static void Initialize( lua_State *state )
+{
+	LUA->CreateMetaTableType( metaname, metatype );
+
+	LUA->PushCFunction( tostring );
+	LUA->SetField( -2, "__tostring" );
+
+	LUA->PushCFunction( eq );
+	LUA->SetField( -2, "__eq" );
+
+	LUA->PushCFunction( index );
+	LUA->SetField( -2, "__index" );
+
+	LUA->PushCFunction( newindex );
+	LUA->SetField( -2, "__newindex" );
+
+	LUA->PushCFunction( valid );
+	LUA->SetField( -2, "valid" );
+
+	LUA->PushCFunction( disconnect );
+	LUA->SetField( -2, "disconnect" );
+
+	LUA->PushCFunction( disconnect_now );
+	LUA->SetField( -2, "disconnect_now" );
+
+	LUA->PushCFunction( disconnect_later );
+	LUA->SetField( -2, "disconnect_later" );
+
+	LUA->PushCFunction( reset );
+	LUA->SetField( -2, "reset" );
+
+	LUA->PushCFunction( ping );
+	LUA->SetField( -2, "ping" );
+
+	LUA->PushCFunction( receive );
+	LUA->SetField( -2, "receive" );
+
+	LUA->PushCFunction( send );
+	LUA->SetField( -2, "send" );
+
+	LUA->PushCFunction( throttle_configure );
+	LUA->SetField( -2, "throttle_configure" );
+
+	LUA->PushCFunction( ping_interval );
+	LUA->SetField( -2, "ping_interval" );
+
+	LUA->PushCFunction( timeout );
+	LUA->SetField( -2, "timeout" );
+
+	LUA->PushCFunction( peer_index );
+	LUA->SetField( -2, "index" );
+
+	LUA->PushCFunction( peer_state );
+	LUA->SetField( -2, "state" );
+
+	LUA->PushCFunction( connect_id );
+	LUA->SetField( -2, "connect_id" );
+
+	LUA->PushCFunction( round_trip_time );
+	LUA->SetField( -2, "round_trip_time" );
+
+	LUA->PushCFunction( last_round_trip_time );
+	LUA->SetField( -2, "last_round_trip_time" );
+
+	LUA->PushCFunction( host );
+	LUA->SetField( -2, "host" );
+
+	LUA->PushCFunction( local_address );
+	LUA->SetField( -2, "local_address" );
+
+	LUA->PushCFunction( remote_address );
+	LUA->SetField( -2, "remote_address" );
+
+	LUA->PushCFunction( secure );
+	LUA->SetField( -2, "secure" );
+
+	LUA->PushCFunction( set_position );
+	LUA->SetField( -2, "set_position" );
+
+	LUA->PushCFunction( clear_position );
+	LUA->SetField( -2, "clear_position" );
+
+	LUA->PushCFunction( position );
+	LUA->SetField( -2, "position" );
+
+	LUA->PushCFunction( incoming_dropped );
+	LUA->SetField( -2, "incoming_dropped" );
+
+	LUA->PushCFunction( set_watermarks );
+	LUA->SetField( -2, "set_watermarks" );
+
+	LUA->PushCFunction( queued );
+	LUA->SetField( -2, "queued" );
+
+	LUA->PushCFunction( send_struct );
+	LUA->SetField( -2, "send_struct" );
+
+	LUA->PushCFunction( open_stream );
+	LUA->SetField( -2, "open_stream" );
+
+	LUA->PushCFunction( close_stream );
+	LUA->SetField( -2, "close_stream" );
+
+	LUA->PushCFunction( send_stream );
+	LUA->SetField( -2, "send_stream" );
+
+	LUA->PushCFunction( stream_stats );
+	LUA->SetField( -2, "stream_stats" );
+
+	LUA->PushCFunction( set_groups );
+	LUA->SetField( -2, "set_groups" );
+
+	LUA->PushCFunction( groups );
+	LUA->SetField( -2, "groups" );
+
+	LUA->PushCFunction( send_latest );
+	LUA->SetField( -2, "send_latest" );
+
+	LUA->PushCFunction( latest_replaced );
+	LUA->SetField( -2, "latest_replaced" );
+
+	LUA->PushCFunction( send_snapshot );
+	LUA->SetField( -2, "send_snapshot" );
+
+	LUA->PushCFunction( jitter_stats );
+	LUA->SetField( -2, "jitter_stats" );
+
+	LUA->PushCFunction( peer_mtu );
+	LUA->SetField( -2, "mtu" );
+
+	LUA->Pop( 1 );
+
+	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+
+	LUA->CreateTable( );
+
+	LUA->CreateTable( );
+
+	LUA->PushString( "v" );
+	LUA->SetField( -2, "__mode" );
+
+	LUA->SetMetaTable( -2 );
+
+	LUA->SetField( -2, tablename );
+
+	LUA->Pop( 1 );
+}
+
+static void Deinitialize( lua_State *state )
+{
+	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, metaname );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, tablename );
+
+	LUA->Pop( 1 );
+}
+
+}
+
+namespace shared
+{
+
+// Hosts created with a "shm://" address are ENetHost objects carrying a shm::host
+// instead of an ENetHost, their methods below are what the transport supports.
+static const char *scheme = "shm://";
+static const size_t scheme_length = 6;
+
+inline bool IsAddress( const char *addr )
+{
+	return std::strncmp( addr, scheme, scheme_length ) == 0;
+}
+
+static int32_t PushEvent( lua_State *state, ::shm::host *link, const ::shm::event &ev )
+{
+	LUA->CreateTable( );
+
+	LUA->PushNumber( static_cast<double>( ev.peer ) );
+	LUA->SetField( -2, "id" );
+
+	peer::CreateShared( state, 1, link, ev.peer );
+	LUA->SetField( -2, "peer" );
+
+	switch( ev.type )
+	{
+		case ::shm::EVENT_CONNECT:
+			LUA->PushNumber( ev.data );
+			LUA->SetField( -2, "data" );
+
+			LUA->PushString( "connect" );
+			break;
+
+		case ::shm::EVENT_DISCONNECT:
+			LUA->PushNumber( ev.data );
+			LUA->SetField( -2, "data" );
+
+			LUA->PushString( "disconnect" );
+			break;
+
+		case ::shm::EVENT_RECEIVE:
+			LUA->PushNumber( ev.channel );
+			LUA->SetField( -2, "channel" );
+
+			LUA->PushString( ev.payload.data( ), ev.payload.size( ) );
+			LUA->SetField( -2, "data" );
+
+			LUA->PushNumber( ev.flags );
+			LUA->SetField( -2, "flags" );
+
+			LUA->PushString( "receive" );
+			break;
+
+		default:
+			LUA->PushString( "none" );
+			break;
+	}
+
+	LUA->SetField( -2, "type" );
+	return 1;
+}
+
+// Nothing blocks on the rings, so waiting spins briefly and then naps in short steps.
+static int32_t Service( lua_State *state, ::shm::host *link, uint32_t timeout )
+{
+	::shm::event ev;
+	auto deadline = std::chrono::steady_clock::now( ) + std::chrono::milliseconds( timeout );
+	for( uint32_t spins = 0; !link->Poll( ev ); ++spins )
+	{
+		if( timeout == 0 || std::chrono::steady_clock::now( ) >= deadline )
+			return 0;
+
+		if( spins < 256 )
+			std::this_thread::yield( );
+		else
+			std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+	}
+
+	return PushEvent( state, link, ev );
+}
+
+static int32_t Connect( lua_State *state, ::shm::host *link )
+{
+	const char *addr = LUA->CheckString( 2 );
+	enet_uint32 data = 0;
+	if( LUA->Top( ) > 3 )
+		data = static_cast<enet_uint32>( LUA->CheckNumber( 4 ) );
+
+	if( !IsAddress( addr ) || addr[scheme_length] == '\0' )
+		LUA->ArgError( 2, "expected an address like 'shm://name'" );
+
+	int32_t index = link->Connect( addr + scheme_length, data );
+	if( index < 0 )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "failed to connect to shared memory segment" );
+		return 2;
+	}
+
+	peer::CreateShared( state, 1, link, static_cast<size_t>( index ) );
+	return 1;
+}
+
+static int32_t Broadcast( lua_State *state, ::shm::host *link )
+{
+	const char *data = nullptr;
+	size_t len = 0;
+	enet_uint8 channel = 1;
+	enet_uint32 flags = 0;
+	if( !GetSendArguments( state, 2, data, len, channel, flags ) )
+		return 2;
+
+	size_t sent = 0;
+	for( size_t k = 0; k < link->PeerCount( ); ++k )
+		if( link->Send( k, channel, flags, data, len ) )
+			++sent;
+
+	LUA->PushNumber( static_cast<double>( sent ) );
+	return 1;
+}
+
+// Called before the link goes away, so its peer objects stop using it.
+static void Invalidate( lua_State *state, ::shm::host *link )
+{
+	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+
+	LUA->GetField( -1, peer::tablename );
+
+	if( LUA->IsType( -1, GarrysMod::Lua::Type::TABLE ) )
+		for( size_t k = 0; k < link->PeerCount( ); ++k )
+		{
+			LUA->PushUserdata( const_cast<void *>( link->GetKey( k ) ) );
+			LUA->GetTable( -2 );
+
+			if( LUA->IsType( -1, peer::metatype ) )
+				peer::GetUserdata( state, -1 )->shared = nullptr;
+
+			LUA->Pop( 1 );
+		}
+
+	LUA->Pop( 2 );
+}
+
+// "shm://name" listens on a new segment, a bare "shm://" only makes outgoing connections.
+static int32_t Create( lua_State *state, const char *addr, size_t peer_count, int32_t options )
+{
+	size_t ring_size = ::shm::default_ring_size;
+	uint32_t timeout = ::shm::default_timeout;
+	if( options != 0 )
+	{
+		LUA->GetField( options, "ring_size" );
+		if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+			ring_size = static_cast<size_t>( LUA->CheckNumber( -1 ) );
+
+		LUA->Pop( 1 );
+
+		// milliseconds before a silent process loses its slots, 0 to keep them forever
+		LUA->GetField( options, "timeout" );
+		if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+		{
+			double value = LUA->CheckNumber( -1 );
+			if( value != 0.0 && value < 4.0 * ::shm::beat_interval )
+				LUA->ArgError( options, "timeout must be 0 or at least four beat intervals (1000 ms)" );
+
+			timeout = static_cast<uint32_t>( value );
+		}
+
+		LUA->Pop( 1 );
+	}
+
+	::shm::host *link = new ::shm::host;
+	const char *name = addr + scheme_length;
+	if( *name != '\0' ? !link->Listen( name, peer_count, ring_size ) : !link->Client( peer_count ) )
+	{
+		delete link;
+		LUA->PushNil( );
+		LUA->PushString( "failed to create shared memory host" );
+		return 2;
+	}
+
+	link->SetTimeout( timeout );
+	host::PushShared( state, link );
+	return 1;
+}
+
+}
+
+namespace host
+{
+
+static const char *metaname = "ENetHost";
+static uint8_t metatype = 230;
+static const char *tablename = "enet_hosts";
+static const char *invalid_error = "invalid ENetHost";
+static const char *shared_error = "not supported by shared memory hosts";
+
+// Shared memory hosts have no ENetHost, see the shared namespace.
+struct userdata
+{
+	ENetHost *host;
+	uint8_t type;
+	::shm::host *shared;
+};
+
+inline void Check( lua_State *state, int32_t index )
+{
+	if( !LUA->IsType( index, metatype ) )
+		luaL_typerror( state, index, metaname );
+}
+
+inline userdata *GetUserdata( lua_State *state, int32_t index )
+{
+	return static_cast<userdata *>( LUA->GetUserdata( index ) );
+}
+
+static ENetHost *GetAndValidate( lua_State *state, int32_t index )
+{
+	Check( state, index );
+	userdata *udata = GetUserdata( state, index );
+	if( udata->shared != nullptr )
+		LUA->ArgError( index, shared_error );
+
+	if( udata->host == nullptr )
+		LUA->ArgError( index, invalid_error );
+
+	return udata->host;
+}
+
+// Returns the link of a shared memory host, or nullptr for a valid ENetHost, so the
+// methods both kinds support can branch before GetAndValidate.
+static ::shm::host *GetShared( lua_State *state, int32_t index )
+{
+	Check( state, index );
+	userdata *udata = GetUserdata( state, index );
+	if( udata->host == nullptr && udata->shared == nullptr )
+		LUA->ArgError( index, invalid_error );
+
+	return udata->shared;
+}
+
+static bool Create( lua_State *state, ENetHost *host, bool onlyexisting )
+{
+	if( onlyexisting )
+	{
+		LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+
+		LUA->GetField( -1, tablename );
+
+		LUA->Remove( -2 );
+
+		LUA->PushUserdata( host );
+		LUA->GetTable( -2 );
+
+		if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+		{
+			LUA->Remove( -2 );
+			return true;
+		}
+
+		LUA->Pop( 1 );
+		return false;
+	}
+
+	CreateContext( host );
+	Push( state, host );
+	return true;
+}
+
+static context *CreateContext( ENetHost *host )
+{
+	context *ctx = new context;
+	ctx->host = host;
+	ctx->slots.resize( host->peerCount, slot( ) );
+	ctx->peer_ids = false;
+	ctx->encrypted = false;
+	ctx->secure_rejected = 0;
+	ctx->cell_size = default_cell_size;
+	ctx->positioned = 0;
+	ctx->limited = false;
+	ctx->incoming_limit = limit( );
+	ctx->forward = nullptr;
+	ctx->streamed = false;
+	ctx->stream_channel = 0;
+	ctx->stream_limit = default_stream_limit;
+	ctx->streams_refused = 0;
+	ctx->timestamps = false;
+	std::fill( ctx->latency, ctx->latency + latency_buckets, 0 );
+	ctx->orphaned = false;
+	ctx->lua_ref = -1;
+	ctx->gap_dropped = 0;
+	ctx->ffi_packet = nullptr;
+	ctx->ffi_id = 0;
+	ctx->discovering = false;
+	ctx->mtu_policy = mtu::discovery( );
+	ctx->probes_updated = 0;
+	ctx->mtu_cap = 0;
+	ctx->fragmentation.saved = false;
+	ctx->parallel_minimum = 0;
+	contexts[host] = ctx;
+
+	host->intercept = Intercept;
+	return ctx;
+}
+
+static void Push( lua_State *state, ENetHost *host )
+{
+	userdata *udata = static_cast<userdata *>( LUA->NewUserdata( sizeof( userdata ) ) );
+	udata->type = metatype;
+	udata->host = host;
+	udata->shared = nullptr;
+
+	LUA->CreateMetaTableType( metaname, metatype );
+	LUA->SetMetaTable( -2 );
+
+	LUA->CreateTable( );
+	lua_setfenv( state, -2 );
+}
+
+static void PushShared( lua_State *state, ::shm::host *link )
+{
+	userdata *udata = static_cast<userdata *>( LUA->NewUserdata( sizeof( userdata ) ) );
+	udata->type = metatype;
+	udata->host = nullptr;
+	udata->shared = link;
+
+	LUA->CreateMetaTableType( metaname, metatype );
+	LUA->SetMetaTable( -2 );
+
+	LUA->CreateTable( );
+	lua_setfenv( state, -2 );
+}
+
+static context *GetContextAndValidate( lua_State *state, int32_t index )
+{
+	return GetContext( GetAndValidate( state, index ) );
+}
+
+// Packets that came in earlier datagrams of the same service call report the later
+// arrival, so their delay is a lower bound.
+static void PushArrival( lua_State *state, context *ctx, ENetPeer *peer )
+{
+	uint64_t arrival = ctx->slots[GetSlotIndex( peer )].arrival;
+	if( arrival == 0 )
+		return;
+
+	uint64_t now = GetWallTime( );
+	uint64_t delay = now > arrival ? now - arrival : 0;
+	size_t bucket = 0;
+	while( bucket < latency_buckets - 1 && delay >= ( static_cast<uint64_t>( 1 ) << bucket ) )
+		++bucket;
+
+	++ctx->latency[bucket];
+
+	LUA->PushNumber( arrival / 1000000.0 );
+	LUA->SetField( -2, "arrival" );
+
+	LUA->PushNumber( delay / 1000.0 );
+	LUA->SetField( -2, "delay" );
+}
+
+static int32_t PushEvent( lua_State *state, context *ctx, const ENetEvent &ev )
+{
+	profile::scope profiled( "push_event" );
+	LUA->CreateTable( );
+
+	if( ev.peer != nullptr )
+	{
+		LUA->PushNumber(
+			ev.type == ENET_EVENT_TYPE_DISCONNECT ?
+				GetReleasedPeerID( ctx, ev.peer ) : GetPeerID( ctx, ev.peer )
+		);
+		LUA->SetField( -2, "id" );
+
+		if( !ctx->peer_ids )
+		{
+			peer::Create( state, ev.peer );
+			LUA->SetField( -2, "peer" );
+		}
+	}
+
+	switch( static_cast<int32_t>( ev.type ) )
+	{
+		case ENET_EVENT_TYPE_NONE:
+			LUA->PushString( "none" );
+			break;
+
+		case ENET_EVENT_TYPE_CONNECT:
+			LUA->PushNumber( ev.data );
+			LUA->SetField( -2, "data" );
+
+			LUA->PushString( "connect" );
+			break;
+
+		case ENET_EVENT_TYPE_DISCONNECT:
+			LUA->PushNumber( ev.data );
+			LUA->SetField( -2, "data" );
+
+			LUA->PushString( "disconnect" );
+			break;
+
+		case ENET_EVENT_TYPE_RECEIVE:
+			LUA->PushNumber( ev.channelID );
+			LUA->SetField( -2, "channel" );
+
+			LUA->PushString( reinterpret_cast<char *>( ev.packet->data ), ev.packet->dataLength );
+			LUA->SetField( -2, "data" );
+
+			LUA->PushNumber( ev.packet->flags );
+			LUA->SetField( -2, "flags" );
+
+			if( ctx->streamed && ev.channelID >= ctx->stream_channel )
+			{
+				LUA->PushNumber( ev.data );
+				LUA->SetField( -2, "stream" );
+			}
+
+			if( ctx->timestamps )
+				PushArrival( state, ctx, ev.peer );
+
+			LUA->PushString( "receive" );
+
+			enet_packet_destroy( ev.packet );
+			break;
+
+		case EVENT_TYPE_DRAIN:
+			LUA->PushNumber( ev.data );
+			LUA->SetField( -2, "data" );
+
+			LUA->PushString( "drain" );
+			break;
+
+		case EVENT_TYPE_RATE_EXCEEDED:
+			LUA->PushNumber( ev.channelID );
+			LUA->SetField( -2, "channel" );
+
+			LUA->PushNumber( ev.data );
+			LUA->SetField( -2, "data" );
+
+			LUA->PushString( "rate_exceeded" );
+			break;
+
+		case EVENT_TYPE_OVERLOADED:
+			LUA->PushBool( ev.data != 0 );
+			LUA->SetField( -2, "overloaded" );
+
+			LUA->PushNumber( static_cast<double>( ctx->load.Pending( ) ) );
+			LUA->SetField( -2, "pending" );
+
+			LUA->PushNumber( static_cast<double>( ctx->load.Datagrams( ) ) );
+			LUA->SetField( -2, "datagrams" );
+
+			LUA->PushNumber( ctx->load.Gap( ) );
+			LUA->SetField( -2, "gap" );
+
+			LUA->PushNumber( static_cast<double>( ctx->load.Shed( ) ) );
+			LUA->SetField( -2, "shed" );
+
+			LUA->PushNumber( static_cast<double>( ctx->load.Coalesced( ) ) );
+			LUA->SetField( -2, "coalesced" );
+
+			LUA->PushString( "overloaded" );
+			break;
+	}
+
+	LUA->SetField( -2, "type" );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( gc )
+{
+	Check( state, 1 );
+	userdata *udata = GetUserdata( state, 1 );
+
+	if( udata->shared != nullptr )
+	{
+		shared::Invalidate( state, udata->shared );
+		delete udata->shared;
+		udata->shared = nullptr;
+		return 0;
+	}
+
+	ENetHost *host = udata->host;
+	if( host != nullptr )
+	{
+		LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+
+		LUA->GetField( -1, peer::tablename );
+
+		if( LUA->IsType( -1, GarrysMod::Lua::Type::TABLE ) )
+			for( size_t k = 0; k < host->peerCount; ++k )
+			{
+				LUA->PushUserdata( &host->peers[k] );
+				LUA->GetTable( -2 );
+
+				if( LUA->IsType( -1, peer::metatype ) )
+					peer::GetUserdata( state, -1 )->peer = nullptr;
+
+				LUA->Pop( 1 );
+			}
+
+		LUA->Pop( 2 );
+		udata->host = nullptr;
+
+		auto it = contexts.find( host );
+		if( it != contexts.end( ) && !it->second->persistent.empty( ) )
+		{
+			// persistent hosts outlive their Lua objects, see enet.host_persistent
+			if( !it->second->orphaned )
+				persistent::Orphan( state, it->second );
+
+			return 0;
+		}
+
+		if( it != contexts.end( ) && it->second->forward != nullptr )
+			DetachRelay( it->second );
+
+		if( it != contexts.end( ) )
+			for( slot &s : it->second->slots )
+				ReleaseLatest( s );
+
+		enet_host_destroy( host );
+
+		if( it != contexts.end( ) )
+		{
+			for( slot &s : it->second->slots )
+				DetachBacklog( s );
+
+			if( it->second->ffi_packet != nullptr )
+				enet_packet_destroy( it->second->ffi_packet );
+
+			if( it->second->ffi_id != 0 )
+				ffi_handles.erase( it->second->ffi_id );
+
+			delete it->second;
+			contexts.erase( it );
+		}
+	}
+
+	return 0;
+}
+
+// Unlike collection, destroying a persistent host ends it along with its name, the way
+// host:persistent( false ) followed by collection would.
+LUA_FUNCTION_STATIC( destroy )
+{
+	Check( state, 1 );
+	ENetHost *host = GetUserdata( state, 1 )->host;
+	if( host != nullptr )
+	{
+		context *ctx = GetContext( host );
+		if( ctx != nullptr && !ctx->persistent.empty( ) )
+		{
+			persistent::Release( ctx );
+			LUA->ReferenceFree( ctx->lua_ref );
+			ctx->lua_ref = -1;
+		}
+	}
+
+	return gc( state );
+}
+
+LUA_FUNCTION_STATIC( tostring )
+{
+	::shm::host *link = GetShared( state, 1 );
+	if( link != nullptr )
+	{
+		lua_pushfstring( state, "%s: %p", metaname, link );
+		return 1;
+	}
+
+	lua_pushfstring( state, "%s: %p", metaname, GetAndValidate( state, 1 ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( eq )
+{
+	::shm::host *first = GetShared( state, 1 ), *second = GetShared( state, 2 );
+	if( first != nullptr || second != nullptr )
+	{
+		LUA->PushBool( first == second );
+		return 1;
+	}
+
+	LUA->PushBool( GetAndValidate( state, 1 ) == GetAndValidate( state, 2 ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( index )
+{
+	LUA->GetMetaTable( 1 );
+	LUA->Push( 2 );
+	LUA->RawGet( -2 );
+	if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+		return 1;
+
+	LUA->Pop( 2 );
+
+	lua_getfenv( state, 1 );
+	LUA->Push( 2 );
+	LUA->RawGet( -2 );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( newindex )
+{
+	lua_getfenv( state, 1 );
+	LUA->Push( 2 );
+	LUA->Push( 3 );
+	LUA->RawSet( -3 );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( valid )
+{
+	Check( state, 1 );
+	userdata *udata = GetUserdata( state, 1 );
+	LUA->PushBool( udata->host != nullptr || udata->shared != nullptr );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( service )
+{
+	enet_uint32 timeout = LUA->Top( ) > 1 ? static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) : 0;
+	::shm::host *link = GetShared( state, 1 );
+	if( link != nullptr )
+		return shared::Service( state, link, timeout );
+
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	ENetEvent ev;
+	int32_t ret = NextEvent( ctx, ev, timeout, false );
+	if( ret < 0 )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "failed to service ENetHost" );
+		return 2;
+	}
+	else if( ret == 0 )
+		return 0;
+
+	return PushEvent( state, ctx, ev );
+}
+
+LUA_FUNCTION_STATIC( check_events )
+{
+	::shm::host *link = GetShared( state, 1 );
+	if( link != nullptr )
+		return shared::Service( state, link, 0 );
+
+	context *ctx = GetContextAndValidate( state, 1 );
+	ENetEvent ev;
+	int32_t ret = NextEvent( ctx, ev, 0, true );
+	if( ret < 0 )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "failed to check events for ENetHost" );
+		return 2;
+	}
+	else if( ret == 0 )
+		return 0;
+
+	return PushEvent( state, ctx, ev );
+}
+
+LUA_FUNCTION_STATIC( compress_with_range_coder )
+{
+	return enet_host_compress_with_range_coder( GetAndValidate( state, 1 ) ) == 0;
+}
+
+LUA_FUNCTION_STATIC( connect )
+{
+	::shm::host *link = GetShared( state, 1 );
+	if( link != nullptr )
+		return shared::Connect( state, link );
+
+	ENetHost *host = GetAndValidate( state, 1 );
+	const char *addr = LUA->CheckString( 2 );
+	size_t channels = 1;
+	enet_uint32 data = 0;
+
+	switch( LUA->Top( ) )
+	{
+		default:
+			data = static_cast<enet_uint32>( LUA->CheckNumber( 4 ) );
+
+		case 3:
+			if( !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
+				channels = static_cast<size_t>( LUA->CheckNumber( 3 ) );
+
+		case 2:
+			/* do nothing */;
+	}
+
+	// shared memory peers live on hosts created with a "shm://" address
+	if( shared::IsAddress( addr ) )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "shared memory addresses need a host created with 'shm://'" );
+		return 2;
+	}
+
+	ENetAddress address;
+	if( !ParseAddress( state, addr, address ) )
+		return 2;
+
+	ENetPeer *peer = enet_host_connect( host, &address, channels, data );
+	if( peer == nullptr )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "failed to create ENetPeer" );
+		return 2;
+	}
+
+	// with peer IDs on, Lua only ever sees the ID, as with events
+	context *ctx = GetContext( host );
+	if( ctx->peer_ids )
+		LUA->PushNumber( GetPeerID( ctx, peer ) );
+	else
+		peer::Create( state, peer );
+
+	return 1;
+}
+
+// Writes to a shared memory ring are visible right away, there's nothing to flush.
+LUA_FUNCTION_STATIC( flush )
+{
+	if( GetShared( state, 1 ) != nullptr )
+		return 0;
+
+	context *ctx = GetContextAndValidate( state, 1 );
+	if( !ctx->latest_dirty.empty( ) )
+		FlushLatest( ctx );
+
+	enet_host_flush( ctx->host );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( broadcast )
+{
+	::shm::host *link = GetShared( state, 1 );
+	if( link != nullptr )
+		return shared::Broadcast( state, link );
+
+	context *ctx = GetContextAndValidate( state, 1 );
+	const char *data = nullptr;
+	size_t len = 0;
+	enet_uint8 channel = 1;
+	enet_uint32 flags = 0;
+	if( !GetSendArguments( state, 2, data, len, channel, flags ) )
+		return 2;
+
+	Broadcast( ctx, channel, data, len, flags );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( channel_limit )
+{
+	ENetHost *host = GetAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		enet_host_channel_limit( host, static_cast<size_t>( LUA->CheckNumber( 2 ) ) );
+		return 0;
+	}
+
+	LUA->PushNumber( host->channelLimit );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( bandwidth_limit )
+{
+	ENetHost *host = GetAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 2 )
+	{
+		enet_host_bandwidth_limit(
+			GetAndValidate( state, 1 ),
+			static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ),
+			static_cast<enet_uint32>( LUA->CheckNumber( 3 ) )
+		);
+		return 0;
+	}
+
+	LUA->PushNumber( host->incomingBandwidth );
+	LUA->PushNumber( host->outgoingBandwidth );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( local_address )
+{
+	const ENetAddress &address = GetAndValidate( state, 1 )->address;
+	lua_pushfstring(
+		state,
+		"%d.%d.%d.%d:%d",
+		( ( address.host ) & 0xFF ),
+		( ( address.host >> 8 ) & 0xFF ),
+		( ( address.host >> 16 ) & 0xFF ),
+		( address.host >> 24 & 0xFF ),
+		address.port
+	);
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( total_sent_data )
+{
+	ENetHost *host = GetAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		host->totalSentData = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
+		return 0;
+	}
+
+	LUA->PushNumber( host->totalSentData );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( total_sent_packets )
+{
+	ENetHost *host = GetAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		host->totalSentPackets = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
+		return 0;
+	}
+
+	LUA->PushNumber( host->totalSentPackets );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( total_received_data )
+{
+	ENetHost *host = GetAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		host->totalReceivedData = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
+		return 0;
+	}
+
+	LUA->PushNumber( host->totalReceivedData );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( total_received_packets )
+{
+	ENetHost *host = GetAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		host->totalReceivedPackets = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
+		return 0;
+	}
+
+	LUA->PushNumber( host->totalReceivedPackets );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( service_time )
+{
+	LUA->PushNumber( GetAndValidate( state, 1 )->serviceTime );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( peer_count )
+{
+	::shm::host *link = GetShared( state, 1 );
+	if( link != nullptr )
+	{
+		LUA->PushNumber( static_cast<double>( link->PeerCount( ) ) );
+		return 1;
+	}
+
+	LUA->PushNumber( GetAndValidate( state, 1 )->peerCount );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( peer )
+{
+	ENetHost *host = GetAndValidate( state, 1 );
+	size_t index = static_cast<size_t>( LUA->CheckNumber( 2 ) ) - 1;
+
+	if( index < 0 || index >= host->peerCount )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "invalid peer index" );
+		return 2;
+	}
+
+	peer::Create( state, &host->peers[index] );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( peer_ids )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		LUA->CheckType( 2, GarrysMod::Lua::Type::BOOL );
+		ctx->peer_ids = LUA->GetBool( 2 );
+		return 0;
+	}
+
+	LUA->PushBool( ctx->peer_ids );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( peer_id )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	ENetPeer *peer = peer::GetAndValidate( state, 2 );
+	if( peer->host != ctx->host )
+		LUA->ArgError( 2, "ENetPeer doesn't belong to this ENetHost" );
+
+	LUA->PushNumber( GetPeerID( ctx, peer ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( valid_id )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	LUA->PushBool(
+		GetPeerFromID( ctx, static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) ) != nullptr
+	);
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( peer_from_id )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	ENetPeer *peer = GetPeerFromID( ctx, static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) );
+	if( peer == nullptr )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "invalid peer ID" );
+		return 2;
+	}
+
+	peer::Create( state, peer );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( send_to )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	ENetPeer *peer = GetPeerFromID( ctx, static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) );
+	const char *data = nullptr;
+	size_t len = 0;
+	enet_uint8 channel = 1;
+	enet_uint32 flags = 0;
+	if( !GetSendArguments( state, 3, data, len, channel, flags ) )
+		return 2;
+
+	if( peer == nullptr )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "invalid peer ID" );
+		return 2;
+	}
+
+	if( !Send( ctx, peer, channel, data, len, flags ) )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "failed to send packet" );
+		return 2;
+	}
+
+	return PushQueued( state, ctx, peer );
+}
+
+LUA_FUNCTION_STATIC( rtt )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	ENetPeer *peer = GetPeerFromID( ctx, static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) );
+	if( peer == nullptr )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "invalid peer ID" );
+		return 2;
+	}
+
+	LUA->PushNumber( peer->roundTripTime );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( disconnect_id )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	ENetPeer *peer = GetPeerFromID( ctx, static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) );
+	enet_uint32 data = LUA->Top( ) > 2 ? static_cast<enet_uint32>( LUA->CheckNumber( 3 ) ) : 0;
+	if( peer == nullptr )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "invalid peer ID" );
+		return 2;
+	}
+
+	enet_peer_disconnect( peer, data );
+	LUA->PushBool( true );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( capture_start )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	const char *path = LUA->CheckString( 2 );
+	size_t size = 64 * 1024 * 1024;
+	if( LUA->Top( ) > 2 && !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
+		size = static_cast<size_t>( LUA->CheckNumber( 3 ) );
+
+	if( !ctx->capture.Open( path, size ) )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "failed to open capture file" );
+		return 2;
+	}
+
+	LUA->PushBool( true );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( capture_stop )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	if( !ctx->capture.IsOpen( ) )
+		return 0;
+
+	LUA->PushNumber( static_cast<double>( ctx->capture.Records( ) ) );
+	LUA->PushNumber( static_cast<double>( ctx->capture.Dropped( ) ) );
+	ctx->capture.Close( );
+	return 2;
+}
+
+LUA_FUNCTION_STATIC( checksum )
+{
+	ENetHost *host = GetAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		if( LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+		{
+			host->checksum = nullptr;
+			return 0;
+		}
+
+		const char *type = LUA->CheckString( 2 );
+		if( strcmp( type, "crc32c" ) == 0 )
+			host->checksum = ChecksumCRC32C;
+		else if( strcmp( type, "crc32" ) == 0 )
+			host->checksum = enet_crc32;
+		else if( strcmp( type, "none" ) == 0 )
+			host->checksum = nullptr;
+		else
+		{
+			LUA->PushNil( );
+			LUA->PushString( "unknown checksum type" );
+			return 2;
+		}
+
+		LUA->PushBool( true );
+		return 1;
+	}
+
+	if( host->checksum == ChecksumCRC32C )
+	{
+		LUA->PushString( "crc32c" );
+		LUA->PushString( crc32c::GetImplementation( ) );
+		return 2;
+	}
+	else if( host->checksum == enet_crc32 )
+		LUA->PushString( "crc32" );
+	else if( host->checksum == nullptr )
+		LUA->PushString( "none" );
+	else
+		LUA->PushString( "unknown" );
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( encrypt )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		if( LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+		{
+			if( ctx->encrypted && HasSessions( ctx ) )
+			{
+				LUA->PushNil( );
+				LUA->PushString( "can't turn encryption off while peers have encrypted sessions" );
+				return 2;
+			}
+
+			ctx->encrypted = false;
+			for( slot &s : ctx->slots )
+				s.secure = session( );
+
+			LUA->PushBool( true );
+			return 1;
+		}
+
+		LUA->CheckType( 2, GarrysMod::Lua::Type::STRING );
+		size_t len = 0;
+		const char *key = LUA->GetString( 2, &len );
+		if( len != aead::key_size )
+			LUA->ArgError( 2, "encryption key must be 32 bytes long" );
+
+		if( ctx->encrypted )
+		{
+			if( std::memcmp( ctx->key, key, aead::key_size ) != 0 && HasSessions( ctx ) )
+			{
+				LUA->PushNil( );
+				LUA->PushString( "can't change the key while peers have encrypted sessions" );
+				return 2;
+			}
+
+			std::memcpy( ctx->key, key, aead::key_size );
+			LUA->PushBool( true );
+			return 1;
+		}
+
+		std::memcpy( ctx->key, key, aead::key_size );
+		ctx->encrypted = true;
+
+		// peers connected before now missed the hello sent on connect
+		for( size_t k = 0; k < ctx->host->peerCount; ++k )
+		{
+			ENetPeer *peer = &ctx->host->peers[k];
+			if( peer->state != ENET_PEER_STATE_CONNECTED )
+				continue;
+
+			slot &s = AcquireSlot( ctx, peer );
+			StartSession( peer, s );
+			s.secure.resend = s.secure.started;
+		}
+
+		LUA->PushBool( true );
+		return 1;
+	}
+
+	LUA->PushBool( ctx->encrypted );
+	LUA->PushNumber( static_cast<double>( ctx->secure_rejected ) );
+	return 2;
+}
+
+LUA_FUNCTION_STATIC( grid_size )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		double cell_size = CheckFinite( state, 2 );
+		if( !( cell_size > 0.0 ) )
+			LUA->ArgError( 2, "cell size must be positive" );
+
+		ctx->cell_size = cell_size;
+		for( size_t k = 0; k < ctx->slots.size( ); ++k )
+		{
+			slot &s = ctx->slots[k];
+			if( s.positioned )
+			{
+				float position[3] = { s.position[0], s.position[1], s.position[2] };
+				RemovePosition( ctx, k );
+				SetPosition( ctx, k, position[0], position[1], position[2] );
+			}
+		}
+
+		return 0;
+	}
+
+	LUA->PushNumber( ctx->cell_size );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( grid_cell )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	LUA->PushNumber( static_cast<double>( GetCellKey(
+		GetCellCoordinate( ctx, CheckFinite( state, 2 ) ),
+		GetCellCoordinate( ctx, CheckFinite( state, 3 ) ),
+		GetCellCoordinate( ctx, CheckFinite( state, 4 ) )
+	) ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( broadcast_radius )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	double x = CheckFinite( state, 2 ), y = CheckFinite( state, 3 ), z = CheckFinite( state, 4 );
+	double radius = CheckFinite( state, 5 );
+	const char *data = nullptr;
+	size_t len = 0;
+	enet_uint8 channel = 1;
+	enet_uint32 flags = 0;
+	if( !GetSendArguments( state, 6, data, len, channel, flags ) )
+		return 2;
+
+	fanout recipients( ctx, channel, data, len, flags );
+	const double radius_sqr = radius * radius;
+	auto visit = [&]( size_t index )
+	{
+		const slot &s = ctx->slots[index];
+		double dx = s.position[0] - x, dy = s.position[1] - y, dz = s.position[2] - z;
+		if( dx * dx + dy * dy + dz * dz <= radius_sqr )
+			recipients.Send( &ctx->host->peers[index] );
+	};
+
+	int32_t min[3] = {
+		GetCellCoordinate( ctx, x - radius ),
+		GetCellCoordinate( ctx, y - radius ),
+		GetCellCoordinate( ctx, z - radius )
+	};
+	int32_t max[3] = {
+		GetCellCoordinate( ctx, x + radius ),
+		GetCellCoordinate( ctx, y + radius ),
+		GetCellCoordinate( ctx, z + radius )
+	};
+	double cells = ( static_cast<double>( max[0] ) - min[0] + 1.0 ) *
+		( static_cast<double>( max[1] ) - min[1] + 1.0 ) *
+		( static_cast<double>( max[2] ) - min[2] + 1.0 );
+
+	// when the sphere covers more cells than there are positioned peers,
+	// testing every peer is cheaper than looking up every cell
+	if( radius >= 0.0 && cells > static_cast<double>( ctx->positioned ) )
+	{
+		for( size_t k = 0; k < ctx->slots.size( ); ++k )
+			if( ctx->slots[k].positioned )
+				visit( k );
+	}
+	else if( radius >= 0.0 )
+		for( int32_t cx = min[0]; cx <= max[0]; ++cx )
+			for( int32_t cy = min[1]; cy <= max[1]; ++cy )
+				for( int32_t cz = min[2]; cz <= max[2]; ++cz )
+				{
+					auto it = ctx->cells.find( GetCellKey( cx, cy, cz ) );
+					if( it != ctx->cells.end( ) )
+						for( enet_uint16 index : it->second )
+							visit( index );
+				}
+
+	LUA->PushNumber( recipients.Count( ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( broadcast_visible )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	LUA->CheckType( 2, GarrysMod::Lua::Type::TABLE );
+	const char *data = nullptr;
+	size_t len = 0;
+	enet_uint8 channel = 1;
+	enet_uint32 flags = 0;
+	if( !GetSendArguments( state, 3, data, len, channel, flags ) )
+		return 2;
+
+	fanout recipients( ctx, channel, data, len, flags );
+	size_t count = lua_objlen( state, 2 );
+	for( size_t k = 1; k <= count; ++k )
+	{
+		lua_rawgeti( state, 2, static_cast<int>( k ) );
+		double key = LUA->IsType( -1, GarrysMod::Lua::Type::NUMBER ) ? LUA->GetNumber( -1 ) : -1.0;
+		if( key >= 0.0 && key < cell_key_limit )
+		{
+			auto it = ctx->cells.find( static_cast<uint64_t>( key ) );
+			if( it != ctx->cells.end( ) )
+				for( enet_uint16 index : it->second )
+					recipients.Send( &ctx->host->peers[index] );
+		}
+
+		LUA->Pop( 1 );
+	}
+
+	LUA->PushNumber( recipients.Count( ) );
+	return 1;
+}
+
+static double GetNumberField( lua_State *state, int32_t index, const char *name, double def )
+{
+	LUA->GetField( index, name );
+	double value = def;
+	if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+	{
+		if( !LUA->IsType( -1, GarrysMod::Lua::Type::NUMBER ) )
+		{
+			lua_pushfstring( state, "field '%s' must be a number", name );
+			LUA->ArgError( index, LUA->GetString( -1 ) );
+		}
+
+		value = LUA->GetNumber( -1 );
+	}
+
+	LUA->Pop( 1 );
+	return value;
+}
+
+// Like GetNumberField, for counts and limits that must be integers between 0 and maximum.
+static double GetCountField( lua_State *state, int32_t index, const char *name, double def, double maximum )
+{
+	double value = GetNumberField( state, index, name, def );
+	if( value < 0.0 || value > maximum || value != std::floor( value ) )
+	{
+		lua_pushfstring( state, "field '%s' must be an integer between 0 and %f", name, maximum );
+		LUA->ArgError( index, LUA->GetString( -1 ) );
+	}
+
+	return value;
+}
+
+static bool GetBoolField( lua_State *state, int32_t index, const char *name, bool def )
+{
+	LUA->GetField( index, name );
+	bool value = LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) ? def : LUA->GetBool( -1 );
+	LUA->Pop( 1 );
+	return value;
+}
+
+LUA_FUNCTION_STATIC( incoming_limit )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		if( LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+		{
+			ctx->limited = false;
+			return 0;
+		}
+
+		LUA->CheckType( 2, GarrysMod::Lua::Type::TABLE );
+		limit lim;
+		lim.packets_per_second = GetNumberField( state, 2, "packets_per_s", 0.0 );
+		lim.bytes_per_second = GetNumberField( state, 2, "bytes_per_s", 0.0 );
+		lim.burst = GetNumberField( state, 2, "burst", 1.0 );
+		lim.per_channel = GetBoolField( state, 2, "per_channel", false );
+		lim.drop = GetBoolField( state, 2, "drop", true );
+		lim.notify = GetBoolField( state, 2, "event", false );
+		if( lim.burst <= 0.0 )
+			LUA->ArgError( 2, "burst must be positive" );
+
+		ctx->incoming_limit = lim;
+		ctx->limited = lim.packets_per_second > 0.0 || lim.bytes_per_second > 0.0;
+		for( slot &s : ctx->slots )
+		{
+			s.incoming = bucket( );
+			s.channel_incoming.clear( );
+		}
+
+		return 0;
+	}
+
+	if( !ctx->limited )
+		return 0;
+
+	const limit &lim = ctx->incoming_limit;
+	LUA->CreateTable( );
+
+	LUA->PushNumber( lim.packets_per_second );
+	LUA->SetField( -2, "packets_per_s" );
+
+	LUA->PushNumber( lim.bytes_per_second );
+	LUA->SetField( -2, "bytes_per_s" );
+
+	LUA->PushNumber( lim.burst );
+	LUA->SetField( -2, "burst" );
+
+	LUA->PushBool( lim.per_channel );
+	LUA->SetField( -2, "per_channel" );
+
+	LUA->PushBool( lim.drop );
+	LUA->SetField( -2, "drop" );
+
+	LUA->PushBool( lim.notify );
+	LUA->SetField( -2, "event" );
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( connect_challenge )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		LUA->CheckType( 2, GarrysMod::Lua::Type::BOOL );
+		if( !LUA->GetBool( 2 ) )
+		{
+			ctx->guard.Disable( );
+			LUA->PushBool( true );
+			return 1;
+		}
+
+		double per_prefix = 32.0;
+		if( !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
+			per_prefix = LUA->CheckNumber( 3 );
+
+		if( per_prefix < 0.0 || per_prefix > 4294967295.0 )
+			LUA->ArgError( 3, "challenge rate must be between 0 and 2^32 - 1" );
+
+		if( !ctx->guard.Enable( static_cast<uint32_t>( per_prefix ) ) )
+		{
+			LUA->PushNil( );
+			LUA->PushString( "failed to generate challenge secret" );
+			return 2;
+		}
+
+		LUA->PushBool( true );
+		return 1;
+	}
+
+	LUA->PushBool( ctx->guard.IsEnabled( ) );
+
+	LUA->CreateTable( );
+
+	LUA->PushNumber( static_cast<double>( ctx->guard.Issued( ) ) );
+	LUA->SetField( -2, "issued" );
+
+	LUA->PushNumber( static_cast<double>( ctx->guard.Passed( ) ) );
+	LUA->SetField( -2, "passed" );
+
+	LUA->PushNumber( static_cast<double>( ctx->guard.Limited( ) ) );
+	LUA->SetField( -2, "limited" );
+
+	LUA->PushNumber( static_cast<double>( ctx->guard.Rejected( ) ) );
+	LUA->SetField( -2, "rejected" );
+
+	return 2;
+}
+
+// Accepts either an ENetPeer of this host or a peer ID.
+static ENetPeer *GetPeerArgument( lua_State *state, context *ctx, int32_t index )
+{
+	if( LUA->IsType( index, GarrysMod::Lua::Type::NUMBER ) )
+		return GetPeerFromID( ctx, static_cast<enet_uint32>( LUA->GetNumber( index ) ) );
+
+	ENetPeer *peer = peer::GetAndValidate( state, index );
+	if( peer->host != ctx->host )
+		LUA->ArgError( index, "peer doesn't belong to this host" );
+
+	return peer;
+}
+
+LUA_FUNCTION_STATIC( subscribe )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	ENetPeer *peer = GetPeerArgument( state, ctx, 2 );
+	size_t len = 0;
+	LUA->CheckType( 3, GarrysMod::Lua::Type::STRING );
+	const char *name = LUA->GetString( 3, &len );
+	if( peer == nullptr )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "invalid peer ID" );
+		return 2;
+	}
+
+	size_t index = GetSlotIndex( peer );
+	AcquireSlot( ctx, peer );
+
+	topic &t = ctx->subscribed[std::string( name, len )];
+	if( t.members.empty( ) )
+	{
+		t.members.resize( ( ctx->host->peerCount + 63 ) / 64, 0 );
+		t.count = 0;
+	}
+
+	uint64_t &word = t.members[index / 64];
+	uint64_t bit = static_cast<uint64_t>( 1 ) << ( index % 64 );
+	if( ( word & bit ) == 0 )
+	{
+		word |= bit;
+		++t.count;
+		++ctx->slots[index].subscriptions;
+	}
+
+	LUA->PushBool( true );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( unsubscribe )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	ENetPeer *peer = GetPeerArgument( state, ctx, 2 );
+	if( peer == nullptr )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "invalid peer ID" );
+		return 2;
+	}
+
+	size_t index = GetSlotIndex( peer );
+	AcquireSlot( ctx, peer );
+
+	// without a topic, the peer leaves every topic it belongs to
+	if( LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
+	{
+		UnsubscribeAll( ctx, index );
+		LUA->PushBool( true );
+		return 1;
+	}
+
+	size_t len = 0;
+	LUA->CheckType( 3, GarrysMod::Lua::Type::STRING );
+	const char *name = LUA->GetString( 3, &len );
+	auto it = ctx->subscribed.find( std::string( name, len ) );
+	LUA->PushBool( it != ctx->subscribed.end( ) && Unsubscribe( ctx, it, index ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( publish )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	size_t name_len = 0;
+	LUA->CheckType( 2, GarrysMod::Lua::Type::STRING );
+	const char *name = LUA->GetString( 2, &name_len );
+	const char *data = nullptr;
+	size_t len = 0;
+	enet_uint8 channel = 1;
+	enet_uint32 flags = 0;
+	if( !GetSendArguments( state, 3, data, len, channel, flags ) )
+		return 2;
+
+	auto it = ctx->subscribed.find( std::string( name, name_len ) );
+	if( it == ctx->subscribed.end( ) )
+	{
+		LUA->PushNumber( 0 );
+		return 1;
+	}
+
+	fanout recipients( ctx, channel, data, len, flags );
+	const std::vector<uint64_t> &members = it->second.members;
+	for( size_t k = 0; k < members.size( ); ++k )
+		for( uint64_t word = members[k]; word != 0; word &= word - 1 )
+			recipients.Send( &ctx->host->peers[k * 64 + CountTrailingZeros( word )] );
+
+	LUA->PushNumber( static_cast<double>( recipients.Count( ) ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( subscribers )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	size_t len = 0;
+	LUA->CheckType( 2, GarrysMod::Lua::Type::STRING );
+	const char *name = LUA->GetString( 2, &len );
+	auto it = ctx->subscribed.find( std::string( name, len ) );
+	LUA->PushNumber( it != ctx->subscribed.end( ) ? static_cast<double>( it->second.count ) : 0.0 );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( streams )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		if( LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+		{
+			ctx->streamed = false;
+			return 0;
+		}
+
+		double channel = LUA->CheckNumber( 2 );
+		if( channel < 0.0 || channel >= static_cast<double>( ctx->host->channelLimit ) )
+			LUA->ArgError( 2, "first stream channel must be below the host's channel limit" );
+
+		double limit = default_stream_limit;
+		if( LUA->Top( ) > 2 && !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
+		{
+			limit = LUA->CheckNumber( 3 );
+			if( limit < 1.0 )
+				LUA->ArgError( 3, "stream limit must be positive" );
+		}
+
+		ctx->stream_channel = static_cast<enet_uint8>( channel );
+		ctx->stream_limit = static_cast<size_t>( limit );
+		ctx->streamed = true;
+		return 0;
+	}
+
+	if( !ctx->streamed )
+		return 0;
+
+	LUA->PushNumber( ctx->stream_channel );
+	LUA->PushNumber( static_cast<double>( ctx->stream_limit ) );
+	LUA->PushNumber( static_cast<double>( ctx->streams_refused ) );
+	return 3;
+}
+
+LUA_FUNCTION_STATIC( socket_drops )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+#if defined __linux__
+
+	// the kernel reports drops per socket in /proc/net/udp, next to the socket's inode
+	struct stat info;
+	if( fstat( ctx->host->socket, &info ) != 0 )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "failed to stat socket" );
+		return 2;
+	}
+
+	static const char *paths[] = { "/proc/net/udp", "/proc/net/udp6" };
+	for( const char *path : paths )
+	{
+		FILE *file = std::fopen( path, "r" );
+		if( file == nullptr )
+			continue;
+
+		char line[512];
+		while( std::fgets( line, sizeof( line ), file ) != nullptr )
+		{
+			unsigned long tx_queue = 0, rx_queue = 0, inode = 0, drops = 0;
+			if( std::sscanf(
+				line,
+				" %*s %*s %*s %*x %lx:%lx %*x:%*x %*x %*u %*u %lu %*u %*s %lu",
+				&tx_queue,
+				&rx_queue,
+				&inode,
+				&drops
+			) == 4 && inode == static_cast<unsigned long>( info.st_ino ) )
+			{
+				std::fclose( file );
+				LUA->PushNumber( static_cast<double>( drops ) );
+				LUA->PushNumber( static_cast<double>( rx_queue ) );
+				return 2;
+			}
+		}
+
+		std::fclose( file );
+	}
+
+	LUA->PushNil( );
+	LUA->PushString( "socket not found in /proc/net/udp" );
+	return 2;
+
+#else
+
+	( void )ctx;
+	LUA->PushNil( );
+	LUA->PushString( "socket drop counters are only available on Linux" );
+	return 2;
+
+#endif
+}
+
+LUA_FUNCTION_STATIC( timestamps )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		bool enable = LUA->GetBool( 2 );
+		if( !EnableTimestamps( ctx->host->socket, enable ) )
+		{
+			LUA->PushNil( );
+			LUA->PushString( "kernel receive timestamps are not available" );
+			return 2;
+		}
+
+		ctx->timestamps = enable;
+		for( slot &s : ctx->slots )
+			s.arrival = 0;
+
+		LUA->PushBool( true );
+		return 1;
+	}
+
+	LUA->PushBool( ctx->timestamps );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( latency_histogram )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	LUA->CreateTable( );
+	for( size_t k = 0; k < latency_buckets; ++k )
+	{
+		LUA->PushNumber( static_cast<double>( ctx->latency[k] ) );
+		lua_rawseti( state, -2, static_cast<int>( k + 1 ) );
+	}
+
+	if( LUA->GetBool( 2 ) )
+		std::fill( ctx->latency, ctx->latency + latency_buckets, 0 );
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( broadcast_mask )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	uint32_t include = GetGroupMask( state, 2 );
+	uint32_t exclude = GetGroupMask( state, 3 );
+	ENetPeer *except = nullptr;
+	if( LUA->Top( ) > 6 && !LUA->IsType( 7, GarrysMod::Lua::Type::NIL ) )
+		except = GetPeerArgument( state, ctx, 7 );
+
+	const char *data = nullptr;
+	size_t len = 0;
+	enet_uint8 channel = 1;
+	enet_uint32 flags = 0;
+	if( !GetSendArguments( state, 4, data, len, channel, flags ) )
+		return 2;
+
+	// an include mask of 0 matches every peer
+	fanout recipients( ctx, channel, data, len, flags );
+	for( size_t k = 0; k < ctx->slots.size( ); ++k )
+	{
+		uint32_t groups = ctx->slots[k].groups;
+		if( ( include == 0 || ( groups & include ) != 0 ) && ( groups & exclude ) == 0 &&
+			&ctx->host->peers[k] != except )
+			recipients.Send( &ctx->host->peers[k] );
+	}
+
+	LUA->PushNumber( static_cast<double>( recipients.Count( ) ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( persistent )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		LUA->CheckType( 2, GarrysMod::Lua::Type::BOOL );
+		if( LUA->GetBool( 2 ) )
+			LUA->ArgError( 2, "use enet.host_persistent to create persistent hosts" );
+
+		// back to a regular host, destroyed once collected
+		if( !ctx->persistent.empty( ) )
+		{
+			persistent::Release( ctx );
+			LUA->ReferenceFree( ctx->lua_ref );
+			ctx->lua_ref = -1;
+		}
+
+		return 0;
+	}
+
+	if( ctx->persistent.empty( ) )
+		return 0;
+
+	LUA->PushString( ctx->persistent.c_str( ) );
+	LUA->PushNumber( static_cast<double>( ctx->gap_dropped ) );
+	return 2;
+}
+
+// Sets the backlog thresholds and shedding policy, or disables overload handling with nil.
+LUA_FUNCTION_STATIC( overload_policy )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		if( LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+		{
+			ctx->load.Disable( );
+			return 0;
+		}
+
+		LUA->CheckType( 2, GarrysMod::Lua::Type::TABLE );
+		overload::policy policy;
+		policy.max_pending = static_cast<size_t>( GetCountField( state, 2, "max_pending", 0.0, 4294967295.0 ) );
+		policy.max_datagrams = static_cast<size_t>( GetCountField( state, 2, "max_datagrams", 0.0, 4294967295.0 ) );
+		policy.max_gap = static_cast<enet_uint32>( GetCountField( state, 2, "max_gap", 0.0, 4294967295.0 ) );
+		policy.drain_limit = static_cast<size_t>( GetCountField( state, 2, "drain_limit", 4096.0, 4294967295.0 ) );
+		policy.shed_unreliable = GetBoolField( state, 2, "shed_unreliable", false );
+		policy.coalesce = GetBoolField( state, 2, "coalesce", true );
+		if( policy.drain_limit == 0 )
+			LUA->ArgError( 2, "drain_limit must be positive" );
+
+		ctx->load.Enable( policy );
+		return 0;
+	}
+
+	if( !ctx->load.IsEnabled( ) )
+		return 0;
+
+	const overload::policy &policy = ctx->load.Policy( );
+	LUA->CreateTable( );
+
+	LUA->PushNumber( static_cast<double>( policy.max_pending ) );
+	LUA->SetField( -2, "max_pending" );
+
+	LUA->PushNumber( static_cast<double>( policy.max_datagrams ) );
+	LUA->SetField( -2, "max_datagrams" );
+
+	LUA->PushNumber( policy.max_gap );
+	LUA->SetField( -2, "max_gap" );
+
+	LUA->PushNumber( static_cast<double>( policy.drain_limit ) );
+	LUA->SetField( -2, "drain_limit" );
+
+	LUA->PushBool( policy.shed_unreliable );
+	LUA->SetField( -2, "shed_unreliable" );
+
+	LUA->PushBool( policy.coalesce );
+	LUA->SetField( -2, "coalesce" );
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( overload_stats )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	LUA->PushBool( ctx->load.IsOverloaded( ) );
+	LUA->PushNumber( static_cast<double>( ctx->load.Shed( ) ) );
+	LUA->PushNumber( static_cast<double>( ctx->load.Coalesced( ) ) );
+	LUA->PushNumber( static_cast<double>( ctx->load.Overloads( ) ) );
+	return 4;
+}
+
+// Buffers the channel's snapshots until they're due, or delivers them as they come with nil.
+LUA_FUNCTION_STATIC( jitter_buffer )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	enet_uint8 channel = static_cast<enet_uint8>( LUA->CheckNumber( 2 ) );
+
+	if( LUA->Top( ) < 3 || LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
+	{
+		ctx->playouts.erase( channel );
+		for( slot &s : ctx->slots )
+			s.jitter_buffers.erase( channel );
+
+		RescheduleSnapshots( ctx );
+		return 0;
+	}
+
+	LUA->CheckType( 3, GarrysMod::Lua::Type::TABLE );
+	double tick_rate = GetNumberField( state, 3, "tick_rate", 0.0 );
+	if( tick_rate <= 0.0 )
+		LUA->ArgError( 3, "tick_rate must be positive" );
+
+	jitter::playout p;
+	p.tick_interval = 1000.0 / tick_rate;
+	p.min_delay = GetNumberField( state, 3, "min_delay", p.tick_interval );
+	p.max_delay = GetNumberField( state, 3, "max_delay", 250.0 );
+	p.factor = GetNumberField( state, 3, "factor", 3.0 );
+	p.capacity = static_cast<size_t>( GetNumberField( state, 3, "capacity", 64.0 ) );
+	if( p.min_delay < 0.0 || p.max_delay < p.min_delay )
+		LUA->ArgError( 3, "delays must satisfy 0 <= min_delay <= max_delay" );
+
+	if( p.capacity == 0 )
+		LUA->ArgError( 3, "capacity must be positive" );
+
+	ctx->playouts[channel] = p;
+	RescheduleSnapshots( ctx );
+	return 0;
+}
+
+// Returns the data, tick, peer and channel of the snapshot due the earliest, if any is due.
+LUA_FUNCTION_STATIC( pop_snapshot )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	jitter::schedule &due = ctx->snapshots_due;
+	double now = timing::GetMilliseconds( );
+	while( !due.IsEmpty( ) && due.Top( ).due <= now )
+	{
+		jitter::entry e = due.Top( );
+		due.Pop( );
+
+		// the slot changed hands, or the buffer or its playout is gone
+		slot &s = ctx->slots[e.index];
+		auto jit = s.jitter_buffers.find( e.channel );
+		auto pit = ctx->playouts.find( e.channel );
+		if( s.generation != e.generation || jit == s.jitter_buffers.end( ) || pit == ctx->playouts.end( ) )
+			continue;
+
+		jitter::buffer &b = jit->second;
+		if( !b.IsScheduled( e.due ) )
+			continue;
+
+		// entries may be early, those are queued again with the current due time
+		b.Unschedule( );
+		if( b.IsEmpty( ) || b.Due( pit->second ) != e.due )
+		{
+			ScheduleSnapshot( ctx, e.index, e.channel, pit->second, b );
+			continue;
+		}
+
+		std::string data;
+		uint32_t tick = b.Pop( data );
+		ScheduleSnapshot( ctx, e.index, e.channel, pit->second, b );
+
+		ENetPeer *peer = &ctx->host->peers[e.index];
+		LUA->PushString( data.data( ), data.size( ) );
+		LUA->PushNumber( tick );
+		if( ctx->peer_ids )
+			LUA->PushNumber( GetPeerID( ctx, peer ) );
+		else
+			peer::Create( state, peer );
+
+		LUA->PushNumber( e.channel );
+		return 4;
+	}
+
+	return 0;
+}
+
+// Probes the path MTU of every connected peer, or stops probing with nil, which also puts
+// the socket's fragmentation setting back, see discovery.
+LUA_FUNCTION_STATIC( mtu_discovery )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		if( LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+		{
+			ctx->discovering = false;
+			ctx->mtu_cap = 0;
+			for( slot &s : ctx->slots )
+				s.probes.Stop( false );
+
+			mtu::RestoreFragmentation( ctx->host->socket, ctx->fragmentation );
+			return 0;
+		}
+
+		LUA->CheckType( 2, GarrysMod::Lua::Type::TABLE );
+		mtu::discovery policy;
+		policy.minimum = static_cast<uint32_t>( GetNumberField( state, 2, "minimum", ENET_PROTOCOL_MINIMUM_MTU ) );
+		policy.maximum = static_cast<uint32_t>( GetNumberField( state, 2, "maximum", 1472.0 ) );
+		policy.interval = static_cast<enet_uint32>( GetNumberField( state, 2, "interval", 0.0 ) );
+		policy.timeout = static_cast<enet_uint32>( GetNumberField( state, 2, "timeout", 250.0 ) );
+		policy.attempts = static_cast<uint32_t>( GetNumberField( state, 2, "attempts", 3.0 ) );
+		uint32_t cap = static_cast<uint32_t>( GetNumberField( state, 2, "cap", 0.0 ) );
+		if( policy.minimum < ENET_PROTOCOL_MINIMUM_MTU || policy.maximum > ENET_PROTOCOL_MAXIMUM_MTU ||
+			policy.minimum > policy.maximum )
+			LUA->ArgError( 2, "sizes must satisfy ENet's minimum MTU <= minimum <= maximum <= ENet's maximum MTU" );
+
+		if( policy.attempts == 0 )
+			LUA->ArgError( 2, "attempts must be positive" );
+
+		if( !mtu::ForbidFragmentation( ctx->host->socket, ctx->fragmentation ) )
+		{
+			LUA->PushNil( );
+			LUA->PushString( "failed to forbid IP fragmentation on the socket" );
+			return 2;
+		}
+
+		ctx->mtu_policy = policy;
+		ctx->mtu_cap = cap;
+		ctx->discovering = true;
+		for( slot &s : ctx->slots )
+			s.probes.Stop( true );
+
+		LUA->PushBool( true );
+		return 1;
+	}
+
+	if( !ctx->discovering )
+		return 0;
+
+	const mtu::discovery &policy = ctx->mtu_policy;
+	LUA->CreateTable( );
+
+	LUA->PushNumber( policy.minimum );
+	LUA->SetField( -2, "minimum" );
+
+	LUA->PushNumber( policy.maximum );
+	LUA->SetField( -2, "maximum" );
+
+	LUA->PushNumber( policy.interval );
+	LUA->SetField( -2, "interval" );
+
+	LUA->PushNumber( policy.timeout );
+	LUA->SetField( -2, "timeout" );
+
+	LUA->PushNumber( policy.attempts );
+	LUA->SetField( -2, "attempts" );
+
+	LUA->PushNumber( ctx->mtu_cap );
+	LUA->SetField( -2, "cap" );
+
+	return 1;
+}
+
+// Seals encrypted fanouts reaching at least min_peers peers on a worker pool, 0 turns it off.
+// Only the sealing is spread: ENet assembles, compresses and checksums datagrams one peer
+// at a time in enet_host_flush and enet_host_service, in buffers shared by the whole host.
+LUA_FUNCTION_STATIC( parallel_sealing )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+
+	if( LUA->Top( ) > 1 )
+	{
+		double minimum = LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) ? 0.0 : LUA->CheckNumber( 2 );
+		if( minimum < 0.0 )
+			LUA->ArgError( 2, "minimum peer count can't be negative" );
+
+		if( minimum != 0.0 && sealers == nullptr )
+		{
+			unsigned int cores = std::thread::hardware_concurrency( );
+			sealers = new pool::workers( cores > 1 ? cores - 1 : 1 );
+		}
+
+		ctx->parallel_minimum = static_cast<size_t>( minimum );
+		return 0;
+	}
+
+	LUA->PushNumber( static_cast<double>( ctx->parallel_minimum ) );
+	LUA->PushNumber( sealers != nullptr ? static_cast<double>( sealers->Size( ) ) : 0.0 );
+	return 2;
+}
+
+// The handle is a number that stops working when the host is destroyed or left to the
+// background thread by a closing Lua state, the FFI functions then return
+// ENET_FFI_INVALID_HOST, see enet.ffi_cdef. An adopted host gets a new handle.
+LUA_FUNCTION_STATIC( ffi_handle )
+{
+	context *ctx = GetContextAndValidate( state, 1 );
+	if( ctx->ffi_id == 0 )
+	{
+		ctx->ffi_id = ffi_next_id++;
+		ffi_handles[ctx->ffi_id] = ctx;
+	}
+
+	LUA->PushNumber( ctx->ffi_id );
+	return 1;
+}
+
+static void Initialize( lua_State *state )
+{
+	LUA->CreateMetaTableType( metaname, metatype );
+
+	LUA->PushCFunction( gc );
+	LUA->SetField( -2, "__gc" );
+
+	LUA->PushCFunction( tostring );
+	LUA->SetField( -2, "__tostring" );
+
+	LUA->PushCFunction( eq );
+	LUA->SetField( -2, "__eq" );
+
+	LUA->PushCFunction( index );
+	LUA->SetField( -2, "__index" );
+
+	LUA->PushCFunction( newindex );
+	LUA->SetField( -2, "__newindex" );
+
+	LUA->PushCFunction( valid );
+	LUA->SetField( -2, "valid" );
+
+	LUA->PushCFunction( service );
+	LUA->SetField( -2, "service" );
+
+	LUA->PushCFunction( check_events );
+	LUA->SetField( -2, "check_events" );
+
+	LUA->PushCFunction( compress_with_range_coder );
+	LUA->SetField( -2, "compress_with_range_coder" );
+
+	LUA->PushCFunction( checksum );
+	LUA->SetField( -2, "checksum" );
+
+	LUA->PushCFunction( encrypt );
+	LUA->SetField( -2, "encrypt" );
+
+	LUA->PushCFunction( grid_size );
+	LUA->SetField( -2, "grid_size" );
+
+	LUA->PushCFunction( grid_cell );
+	LUA->SetField( -2, "grid_cell" );
+
+	LUA->PushCFunction( broadcast_radius );
+	LUA->SetField( -2, "broadcast_radius" );
+
+	LUA->PushCFunction( broadcast_visible );
+	LUA->SetField( -2, "broadcast_visible" );
+
+	LUA->PushCFunction( incoming_limit );
+	LUA->SetField( -2, "incoming_limit" );
+
+	LUA->PushCFunction( connect_challenge );
+	LUA->SetField( -2, "connect_challenge" );
+
+	LUA->PushCFunction( subscribe );
+	LUA->SetField( -2, "subscribe" );
+
+	LUA->PushCFunction( unsubscribe );
+	LUA->SetField( -2, "unsubscribe" );
+
+	LUA->PushCFunction( publish );
+	LUA->SetField( -2, "publish" );
+
+	LUA->PushCFunction( subscribers );
+	LUA->SetField( -2, "subscribers" );
+
+	LUA->PushCFunction( streams );
+	LUA->SetField( -2, "streams" );
+
+	LUA->PushCFunction( socket_drops );
+	LUA->SetField( -2, "socket_drops" );
+
+	LUA->PushCFunction( timestamps );
+	LUA->SetField( -2, "timestamps" );
+
+	LUA->PushCFunction( latency_histogram );
+	LUA->SetField( -2, "latency_histogram" );
+
+	LUA->PushCFunction( broadcast_mask );
+	LUA->SetField( -2, "broadcast_mask" );
+
+	LUA->PushCFunction( persistent );
+	LUA->SetField( -2, "persistent" );
+
+	LUA->PushCFunction( ffi_handle );
+	LUA->SetField( -2, "ffi_handle" );
+
+	LUA->PushCFunction( overload_policy );
+	LUA->SetField( -2, "overload_policy" );
+
+	LUA->PushCFunction( overload_stats );
+	LUA->SetField( -2, "overload_stats" );
+
+	LUA->PushCFunction( jitter_buffer );
+	LUA->SetField( -2, "jitter_buffer" );
+
+	LUA->PushCFunction( pop_snapshot );
+	LUA->SetField( -2, "pop_snapshot" );
+
+	LUA->PushCFunction( mtu_discovery );
+	LUA->SetField( -2, "mtu_discovery" );
+
+	LUA->PushCFunction( parallel_sealing );
+	LUA->SetField( -2, "parallel_sealing" );
+
+	LUA->PushCFunction( connect );
+	LUA->SetField( -2, "connect" );
+
+	LUA->PushCFunction( flush );
+	LUA->SetField( -2, "flush" );
+
+	LUA->PushCFunction( broadcast );
+	LUA->SetField( -2, "broadcast" );
+
+	LUA->PushCFunction( channel_limit );
+	LUA->SetField( -2, "channel_limit" );
+
+	LUA->PushCFunction( bandwidth_limit );
+	LUA->SetField( -2, "bandwidth_limit" );
+
+	LUA->PushCFunction( local_address );
+	LUA->SetField( -2, "local_address" );
+
+	LUA->PushCFunction( destroy );
+	LUA->SetField( -2, "destroy" );
+
+	LUA->PushCFunction( total_sent_data );
+	LUA->SetField( -2, "total_sent_data" );
+
+	LUA->PushCFunction( total_sent_packets );
+	LUA->SetField( -2, "total_sent_packets" );
+
+	LUA->PushCFunction( total_received_data );
+	LUA->SetField( -2, "total_received_data" );
+
+	LUA->PushCFunction( total_received_packets );
+	LUA->SetField( -2, "total_received_packets" );
+
+	LUA->PushCFunction( service_time );
+	LUA->SetField( -2, "service_time" );
+
+	LUA->PushCFunction( peer_count );
+	LUA->SetField( -2, "peer_count" );
+
+	LUA->PushCFunction( peer );
+	LUA->SetField( -2, "peer" );
+
+	LUA->PushCFunction( peer_ids );
+	LUA->SetField( -2, "peer_ids" );
+
+	LUA->PushCFunction( peer_id );
+	LUA->SetField( -2, "peer_id" );
+
+	LUA->PushCFunction( valid_id );
+	LUA->SetField( -2, "valid_id" );
+
+	LUA->PushCFunction( peer_from_id );
+	LUA->SetField( -2, "peer_from_id" );
+
+	LUA->PushCFunction( send_to );
+	LUA->SetField( -2, "send_to" );
+
+	LUA->PushCFunction( rtt );
+	LUA->SetField( -2, "rtt" );
+
+	LUA->PushCFunction( disconnect_id );
+	LUA->SetField( -2, "disconnect_id" );
+
+	LUA->PushCFunction( capture_start );
+	LUA->SetField( -2, "capture_start" );
+
+	LUA->PushCFunction( capture_stop );
+	LUA->SetField( -2, "capture_stop" );
+
+	LUA->Pop( 1 );
+
+	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+
+	LUA->CreateTable( );
+
+	LUA->CreateTable( );
+
+	LUA->PushString( "v" );
+	LUA->SetField( -2, "__mode" );
 
-	LUA->PushNumber( timeout_limit );
-	LUA->PushNumber( timeout_minimum );
-	LUA->PushNumber( timeout_maximum );
-	return 3;
-}
+	LUA->SetMetaTable( -2 );
 
-LUA_FUNCTION_STATIC( peer_index )
-{
-	Check( state, 1 );
-	LUA->PushNumber( GetUserdata( state, 1 )->index );
-	return 1;
+	LUA->SetField( -2, tablename );
+
+	LUA->Pop( 1 );
 }
 
-LUA_FUNCTION_STATIC( peer_state )
+static void Deinitialize( lua_State *state )
 {
-	switch( GetAndValidate( state, 1 )->state )
-	{
-		case ENET_PEER_STATE_DISCONNECTED:
-			LUA->PushString( "disconnected" );
-			break;
-
-		case ENET_PEER_STATE_CONNECTING:
-			LUA->PushString( "connecting" );
-			break;
-
-		case ENET_PEER_STATE_ACKNOWLEDGING_CONNECT:
-			LUA->PushString( "acknowledging_connect" );
-			break;
+	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
 
-		case ENET_PEER_STATE_CONNECTION_PENDING:
-			LUA->PushString( "connection_pending" );
-			break;
+	LUA->PushNil( );
+	LUA->SetField( -2, metaname );
 
-		case ENET_PEER_STATE_CONNECTION_SUCCEEDED:
-			LUA->PushString( "connection_succeeded" );
-			break;
+	LUA->PushNil( );
+	LUA->SetField( -2, tablename );
 
-		case ENET_PEER_STATE_CONNECTED:
-			LUA->PushString( "connected" );
-			break;
+	LUA->Pop( 1 );
+}
 
-		case ENET_PEER_STATE_DISCONNECT_LATER:
-			LUA->PushString( "disconnect_later" );
-			break;
+}
 
-		case ENET_PEER_STATE_DISCONNECTING:
-			LUA->PushString( "disconnecting" );
-			break;
+namespace replay
+{
 
-		case ENET_PEER_STATE_ACKNOWLEDGING_DISCONNECT:
-			LUA->PushString( "acknowledging_disconnect" );
-			break;
+static const char *metaname = "ENetReplay";
+static uint8_t metatype = 232;
+static const char *invalid_error = "invalid ENetReplay";
 
-		case ENET_PEER_STATE_ZOMBIE:
-			LUA->PushString( "zombie" );
-			break;
+struct userdata
+{
+	capture::player *play;
+	uint8_t type;
+};
 
-		default:
-			LUA->PushString( "unknown" );
-	}
-	return 1;
+inline void Check( lua_State *state, int32_t index )
+{
+	if( !LUA->IsType( index, metatype ) )
+		luaL_typerror( state, index, metaname );
 }
 
-LUA_FUNCTION_STATIC( connect_id )
+inline userdata *GetUserdata( lua_State *state, int32_t index )
 {
-	LUA->PushNumber( GetAndValidate( state, 1 )->connectID );
-	return 1;
+	return static_cast<userdata *>( LUA->GetUserdata( index ) );
 }
 
-LUA_FUNCTION_STATIC( round_trip_time )
+static capture::player *GetAndValidate( lua_State *state, int32_t index )
 {
-	ENetPeer *peer = GetAndValidate( state, 1 );
+	Check( state, index );
+	capture::player *play = GetUserdata( state, index )->play;
+	if( play == nullptr )
+		LUA->ArgError( index, invalid_error );
 
-	if( LUA->Top( ) > 1 )
+	return play;
+}
+
+LUA_FUNCTION_STATIC( gc )
+{
+	Check( state, 1 );
+	userdata *udata = GetUserdata( state, 1 );
+	if( udata->play != nullptr )
 	{
-		peer->roundTripTime = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
-		return 0;
+		delete udata->play;
+		udata->play = nullptr;
 	}
 
-	LUA->PushNumber( peer->roundTripTime );
-	return 1;
+	return 0;
 }
 
-LUA_FUNCTION_STATIC( last_round_trip_time )
+LUA_FUNCTION_STATIC( tostring )
 {
-	ENetPeer *peer = GetAndValidate( state, 1 );
+	lua_pushfstring( state, "%s: %p", metaname, GetAndValidate( state, 1 ) );
+	return 1;
+}
 
-	if( LUA->Top( ) > 1 )
-	{
-		peer->lastRoundTripTime = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
-		return 0;
-	}
+LUA_FUNCTION_STATIC( valid )
+{
+	Check( state, 1 );
+	LUA->PushBool( GetUserdata( state, 1 )->play != nullptr );
+	return 1;
+}
 
-	LUA->PushNumber( peer->lastRoundTripTime );
+LUA_FUNCTION_STATIC( pump )
+{
+	capture::player *play = GetAndValidate( state, 1 );
+	size_t limit = LUA->Top( ) > 1 ? static_cast<size_t>( LUA->CheckNumber( 2 ) ) : 0;
+	LUA->PushNumber( static_cast<double>( play->Pump( limit ) ) );
 	return 1;
 }
 
-LUA_FUNCTION_STATIC( host )
+LUA_FUNCTION_STATIC( finished )
 {
-	host::Create( state, GetAndValidate( state, 1 )->host, true );
+	LUA->PushBool( GetAndValidate( state, 1 )->Finished( ) );
 	return 1;
 }
 
-LUA_FUNCTION_STATIC( local_address )
+LUA_FUNCTION_STATIC( remaining )
 {
-	const ENetAddress &address = GetAndValidate( state, 1 )->host->address;
-	lua_pushfstring(
-		state,
-		"%d.%d.%d.%d:%d",
-		( ( address.host ) & 0xFF ),
-		( ( address.host >> 8 ) & 0xFF ),
-		( ( address.host >> 16 ) & 0xFF ),
-		( address.host >> 24 & 0xFF ),
-		address.port
-	);
+	LUA->PushNumber( static_cast<double>( GetAndValidate( state, 1 )->Remaining( ) ) );
 	return 1;
 }
 
-LUA_FUNCTION_STATIC( remote_address )
+LUA_FUNCTION_STATIC( sent )
 {
-	const ENetAddress &address = GetAndValidate( state, 1 )->address;
-	lua_pushfstring(
-		state,
-		"%d.%d.%d.%d:%d",
-		( ( address.host ) & 0xFF ),
-		( ( address.host >> 8 ) & 0xFF ),
-		( ( address.host >> 16 ) & 0xFF ),
-		( address.host >> 24 & 0xFF ),
-		address.port
-	);
+	LUA->PushNumber( static_cast<double>( GetAndValidate( state, 1 )->Sent( ) ) );
 	return 1;
 }
 
+static void Create( lua_State *state, capture::player *play )
+{
+	userdata *udata = static_cast<userdata *>( LUA->NewUserdata( sizeof( userdata ) ) );
+	udata->type = metatype;
+	udata->play = play;
+
+	LUA->CreateMetaTableType( metaname, metatype );
+	LUA->SetMetaTable( -2 );
+}
+
 static void Initialize( lua_State *state )
 {
 	LUA->CreateMetaTableType( metaname, metatype );
 
+	LUA->PushCFunction( gc );
+	LUA->SetField( -2, "__gc" );
+
 	LUA->PushCFunction( tostring );
 	LUA->SetField( -2, "__tostring" );
 
-	LUA->PushCFunction( eq );
-	LUA->SetField( -2, "__eq" );
-
-	LUA->PushCFunction( index );
+	LUA->Push( -1 );
 	LUA->SetField( -2, "__index" );
 
-	LUA->PushCFunction( newindex );
-	LUA->SetField( -2, "__newindex" );
-
 	LUA->PushCFunction( valid );
 	LUA->SetField( -2, "valid" );
 
-	LUA->PushCFunction( disconnect );
-	LUA->SetField( -2, "disconnect" );
+	LUA->PushCFunction( pump );
+	LUA->SetField( -2, "pump" );
 
-	LUA->PushCFunction( disconnect_now );
-	LUA->SetField( -2, "disconnect_now" );
+	LUA->PushCFunction( finished );
+	LUA->SetField( -2, "finished" );
 
-	LUA->PushCFunction( disconnect_later );
-	LUA->SetField( -2, "disconnect_later" );
+	LUA->PushCFunction( remaining );
+	LUA->SetField( -2, "remaining" );
 
-	LUA->PushCFunction( reset );
-	LUA->SetField( -2, "reset" );
+	LUA->PushCFunction( sent );
+	LUA->SetField( -2, "sent" );
 
-	LUA->PushCFunction( ping );
-	LUA->SetField( -2, "ping" );
+	LUA->PushCFunction( gc );
+	LUA->SetField( -2, "destroy" );
 
-	LUA->PushCFunction( receive );
-	LUA->SetField( -2, "receive" );
+	LUA->Pop( 1 );
+}
 
-	LUA->PushCFunction( send );
-	LUA->SetField( -2, "send" );
+static void Deinitialize( lua_State *state )
+{
+	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
 
-	LUA->PushCFunction( throttle_configure );
-	LUA->SetField( -2, "throttle_configure" );
+	LUA->PushNil( );
+	LUA->SetField( -2, metaname );
 
-	LUA->PushCFunction( ping_interval );
-	LUA->SetField( -2, "ping_interval" );
+	LUA->Pop( 1 );
+}
 
-	LUA->PushCFunction( timeout );
-	LUA->SetField( -2, "timeout" );
+}
 
-	LUA->PushCFunction( peer_index );
-	LUA->SetField( -2, "index" );
+namespace relay
+{
 
-	LUA->PushCFunction( peer_state );
-	LUA->SetField( -2, "state" );
+static const char *metaname = "ENetRelay";
+static uint8_t metatype = 233;
+static const char *invalid_error = "invalid ENetRelay";
 
-	LUA->PushCFunction( connect_id );
-	LUA->SetField( -2, "connect_id" );
+struct userdata
+{
+	bridge *link;
+	uint8_t type;
+};
 
-	LUA->PushCFunction( round_trip_time );
-	LUA->SetField( -2, "round_trip_time" );
+inline void Check( lua_State *state, int32_t index )
+{
+	if( !LUA->IsType( index, metatype ) )
+		luaL_typerror( state, index, metaname );
+}
+
+inline userdata *GetUserdata( lua_State *state, int32_t index )
+{
+	return static_cast<userdata *>( LUA->GetUserdata( index ) );
+}
+
+static bridge *GetAndValidate( lua_State *state, int32_t index )
+{
+	Check( state, index );
+	bridge *r = GetUserdata( state, index )->link;
+	if( r == nullptr )
+		LUA->ArgError( index, invalid_error );
+
+	return r;
+}
+
+static void Destroy( lua_State *state, bridge *r )
+{
+	if( r->front != nullptr )
+		DetachRelay( r->front );
+
+	if( r->back != nullptr )
+		DetachRelay( r->back );
+
+	LUA->ReferenceFree( r->front_ref );
+	LUA->ReferenceFree( r->back_ref );
+	delete r;
+}
+
+LUA_FUNCTION_STATIC( gc )
+{
+	Check( state, 1 );
+	userdata *udata = GetUserdata( state, 1 );
+	if( udata->link != nullptr )
+	{
+		Destroy( state, udata->link );
+		udata->link = nullptr;
+	}
+
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( tostring )
+{
+	lua_pushfstring( state, "%s: %p", metaname, GetAndValidate( state, 1 ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( valid )
+{
+	Check( state, 1 );
+	LUA->PushBool( GetUserdata( state, 1 )->link != nullptr );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( stats )
+{
+	bridge *r = GetAndValidate( state, 1 );
+
+	size_t pairs = 0;
+	if( r->front != nullptr )
+		for( size_t k = 0; k < r->front_links.size( ); ++k )
+			if( GetPaired( r, r->front, &r->front->host->peers[k] ) != nullptr )
+				++pairs;
+
+	LUA->PushNumber( static_cast<double>( r->forwarded ) );
+	LUA->PushNumber( static_cast<double>( r->dropped ) );
+	LUA->PushNumber( static_cast<double>( pairs ) );
+	return 3;
+}
+
+LUA_FUNCTION_STATIC( paired )
+{
+	bridge *r = GetAndValidate( state, 1 );
+	ENetPeer *peer = peer::GetAndValidate( state, 2 );
+	context *ctx = GetContext( peer->host );
+	if( ctx != r->front && ctx != r->back )
+		LUA->ArgError( 2, "peer doesn't belong to either of the relay's hosts" );
+
+	ENetPeer *other = GetPaired( r, ctx, peer );
+	if( other == nullptr )
+		return 0;
 
-	LUA->PushCFunction( last_round_trip_time );
-	LUA->SetField( -2, "last_round_trip_time" );
+	peer::Create( state, other );
+	return 1;
+}
 
-	LUA->PushCFunction( host );
-	LUA->SetField( -2, "host" );
+static void Create( lua_State *state, bridge *r )
+{
+	userdata *udata = static_cast<userdata *>( LUA->NewUserdata( sizeof( userdata ) ) );
+	udata->type = metatype;
+	udata->link = r;
 
-	LUA->PushCFunction( local_address );
-	LUA->SetField( -2, "local_address" );
+	LUA->CreateMetaTableType( metaname, metatype );
+	LUA->SetMetaTable( -2 );
+}
 
-	LUA->PushCFunction( remote_address );
-	LUA->SetField( -2, "remote_address" );
+static void Initialize( lua_State *state )
+{
+	LUA->CreateMetaTableType( metaname, metatype );
 
-	LUA->Pop( 1 );
+	LUA->PushCFunction( gc );
+	LUA->SetField( -2, "__gc" );
 
-	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+	LUA->PushCFunction( tostring );
+	LUA->SetField( -2, "__tostring" );
 
-	LUA->CreateTable( );
+	LUA->Push( -1 );
+	LUA->SetField( -2, "__index" );
 
-	LUA->CreateTable( );
+	LUA->PushCFunction( valid );
+	LUA->SetField( -2, "valid" );
 
-	LUA->PushString( "v" );
-	LUA->SetField( -2, "__mode" );
+	LUA->PushCFunction( stats );
+	LUA->SetField( -2, "stats" );
 
-	LUA->SetMetaTable( -2 );
+	LUA->PushCFunction( paired );
+	LUA->SetField( -2, "paired" );
 
-	LUA->SetField( -2, tablename );
+	LUA->PushCFunction( gc );
+	LUA->SetField( -2, "destroy" );
 
 	LUA->Pop( 1 );
 }
@@ -633,25 +5476,50 @@ static void Deinitialize( lua_State *state )
 	LUA->PushNil( );
 	LUA->SetField( -2, metaname );
 
-	LUA->PushNil( );
-	LUA->SetField( -2, tablename );
-
 	LUA->Pop( 1 );
 }
 
 }
 
-namespace host
+namespace schema
 {
 
-static const char *metaname = "ENetHost";
-static uint8_t metatype = 230;
-static const char *tablename = "enet_hosts";
-static const char *invalid_error = "invalid ENetHost";
+static const char *metaname = "ENetSchema";
+static uint8_t metatype = 234;
+static const char *invalid_error = "invalid ENetSchema";
+
+// World coordinates in Source engine maps are within this range by default.
+static const double default_range = 16384.0;
+
+enum kind
+{
+	KIND_BITS,
+	KIND_INT,
+	KIND_BOOL,
+	KIND_FLOAT,
+	KIND_ANGLE,
+	KIND_VECTOR,
+	KIND_QUANTIZED_VECTOR,
+	KIND_STRING
+};
+
+struct field
+{
+	std::string name;
+	kind type;
+	size_t bits;
+	double range;
+};
+
+// Fields are encoded back to back in declaration order, with no tags or padding.
+struct compiled
+{
+	std::vector<field> fields;
+};
 
 struct userdata
 {
-	ENetHost *host;
+	compiled *layout;
 	uint8_t type;
 };
 
@@ -666,132 +5534,346 @@ inline userdata *GetUserdata( lua_State *state, int32_t index )
 	return static_cast<userdata *>( LUA->GetUserdata( index ) );
 }
 
-static ENetHost *GetAndValidate( lua_State *state, int32_t index )
+static const compiled *GetAndValidate( lua_State *state, int32_t index )
 {
 	Check( state, index );
-	ENetHost *host = GetUserdata( state, index )->host;
-	if( host == nullptr )
+	const compiled *layout = GetUserdata( state, index )->layout;
+	if( layout == nullptr )
 		LUA->ArgError( index, invalid_error );
 
-	return host;
+	return layout;
 }
 
-static bool Create( lua_State *state, ENetHost *host, bool onlyexisting )
+// Parses "bits:N", "int:N", "vec3_q16[:range]" and the parameterless types.
+static bool ParseType( const std::string &spec, field &f )
 {
-	if( onlyexisting )
+	std::string name = spec, parameter;
+	size_t colon = spec.find( ':' );
+	if( colon != std::string::npos )
 	{
-		LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
-
-		LUA->GetField( -1, tablename );
+		name = spec.substr( 0, colon );
+		parameter = spec.substr( colon + 1 );
+	}
 
-		LUA->Remove( -2 );
+	double value = 0.0;
+	if( !parameter.empty( ) )
+	{
+		char *end = nullptr;
+		value = std::strtod( parameter.c_str( ), &end );
+		if( end == parameter.c_str( ) || *end != '\0' )
+			return false;
+	}
 
-		LUA->PushUserdata( host );
-		LUA->GetTable( -2 );
+	f.bits = 0;
+	f.range = 0.0;
+	if( name == "bits" || name == "int" )
+	{
+		f.type = name == "bits" ? KIND_BITS : KIND_INT;
+		if( value != std::floor( value ) || value < ( f.type == KIND_INT ? 2.0 : 1.0 ) || value > 32.0 )
+			return false;
 
-		if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
-		{
-			LUA->Remove( -2 );
-			return true;
-		}
+		f.bits = static_cast<size_t>( value );
+		return true;
+	}
+	else if( name == "vec3_q16" )
+	{
+		f.type = KIND_QUANTIZED_VECTOR;
+		f.bits = 16;
+		f.range = parameter.empty( ) ? default_range : value;
+		return std::isfinite( f.range ) && f.range > 0.0;
+	}
 
-		LUA->Pop( 1 );
+	if( !parameter.empty( ) )
 		return false;
+
+	if( name == "bool" )
+		f.type = KIND_BOOL;
+	else if( name == "float" )
+		f.type = KIND_FLOAT;
+	else if( name == "angle8" || name == "angle16" )
+	{
+		f.type = KIND_ANGLE;
+		f.bits = name == "angle8" ? 8 : 16;
 	}
+	else if( name == "vec3" )
+		f.type = KIND_VECTOR;
+	else if( name == "string" )
+		f.type = KIND_STRING;
+	else
+		return false;
 
-	userdata *udata = static_cast<userdata *>( LUA->NewUserdata( sizeof( userdata ) ) );
-	udata->type = metatype;
-	udata->host = host;
+	return true;
+}
 
-	LUA->CreateMetaTableType( metaname, metatype );
-	LUA->SetMetaTable( -2 );
+inline uint32_t Quantize( double value, double min, double max, size_t bits )
+{
+	double steps = static_cast<double>( ( static_cast<uint64_t>( 1 ) << bits ) - 1 );
+	double scaled = std::floor( ( value - min ) / ( max - min ) * steps + 0.5 );
+	return static_cast<uint32_t>( std::max( 0.0, std::min( steps, scaled ) ) );
+}
 
-	LUA->CreateTable( );
-	lua_setfenv( state, -2 );
+inline double Dequantize( uint32_t value, double min, double max, size_t bits )
+{
+	double steps = static_cast<double>( ( static_cast<uint64_t>( 1 ) << bits ) - 1 );
+	return min + value / steps * ( max - min );
+}
 
-	return true;
+inline uint32_t FloatToBits( float value )
+{
+	uint32_t bits = 0;
+	std::memcpy( &bits, &value, sizeof( bits ) );
+	return bits;
 }
 
-static int32_t PushEvent( lua_State *state, const ENetEvent &ev )
+inline float BitsToFloat( uint32_t bits )
 {
-	LUA->CreateTable( );
+	float value = 0.0f;
+	std::memcpy( &value, &bits, sizeof( value ) );
+	return value;
+}
 
-	if( ev.peer != nullptr )
+static double GetNumber( lua_State *state, const field &f )
+{
+	if( !LUA->IsType( -1, GarrysMod::Lua::Type::NUMBER ) )
 	{
-		peer::Create( state, ev.peer );
-		LUA->SetField( -2, "peer" );
+		lua_pushfstring( state, "field '%s' must be a number", f.name.c_str( ) );
+		LUA->ThrowError( LUA->GetString( -1 ) );
 	}
 
-	switch( ev.type )
+	// only floats carry infinities and NaN, every other kind ends up as an integer
+	double value = LUA->GetNumber( -1 );
+	if( !std::isfinite( value ) && f.type != KIND_FLOAT && f.type != KIND_VECTOR )
 	{
-		case ENET_EVENT_TYPE_NONE:
-			LUA->PushString( "none" );
+		lua_pushfstring( state, "field '%s' must be a finite number", f.name.c_str( ) );
+		LUA->ThrowError( LUA->GetString( -1 ) );
+	}
+
+	return value;
+}
+
+static void EncodeNumber( lua_State *state, const field &f, bitstream::writer &output )
+{
+	double value = GetNumber( state, f );
+	switch( f.type )
+	{
+		case KIND_BITS:
+		{
+			double max = static_cast<double>( ( static_cast<uint64_t>( 1 ) << f.bits ) - 1 );
+			output.Write( static_cast<uint32_t>( std::max( 0.0, std::min( max, value ) ) ), f.bits );
 			break;
+		}
 
-		case ENET_EVENT_TYPE_CONNECT:
-			LUA->PushNumber( ev.data );
-			LUA->SetField( -2, "data" );
+		case KIND_INT:
+		{
+			double limit = static_cast<double>( static_cast<uint64_t>( 1 ) << ( f.bits - 1 ) );
+			int64_t clamped = static_cast<int64_t>( std::max( -limit, std::min( limit - 1.0, value ) ) );
+			output.Write( static_cast<uint32_t>( clamped ), f.bits );
+			break;
+		}
 
-			LUA->PushString( "connect" );
+		case KIND_FLOAT:
+		case KIND_VECTOR:
+			output.Write( FloatToBits( static_cast<float>( value ) ), 32 );
 			break;
 
-		case ENET_EVENT_TYPE_DISCONNECT:
-			LUA->PushNumber( ev.data );
-			LUA->SetField( -2, "data" );
+		case KIND_ANGLE:
+		{
+			double wrapped = std::fmod( value, 360.0 );
+			if( wrapped < 0.0 )
+				wrapped += 360.0;
 
-			LUA->PushString( "disconnect" );
+			uint64_t steps = static_cast<uint64_t>( 1 ) << f.bits;
+			output.Write( static_cast<uint32_t>( static_cast<uint64_t>( wrapped / 360.0 * steps + 0.5 ) % steps ), f.bits );
 			break;
+		}
 
-		case ENET_EVENT_TYPE_RECEIVE:
-			LUA->PushNumber( ev.channelID );
-			LUA->SetField( -2, "channel" );
+		case KIND_QUANTIZED_VECTOR:
+			output.Write( Quantize( value, -f.range, f.range, f.bits ), f.bits );
+			break;
 
-			LUA->PushString( reinterpret_cast<char *>( ev.packet->data ), ev.packet->dataLength );
-			LUA->SetField( -2, "data" );
+		default:
+			break;
+	}
+}
 
-			LUA->PushNumber( ev.packet->flags );
-			LUA->SetField( -2, "flags" );
+static void Encode( lua_State *state, const compiled *layout, int32_t index, bitstream::writer &output )
+{
+	static const char *axes[] = { "x", "y", "z" };
+	for( const field &f : layout->fields )
+	{
+		LUA->GetField( index, f.name.c_str( ) );
+		switch( f.type )
+		{
+			case KIND_BOOL:
+				output.Write( LUA->GetBool( -1 ) ? 1 : 0, 1 );
+				break;
 
-			LUA->PushString( "receive" );
+			case KIND_STRING:
+			{
+				if( !LUA->IsType( -1, GarrysMod::Lua::Type::STRING ) )
+				{
+					lua_pushfstring( state, "field '%s' must be a string", f.name.c_str( ) );
+					LUA->ThrowError( LUA->GetString( -1 ) );
+				}
+
+				size_t len = 0;
+				const char *data = LUA->GetString( -1, &len );
+				output.WriteVarint( static_cast<uint32_t>( len ) );
+				output.WriteBytes( data, len );
+				break;
+			}
 
-			enet_packet_destroy( ev.packet );
+			case KIND_VECTOR:
+			case KIND_QUANTIZED_VECTOR:
+			{
+				// works with GMod's Vector as well as tables with x, y and z fields
+				if( LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) ||
+					LUA->IsType( -1, GarrysMod::Lua::Type::NUMBER ) ||
+					LUA->IsType( -1, GarrysMod::Lua::Type::STRING ) )
+				{
+					lua_pushfstring( state, "field '%s' must be a vector", f.name.c_str( ) );
+					LUA->ThrowError( LUA->GetString( -1 ) );
+				}
+
+				for( const char *axis : axes )
+				{
+					LUA->GetField( -1, axis );
+					EncodeNumber( state, f, output );
+					LUA->Pop( 1 );
+				}
+
+				break;
+			}
+
+			default:
+				EncodeNumber( state, f, output );
+				break;
+		}
+
+		LUA->Pop( 1 );
+	}
+}
+
+static bool DecodeNumber( const field &f, bitstream::reader &input, double &value )
+{
+	uint32_t raw = 0;
+	if( !input.Read( raw, f.type == KIND_FLOAT || f.type == KIND_VECTOR ? 32 : f.bits ) )
+		return false;
+
+	switch( f.type )
+	{
+		case KIND_BITS:
+			value = raw;
+			break;
+
+		case KIND_INT:
+		{
+			uint32_t sign = static_cast<uint32_t>( 1 ) << ( f.bits - 1 );
+			value = static_cast<double>( static_cast<int64_t>( raw ^ sign ) - static_cast<int64_t>( sign ) );
+			break;
+		}
+
+		case KIND_FLOAT:
+		case KIND_VECTOR:
+			value = BitsToFloat( raw );
+			break;
+
+		case KIND_ANGLE:
+			value = raw * 360.0 / static_cast<double>( static_cast<uint64_t>( 1 ) << f.bits );
+			break;
+
+		case KIND_QUANTIZED_VECTOR:
+			value = Dequantize( raw, -f.range, f.range, f.bits );
 			break;
+
+		default:
+			return false;
 	}
 
-	LUA->SetField( -2, "type" );
-	return 1;
+	return true;
 }
 
-LUA_FUNCTION_STATIC( gc )
+// Pushes the decoded table, or nothing when the input is too short.
+static bool Decode( lua_State *state, const compiled *layout, const uint8_t *data, size_t len )
 {
-	Check( state, 1 );
-	userdata *udata = GetUserdata( state, 1 );
-
-	ENetHost *host = udata->host;
-	if( host != nullptr )
+	static const char *axes[] = { "x", "y", "z" };
+	bitstream::reader input( data, len );
+	LUA->CreateTable( );
+	for( const field &f : layout->fields )
 	{
-		LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+		switch( f.type )
+		{
+			case KIND_BOOL:
+			{
+				uint32_t value = 0;
+				if( !input.Read( value, 1 ) )
+					break;
 
-		LUA->GetField( -1, peer::tablename );
+				LUA->PushBool( value != 0 );
+				LUA->SetField( -2, f.name.c_str( ) );
+				continue;
+			}
 
-		if( LUA->IsType( -1, GarrysMod::Lua::Type::TABLE ) )
-			for( size_t k = 0; k < host->peerCount; ++k )
+			case KIND_STRING:
 			{
-				LUA->PushUserdata( &host->peers[k] );
-				LUA->GetTable( -2 );
+				uint32_t size = 0;
+				if( !input.ReadVarint( size ) || size > len )
+					break;
 
-				if( LUA->IsType( -1, peer::metatype ) )
-					peer::GetUserdata( state, -1 )->peer = nullptr;
+				std::string value( size, '\0' );
+				if( !input.ReadBytes( &value[0], size ) )
+					break;
 
-				LUA->Pop( 1 );
+				LUA->PushString( value.c_str( ), value.size( ) );
+				LUA->SetField( -2, f.name.c_str( ) );
+				continue;
 			}
 
-		LUA->Pop( 2 );
+			case KIND_VECTOR:
+			case KIND_QUANTIZED_VECTOR:
+			{
+				double values[3];
+				if( !DecodeNumber( f, input, values[0] ) ||
+					!DecodeNumber( f, input, values[1] ) ||
+					!DecodeNumber( f, input, values[2] ) )
+					break;
+
+				LUA->CreateTable( );
+				for( size_t k = 0; k < 3; ++k )
+				{
+					LUA->PushNumber( values[k] );
+					LUA->SetField( -2, axes[k] );
+				}
+
+				LUA->SetField( -2, f.name.c_str( ) );
+				continue;
+			}
 
-		enet_host_destroy( host );
-		udata->host = nullptr;
+			default:
+			{
+				double value = 0.0;
+				if( !DecodeNumber( f, input, value ) )
+					break;
+
+				LUA->PushNumber( value );
+				LUA->SetField( -2, f.name.c_str( ) );
+				continue;
+			}
+		}
+
+		LUA->Pop( 1 );
+		return false;
 	}
 
+	return true;
+}
+
+LUA_FUNCTION_STATIC( gc )
+{
+	Check( state, 1 );
+	userdata *udata = GetUserdata( state, 1 );
+	delete udata->layout;
+	udata->layout = nullptr;
 	return 0;
 }
 
@@ -801,441 +5883,844 @@ LUA_FUNCTION_STATIC( tostring )
 	return 1;
 }
 
-LUA_FUNCTION_STATIC( eq )
+LUA_FUNCTION_STATIC( encode )
 {
-	LUA->PushBool( GetAndValidate( state, 1 ) == GetAndValidate( state, 2 ) );
+	const compiled *layout = GetAndValidate( state, 1 );
+	LUA->CheckType( 2, GarrysMod::Lua::Type::TABLE );
+
+	bitstream::writer output;
+	Encode( state, layout, 2, output );
+	const std::vector<uint8_t> &data = output.Finish( );
+	LUA->PushString( data.empty( ) ? "" : reinterpret_cast<const char *>( data.data( ) ), data.size( ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( decode )
+{
+	const compiled *layout = GetAndValidate( state, 1 );
+	LUA->CheckType( 2, GarrysMod::Lua::Type::STRING );
+	size_t len = 0;
+	const char *data = LUA->GetString( 2, &len );
+	if( !Decode( state, layout, reinterpret_cast<const uint8_t *>( data ), len ) )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "message is shorter than the schema" );
+		return 2;
+	}
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( fields )
+{
+	LUA->PushNumber( static_cast<double>( GetAndValidate( state, 1 )->fields.size( ) ) );
 	return 1;
 }
 
-LUA_FUNCTION_STATIC( index )
+static void Create( lua_State *state, compiled *layout )
+{
+	userdata *udata = static_cast<userdata *>( LUA->NewUserdata( sizeof( userdata ) ) );
+	udata->type = metatype;
+	udata->layout = layout;
+
+	LUA->CreateMetaTableType( metaname, metatype );
+	LUA->SetMetaTable( -2 );
+}
+
+static void Initialize( lua_State *state )
+{
+	LUA->CreateMetaTableType( metaname, metatype );
+
+	LUA->PushCFunction( gc );
+	LUA->SetField( -2, "__gc" );
+
+	LUA->PushCFunction( tostring );
+	LUA->SetField( -2, "__tostring" );
+
+	LUA->Push( -1 );
+	LUA->SetField( -2, "__index" );
+
+	LUA->PushCFunction( encode );
+	LUA->SetField( -2, "encode" );
+
+	LUA->PushCFunction( decode );
+	LUA->SetField( -2, "decode" );
+
+	LUA->PushCFunction( fields );
+	LUA->SetField( -2, "fields" );
+
+	LUA->Pop( 1 );
+}
+
+static void Deinitialize( lua_State *state )
 {
-	LUA->GetMetaTable( 1 );
-	LUA->Push( 2 );
-	LUA->RawGet( -2 );
-	if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
-		return 1;
+	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
 
-	LUA->Pop( 2 );
+	LUA->PushNil( );
+	LUA->SetField( -2, metaname );
 
-	lua_getfenv( state, 1 );
-	LUA->Push( 2 );
-	LUA->RawGet( -2 );
-	return 1;
+	LUA->Pop( 1 );
 }
 
-LUA_FUNCTION_STATIC( newindex )
-{
-	lua_getfenv( state, 1 );
-	LUA->Push( 2 );
-	LUA->Push( 3 );
-	LUA->RawSet( -3 );
-	return 0;
 }
 
-LUA_FUNCTION_STATIC( valid )
+static bool SetSocketOption( ENetSocket socket, int level, int name, int value )
 {
-	Check( state, 1 );
-	LUA->PushBool( GetUserdata( state, 1 )->host != nullptr );
-	return 1;
+	return setsockopt(
+		socket,
+		level,
+		name,
+		reinterpret_cast<const char *>( &value ),
+		sizeof( value )
+	) == 0;
 }
 
-LUA_FUNCTION_STATIC( service )
+// Applies the options table given to host_create, pushes nil and an error on failure.
+static bool ApplyHostOptions( lua_State *state, ENetHost *host, int32_t index )
 {
-	ENetHost *host = GetAndValidate( state, 1 );
-	enet_uint32 timeout = LUA->Top( ) > 1 ? static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) : 0;
+	static const char *names[] = {
+		"rcvbuf", "sndbuf", "busy_poll", "tos", "dscp", "mtu", "maximum_packet_size", "maximum_waiting_data"
+	};
 
-	ENetEvent ev;
-	int32_t ret = enet_host_service( host, &ev, timeout );
-	if( ret < 0 )
+	for( const char *name : names )
 	{
-		LUA->PushNil( );
-		LUA->PushString( "failed to service ENetHost" );
-		return 2;
+		double value = host::GetNumberField( state, index, name, -1.0 );
+		if( value < 0.0 )
+			continue;
+
+		int option = static_cast<int>( std::min( value, 2147483647.0 ) );
+		bool success = true;
+		if( std::strcmp( name, "rcvbuf" ) == 0 )
+			success = enet_socket_set_option( host->socket, ENET_SOCKOPT_RCVBUF, option ) == 0;
+		else if( std::strcmp( name, "sndbuf" ) == 0 )
+			success = enet_socket_set_option( host->socket, ENET_SOCKOPT_SNDBUF, option ) == 0;
+		else if( std::strcmp( name, "busy_poll" ) == 0 )
+		{
+#if defined SO_BUSY_POLL
+			success = SetSocketOption( host->socket, SOL_SOCKET, SO_BUSY_POLL, option );
+#else
+			success = false;
+#endif
+		}
+		else if( std::strcmp( name, "tos" ) == 0 || std::strcmp( name, "dscp" ) == 0 )
+		{
+			if( name[0] == 'd' )
+				option <<= 2;
+
+			success = option <= 0xFF && SetSocketOption( host->socket, IPPROTO_IP, IP_TOS, option );
+		}
+		else if( std::strcmp( name, "mtu" ) == 0 )
+		{
+			success = option >= ENET_PROTOCOL_MINIMUM_MTU && option <= ENET_PROTOCOL_MAXIMUM_MTU;
+			if( success )
+				host->mtu = static_cast<enet_uint32>( option );
+		}
+		else if( std::strcmp( name, "maximum_packet_size" ) == 0 )
+			host->maximumPacketSize = static_cast<size_t>( value );
+		else
+			host->maximumWaitingData = static_cast<size_t>( value );
+
+		if( !success )
+		{
+			LUA->PushNil( );
+			lua_pushfstring( state, "failed to set host option '%s'", name );
+			return false;
+		}
 	}
-	else if( ret == 0 )
-		return 0;
 
-	return PushEvent( state, ev );
+	return true;
 }
 
-LUA_FUNCTION_STATIC( check_events )
+namespace persistent
 {
-	ENetEvent ev;
-	int32_t ret = enet_host_check_events( GetAndValidate( state, 1 ), &ev );
-	if( ret < 0 )
-	{
-		LUA->PushNil( );
-		LUA->PushString( "failed to check events for ENetHost" );
-		return 2;
-	}
-	else if( ret == 0 )
-		return 0;
 
-	return PushEvent( state, ev );
+// Events queued per host while no Lua state is around to take them.
+static const size_t event_limit = 65536;
+static const std::chrono::milliseconds service_interval( 5 );
+
+static std::unordered_map<std::string, context *> registry;
+static std::vector<context *> orphans;
+static std::mutex orphans_lock;
+// never destroyed, a joinable std::thread would terminate the process at exit
+static std::thread *worker = nullptr;
+static std::atomic<bool> running( false );
+static bool pinned = false;
+
+// Keeps the module loaded after GMod unloads it with the Lua state, so the registry,
+// the hosts and the code servicing them survive until the next state requires it.
+static bool Pin( )
+{
+	if( pinned )
+		return true;
+
+#if defined _WIN32
+	HMODULE module = nullptr;
+	pinned = GetModuleHandleExA(
+		GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_PIN,
+		reinterpret_cast<LPCSTR>( &Pin ),
+		&module
+	) != 0;
+#else
+	Dl_info info;
+	if( dladdr( reinterpret_cast<void *>( &Pin ), &info ) != 0 && info.dli_fname != nullptr )
+		pinned = dlopen( info.dli_fname, RTLD_NOW | RTLD_NOLOAD | RTLD_NODELETE ) != nullptr;
+#endif
+
+	return pinned;
 }
 
-LUA_FUNCTION_STATIC( compress_with_range_coder )
+static void Service( )
 {
-	return enet_host_compress_with_range_coder( GetAndValidate( state, 1 ) ) == 0;
+	while( running )
+	{
+		{
+			std::lock_guard<std::mutex> guard( orphans_lock );
+			for( context *ctx : orphans )
+			{
+				servicing = ctx;
+
+				ENetEvent ev;
+				while( PollEvent( ctx, ev, 0, false ) > 0 )
+				{
+					if( ctx->pending.size( ) < event_limit )
+						ctx->pending.push_back( ev );
+					else
+					{
+						if( ev.type == ENET_EVENT_TYPE_RECEIVE )
+							enet_packet_destroy( ev.packet );
+
+						++ctx->gap_dropped;
+					}
+				}
+
+				servicing = nullptr;
+			}
+		}
+
+		std::this_thread::sleep_for( service_interval );
+	}
 }
 
-LUA_FUNCTION_STATIC( connect )
+// Hands a persistent host over to the background thread until a Lua state adopts it.
+// Its FFI handle stops working, FFI calls would otherwise race with the thread.
+static void Orphan( lua_State *state, context *ctx )
 {
-	ENetHost *host = GetAndValidate( state, 1 );
-	const char *addr = LUA->CheckString( 2 );
-	size_t channels = 1;
-	enet_uint32 data = 0;
+	if( ctx->forward != nullptr )
+		DetachRelay( ctx );
 
-	switch( LUA->Top( ) )
+	if( ctx->lua_ref != -1 )
 	{
-		default:
-			data = static_cast<enet_uint32>( LUA->CheckNumber( 4 ) );
-
-		case 3:
-			if( !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
-				channels = static_cast<size_t>( LUA->CheckNumber( 3 ) );
+		LUA->ReferenceFree( ctx->lua_ref );
+		ctx->lua_ref = -1;
+	}
 
-		case 2:
-			/* do nothing */;
+	if( ctx->ffi_id != 0 )
+	{
+		ffi_handles.erase( ctx->ffi_id );
+		ctx->ffi_id = 0;
 	}
 
-	ENetAddress address;
-	if( !ParseAddress( state, addr, address ) )
-		return 2;
+	std::lock_guard<std::mutex> guard( orphans_lock );
+	ctx->orphaned = true;
+	orphans.push_back( ctx );
+	if( !running )
+	{
+		if( worker != nullptr )
+		{
+			worker->join( );
+			delete worker;
+		}
 
-	ENetPeer *peer = enet_host_connect( host, &address, channels, data );
-	if( peer == nullptr )
+		running = true;
+		worker = new std::thread( Service );
+	}
+}
+
+static void Adopt( context *ctx )
+{
+	std::unique_lock<std::mutex> guard( orphans_lock );
+	orphans.erase( std::remove( orphans.begin( ), orphans.end( ), ctx ), orphans.end( ) );
+	ctx->orphaned = false;
+	if( orphans.empty( ) && running )
 	{
-		LUA->PushNil( );
-		LUA->PushString( "failed to create ENetPeer" );
-		return 2;
+		running = false;
+		guard.unlock( );
+		worker->join( );
+		delete worker;
+		worker = nullptr;
 	}
+}
 
-	peer::Create( state, peer );
-	return 1;
+static void Release( context *ctx )
+{
+	registry.erase( ctx->persistent );
+	ctx->persistent.clear( );
 }
 
-LUA_FUNCTION_STATIC( flush )
+// Called when the Lua state goes away, its persistent hosts may not be collected yet.
+static void OrphanAll( lua_State *state )
 {
-	enet_host_flush( GetAndValidate( state, 1 ) );
-	return 0;
+	for( auto &pair : registry )
+		if( !pair.second->orphaned )
+			Orphan( state, pair.second );
 }
 
-LUA_FUNCTION_STATIC( broadcast )
+}
+
+LUA_FUNCTION_STATIC( host_create )
 {
-	ENetHost *host = GetAndValidate( state, 1 );
-	LUA->CheckType( 2, GarrysMod::Lua::Type::STRING );
-	size_t len = 0;
-	const char *data = LUA->GetString( 2, &len );
-	enet_uint8 channel = 1;
-	enet_uint32 flags = 0;
+	bool have_address = true;
+	ENetAddress address = { 0 };
+	if( LUA->Top( ) == 0 || LUA->IsType( 1, GarrysMod::Lua::Type::NIL ) )
+		have_address = false;
+	else if( shared::IsAddress( LUA->CheckString( 1 ) ) )
+	{
+		size_t peer_count = 64;
+		if( LUA->Top( ) > 1 && !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+			peer_count = static_cast<size_t>( LUA->CheckNumber( 2 ) );
+
+		int32_t options = 0;
+		if( LUA->Top( ) > 5 && !LUA->IsType( 6, GarrysMod::Lua::Type::NIL ) )
+		{
+			LUA->CheckType( 6, GarrysMod::Lua::Type::TABLE );
+			options = 6;
+		}
 
+		return shared::Create( state, LUA->GetString( 1 ), peer_count, options );
+	}
+	else if( !ParseAddress( state, LUA->GetString( 1 ), address ) )
+		return 2;
+
+	size_t peer_count = 64, channel_count = 1;
+	enet_uint32 in_bandwidth = 0, out_bandwidth = 0;
 	switch( LUA->Top( ) )
 	{
 		default:
-			if( !GetPacketFlags( state, LUA->CheckString( 4 ), flags ) )
-				return 2;
+			out_bandwidth = static_cast<enet_uint32>( LUA->CheckNumber( 5 ) );
+
+		case 4:
+			if( !LUA->IsType( 4, GarrysMod::Lua::Type::NIL ) )
+				in_bandwidth = static_cast<enet_uint32>( LUA->CheckNumber( 4 ) );
 
 		case 3:
 			if( !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
-				channel = static_cast<enet_uint8>( LUA->CheckNumber( 3 ) );
+				channel_count = static_cast<size_t>( LUA->CheckNumber( 3 ) );
 
 		case 2:
+			if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+				peer_count = static_cast<size_t>( LUA->CheckNumber( 2 ) );
+
+		case 1:
 			/* do nothing */;
 	}
 
-	ENetPacket *packet = enet_packet_create( data, len, flags );
-	enet_host_broadcast( host, channel, packet );
-	enet_packet_destroy( packet );
-	return 0;
-}
-
-LUA_FUNCTION_STATIC( channel_limit )
-{
-	ENetHost *host = GetAndValidate( state, 1 );
-
-	if( LUA->Top( ) > 1 )
+	ENetHost *host = enet_host_create(
+		have_address ? &address : nullptr,
+		peer_count,
+		channel_count,
+		in_bandwidth,
+		out_bandwidth
+	);
+	if( host == nullptr )
 	{
-		enet_host_channel_limit( host, static_cast<size_t>( LUA->CheckNumber( 2 ) ) );
-		return 0;
+		LUA->PushNil( );
+		LUA->PushString( "failed to create ENetHost" );
+		return 2;
 	}
 
-	LUA->PushNumber( host->channelLimit );
-	return 1;
-}
-
-LUA_FUNCTION_STATIC( bandwidth_limit )
-{
-	ENetHost *host = GetAndValidate( state, 1 );
-
-	if( LUA->Top( ) > 2 )
+	if( LUA->Top( ) > 5 && !LUA->IsType( 6, GarrysMod::Lua::Type::NIL ) )
 	{
-		enet_host_bandwidth_limit(
-			GetAndValidate( state, 1 ),
-			static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ),
-			static_cast<enet_uint32>( LUA->CheckNumber( 3 ) )
-		);
-		return 0;
+		LUA->CheckType( 6, GarrysMod::Lua::Type::TABLE );
+		if( !ApplyHostOptions( state, host, 6 ) )
+		{
+			enet_host_destroy( host );
+			return 2;
+		}
 	}
 
-	LUA->PushNumber( host->incomingBandwidth );
-	LUA->PushNumber( host->outgoingBandwidth );
+	host::Create( state, host );
 	return 1;
 }
 
-LUA_FUNCTION_STATIC( local_address )
+LUA_FUNCTION_STATIC( host_persistent )
 {
-	const ENetAddress &address = GetAndValidate( state, 1 )->address;
-	lua_pushfstring(
-		state,
-		"%d.%d.%d.%d:%d",
-		( ( address.host ) & 0xFF ),
-		( ( address.host >> 8 ) & 0xFF ),
-		( ( address.host >> 16 ) & 0xFF ),
-		( address.host >> 24 & 0xFF ),
-		address.port
-	);
-	return 1;
-}
+	std::string name = LUA->CheckString( 1 );
+	auto it = persistent::registry.find( name );
+	if( it != persistent::registry.end( ) )
+	{
+		context *ctx = it->second;
+		if( !ctx->orphaned && ctx->lua_ref != -1 )
+		{
+			LUA->ReferencePush( ctx->lua_ref );
+			LUA->PushBool( false );
+			return 2;
+		}
 
-LUA_FUNCTION_STATIC( total_sent_data )
-{
-	ENetHost *host = GetAndValidate( state, 1 );
+		persistent::Adopt( ctx );
+		host::Push( state, ctx->host );
+		LUA->Push( -1 );
+		ctx->lua_ref = LUA->ReferenceCreate( );
+		LUA->PushBool( true );
+		return 2;
+	}
 
-	if( LUA->Top( ) > 1 )
+	if( !persistent::Pin( ) )
 	{
-		host->totalSentData = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
-		return 0;
+		LUA->PushNil( );
+		LUA->PushString( "failed to pin module in memory" );
+		return 2;
 	}
 
-	LUA->PushNumber( host->totalSentData );
-	return 1;
-}
-
-LUA_FUNCTION_STATIC( total_sent_packets )
-{
-	ENetHost *host = GetAndValidate( state, 1 );
+	LUA->Remove( 1 );
+	if( host_create( state ) != 1 )
+		return 2;
 
-	if( LUA->Top( ) > 1 )
-	{
-		host->totalSentPackets = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
-		return 0;
-	}
+	context *ctx = host::GetContextAndValidate( state, -1 );
+	ctx->persistent = name;
+	LUA->Push( -1 );
+	ctx->lua_ref = LUA->ReferenceCreate( );
+	persistent::registry[name] = ctx;
 
-	LUA->PushNumber( host->totalSentPackets );
-	return 1;
+	LUA->PushBool( false );
+	return 2;
 }
 
-LUA_FUNCTION_STATIC( total_received_data )
+LUA_FUNCTION_STATIC( replay_create )
 {
-	ENetHost *host = GetAndValidate( state, 1 );
+	const char *path = LUA->CheckString( 1 );
+	const char *addr = LUA->CheckString( 2 );
+	double speed = 1.0;
+	if( LUA->Top( ) > 2 && !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
+		speed = LUA->CheckNumber( 3 );
 
-	if( LUA->Top( ) > 1 )
+	ENetAddress address;
+	if( !ParseAddress( state, addr, address ) )
+		return 2;
+
+	capture::player *play = new capture::player;
+	if( !play->Open( path, address, speed ) )
 	{
-		host->totalReceivedData = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
-		return 0;
+		delete play;
+		LUA->PushNil( );
+		LUA->PushString( "failed to open capture file" );
+		return 2;
 	}
 
-	LUA->PushNumber( host->totalReceivedData );
+	replay::Create( state, play );
 	return 1;
 }
 
-LUA_FUNCTION_STATIC( total_received_packets )
+LUA_FUNCTION_STATIC( relay_create )
 {
-	ENetHost *host = GetAndValidate( state, 1 );
+	context *front = host::GetContextAndValidate( state, 1 );
+	context *back = host::GetContextAndValidate( state, 2 );
+	LUA->CheckType( 3, GarrysMod::Lua::Type::TABLE );
+	if( front == back )
+		LUA->ArgError( 2, "front and back hosts must be different" );
 
-	if( LUA->Top( ) > 1 )
-	{
-		host->totalReceivedPackets = static_cast<enet_uint32>( LUA->CheckNumber( 2 ) );
-		return 0;
-	}
+	if( front->forward != nullptr )
+		LUA->ArgError( 1, "host already belongs to a relay" );
 
-	LUA->PushNumber( host->totalReceivedPackets );
-	return 1;
-}
+	if( back->forward != nullptr )
+		LUA->ArgError( 2, "host already belongs to a relay" );
 
-LUA_FUNCTION_STATIC( service_time )
-{
-	LUA->PushNumber( GetAndValidate( state, 1 )->serviceTime );
-	return 1;
-}
+	LUA->GetField( 3, "address" );
+	if( !LUA->IsType( -1, GarrysMod::Lua::Type::STRING ) )
+		LUA->ArgError( 3, "field 'address' must be a string" );
+
+	ENetAddress address;
+	if( !ParseAddress( state, LUA->GetString( -1 ), address ) )
+		return 2;
+
+	LUA->Pop( 1 );
 
-LUA_FUNCTION_STATIC( peer_count )
-{
-	LUA->PushNumber( GetAndValidate( state, 1 )->peerCount );
+	double channels = host::GetNumberField( state, 3, "channels", static_cast<double>( back->host->channelLimit ) );
+	if( channels < 1.0 || channels > ENET_PROTOCOL_MAXIMUM_CHANNEL_COUNT )
+		LUA->ArgError( 3, "channel count must be between 1 and 255" );
+
+	bridge *r = new bridge;
+	r->front = front;
+	r->back = back;
+	r->address = address;
+	r->channels = static_cast<size_t>( channels );
+	r->data = static_cast<enet_uint32>( host::GetNumberField( state, 3, "data", 0.0 ) );
+	r->front_links.resize( front->host->peerCount, link( ) );
+	r->back_links.resize( back->host->peerCount, link( ) );
+	r->waiting.resize( front->host->peerCount );
+	r->forwarded = 0;
+	r->dropped = 0;
+
+	// the hosts must outlive the relay
+	LUA->Push( 1 );
+	r->front_ref = LUA->ReferenceCreate( );
+	LUA->Push( 2 );
+	r->back_ref = LUA->ReferenceCreate( );
+
+	front->forward = r;
+	back->forward = r;
+
+	relay::Create( state, r );
 	return 1;
 }
 
-LUA_FUNCTION_STATIC( peer )
+LUA_FUNCTION_STATIC( schema_compile )
 {
-	ENetHost *host = GetAndValidate( state, 1 );
-	size_t index = static_cast<size_t>( LUA->CheckNumber( 2 ) ) - 1;
+	LUA->CheckType( 1, GarrysMod::Lua::Type::TABLE );
 
-	if( index < 0 || index >= host->peerCount )
+	schema::compiled *layout = new schema::compiled;
+	size_t count = lua_objlen( state, 1 );
+	for( size_t k = 1; k <= count; ++k )
 	{
-		LUA->PushNil( );
-		LUA->PushString( "invalid peer index" );
-		return 2;
+		lua_rawgeti( state, 1, static_cast<int>( k ) );
+		lua_rawgeti( state, -1, 1 );
+		lua_rawgeti( state, -2, 2 );
+
+		schema::field f;
+		bool valid = LUA->IsType( -2, GarrysMod::Lua::Type::STRING ) &&
+			LUA->IsType( -1, GarrysMod::Lua::Type::STRING );
+		if( valid )
+		{
+			f.name = LUA->GetString( -2 );
+			valid = schema::ParseType( LUA->GetString( -1 ), f );
+		}
+
+		LUA->Pop( 3 );
+		if( !valid )
+		{
+			delete layout;
+			LUA->PushNil( );
+			lua_pushfstring( state, "invalid schema field #%d", static_cast<int>( k ) );
+			return 2;
+		}
+
+		layout->fields.push_back( f );
 	}
 
-	peer::Create( state, &host->peers[index] );
+	schema::Create( state, layout );
 	return 1;
 }
 
-static void Initialize( lua_State *state )
+// Waits on the sockets of every host at once and marks the ones with datagrams waiting.
+static int32_t WaitHosts( const std::vector<context *> &ctxs, std::vector<bool> &ready, enet_uint32 timeout )
 {
-	LUA->CreateMetaTableType( metaname, metatype );
+#if defined _WIN32
 
-	LUA->PushCFunction( gc );
-	LUA->SetField( -2, "__gc" );
+	ENetSocketSet set;
+	ENET_SOCKETSET_EMPTY( set );
+	ENetSocket max = 0;
+	for( context *ctx : ctxs )
+	{
+		ENET_SOCKETSET_ADD( set, ctx->host->socket );
+		max = std::max( max, ctx->host->socket );
+	}
 
-	LUA->PushCFunction( tostring );
-	LUA->SetField( -2, "__tostring" );
+	int32_t ret = enet_socketset_select( max, &set, nullptr, timeout );
+	if( ret < 0 )
+		return ret;
 
-	LUA->PushCFunction( eq );
-	LUA->SetField( -2, "__eq" );
+	for( size_t k = 0; k < ctxs.size( ); ++k )
+		ready[k] = ENET_SOCKETSET_CHECK( set, ctxs[k]->host->socket ) != 0;
 
-	LUA->PushCFunction( index );
-	LUA->SetField( -2, "__index" );
+	return ret;
 
-	LUA->PushCFunction( newindex );
-	LUA->SetField( -2, "__newindex" );
+#else
 
-	LUA->PushCFunction( valid );
-	LUA->SetField( -2, "valid" );
+	std::vector<pollfd> fds( ctxs.size( ) );
+	for( size_t k = 0; k < ctxs.size( ); ++k )
+	{
+		fds[k].fd = ctxs[k]->host->socket;
+		fds[k].events = POLLIN;
+		fds[k].revents = 0;
+	}
 
-	LUA->PushCFunction( service );
-	LUA->SetField( -2, "service" );
+	int32_t ret = poll( fds.data( ), fds.size( ), static_cast<int>( timeout ) );
+	if( ret < 0 )
+		return errno == EINTR ? 0 : ret;
 
-	LUA->PushCFunction( check_events );
-	LUA->SetField( -2, "check_events" );
+	for( size_t k = 0; k < ctxs.size( ); ++k )
+		ready[k] = ( fds[k].revents & ( POLLIN | POLLERR ) ) != 0;
 
-	LUA->PushCFunction( compress_with_range_coder );
-	LUA->SetField( -2, "compress_with_range_coder" );
+	return ret;
 
-	LUA->PushCFunction( connect );
-	LUA->SetField( -2, "connect" );
+#endif
+}
 
-	LUA->PushCFunction( flush );
-	LUA->SetField( -2, "flush" );
+LUA_FUNCTION_STATIC( service_many )
+{
+	LUA->CheckType( 1, GarrysMod::Lua::Type::TABLE );
+	enet_uint32 timeout = LUA->Top( ) > 1 && !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) ?
+		static_cast<enet_uint32>( LUA->CheckNumber( 2 ) ) : 0;
+	size_t max_events = LUA->Top( ) > 2 && !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) ?
+		static_cast<size_t>( LUA->CheckNumber( 3 ) ) : 64;
+
+	std::vector<context *> ctxs;
+	size_t count = lua_objlen( state, 1 );
+	for( size_t k = 1; k <= count; ++k )
+	{
+		lua_rawgeti( state, 1, static_cast<int>( k ) );
+		ctxs.push_back( host::GetContextAndValidate( state, -1 ) );
+		LUA->Pop( 1 );
+	}
 
-	LUA->PushCFunction( broadcast );
-	LUA->SetField( -2, "broadcast" );
+	LUA->CreateTable( );
+	size_t events = 0;
+	auto collect = [&]( size_t index, bool check_only ) -> int32_t
+	{
+		ENetEvent ev;
+		int32_t ret = NextEvent( ctxs[index], ev, 0, check_only );
+		if( ret > 0 )
+		{
+			host::PushEvent( state, ctxs[index], ev );
+			lua_rawgeti( state, 1, static_cast<int>( index + 1 ) );
+			LUA->SetField( -2, "host" );
+			lua_rawseti( state, -2, static_cast<int>( ++events ) );
+		}
 
-	LUA->PushCFunction( channel_limit );
-	LUA->SetField( -2, "channel_limit" );
+		return ret;
+	};
 
-	LUA->PushCFunction( bandwidth_limit );
-	LUA->SetField( -2, "bandwidth_limit" );
+	// events already queued are returned right away, without waiting
+	for( size_t k = 0; k < ctxs.size( ) && events < max_events; ++k )
+		while( events < max_events && collect( k, true ) > 0 )
+			/* do nothing */;
 
-	LUA->PushCFunction( local_address );
-	LUA->SetField( -2, "local_address" );
+	if( events != 0 || ctxs.empty( ) )
+		return 1;
 
-	LUA->PushCFunction( gc );
-	LUA->SetField( -2, "destroy" );
+	for( context *ctx : ctxs )
+	{
+		if( !ctx->latest_dirty.empty( ) )
+			FlushLatest( ctx );
 
-	LUA->PushCFunction( total_sent_data );
-	LUA->SetField( -2, "total_sent_data" );
+		enet_host_flush( ctx->host );
+	}
 
-	LUA->PushCFunction( total_sent_packets );
-	LUA->SetField( -2, "total_sent_packets" );
+	std::vector<bool> ready( ctxs.size( ), false );
+	if( WaitHosts( ctxs, ready, timeout ) < 0 )
+	{
+		LUA->PushNil( );
+		LUA->PushString( "failed to wait on ENetHost sockets" );
+		return 2;
+	}
 
-	LUA->PushCFunction( total_received_data );
-	LUA->SetField( -2, "total_received_data" );
+	// ready hosts are drained, the others are serviced once so their timers still run
+	for( size_t k = 0; k < ctxs.size( ) && events < max_events; ++k )
+	{
+		int32_t ret = collect( k, false );
+		while( ready[k] && ret > 0 && events < max_events )
+			ret = collect( k, false );
+	}
 
-	LUA->PushCFunction( total_received_packets );
-	LUA->SetField( -2, "total_received_packets" );
+	return 1;
+}
 
-	LUA->PushCFunction( service_time );
-	LUA->SetField( -2, "service_time" );
+// Bindings are timed by swapping every C function in the module's tables for a
+// closure holding the original and its name, until profiling stops.
+static std::vector<std::pair<size_t, uint64_t>> profiled_scopes;
 
-	LUA->PushCFunction( peer_count );
-	LUA->SetField( -2, "peer_count" );
+LUA_FUNCTION_STATIC( profile_start );
+LUA_FUNCTION_STATIC( profile_stop );
+LUA_FUNCTION_STATIC( profile_dump );
+LUA_FUNCTION_STATIC( profile_enter );
+LUA_FUNCTION_STATIC( profile_leave );
 
-	LUA->PushCFunction( peer );
-	LUA->SetField( -2, "peer" );
+// Calls the original C function directly on the same stack, so its errors and
+// results reach Lua untouched. LuaJIT raises errors as C++ exceptions, which closes
+// the scope on the way out.
+static int ProfiledCall( lua_State *state )
+{
+	lua_CFunction func = lua_tocfunction( state, lua_upvalueindex( 1 ) );
+	profile::scope profiled( lua_tostring( state, lua_upvalueindex( 2 ) ) );
+	return func( state );
+}
 
-	LUA->Pop( 1 );
+static bool IsProfilerFunction( lua_CFunction func )
+{
+	return func == profile_start || func == profile_stop || func == profile_dump ||
+		func == profile_enter || func == profile_leave;
+}
 
-	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+// Wraps or unwraps the C functions in the table on top of the stack.
+static void ProfileTable( lua_State *state, const char *prefix, bool wrap )
+{
+	LUA->PushNil( );
+	while( lua_next( state, -2 ) != 0 )
+	{
+		lua_CFunction func = LUA->IsType( -2, GarrysMod::Lua::Type::STRING ) ?
+			lua_tocfunction( state, -1 ) : nullptr;
+		if( func == nullptr || IsProfilerFunction( func ) || ( func == ProfiledCall ) == wrap )
+		{
+			LUA->Pop( 1 );
+			continue;
+		}
 
-	LUA->CreateTable( );
+		if( wrap )
+		{
+			lua_pushfstring( state, "%s%s", prefix, LUA->GetString( -2 ) );
+			lua_pushcclosure( state, ProfiledCall, 2 );
+		}
+		else
+		{
+			lua_getupvalue( state, -1, 1 );
+			LUA->Remove( -2 );
+		}
 
-	LUA->CreateTable( );
+		LUA->Push( -2 );
+		lua_insert( state, -2 );
+		lua_rawset( state, -4 );
+	}
+}
 
-	LUA->PushString( "v" );
-	LUA->SetField( -2, "__mode" );
+static void ProfileBindings( lua_State *state, bool wrap )
+{
+	const char *metanames[] = {
+		host::metaname,
+		peer::metaname,
+		replay::metaname,
+		relay::metaname,
+		schema::metaname
+	};
 
-	LUA->SetMetaTable( -2 );
+	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+	for( const char *name : metanames )
+	{
+		LUA->GetField( -1, name );
+		if( LUA->IsType( -1, GarrysMod::Lua::Type::TABLE ) )
+		{
+			std::string prefix = std::string( name ) + ":";
+			ProfileTable( state, prefix.c_str( ), wrap );
+		}
 
-	LUA->SetField( -2, tablename );
+		LUA->Pop( 1 );
+	}
 
 	LUA->Pop( 1 );
+
+	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_GLOB );
+	LUA->GetField( -1, "enet" );
+	if( LUA->IsType( -1, GarrysMod::Lua::Type::TABLE ) )
+		ProfileTable( state, "enet.", wrap );
+
+	LUA->Pop( 2 );
 }
 
-static void Deinitialize( lua_State *state )
+LUA_FUNCTION_STATIC( profile_start )
 {
-	LUA->PushSpecial( GarrysMod::Lua::SPECIAL_REG );
+	if( !profile::active )
+		ProfileBindings( state, true );
 
-	LUA->PushNil( );
-	LUA->SetField( -2, metaname );
+	profiled_scopes.clear( );
+	profile::Start( );
+	return 0;
+}
 
-	LUA->PushNil( );
-	LUA->SetField( -2, tablename );
+LUA_FUNCTION_STATIC( profile_stop )
+{
+	if( !profile::active )
+		return 0;
 
-	LUA->Pop( 1 );
-}
+	while( !profiled_scopes.empty( ) )
+	{
+		profile::Leave( profiled_scopes.back( ).first, profiled_scopes.back( ).second );
+		profiled_scopes.pop_back( );
+	}
 
+	profile::Stop( );
+	ProfileBindings( state, false );
+	return 0;
 }
 
-LUA_FUNCTION_STATIC( host_create )
+// Returns the collapsed call paths and a table of calls, total and max microseconds per name.
+LUA_FUNCTION_STATIC( profile_dump )
 {
-	bool have_address = true;
-	ENetAddress address = { 0 };
-	if( LUA->Top( ) == 0 || LUA->IsType( 1, GarrysMod::Lua::Type::NIL ) )
-		have_address = false;
-	else if( !ParseAddress( state, LUA->CheckString( 1 ), address ) )
-		return 2;
+	std::string collapsed = profile::Collapsed( );
+	LUA->PushString( collapsed.data( ), collapsed.size( ) );
 
-	size_t peer_count = 64, channel_count = 1;
-	enet_uint32 in_bandwidth = 0, out_bandwidth = 0;
-	switch( LUA->Top( ) )
+	LUA->CreateTable( );
+	for( const profile::summary &s : profile::Summarize( ) )
 	{
-		default:
-			out_bandwidth = static_cast<enet_uint32>( LUA->CheckNumber( 5 ) );
+		LUA->CreateTable( );
 
-		case 4:
-			if( !LUA->IsType( 4, GarrysMod::Lua::Type::NIL ) )
-				in_bandwidth = static_cast<enet_uint32>( LUA->CheckNumber( 4 ) );
+		LUA->PushNumber( static_cast<double>( s.calls ) );
+		LUA->SetField( -2, "calls" );
 
-		case 3:
-			if( !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
-				channel_count = static_cast<size_t>( LUA->CheckNumber( 3 ) );
+		LUA->PushNumber( s.total );
+		LUA->SetField( -2, "total" );
 
-		case 2:
-			if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
-				peer_count = static_cast<size_t>( LUA->CheckNumber( 2 ) );
+		LUA->PushNumber( s.max );
+		LUA->SetField( -2, "max" );
 
-		case 1:
-			/* do nothing */;
+		LUA->SetField( -2, s.name.c_str( ) );
 	}
 
-	ENetHost *host = enet_host_create(
-		have_address ? &address : nullptr,
-		peer_count,
-		channel_count,
-		in_bandwidth,
-		out_bandwidth
-	);
-	if( host == nullptr )
+	return 2;
+}
+
+// Lets Lua handlers show up as their own frames in the call paths.
+LUA_FUNCTION_STATIC( profile_enter )
+{
+	const char *name = LUA->CheckString( 1 );
+	if( profile::active )
+		profiled_scopes.push_back( std::make_pair( profile::Enter( name ), profile::Now( ) ) );
+
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( profile_leave )
+{
+	if( !profile::active || profiled_scopes.empty( ) )
+		return 0;
+
+	profile::Leave( profiled_scopes.back( ).first, profiled_scopes.back( ).second );
+	profiled_scopes.pop_back( );
+	return 0;
+}
+
+// Declarations for LuaJIT's ffi.cdef, matching the extern "C" functions at the end of this file.
+// They take the handle returned by host:ffi_handle() and address peers by their ID.
+static const char ffi_cdef[] =
+	"enum { ENET_FFI_INVALID_HOST = -2 };\n"
+	"typedef struct {\n"
+	"\tint32_t type;\n"
+	"\tuint32_t id;\n"
+	"\tuint32_t channel;\n"
+	"\tuint32_t flags;\n"
+	"\tuint32_t data;\n"
+	"\tconst uint8_t *packet;\n"
+	"\tsize_t length;\n"
+	"} enet_ffi_event;\n"
+	"int enet_ffi_send(uint32_t host, uint32_t id, uint8_t channel, uint32_t flags, const void *data, size_t length);\n"
+	"int enet_ffi_broadcast(uint32_t host, uint8_t channel, uint32_t flags, const void *data, size_t length);\n"
+	"int enet_ffi_poll(uint32_t host, uint32_t timeout, enet_ffi_event *event);\n"
+	"int enet_ffi_flush(uint32_t host);\n";
+
+// The module isn't loaded globally, so FFI callers need its path for ffi.load.
+LUA_FUNCTION_STATIC( ffi_path )
+{
+#if defined _WIN32
+	HMODULE module = nullptr;
+	char path[MAX_PATH];
+	if( GetModuleHandleExA(
+		GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+		reinterpret_cast<LPCSTR>( &ffi_path ),
+		&module
+	) != 0 && GetModuleFileNameA( module, path, sizeof( path ) ) != 0 )
 	{
-		LUA->PushNil( );
-		LUA->PushString( "failed to create ENetHost" );
-		return 2;
+		LUA->PushString( path );
+		return 1;
 	}
+#else
+	Dl_info info;
+	if( dladdr( reinterpret_cast<void *>( &ffi_path ), &info ) != 0 && info.dli_fname != nullptr )
+	{
+		LUA->PushString( info.dli_fname );
+		return 1;
+	}
+#endif
 
-	host::Create( state, host );
-	return 1;
+	LUA->PushNil( );
+	LUA->PushString( "failed to find module path" );
+	return 2;
 }
 
 LUA_FUNCTION_STATIC( linked_version )
@@ -1263,9 +6748,45 @@ static void Initialize( lua_State *state )
 	LUA->PushCFunction( host_create );
 	LUA->SetField( -2, "host_create" );
 
+	LUA->PushCFunction( host_persistent );
+	LUA->SetField( -2, "host_persistent" );
+
+	LUA->PushCFunction( replay_create );
+	LUA->SetField( -2, "replay_create" );
+
+	LUA->PushCFunction( relay_create );
+	LUA->SetField( -2, "relay_create" );
+
+	LUA->PushCFunction( schema_compile );
+	LUA->SetField( -2, "schema" );
+
+	LUA->PushCFunction( service_many );
+	LUA->SetField( -2, "service_many" );
+
 	LUA->PushCFunction( linked_version );
 	LUA->SetField( -2, "linked_version" );
 
+	LUA->PushCFunction( profile_start );
+	LUA->SetField( -2, "profile_start" );
+
+	LUA->PushCFunction( profile_stop );
+	LUA->SetField( -2, "profile_stop" );
+
+	LUA->PushCFunction( profile_dump );
+	LUA->SetField( -2, "profile_dump" );
+
+	LUA->PushCFunction( profile_enter );
+	LUA->SetField( -2, "profile_enter" );
+
+	LUA->PushCFunction( profile_leave );
+	LUA->SetField( -2, "profile_leave" );
+
+	LUA->PushString( ffi_cdef, sizeof( ffi_cdef ) - 1 );
+	LUA->SetField( -2, "ffi_cdef" );
+
+	LUA->PushCFunction( ffi_path );
+	LUA->SetField( -2, "ffi_path" );
+
 	LUA->SetField( -2, "enet" );
 
 	LUA->Pop( 1 );
@@ -1280,9 +6801,136 @@ static void Deinitialize( lua_State *state )
 
 	LUA->Pop( 1 );
 
-	enet_deinitialize( );
+	profile::Stop( );
+	profiled_scopes.clear( );
+
+	// the workers can't outlive the module's code
+	delete sealers;
+	sealers = nullptr;
+
+	// persistent hosts keep their sockets open until the next Lua state takes them
+	persistent::OrphanAll( state );
+	if( persistent::registry.empty( ) )
+		enet_deinitialize( );
+}
+
+}
+
+#if defined _WIN32
+#define ENET_FFI_EXPORT extern "C" __declspec( dllexport )
+#else
+#define ENET_FFI_EXPORT extern "C" __attribute__( ( visibility( "default" ) ) )
+#endif
+
+static const int ENET_FFI_INVALID_HOST = -2;
+
+static enet::context *GetFFIContext( uint32_t handle )
+{
+	auto it = enet::ffi_handles.find( handle );
+	return it != enet::ffi_handles.end( ) ? it->second : nullptr;
+}
+
+// Same layout as enet_ffi_event in enet.ffi_cdef.
+struct enet_ffi_event
+{
+	int32_t type;
+	uint32_t id;
+	uint32_t channel;
+	uint32_t flags;
+	uint32_t data;
+	const uint8_t *packet;
+	size_t length;
+};
+
+ENET_FFI_EXPORT int enet_ffi_send(
+	uint32_t handle,
+	uint32_t id,
+	uint8_t channel,
+	uint32_t flags,
+	const void *data,
+	size_t length
+)
+{
+	enet::context *ctx = GetFFIContext( handle );
+	if( ctx == nullptr )
+		return ENET_FFI_INVALID_HOST;
+
+	ENetPeer *peer = enet::GetPeerFromID( ctx, id );
+	if( peer == nullptr ||
+		enet::Send( ctx, peer, channel, static_cast<const char *>( data ), length, flags ) == nullptr )
+		return -1;
+
+	return 0;
+}
+
+ENET_FFI_EXPORT int enet_ffi_broadcast(
+	uint32_t handle,
+	uint8_t channel,
+	uint32_t flags,
+	const void *data,
+	size_t length
+)
+{
+	enet::context *ctx = GetFFIContext( handle );
+	if( ctx == nullptr )
+		return ENET_FFI_INVALID_HOST;
+
+	enet::Broadcast( ctx, channel, static_cast<const char *>( data ), length, flags );
+	return 0;
+}
+
+// Received bytes stay readable through event->packet until the next poll on the same host.
+ENET_FFI_EXPORT int enet_ffi_poll( uint32_t handle, uint32_t timeout, enet_ffi_event *event )
+{
+	enet::context *ctx = GetFFIContext( handle );
+	if( ctx == nullptr )
+		return ENET_FFI_INVALID_HOST;
+
+	if( ctx->ffi_packet != nullptr )
+	{
+		enet_packet_destroy( ctx->ffi_packet );
+		ctx->ffi_packet = nullptr;
+	}
+
+	ENetEvent ev;
+	int32_t ret = enet::NextEvent( ctx, ev, timeout, false );
+	if( ret <= 0 )
+		return ret;
+
+	event->type = static_cast<int32_t>( ev.type );
+	event->id = 0;
+	event->channel = ev.channelID;
+	event->flags = 0;
+	event->data = ev.data;
+	event->packet = nullptr;
+	event->length = 0;
+
+	if( ev.peer != nullptr )
+		event->id = ev.type == ENET_EVENT_TYPE_DISCONNECT ?
+			enet::GetReleasedPeerID( ctx, ev.peer ) : enet::GetPeerID( ctx, ev.peer );
+
+	if( ev.type == ENET_EVENT_TYPE_RECEIVE )
+	{
+		ctx->ffi_packet = ev.packet;
+		event->flags = ev.packet->flags;
+		event->packet = ev.packet->data;
+		event->length = ev.packet->dataLength;
+	}
+
+	return 1;
 }
 
+ENET_FFI_EXPORT int enet_ffi_flush( uint32_t handle )
+{
+	enet::context *ctx = GetFFIContext( handle );
+	if( ctx == nullptr )
+		return ENET_FFI_INVALID_HOST;
+
+	if( !ctx->latest_dirty.empty( ) )
+		enet::FlushLatest( ctx );
+
+	enet_host_flush( ctx->host );
+	return 0;
 }
 
 GMOD_MODULE_OPEN( )
@@ -1290,11 +6938,17 @@ GMOD_MODULE_OPEN( )
 	enet::Initialize( state );
 	enet::host::Initialize( state );
 	enet::peer::Initialize( state );
+	enet::replay::Initialize( state );
+	enet::relay::Initialize( state );
+	enet::schema::Initialize( state );
 	return 0;
 }
 
 GMOD_MODULE_CLOSE( )
 {
+	enet::schema::Deinitialize( state );
+	enet::relay::Deinitialize( state );
+	enet::replay::Deinitialize( state );
 	enet::peer::Deinitialize( state );
 	enet::host::Deinitialize( state );
 	enet::Deinitialize( state );
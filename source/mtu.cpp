@@ -0,0 +1,293 @@
+#include "mtu.hpp"
+#include <cstring>
+#include <algorithm>
+
+#if defined _WIN32
+
+#include <ws2tcpip.h>
+
+#else
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#endif
+
+namespace mtu
+{
+
+static const uint8_t probe_magic[8] = { 0xFF, 0xFF, 'E', 'N', 'M', 'T', 'U', 'P' };
+static const uint8_t acknowledgement_magic[8] = { 0xFF, 0xFF, 'E', 'N', 'M', 'T', 'U', 'A' };
+static const size_t magic_size = sizeof( probe_magic );
+
+inline void Store( uint8_t *data, uint32_t value, size_t bytes )
+{
+	for( size_t k = 0; k < bytes; ++k )
+		data[k] = static_cast<uint8_t>( value >> ( k * 8 ) );
+}
+
+inline uint32_t Load( const uint8_t *data, size_t bytes )
+{
+	uint32_t value = 0;
+	for( size_t k = 0; k < bytes; ++k )
+		value |= static_cast<uint32_t>( data[k] ) << ( k * 8 );
+
+	return value;
+}
+
+search::search( ) :
+	active( false ),
+	low( 0 ),
+	high( 0 )
+{ }
+
+void search::Start( uint32_t from, uint32_t to )
+{
+	low = from;
+	high = to;
+	active = true;
+	Finish( );
+}
+
+void search::Acknowledged( uint32_t size )
+{
+	if( !active || size <= low || size > high )
+		return;
+
+	low = size;
+	Finish( );
+}
+
+void search::Lost( uint32_t size )
+{
+	if( !active || size <= low || size > high )
+		return;
+
+	high = size - 1;
+	Finish( );
+}
+
+void search::Finish( )
+{
+	if( high < low + resolution )
+		active = false;
+}
+
+prober::prober( ) :
+	running( false ),
+	probed( false ),
+	size( 0 ),
+	token( 0 ),
+	attempts( 0 ),
+	sent_time( 0 ),
+	restart( 0 ),
+	sent( 0 ),
+	lost( 0 )
+{ }
+
+probe_step prober::Update( const discovery &policy, enet_uint32 now, enet_uint32 round_trip_time,
+	uint32_t seed, uint32_t tag, uint32_t tag_bits )
+{
+	if( !running )
+	{
+		if( probed && ( policy.interval == 0 || ENET_TIME_LESS( now, restart ) ) )
+			return PROBE_IDLE;
+
+		probing.Start( policy.minimum, policy.maximum );
+		running = true;
+		size = 0;
+	}
+
+	if( size != 0 )
+	{
+		if( ENET_TIME_DIFFERENCE( now, sent_time ) < std::max( policy.timeout, 2 * round_trip_time ) )
+			return PROBE_IDLE;
+
+		if( ++attempts >= policy.attempts )
+			Failed( );
+	}
+	else if( probing.IsActive( ) )
+	{
+		size = probing.Next( );
+		token = ( seed ^ static_cast<uint32_t>( sent * 2654435761u ) ) << tag_bits | tag;
+		attempts = 0;
+	}
+
+	if( size != 0 )
+	{
+		sent_time = now;
+		++sent;
+		return PROBE_SEND;
+	}
+
+	if( probing.IsActive( ) )
+		return PROBE_IDLE;
+
+	running = false;
+	probed = true;
+	restart = now + policy.interval;
+	return PROBE_DONE;
+}
+
+void prober::Failed( )
+{
+	probing.Lost( size );
+	size = 0;
+	++lost;
+}
+
+bool prober::Acknowledge( uint32_t acknowledged, uint32_t acknowledged_token )
+{
+	if( size == 0 || size != acknowledged || token != acknowledged_token )
+		return false;
+
+	probing.Acknowledged( size );
+	size = 0;
+	return true;
+}
+
+void prober::Stop( bool forget )
+{
+	running = false;
+	size = 0;
+	if( forget )
+		probed = false;
+}
+
+#if defined _WIN32
+
+static bool GetFragmentation( ENetSocket socket, int &value )
+{
+	DWORD option = 0;
+	int len = sizeof( option );
+	if( getsockopt( socket, IPPROTO_IP, IP_DONTFRAGMENT, reinterpret_cast<char *>( &option ), &len ) != 0 )
+		return false;
+
+	value = static_cast<int>( option );
+	return true;
+}
+
+static bool SetFragmentation( ENetSocket socket, int value )
+{
+	DWORD option = static_cast<DWORD>( value );
+	return setsockopt( socket, IPPROTO_IP, IP_DONTFRAGMENT,
+		reinterpret_cast<const char *>( &option ), sizeof( option ) ) == 0;
+}
+
+static const int forbidden = 1;
+
+#elif defined IP_MTU_DISCOVER && defined IP_PMTUDISC_PROBE || defined IP_DONTFRAG
+
+#if defined IP_MTU_DISCOVER && defined IP_PMTUDISC_PROBE
+// probe mode sets DF and ignores the kernel's cached path MTU
+static const int fragmentation_option = IP_MTU_DISCOVER;
+static const int forbidden = IP_PMTUDISC_PROBE;
+#else
+static const int fragmentation_option = IP_DONTFRAG;
+static const int forbidden = 1;
+#endif
+
+static bool GetFragmentation( ENetSocket socket, int &value )
+{
+	socklen_t len = sizeof( value );
+	return getsockopt( socket, IPPROTO_IP, fragmentation_option, &value, &len ) == 0;
+}
+
+static bool SetFragmentation( ENetSocket socket, int value )
+{
+	return setsockopt( socket, IPPROTO_IP, fragmentation_option, &value, sizeof( value ) ) == 0;
+}
+
+#else
+
+static bool GetFragmentation( ENetSocket, int & )
+{
+	return false;
+}
+
+static bool SetFragmentation( ENetSocket, int )
+{
+	return false;
+}
+
+static const int forbidden = 1;
+
+#endif
+
+bool ForbidFragmentation( ENetSocket socket, fragmentation &previous )
+{
+	if( !previous.saved )
+	{
+		if( !GetFragmentation( socket, previous.value ) )
+			return false;
+
+		previous.saved = true;
+	}
+
+	return SetFragmentation( socket, forbidden );
+}
+
+bool RestoreFragmentation( ENetSocket socket, fragmentation &previous )
+{
+	if( !previous.saved )
+		return true;
+
+	previous.saved = false;
+	return SetFragmentation( socket, previous.value );
+}
+
+bool SendProbe( ENetSocket socket, const ENetAddress &address, uint32_t size, uint32_t token )
+{
+	if( size < probe_header_size || size > ENET_PROTOCOL_MAXIMUM_MTU )
+		return false;
+
+	uint8_t probe[ENET_PROTOCOL_MAXIMUM_MTU] = { 0 };
+	std::memcpy( probe, probe_magic, magic_size );
+	Store( probe + magic_size, size, 2 );
+	Store( probe + magic_size + 2, token, 4 );
+
+	ENetBuffer buffer;
+	buffer.data = probe;
+	buffer.dataLength = size;
+	return enet_socket_send( socket, &address, &buffer, 1 ) == static_cast<int>( size );
+}
+
+bool Answer( ENetHost *host, const ENetAddress &address, const uint8_t *data, size_t len )
+{
+	if( len < probe_header_size || std::memcmp( data, probe_magic, magic_size ) != 0 )
+		return false;
+
+	// a truncated probe didn't make it through
+	if( Load( data + magic_size, 2 ) != len )
+		return true;
+
+	for( ENetPeer *peer = host->peers; peer < host->peers + host->peerCount; ++peer )
+		if( peer->state == ENET_PEER_STATE_CONNECTED &&
+			peer->address.host == address.host &&
+			peer->address.port == address.port )
+		{
+			uint8_t acknowledgement[acknowledgement_size];
+			std::memcpy( acknowledgement, acknowledgement_magic, magic_size );
+			std::memcpy( acknowledgement + magic_size, data + magic_size, 6 );
+
+			ENetBuffer buffer;
+			buffer.data = acknowledgement;
+			buffer.dataLength = sizeof( acknowledgement );
+			enet_socket_send( host->socket, &address, &buffer, 1 );
+			break;
+		}
+
+	return true;
+}
+
+bool ParseAcknowledgement( const uint8_t *data, size_t len, uint32_t &size, uint32_t &token )
+{
+	if( len != acknowledgement_size || std::memcmp( data, acknowledgement_magic, magic_size ) != 0 )
+		return false;
+
+	size = Load( data + magic_size, 2 );
+	token = Load( data + magic_size + 2, 4 );
+	return true;
+}
+
+}
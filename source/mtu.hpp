@@ -0,0 +1,162 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <cstdint>
+#include <cstddef>
+
+namespace mtu
+{
+
+// Path MTU discovery with out of band probes. A probe is a datagram of the size
+// being tried, starting with a magic and a token, and the other end answers every
+// probe from a connected peer with a short acknowledgement carrying the size and
+// token back. Sizes are datagram payload sizes, like ENet's own MTU.
+static const size_t probe_header_size = 14;
+static const size_t acknowledgement_size = 14;
+
+// Binary search between a size assumed to get through and the largest one allowed.
+// Every size is tried up to attempts times before being considered too large.
+class search
+{
+public:
+	search( );
+
+	void Start( uint32_t low, uint32_t high );
+
+	bool IsActive( ) const
+	{
+		return active;
+	}
+
+	// Size of the next probe to send.
+	uint32_t Next( ) const
+	{
+		return low + ( high - low + 1 ) / 2;
+	}
+
+	void Acknowledged( uint32_t size );
+	void Lost( uint32_t size );
+
+	// Largest size known to get through.
+	uint32_t Result( ) const
+	{
+		return low;
+	}
+
+private:
+	void Finish( );
+
+	bool active;
+	uint32_t low;
+	uint32_t high;
+};
+
+// Searches stop once the range is narrower than this.
+static const uint32_t resolution = 8;
+
+// Sizes searched between, and how long and how many times a size is tried. A peer is
+// searched once, or again every interval milliseconds when it's not 0.
+struct discovery
+{
+	uint32_t minimum;
+	uint32_t maximum;
+	enet_uint32 interval;
+	enet_uint32 timeout;
+	uint32_t attempts;
+};
+
+enum probe_step
+{
+	PROBE_IDLE,
+	PROBE_SEND,
+	PROBE_DONE
+};
+
+// Probes to one peer: the search, the probe in flight and its retries.
+class prober
+{
+public:
+	prober( );
+
+	// Advances the search, returning PROBE_SEND when the probe of Size and Token has to
+	// be sent now and PROBE_DONE when the search just ended with Result. A new probe's
+	// token is mixed from seed and the number of probes sent, with tag in its low bits.
+	probe_step Update( const discovery &policy, enet_uint32 now, enet_uint32 round_trip_time,
+		uint32_t seed, uint32_t tag, uint32_t tag_bits );
+
+	// The probe couldn't be sent, which with fragmentation forbidden means it's too large.
+	void Failed( );
+
+	// Returns whether the acknowledgement matches the probe in flight.
+	bool Acknowledge( uint32_t size, uint32_t token );
+
+	// Drops the search in progress, and with forget the result of the last one too.
+	void Stop( bool forget );
+
+	bool IsRunning( ) const
+	{
+		return running;
+	}
+
+	uint32_t Size( ) const
+	{
+		return size;
+	}
+
+	uint32_t Token( ) const
+	{
+		return token;
+	}
+
+	uint32_t Result( ) const
+	{
+		return probing.Result( );
+	}
+
+	uint64_t Sent( ) const
+	{
+		return sent;
+	}
+
+	uint64_t Lost( ) const
+	{
+		return lost;
+	}
+
+private:
+	search probing;
+	bool running;
+	bool probed;
+	uint32_t size;
+	uint32_t token;
+	uint32_t attempts;
+	enet_uint32 sent_time;
+	enet_uint32 restart;
+	uint64_t sent;
+	uint64_t lost;
+};
+
+// Fragmentation setting of a socket from before ForbidFragmentation.
+struct fragmentation
+{
+	bool saved;
+	int value;
+};
+
+// Forbids IP fragmentation on the socket, so oversized probes are dropped
+// instead of being fragmented, locally or along the path. The setting it
+// replaces is saved in previous, unless a previous call saved it already.
+bool ForbidFragmentation( ENetSocket socket, fragmentation &previous );
+
+// Puts back the setting saved by ForbidFragmentation, if any.
+bool RestoreFragmentation( ENetSocket socket, fragmentation &previous );
+
+bool SendProbe( ENetSocket socket, const ENetAddress &address, uint32_t size, uint32_t token );
+
+// Acknowledges probes from connected peers. Returns true when the datagram was a probe.
+bool Answer( ENetHost *host, const ENetAddress &address, const uint8_t *data, size_t len );
+
+// Returns true when the datagram was an acknowledgement, and fills its size and token.
+bool ParseAcknowledgement( const uint8_t *data, size_t len, uint32_t &size, uint32_t &token );
+
+}
@@ -0,0 +1,91 @@
+#include "nonce.hpp"
+
+namespace nonce
+{
+
+sender::sender( ) :
+	unordered( 0 )
+{ }
+
+uint64_t sender::Next( uint8_t channel, bool reliable )
+{
+	uint32_t space = GetSpace( channel, reliable );
+	uint64_t counter = 0;
+	if( space == 0 )
+		counter = ++unordered;
+	else
+	{
+		if( ordered.size( ) <= channel )
+			ordered.resize( static_cast<size_t>( channel ) + 1, 0 );
+
+		counter = ++ordered[channel];
+	}
+
+	return static_cast<uint64_t>( space ) << counter_bits | counter;
+}
+
+void sender::Cancel( uint64_t value )
+{
+	uint32_t space = GetSpace( value );
+	uint64_t counter = GetCounter( value );
+	if( space == 0 )
+	{
+		if( unordered == counter )
+			--unordered;
+	}
+	else if( space - 1 < ordered.size( ) && ordered[space - 1] == counter )
+		--ordered[space - 1];
+}
+
+receiver::receiver( ) :
+	highest( 0 ),
+	window( 0 )
+{ }
+
+bool receiver::Check( uint64_t value, uint8_t channel, bool reliable ) const
+{
+	uint32_t space = GetSpace( value );
+	uint64_t counter = GetCounter( value );
+	if( counter == 0 )
+		return false;
+
+	if( space != 0 )
+	{
+		if( !reliable || space != GetSpace( channel, true ) )
+			return false;
+
+		uint64_t last = channel < ordered.size( ) ? ordered[channel] : 0;
+		return last == 0 || counter == last + 1;
+	}
+
+	if( counter > highest )
+		return true;
+
+	uint64_t age = highest - counter;
+	return age < window_size && ( window & ( static_cast<uint64_t>( 1 ) << age ) ) == 0;
+}
+
+void receiver::Accept( uint64_t value )
+{
+	uint32_t space = GetSpace( value );
+	uint64_t counter = GetCounter( value );
+	if( space != 0 )
+	{
+		if( ordered.size( ) < space )
+			ordered.resize( space, 0 );
+
+		ordered[space - 1] = counter;
+		return;
+	}
+
+	if( counter > highest )
+	{
+		uint64_t shift = counter - highest;
+		window = shift >= window_size ? 0 : window << shift;
+		highest = counter;
+	}
+
+	window |= static_cast<uint64_t>( 1 ) << ( highest - counter );
+}
+
+}
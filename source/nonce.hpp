@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace nonce
+{
+
+// Sealed packets are numbered in separate counter spaces: one per channel for reliable
+// packets, which ENet delivers exactly once and in order on their channel, and one for
+// everything else, checked against a sliding window since it may be lost or reordered.
+// A nonce holds its space in the top bits and the counter below, counters start at 1.
+static const uint32_t space_bits = 9;
+static const uint32_t counter_bits = 64 - space_bits;
+static const uint64_t counter_mask = ( static_cast<uint64_t>( 1 ) << counter_bits ) - 1;
+static const uint64_t window_size = 64;
+
+inline uint32_t GetSpace( uint8_t channel, bool reliable )
+{
+	return reliable ? 1 + static_cast<uint32_t>( channel ) : 0;
+}
+
+inline uint32_t GetSpace( uint64_t value )
+{
+	return static_cast<uint32_t>( value >> counter_bits );
+}
+
+inline uint64_t GetCounter( uint64_t value )
+{
+	return value & counter_mask;
+}
+
+class sender
+{
+public:
+	sender( );
+
+	uint64_t Next( uint8_t channel, bool reliable );
+
+	// Gives back a nonce whose packet was never sent, as long as it's its space's latest,
+	// so the other end doesn't wait for it.
+	void Cancel( uint64_t value );
+
+private:
+	uint64_t unordered;
+	std::vector<uint64_t> ordered;
+};
+
+class receiver
+{
+public:
+	receiver( );
+
+	// Whether a packet received on the channel with this nonce may be opened. Reliable
+	// packets must follow the last one opened on their channel, the first one excepted:
+	// those sealed before this end had its session keys were dropped without opening.
+	bool Check( uint64_t value, uint8_t channel, bool reliable ) const;
+
+	// Records the nonce of a packet that was opened.
+	void Accept( uint64_t value );
+
+private:
+	uint64_t highest;
+	uint64_t window;
+	std::vector<uint64_t> ordered;
+};
+
+}
@@ -0,0 +1,78 @@
+#include "overload.hpp"
+
+namespace overload
+{
+
+monitor::monitor( ) :
+	settings( policy( ) ),
+	enabled( false ),
+	overloaded( false ),
+	datagrams( 0 ),
+	last_batch( 0 ),
+	pending( 0 ),
+	measured_datagrams( 0 ),
+	gap( 0 ),
+	shed( 0 ),
+	coalesced( 0 ),
+	overloads( 0 )
+{ }
+
+void monitor::Enable( const policy &configured )
+{
+	settings = configured;
+	enabled = true;
+	datagrams = 0;
+	last_batch = 0;
+}
+
+void monitor::Disable( )
+{
+	enabled = false;
+	overloaded = false;
+}
+
+bool monitor::Measure( enet_uint32 now )
+{
+	pending = batch.size( );
+	measured_datagrams = datagrams;
+	gap = last_batch != 0 ? ENET_TIME_DIFFERENCE( now, last_batch ) : 0;
+	datagrams = 0;
+	last_batch = now;
+	newest.clear( );
+
+	return ( settings.max_pending != 0 && pending >= settings.max_pending ) ||
+		( settings.max_datagrams != 0 && measured_datagrams >= settings.max_datagrams ) ||
+		( settings.max_gap != 0 && gap >= settings.max_gap );
+}
+
+bool monitor::Drop( uint64_t key )
+{
+	if( settings.shed_unreliable )
+	{
+		++shed;
+		return true;
+	}
+
+	// the first packet seen for a key is the newest one, it's kept
+	if( settings.coalesce && !newest.insert( key ).second )
+	{
+		++coalesced;
+		return true;
+	}
+
+	return false;
+}
+
+bool monitor::Update( bool state )
+{
+	if( state == overloaded )
+		return false;
+
+	overloaded = state;
+	if( overloaded )
+		++overloads;
+
+	return true;
+}
+
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <enet/enet.h>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_set>
+
+namespace overload
+{
+
+// Backlog thresholds checked every time the pending events run out, zero disables a check.
+// Events are drained in batches of up to drain_limit, and an overloaded batch loses its
+// unreliable packets: every one of them with shed_unreliable, otherwise with coalesce
+// all but the newest per peer, channel and stream.
+struct policy
+{
+	size_t max_pending;
+	size_t max_datagrams;
+	enet_uint32 max_gap;
+	size_t drain_limit;
+	bool shed_unreliable;
+	bool coalesce;
+};
+
+// Overload state of a host. The batch and the keys seen while coalescing are kept
+// between checks, so draining stops allocating once they've grown to the load.
+class monitor
+{
+public:
+	monitor( );
+
+	void Enable( const policy &configured );
+	void Disable( );
+
+	bool IsEnabled( ) const
+	{
+		return enabled;
+	}
+
+	const policy &Policy( ) const
+	{
+		return settings;
+	}
+
+	void CountDatagram( )
+	{
+		++datagrams;
+	}
+
+	// Empty buffer to drain the next batch into.
+	std::vector<ENetEvent> &Batch( )
+	{
+		batch.clear( );
+		return batch;
+	}
+
+	// Measures the batch just drained, returns whether it's over the thresholds.
+	bool Measure( enet_uint32 now );
+
+	bool IsShedding( ) const
+	{
+		return settings.shed_unreliable || settings.coalesce;
+	}
+
+	// Called for the batch's unreliable packets from newest to oldest, returns whether
+	// the packet is dropped and counts it.
+	bool Drop( uint64_t key );
+
+	// Returns whether the overload state changed.
+	bool Update( bool state );
+
+	bool IsOverloaded( ) const
+	{
+		return overloaded;
+	}
+
+	size_t Pending( ) const
+	{
+		return pending;
+	}
+
+	size_t Datagrams( ) const
+	{
+		return measured_datagrams;
+	}
+
+	enet_uint32 Gap( ) const
+	{
+		return gap;
+	}
+
+	uint64_t Shed( ) const
+	{
+		return shed;
+	}
+
+	uint64_t Coalesced( ) const
+	{
+		return coalesced;
+	}
+
+	uint64_t Overloads( ) const
+	{
+		return overloads;
+	}
+
+private:
+	policy settings;
+	bool enabled;
+	bool overloaded;
+	size_t datagrams;
+	enet_uint32 last_batch;
+	size_t pending;
+	size_t measured_datagrams;
+	enet_uint32 gap;
+	uint64_t shed;
+	uint64_t coalesced;
+	uint64_t overloads;
+	std::vector<ENetEvent> batch;
+	std::unordered_set<uint64_t> newest;
+};
+
+}
@@ -0,0 +1,84 @@
+#include "pool.hpp"
+
+namespace pool
+{
+
+workers::workers( size_t count ) :
+	job( nullptr ),
+	job_count( 0 ),
+	next( 0 ),
+	busy( 0 ),
+	generation( 0 ),
+	stopping( false )
+{
+	threads.reserve( count );
+	for( size_t k = 0; k < count; ++k )
+		threads.emplace_back( &workers::Work, this );
+}
+
+workers::~workers( )
+{
+	{
+		std::lock_guard<std::mutex> guard( lock );
+		stopping = true;
+	}
+
+	wake.notify_all( );
+	for( std::thread &thread : threads )
+		thread.join( );
+}
+
+void workers::Run( size_t count, const std::function<void( size_t )> &task )
+{
+	if( threads.empty( ) || count < 2 )
+	{
+		for( size_t k = 0; k < count; ++k )
+			task( k );
+
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard( lock );
+		job = &task;
+		job_count = count;
+		next = 0;
+		busy = threads.size( );
+		++generation;
+	}
+
+	wake.notify_all( );
+	for( size_t k = next++; k < count; k = next++ )
+		task( k );
+
+	// every worker checks in, even the ones that woke too late to take a task
+	std::unique_lock<std::mutex> guard( lock );
+	done.wait( guard, [this]( ) { return busy == 0; } );
+	job = nullptr;
+}
+
+void workers::Work( )
+{
+	uint64_t seen = 0;
+	std::unique_lock<std::mutex> guard( lock );
+	while( true )
+	{
+		wake.wait( guard, [this, seen]( ) { return stopping || generation != seen; } );
+		if( stopping )
+			return;
+
+		seen = generation;
+		const std::function<void( size_t )> *task = job;
+		size_t count = job_count;
+		guard.unlock( );
+
+		for( size_t k = next++; k < count; k = next++ )
+			( *task )( k );
+
+		guard.lock( );
+		if( --busy == 0 )
+			done.notify_all( );
+	}
+}
+
+}
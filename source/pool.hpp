@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace pool
+{
+
+// Fixed set of threads running one batch of independent tasks at a time.
+class workers
+{
+public:
+	explicit workers( size_t count );
+	~workers( );
+
+	size_t Size( ) const
+	{
+		return threads.size( );
+	}
+
+	// Calls task( k ) for every k below count, spread over the workers and the
+	// calling thread, and returns once every call has returned.
+	void Run( size_t count, const std::function<void( size_t )> &task );
+
+private:
+	workers( const workers & );
+	workers &operator=( const workers & );
+
+	void Work( );
+
+	std::vector<std::thread> threads;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const std::function<void( size_t )> *job;
+	size_t job_count;
+	std::atomic<size_t> next;
+	size_t busy;
+	uint64_t generation;
+	bool stopping;
+};
+
+}
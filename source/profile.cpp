@@ -0,0 +1,186 @@
+#include "profile.hpp"
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+
+#if defined _MSC_VER && ( defined _M_X64 || defined _M_IX86 )
+
+#include <intrin.h>
+
+#define PROFILE_TSC( ) __rdtsc( )
+
+#elif ( defined __GNUC__ || defined __clang__ ) && ( defined __x86_64__ || defined __i386__ )
+
+#include <x86intrin.h>
+
+#define PROFILE_TSC( ) __rdtsc( )
+
+#endif
+
+namespace profile
+{
+
+thread_local bool active = false;
+
+// Node 0 is the root, the call paths hang from it.
+struct node
+{
+	std::string name;
+	size_t parent;
+	std::vector<size_t> children;
+	uint64_t calls;
+	uint64_t total;
+	uint64_t max;
+	uint64_t nested;
+};
+
+static std::vector<node> nodes;
+static size_t current = 0;
+
+// Timestamp counter ticks are converted to microseconds with the rate
+// measured between Start and Stop (or the dump, while still running).
+static uint64_t started_ticks = 0;
+static uint64_t stopped_ticks = 0;
+static std::chrono::steady_clock::time_point started_time;
+static std::chrono::steady_clock::time_point stopped_time;
+
+static uint64_t GetClock( )
+{
+	return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now( ).time_since_epoch( )
+	).count( ) );
+}
+
+uint64_t Now( )
+{
+#if defined PROFILE_TSC
+	return PROFILE_TSC( );
+#else
+	return GetClock( );
+#endif
+}
+
+void Start( )
+{
+	node root = { std::string( ), 0, std::vector<size_t>( ), 0, 0, 0, 0 };
+	nodes.assign( 1, root );
+	current = 0;
+	started_time = std::chrono::steady_clock::now( );
+	started_ticks = Now( );
+	stopped_ticks = 0;
+	active = true;
+}
+
+void Stop( )
+{
+	if( !active )
+		return;
+
+	active = false;
+	stopped_time = std::chrono::steady_clock::now( );
+	stopped_ticks = Now( );
+}
+
+size_t Enter( const char *name )
+{
+	for( size_t child : nodes[current].children )
+		if( nodes[child].name == name )
+		{
+			current = child;
+			return child;
+		}
+
+	node created = { name, current, std::vector<size_t>( ), 0, 0, 0, 0 };
+	nodes.push_back( created );
+	size_t child = nodes.size( ) - 1;
+	nodes[current].children.push_back( child );
+	current = child;
+	return child;
+}
+
+void Leave( size_t index, uint64_t start )
+{
+	// a scope left open across profile_start belongs to a discarded tree
+	if( !active || index >= nodes.size( ) )
+		return;
+
+	uint64_t elapsed = Now( ) - start;
+	node &n = nodes[index];
+	++n.calls;
+	n.total += elapsed;
+	n.max = std::max( n.max, elapsed );
+	nodes[n.parent].nested += elapsed;
+	current = n.parent;
+}
+
+static double GetMicroseconds( uint64_t ticks )
+{
+#if defined PROFILE_TSC
+	uint64_t end_ticks = active ? Now( ) : stopped_ticks;
+	auto end_time = active ? std::chrono::steady_clock::now( ) : stopped_time;
+	double elapsed = std::chrono::duration<double, std::micro>( end_time - started_time ).count( );
+	if( end_ticks <= started_ticks || elapsed <= 0.0 )
+		return 0.0;
+
+	return static_cast<double>( ticks ) * elapsed / static_cast<double>( end_ticks - started_ticks );
+#else
+	return static_cast<double>( ticks ) / 1000.0;
+#endif
+}
+
+static void AppendPaths( std::string &out, size_t index, const std::string &prefix )
+{
+	const node &n = nodes[index];
+	std::string path = prefix.empty( ) ? n.name : prefix + ";" + n.name;
+	uint64_t self = n.total > n.nested ? n.total - n.nested : 0;
+	if( n.calls != 0 )
+	{
+		char value[32];
+		std::snprintf( value, sizeof( value ), " %.0f\n", GetMicroseconds( self ) );
+		out += path;
+		out += value;
+	}
+
+	for( size_t child : n.children )
+		AppendPaths( out, child, path );
+}
+
+std::string Collapsed( )
+{
+	std::string out;
+	if( nodes.empty( ) )
+		return out;
+
+	for( size_t child : nodes[0].children )
+		AppendPaths( out, child, std::string( ) );
+
+	return out;
+}
+
+std::vector<summary> Summarize( )
+{
+	std::vector<summary> out;
+	std::unordered_map<std::string, size_t> positions;
+	for( size_t k = 1; k < nodes.size( ); ++k )
+	{
+		const node &n = nodes[k];
+		auto it = positions.find( n.name );
+		if( it == positions.end( ) )
+		{
+			summary empty = { n.name, 0, 0.0, 0.0 };
+			it = positions.insert( std::make_pair( n.name, out.size( ) ) ).first;
+			out.push_back( empty );
+		}
+
+		summary &s = out[it->second];
+		s.calls += n.calls;
+		s.total += GetMicroseconds( n.total );
+		s.max = std::max( s.max, GetMicroseconds( n.max ) );
+	}
+
+	return out;
+}
+
+}
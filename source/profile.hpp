@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace profile
+{
+
+// Records call counts and times along call paths, on the thread that started
+// profiling only. While stopped, a scope costs a thread local flag check.
+extern thread_local bool active;
+
+void Start( );
+void Stop( );
+
+// Timestamp in the profiler's units, cycles where the CPU has a timestamp counter.
+uint64_t Now( );
+
+// Returns the entered node, which Leave takes back along with the entry time.
+size_t Enter( const char *name );
+void Leave( size_t node, uint64_t start );
+
+// One "outer;inner self_microseconds" line per call path, as flamegraph.pl expects.
+std::string Collapsed( );
+
+struct summary
+{
+	std::string name;
+	uint64_t calls;
+	double total;
+	double max;
+};
+
+// Totals per name across every call path, in microseconds.
+std::vector<summary> Summarize( );
+
+class scope
+{
+public:
+	explicit scope( const char *name ) :
+		node( 0 ),
+		start( 0 )
+	{
+		if( active )
+		{
+			node = Enter( name );
+			start = Now( );
+		}
+	}
+
+	~scope( )
+	{
+		if( node != 0 )
+			Leave( node, start );
+	}
+
+private:
+	scope( const scope & );
+	scope &operator=( const scope & );
+
+	size_t node;
+	uint64_t start;
+};
+
+}
@@ -0,0 +1,717 @@
+#include "shm.hpp"
+#include <cstring>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+
+#if defined _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#else
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+
+#endif
+
+namespace shm
+{
+
+static const char magic[8] = { 'E', 'N', 'E', 'T', 'S', 'H', 'M', '1' };
+static const uint32_t version = 3;
+static const uint32_t wrap_marker = 0xFFFFFFFF;
+
+enum slot_state
+{
+	STATE_FREE,
+	STATE_CLAIMING,
+	STATE_REQUESTED,
+	STATE_CONNECTED,
+	STATE_CLIENT_CLOSED,
+	STATE_SERVER_CLOSED
+};
+
+// rings[0] carries data from the client to the server, rings[1] the other way
+static const size_t to_server = 0;
+static const size_t to_client = 1;
+
+// beats[0] is written by the client, beats[1] by the server
+static const size_t client_beat = 0;
+static const size_t server_beat = 1;
+
+struct header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t slots;
+	uint64_t ring_size;
+	std::atomic<uint32_t> owner;
+	uint32_t reserved;
+};
+
+struct ring
+{
+	std::atomic<uint64_t> head;
+	uint8_t head_padding[64 - sizeof( std::atomic<uint64_t> )];
+	std::atomic<uint64_t> tail;
+	uint8_t tail_padding[64 - sizeof( std::atomic<uint64_t> )];
+};
+
+struct slot
+{
+	std::atomic<uint32_t> state;
+	uint32_t connect_data;
+	std::atomic<uint32_t> disconnect_data;
+	std::atomic<uint32_t> generation;
+	std::atomic<uint64_t> beats[2];
+	uint8_t padding[32];
+	ring rings[2];
+};
+
+struct record
+{
+	uint32_t size;
+	uint32_t flags;
+	uint8_t channel;
+	uint8_t reserved[7];
+};
+
+inline uint64_t Align( uint64_t value )
+{
+	return ( value + 63 ) & ~static_cast<uint64_t>( 63 );
+}
+
+inline uint64_t AlignRecord( uint64_t value )
+{
+	return ( value + 7 ) & ~static_cast<uint64_t>( 7 );
+}
+
+static const uint64_t header_size = Align( sizeof( header ) );
+
+// Milliseconds on a clock every process on the machine shares.
+static uint64_t GetBeatTime( )
+{
+	return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now( ).time_since_epoch( )
+	).count( ) );
+}
+
+static uint32_t GetProcessId( )
+{
+#if defined _WIN32
+	return static_cast<uint32_t>( GetCurrentProcessId( ) );
+#else
+	return static_cast<uint32_t>( getpid( ) );
+#endif
+}
+
+class segment
+{
+public:
+	segment( ) :
+		data( nullptr ),
+		size( 0 ),
+		owner( false ),
+#if defined _WIN32
+		map( nullptr )
+#else
+		fd( -1 )
+#endif
+	{ }
+
+	~segment( )
+	{
+		Close( );
+	}
+
+	bool Create( const std::string &segment_name, size_t slots, size_t ring_size )
+	{
+		name = GetSystemName( segment_name );
+		size = static_cast<size_t>( header_size + Align( sizeof( slot ) * slots ) + slots * 2 * ring_size );
+		owner = true;
+
+#if defined _WIN32
+
+		uint64_t size64 = size;
+		map = CreateFileMappingA(
+			INVALID_HANDLE_VALUE,
+			nullptr,
+			PAGE_READWRITE,
+			static_cast<DWORD>( size64 >> 32 ),
+			static_cast<DWORD>( size64 & 0xFFFFFFFF ),
+			name.c_str( )
+		);
+		if( map == nullptr || GetLastError( ) == ERROR_ALREADY_EXISTS )
+		{
+			Close( );
+			return false;
+		}
+
+		data = static_cast<uint8_t *>( MapViewOfFile( map, FILE_MAP_ALL_ACCESS, 0, 0, size ) );
+
+#else
+
+		fd = shm_open( name.c_str( ), O_RDWR | O_CREAT | O_EXCL, 0600 );
+		if( fd == -1 && errno == EEXIST )
+			fd = TakeOver( );
+
+		if( fd == -1 || ftruncate( fd, 0 ) != 0 || ftruncate( fd, static_cast<off_t>( size ) ) != 0 )
+		{
+			Close( );
+			return false;
+		}
+
+		void *addr = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+		data = addr != MAP_FAILED ? static_cast<uint8_t *>( addr ) : nullptr;
+
+#endif
+
+		if( data == nullptr )
+		{
+			Close( );
+			return false;
+		}
+
+		std::memset( data, 0, size );
+		header *hdr = GetHeader( );
+		hdr->version = version;
+		hdr->slots = static_cast<uint32_t>( slots );
+		hdr->ring_size = ring_size;
+		hdr->owner.store( GetProcessId( ), std::memory_order_relaxed );
+		for( size_t k = 0; k < slots; ++k )
+			new( GetSlot( k ) ) slot( );
+
+		// the magic goes in last, clients won't use the segment before it's ready
+		std::atomic_thread_fence( std::memory_order_release );
+		std::memcpy( hdr->magic, magic, sizeof( magic ) );
+		return true;
+	}
+
+	bool Open( const std::string &segment_name )
+	{
+		name = GetSystemName( segment_name );
+		owner = false;
+
+#if defined _WIN32
+
+		map = OpenFileMappingA( FILE_MAP_ALL_ACCESS, FALSE, name.c_str( ) );
+		if( map == nullptr )
+			return false;
+
+		data = static_cast<uint8_t *>( MapViewOfFile( map, FILE_MAP_ALL_ACCESS, 0, 0, 0 ) );
+		MEMORY_BASIC_INFORMATION info;
+		if( data != nullptr && VirtualQuery( data, &info, sizeof( info ) ) != 0 )
+			size = info.RegionSize;
+
+#else
+
+		fd = shm_open( name.c_str( ), O_RDWR, 0600 );
+		struct stat info;
+		if( fd == -1 || fstat( fd, &info ) != 0 )
+		{
+			Close( );
+			return false;
+		}
+
+		size = static_cast<size_t>( info.st_size );
+		void *addr = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+		data = addr != MAP_FAILED ? static_cast<uint8_t *>( addr ) : nullptr;
+
+#endif
+
+		const header *hdr = GetHeader( );
+		if( data == nullptr || size < header_size ||
+			std::memcmp( hdr->magic, magic, sizeof( magic ) ) != 0 ||
+			hdr->version != version ||
+			size < header_size + Align( sizeof( slot ) * hdr->slots ) + hdr->slots * 2 * hdr->ring_size )
+		{
+			Close( );
+			return false;
+		}
+
+		std::atomic_thread_fence( std::memory_order_acquire );
+		return true;
+	}
+
+	void Close( )
+	{
+#if defined _WIN32
+
+		if( data != nullptr )
+			UnmapViewOfFile( data );
+
+		if( map != nullptr )
+			CloseHandle( map );
+
+		map = nullptr;
+
+#else
+
+		if( data != nullptr )
+			munmap( data, size );
+
+		if( fd != -1 )
+			close( fd );
+
+		if( owner && fd != -1 )
+			shm_unlink( name.c_str( ) );
+
+		fd = -1;
+
+#endif
+
+		data = nullptr;
+		size = 0;
+	}
+
+	header *GetHeader( ) const
+	{
+		return reinterpret_cast<header *>( data );
+	}
+
+	size_t Slots( ) const
+	{
+		return GetHeader( )->slots;
+	}
+
+	slot *GetSlot( size_t index ) const
+	{
+		return reinterpret_cast<slot *>( data + header_size ) + index;
+	}
+
+	uint8_t *GetRing( size_t index, size_t direction ) const
+	{
+		const header *hdr = GetHeader( );
+		return data + header_size + Align( sizeof( slot ) * hdr->slots ) +
+			( index * 2 + direction ) * hdr->ring_size;
+	}
+
+	uint64_t RingSize( ) const
+	{
+		return GetHeader( )->ring_size;
+	}
+
+private:
+	segment( const segment & );
+	segment &operator=( const segment & );
+
+#if !defined _WIN32
+
+	// A segment left behind by a crashed server is taken over, one whose owner is
+	// still running isn't. So is one without an owner yet, which may be mid-creation.
+	// The owner is swapped atomically, so only one of several processes racing for
+	// the same stale segment gets it.
+	int TakeOver( ) const
+	{
+		int existing = shm_open( name.c_str( ), O_RDWR, 0600 );
+		struct stat info;
+		if( existing == -1 )
+			return -1;
+
+		if( fstat( existing, &info ) != 0 || static_cast<uint64_t>( info.st_size ) < header_size )
+		{
+			close( existing );
+			return -1;
+		}
+
+		void *addr = mmap( nullptr, header_size, PROT_READ | PROT_WRITE, MAP_SHARED, existing, 0 );
+		if( addr == MAP_FAILED )
+		{
+			close( existing );
+			return -1;
+		}
+
+		header *hdr = static_cast<header *>( addr );
+		uint32_t previous = hdr->owner.load( std::memory_order_acquire );
+		bool stale = std::memcmp( hdr->magic, magic, sizeof( magic ) ) == 0 && hdr->version == version &&
+			previous != 0 && kill( static_cast<pid_t>( previous ), 0 ) != 0 && errno == ESRCH &&
+			hdr->owner.compare_exchange_strong( previous, GetProcessId( ) );
+		munmap( addr, header_size );
+		if( !stale )
+		{
+			close( existing );
+			return -1;
+		}
+
+		return existing;
+	}
+
+#endif
+
+	static std::string GetSystemName( const std::string &segment_name )
+	{
+#if defined _WIN32
+		return "Local\\enet-" + segment_name;
+#else
+		return "/enet-" + segment_name;
+#endif
+	}
+
+	std::string name;
+	uint8_t *data;
+	size_t size;
+	bool owner;
+#if defined _WIN32
+	HANDLE map;
+#else
+	int fd;
+#endif
+};
+
+static bool Write( segment *seg, size_t index, size_t direction, uint8_t channel, uint32_t flags, const void *data, size_t len )
+{
+	ring &r = seg->GetSlot( index )->rings[direction];
+	uint8_t *area = seg->GetRing( index, direction );
+	const uint64_t size = seg->RingSize( );
+	const uint64_t needed = AlignRecord( sizeof( record ) + len );
+	if( needed > size )
+		return false;
+
+	uint64_t head = r.head.load( std::memory_order_relaxed );
+	uint64_t tail = r.tail.load( std::memory_order_acquire );
+	uint64_t position = head % size;
+	uint64_t contiguous = size - position;
+	uint64_t skip = contiguous < needed ? contiguous : 0;
+	if( size - ( head - tail ) < skip + needed )
+		return false;
+
+	if( skip != 0 )
+	{
+		if( contiguous >= sizeof( uint32_t ) )
+			*reinterpret_cast<uint32_t *>( area + position ) = wrap_marker;
+
+		head += skip;
+		position = 0;
+	}
+
+	record *rec = reinterpret_cast<record *>( area + position );
+	rec->size = static_cast<uint32_t>( len );
+	rec->flags = flags;
+	rec->channel = channel;
+	std::memcpy( rec + 1, data, len );
+
+	r.head.store( head + needed, std::memory_order_release );
+	return true;
+}
+
+static bool Read( segment *seg, size_t index, size_t direction, event &ev )
+{
+	ring &r = seg->GetSlot( index )->rings[direction];
+	const uint8_t *area = seg->GetRing( index, direction );
+	const uint64_t size = seg->RingSize( );
+
+	uint64_t tail = r.tail.load( std::memory_order_relaxed );
+	uint64_t head = r.head.load( std::memory_order_acquire );
+	if( tail == head )
+		return false;
+
+	uint64_t position = tail % size;
+	if( size - position < sizeof( record ) ||
+		*reinterpret_cast<const uint32_t *>( area + position ) == wrap_marker )
+	{
+		tail += size - position;
+		position = 0;
+		if( tail == head )
+		{
+			r.tail.store( tail, std::memory_order_release );
+			return false;
+		}
+	}
+
+	const record *rec = reinterpret_cast<const record *>( area + position );
+	ev.channel = rec->channel;
+	ev.flags = rec->flags;
+	ev.payload.assign( reinterpret_cast<const char *>( rec + 1 ), rec->size );
+
+	r.tail.store( tail + AlignRecord( sizeof( record ) + rec->size ), std::memory_order_release );
+	return true;
+}
+
+host::host( ) :
+	listening( false ),
+	own( nullptr ),
+	next( 0 ),
+	timeout( default_timeout ),
+	last_beat( 0 )
+{ }
+
+host::~host( )
+{
+	for( link &l : links )
+		if( l.seg != nullptr )
+		{
+			if( l.connected )
+				Disconnect( static_cast<size_t>( &l - links.data( ) ), 0 );
+
+			Unlink( l );
+		}
+
+	delete own;
+}
+
+bool host::Listen( const std::string &name, size_t peers, size_t ring_size )
+{
+	if( peers == 0 || peers > maximum_peers || ring_size < 64 || ring_size % 64 != 0 )
+		return false;
+
+	own = new segment;
+	if( !own->Create( name, peers, ring_size ) )
+	{
+		delete own;
+		own = nullptr;
+		return false;
+	}
+
+	listening = true;
+	links.resize( peers );
+	for( size_t k = 0; k < peers; ++k )
+	{
+		links[k].seg = own;
+		links[k].slot = k;
+		links[k].generation = 0;
+		links[k].connected = false;
+		links[k].closing = false;
+	}
+
+	return true;
+}
+
+bool host::Client( size_t peers )
+{
+	if( peers == 0 || peers > maximum_peers )
+		return false;
+
+	link empty = { nullptr, 0, 0, false, false };
+	links.assign( peers, empty );
+	return true;
+}
+
+int32_t host::Connect( const std::string &name, uint32_t data )
+{
+	if( listening )
+		return -1;
+
+	size_t index = 0;
+	while( index < links.size( ) && links[index].seg != nullptr )
+		++index;
+
+	if( index == links.size( ) )
+		return -1;
+
+	segment *seg = new segment;
+	if( !seg->Open( name ) )
+	{
+		delete seg;
+		return -1;
+	}
+
+	uint64_t now = GetBeatTime( );
+	for( size_t k = 0; k < seg->Slots( ); ++k )
+	{
+		// the beat goes in before claiming, so the server never sees a claiming slot
+		// with the previous client's beat and frees it under us
+		slot *s = seg->GetSlot( k );
+		uint32_t expected = STATE_FREE;
+		if( s->state.load( std::memory_order_relaxed ) != STATE_FREE )
+			continue;
+
+		s->beats[client_beat].store( now, std::memory_order_relaxed );
+		s->beats[server_beat].store( now, std::memory_order_relaxed );
+		if( !s->state.compare_exchange_strong( expected, STATE_CLAIMING ) )
+			continue;
+
+		for( ring &r : s->rings )
+		{
+			r.head.store( 0, std::memory_order_relaxed );
+			r.tail.store( 0, std::memory_order_relaxed );
+		}
+
+		s->connect_data = data;
+		s->disconnect_data.store( 0, std::memory_order_relaxed );
+		uint32_t generation = s->generation.load( std::memory_order_relaxed ) + 1;
+		s->generation.store( generation, std::memory_order_relaxed );
+		s->state.store( STATE_REQUESTED, std::memory_order_release );
+
+		link &l = links[index];
+		l.seg = seg;
+		l.slot = k;
+		l.generation = generation;
+		l.connected = false;
+		l.closing = false;
+		return static_cast<int32_t>( index );
+	}
+
+	delete seg;
+	return -1;
+}
+
+bool host::Send( size_t peer, uint8_t channel, uint32_t flags, const void *data, size_t len )
+{
+	if( peer >= links.size( ) || !links[peer].connected || links[peer].closing || IsLost( links[peer] ) )
+		return false;
+
+	const link &l = links[peer];
+	return shm::Write( l.seg, l.slot, listening ? to_client : to_server, channel, flags, data, len );
+}
+
+void host::Disconnect( size_t peer, uint32_t data )
+{
+	if( peer >= links.size( ) || links[peer].seg == nullptr || links[peer].closing )
+		return;
+
+	link &l = links[peer];
+	l.closing = true;
+	if( IsLost( l ) )
+		return;
+
+	slot *s = l.seg->GetSlot( l.slot );
+	uint32_t expected = STATE_CONNECTED;
+	s->disconnect_data.store( data, std::memory_order_relaxed );
+	if( !s->state.compare_exchange_strong( expected, listening ? STATE_SERVER_CLOSED : STATE_CLIENT_CLOSED ) &&
+		!listening && expected == STATE_REQUESTED )
+		s->state.store( STATE_CLIENT_CLOSED, std::memory_order_release );
+}
+
+bool host::IsConnected( size_t peer ) const
+{
+	return peer < links.size( ) && links[peer].connected && !links[peer].closing;
+}
+
+void host::Beat( uint64_t now )
+{
+	last_beat = now;
+	for( const link &l : links )
+		if( l.seg != nullptr )
+			l.seg->GetSlot( l.slot )->beats[listening ? server_beat : client_beat].store( now, std::memory_order_relaxed );
+}
+
+// A server that gave up on a client frees its slot, which someone else may claim.
+bool host::IsLost( const link &l ) const
+{
+	return !listening && l.seg->GetSlot( l.slot )->generation.load( std::memory_order_acquire ) != l.generation;
+}
+
+bool host::IsExpired( const link &l, uint64_t now ) const
+{
+	if( timeout == 0 )
+		return false;
+
+	uint64_t beat = l.seg->GetSlot( l.slot )->beats[listening ? client_beat : server_beat].load( std::memory_order_relaxed );
+	return now > beat && now - beat > timeout;
+}
+
+void host::Unlink( link &l )
+{
+	if( !listening )
+	{
+		delete l.seg;
+		l.seg = nullptr;
+	}
+
+	l.connected = false;
+	l.closing = false;
+}
+
+bool host::Poll( event &ev )
+{
+	uint64_t now = GetBeatTime( );
+	if( now - last_beat >= beat_interval )
+		Beat( now );
+
+	for( size_t n = 0; n < links.size( ); ++n )
+	{
+		size_t index = ( next + n ) % links.size( );
+		link &l = links[index];
+		if( l.seg == nullptr )
+			continue;
+
+		slot *s = l.seg->GetSlot( l.slot );
+		uint32_t state = s->state.load( std::memory_order_acquire );
+		ev.peer = index;
+		ev.data = 0;
+		ev.channel = 0;
+		ev.flags = 0;
+		ev.payload.clear( );
+
+		if( IsLost( l ) )
+		{
+			ev.type = EVENT_DISCONNECT;
+			Unlink( l );
+			next = index + 1;
+			return true;
+		}
+
+		if( !l.connected && !l.closing )
+		{
+			if( listening && state == STATE_REQUESTED && !IsExpired( l, now ) )
+			{
+				ev.data = s->connect_data;
+				s->beats[server_beat].store( now, std::memory_order_relaxed );
+				s->state.store( STATE_CONNECTED, std::memory_order_release );
+			}
+			else if( listening || state != STATE_CONNECTED )
+			{
+				// a client that gave up or died before being accepted
+				if( listening && ( state == STATE_CLIENT_CLOSED ||
+					( ( state == STATE_CLAIMING || state == STATE_REQUESTED ) && IsExpired( l, now ) ) ) )
+					s->state.store( STATE_FREE, std::memory_order_release );
+
+				// a server that died before accepting, disconnected below
+				if( listening || !IsExpired( l, now ) )
+					continue;
+
+				l.closing = true;
+			}
+
+			if( !l.closing )
+			{
+				l.connected = true;
+				ev.type = EVENT_CONNECT;
+				next = index + 1;
+				return true;
+			}
+		}
+
+		// whatever is still in the ring is delivered before the disconnect
+		if( l.connected && shm::Read( l.seg, l.slot, listening ? to_server : to_client, ev ) )
+		{
+			ev.type = EVENT_RECEIVE;
+			next = index + 1;
+			return true;
+		}
+
+		// a dead process reads like one that closed the slot, without disconnect data
+		bool expired = IsExpired( l, now );
+		bool remote_closed = state == ( listening ? STATE_CLIENT_CLOSED : STATE_SERVER_CLOSED ) ||
+			( expired && !l.closing );
+		if( !remote_closed && !l.closing )
+			continue;
+
+		// the side that didn't initiate the disconnect frees the slot, a server that
+		// disconnected a client frees it once the client has let go of it or died
+		if( remote_closed || expired )
+			s->state.store( STATE_FREE, std::memory_order_release );
+		else if( listening && state == STATE_SERVER_CLOSED )
+			continue;
+
+		bool notify = l.connected || !listening;
+		ev.type = EVENT_DISCONNECT;
+		ev.data = expired ? 0 : s->disconnect_data.load( std::memory_order_relaxed );
+		Unlink( l );
+		if( !notify )
+			continue;
+
+		next = index + 1;
+		return true;
+	}
+
+	return false;
+}
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace shm
+{
+
+// Transport between processes on the same machine through a named shared memory
+// segment. A listening host owns the segment, split into peer slots, each with a
+// single producer single consumer ring per direction. Connecting claims a free slot.
+// Delivery is always reliable and ordered, so packet flags are only passed along.
+// Both ends stamp their slots every beat_interval while polling, a slot whose other
+// end stopped for longer than the timeout is disconnected and freed, so a process
+// that died doesn't hold on to it.
+static const size_t default_ring_size = 1 << 20;
+static const size_t maximum_peers = 4096;
+static const uint32_t default_timeout = 10000;
+static const uint32_t beat_interval = 250;
+
+enum event_type
+{
+	EVENT_NONE,
+	EVENT_CONNECT,
+	EVENT_DISCONNECT,
+	EVENT_RECEIVE
+};
+
+struct event
+{
+	event_type type;
+	size_t peer;
+	uint32_t data;
+	uint8_t channel;
+	uint32_t flags;
+	std::string payload;
+};
+
+class segment;
+
+class host
+{
+public:
+	host( );
+	~host( );
+
+	// Creates the named segment and accepts up to peers connections through it.
+	bool Listen( const std::string &name, size_t peers, size_t ring_size );
+
+	// Prepares a host that only makes outgoing connections, up to peers of them.
+	bool Client( size_t peers );
+
+	// Returns the new peer's index, or -1 when the segment or a free slot is missing.
+	int32_t Connect( const std::string &name, uint32_t data );
+
+	// Returns false when the peer isn't connected or its outgoing ring is full.
+	bool Send( size_t peer, uint8_t channel, uint32_t flags, const void *data, size_t len );
+
+	void Disconnect( size_t peer, uint32_t data );
+
+	// Returns false when nothing happened since the last call.
+	bool Poll( event &ev );
+
+	bool IsConnected( size_t peer ) const;
+
+	// Milliseconds without a beat from the other end before a slot is reclaimed, 0 never.
+	void SetTimeout( uint32_t milliseconds )
+	{
+		timeout = milliseconds;
+	}
+
+	size_t PeerCount( ) const
+	{
+		return links.size( );
+	}
+
+	// Stable for the host's lifetime, for keying Lua objects by peer.
+	const void *GetKey( size_t peer ) const
+	{
+		return &links[peer];
+	}
+
+private:
+	host( const host & );
+	host &operator=( const host & );
+
+	struct link
+	{
+		segment *seg;
+		size_t slot;
+		uint32_t generation;
+		bool connected;
+		bool closing;
+	};
+
+	void Unlink( link &l );
+	void Beat( uint64_t now );
+	bool IsLost( const link &l ) const;
+	bool IsExpired( const link &l, uint64_t now ) const;
+
+	bool listening;
+	segment *own;
+	std::vector<link> links;
+	size_t next;
+	uint32_t timeout;
+	uint64_t last_beat;
+};
+
+}
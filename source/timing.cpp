@@ -0,0 +1,19 @@
+#include "timing.hpp"
+#include <chrono>
+
+namespace timing
+{
+
+uint64_t GetMicroseconds( )
+{
+	return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now( ).time_since_epoch( )
+	).count( ) );
+}
+
+double GetMilliseconds( )
+{
+	return GetMicroseconds( ) / 1000.0;
+}
+
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+namespace timing
+{
+
+// Monotonic clock for timing things across calls, like snapshot arrivals and playout.
+// The epoch is unspecified.
+uint64_t GetMicroseconds( );
+
+double GetMilliseconds( );
+
+}
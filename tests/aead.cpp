@@ -0,0 +1,166 @@
+#include "test.hpp"
+#include "aead.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// ChaCha20-Poly1305 AEAD decryption test vector from RFC 8439 appendix A.5. Its nonce
+// starts with four zero bytes, like the ones built from the 64 bits counter.
+static const uint8_t rfc_key[aead::key_size] = {
+	0x1C, 0x92, 0x40, 0xA5, 0xEB, 0x55, 0xD3, 0x8A, 0xF3, 0x33, 0x88, 0x86, 0x04, 0xF6, 0xB5, 0xF0,
+	0x47, 0x39, 0x17, 0xC1, 0x40, 0x2B, 0x80, 0x09, 0x9D, 0xCA, 0x5C, 0xBC, 0x20, 0x70, 0x75, 0xC0
+};
+
+static const uint64_t rfc_nonce = 0x0807060504030201;
+
+static const uint8_t rfc_aad[] = {
+	0xF3, 0x33, 0x88, 0x86, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4E, 0x91
+};
+
+static const uint8_t rfc_ciphertext[] = {
+	0x64, 0xA0, 0x86, 0x15, 0x75, 0x86, 0x1A, 0xF4, 0x60, 0xF0, 0x62, 0xC7, 0x9B, 0xE6, 0x43, 0xBD,
+	0x5E, 0x80, 0x5C, 0xFD, 0x34, 0x5C, 0xF3, 0x89, 0xF1, 0x08, 0x67, 0x0A, 0xC7, 0x6C, 0x8C, 0xB2,
+	0x4C, 0x6C, 0xFC, 0x18, 0x75, 0x5D, 0x43, 0xEE, 0xA0, 0x9E, 0xE9, 0x4E, 0x38, 0x2D, 0x26, 0xB0,
+	0xBD, 0xB7, 0xB7, 0x3C, 0x32, 0x1B, 0x01, 0x00, 0xD4, 0xF0, 0x3B, 0x7F, 0x35, 0x58, 0x94, 0xCF,
+	0x33, 0x2F, 0x83, 0x0E, 0x71, 0x0B, 0x97, 0xCE, 0x98, 0xC8, 0xA8, 0x4A, 0xBD, 0x0B, 0x94, 0x81,
+	0x14, 0xAD, 0x17, 0x6E, 0x00, 0x8D, 0x33, 0xBD, 0x60, 0xF9, 0x82, 0xB1, 0xFF, 0x37, 0xC8, 0x55,
+	0x97, 0x97, 0xA0, 0x6E, 0xF4, 0xF0, 0xEF, 0x61, 0xC1, 0x86, 0x32, 0x4E, 0x2B, 0x35, 0x06, 0x38,
+	0x36, 0x06, 0x90, 0x7B, 0x6A, 0x7C, 0x02, 0xB0, 0xF9, 0xF6, 0x15, 0x7B, 0x53, 0xC8, 0x67, 0xE4,
+	0xB9, 0x16, 0x6C, 0x76, 0x7B, 0x80, 0x4D, 0x46, 0xA5, 0x9B, 0x52, 0x16, 0xCD, 0xE7, 0xA4, 0xE9,
+	0x90, 0x40, 0xC5, 0xA4, 0x04, 0x33, 0x22, 0x5E, 0xE2, 0x82, 0xA1, 0xB0, 0xA0, 0x6C, 0x52, 0x3E,
+	0xAF, 0x45, 0x34, 0xD7, 0xF8, 0x3F, 0xA1, 0x15, 0x5B, 0x00, 0x47, 0x71, 0x8C, 0xBC, 0x54, 0x6A,
+	0x0D, 0x07, 0x2B, 0x04, 0xB3, 0x56, 0x4E, 0xEA, 0x1B, 0x42, 0x22, 0x73, 0xF5, 0x48, 0x27, 0x1A,
+	0x0B, 0xB2, 0x31, 0x60, 0x53, 0xFA, 0x76, 0x99, 0x19, 0x55, 0xEB, 0xD6, 0x31, 0x59, 0x43, 0x4E,
+	0xCE, 0xBB, 0x4E, 0x46, 0x6D, 0xAE, 0x5A, 0x10, 0x73, 0xA6, 0x72, 0x76, 0x27, 0x09, 0x7A, 0x10,
+	0x49, 0xE6, 0x17, 0xD9, 0x1D, 0x36, 0x10, 0x94, 0xFA, 0x68, 0xF0, 0xFF, 0x77, 0x98, 0x71, 0x30,
+	0x30, 0x5B, 0xEA, 0xBA, 0x2E, 0xDA, 0x04, 0xDF, 0x99, 0x7B, 0x71, 0x4D, 0x6C, 0x6F, 0x2C, 0x29,
+	0xA6, 0xAD, 0x5C, 0xB4, 0x02, 0x2B, 0x02, 0x70, 0x9B
+};
+
+static const uint8_t rfc_tag[aead::tag_size] = {
+	0xEE, 0xAD, 0x9D, 0x67, 0x89, 0x0C, 0xBB, 0x22, 0x39, 0x23, 0x36, 0xFE, 0xA1, 0x85, 0x1F, 0x38
+};
+
+static const char rfc_plaintext[] =
+	"Internet-Drafts are draft documents valid for a maximum of six months and may be "
+	"updated, replaced, or obsoleted by other documents at any time. It is inappropriate "
+	"to use Internet-Drafts as reference material or to cite them other than as "
+	"/\xE2\x80\x9Cwork in progress./\xE2\x80\x9D";
+
+TEST( aead_rfc8439_open )
+{
+	CHECK( sizeof( rfc_ciphertext ) == sizeof( rfc_plaintext ) - 1 );
+
+	uint8_t output[sizeof( rfc_ciphertext )];
+	CHECK( aead::Open(
+		rfc_key,
+		rfc_nonce,
+		rfc_aad,
+		sizeof( rfc_aad ),
+		rfc_ciphertext,
+		sizeof( rfc_ciphertext ),
+		rfc_tag,
+		output
+	) );
+	CHECK( std::memcmp( output, rfc_plaintext, sizeof( output ) ) == 0 );
+}
+
+TEST( aead_rfc8439_seal )
+{
+	uint8_t output[sizeof( rfc_ciphertext )], tag[aead::tag_size];
+	aead::Seal(
+		rfc_key,
+		rfc_nonce,
+		rfc_aad,
+		sizeof( rfc_aad ),
+		reinterpret_cast<const uint8_t *>( rfc_plaintext ),
+		sizeof( output ),
+		output,
+		tag
+	);
+	CHECK( std::memcmp( output, rfc_ciphertext, sizeof( output ) ) == 0 );
+	CHECK( std::memcmp( tag, rfc_tag, sizeof( tag ) ) == 0 );
+}
+
+TEST( aead_rejects_forgeries )
+{
+	std::vector<uint8_t> ciphertext( rfc_ciphertext, rfc_ciphertext + sizeof( rfc_ciphertext ) );
+	std::vector<uint8_t> aad( rfc_aad, rfc_aad + sizeof( rfc_aad ) );
+	std::vector<uint8_t> tag( rfc_tag, rfc_tag + sizeof( rfc_tag ) );
+	uint8_t output[sizeof( rfc_ciphertext )];
+
+	ciphertext[100] ^= 1;
+	CHECK( !aead::Open( rfc_key, rfc_nonce, aad.data( ), aad.size( ), ciphertext.data( ), ciphertext.size( ), tag.data( ), output ) );
+	ciphertext[100] ^= 1;
+
+	aad[0] ^= 0x80;
+	CHECK( !aead::Open( rfc_key, rfc_nonce, aad.data( ), aad.size( ), ciphertext.data( ), ciphertext.size( ), tag.data( ), output ) );
+	aad[0] ^= 0x80;
+
+	tag[15] ^= 1;
+	CHECK( !aead::Open( rfc_key, rfc_nonce, aad.data( ), aad.size( ), ciphertext.data( ), ciphertext.size( ), tag.data( ), output ) );
+	tag[15] ^= 1;
+
+	CHECK( !aead::Open( rfc_key, rfc_nonce + 1, aad.data( ), aad.size( ), ciphertext.data( ), ciphertext.size( ), tag.data( ), output ) );
+	CHECK( aead::Open( rfc_key, rfc_nonce, aad.data( ), aad.size( ), ciphertext.data( ), ciphertext.size( ), tag.data( ), output ) );
+}
+
+// The binding opens packets in place, with the output starting before the ciphertext.
+TEST( aead_open_in_place )
+{
+	const size_t offset = 9;
+	std::vector<uint8_t> buffer( offset + sizeof( rfc_ciphertext ) );
+	std::memcpy( buffer.data( ) + offset, rfc_ciphertext, sizeof( rfc_ciphertext ) );
+	CHECK( aead::Open(
+		rfc_key,
+		rfc_nonce,
+		rfc_aad,
+		sizeof( rfc_aad ),
+		buffer.data( ) + offset,
+		sizeof( rfc_ciphertext ),
+		rfc_tag,
+		buffer.data( )
+	) );
+	CHECK( std::memcmp( buffer.data( ), rfc_plaintext, sizeof( rfc_ciphertext ) ) == 0 );
+}
+
+// HChaCha20 test vector from draft-irtf-cfrg-xchacha section 2.2.1.
+TEST( aead_derive_key )
+{
+	uint8_t key[aead::key_size];
+	for( size_t k = 0; k < sizeof( key ); ++k )
+		key[k] = static_cast<uint8_t>( k );
+
+	const uint8_t input[16] = {
+		0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x4A, 0x00, 0x00, 0x00, 0x00, 0x31, 0x41, 0x59, 0x27
+	};
+	const uint8_t expected[aead::key_size] = {
+		0x82, 0x41, 0x3B, 0x42, 0x27, 0xB2, 0x7B, 0xFE, 0xD3, 0x0E, 0x42, 0x50, 0x8A, 0x87, 0x7D, 0x73,
+		0xA0, 0xF9, 0xE4, 0xD5, 0x8A, 0x74, 0xA8, 0x53, 0xC1, 0x2E, 0xC4, 0x13, 0x26, 0xD3, 0xEC, 0xDC
+	};
+
+	uint8_t output[aead::key_size];
+	aead::DeriveKey( output, key, input );
+	CHECK( std::memcmp( output, expected, sizeof( output ) ) == 0 );
+}
+
+// Lengths around the 64 bytes ChaCha20 block and 16 bytes Poly1305 block boundaries.
+TEST( aead_round_trip )
+{
+	uint8_t key[aead::key_size];
+	for( size_t k = 0; k < sizeof( key ); ++k )
+		key[k] = static_cast<uint8_t>( 255 - k );
+
+	std::vector<uint8_t> input( 300 ), sealed( 300 ), opened( 300 );
+	for( size_t k = 0; k < input.size( ); ++k )
+		input[k] = static_cast<uint8_t>( k * 7 );
+
+	const uint8_t aad[] = { 2, 1, 0, 0, 0, 0, 0, 0, 0, 3 };
+	for( size_t len = 0; len < input.size( ); len += 13 )
+	{
+		uint8_t tag[aead::tag_size];
+		aead::Seal( key, len, aad, sizeof( aad ), input.data( ), len, sealed.data( ), tag );
+		CHECK( aead::Open( key, len, aad, sizeof( aad ), sealed.data( ), len, tag, opened.data( ) ) );
+		CHECK( std::memcmp( opened.data( ), input.data( ), len ) == 0 );
+	}
+}
@@ -0,0 +1,80 @@
+#include "test.hpp"
+#include "bitstream.hpp"
+#include <cstring>
+#include <vector>
+
+TEST( bitstream_round_trip )
+{
+	bitstream::writer w;
+	w.Write( 1, 1 );
+	w.Write( 5, 3 );
+	w.Write( 0xABCDE, 20 );
+	w.Write( 0xFFFFFFFF, 32 );
+	w.WriteVarint( 300 );
+	w.WriteBytes( "abc", 3 );
+	w.Write( 2, 2 );
+	const std::vector<uint8_t> &data = w.Finish( );
+
+	// 1 + 3 + 20 + 32 + 16 + 24 + 2 bits
+	CHECK( data.size( ) == 13 );
+
+	bitstream::reader r( data.data( ), data.size( ) );
+	uint32_t value = 0;
+	char bytes[3];
+	CHECK( r.Read( value, 1 ) && value == 1 );
+	CHECK( r.Read( value, 3 ) && value == 5 );
+	CHECK( r.Read( value, 20 ) && value == 0xABCDE );
+	CHECK( r.Read( value, 32 ) && value == 0xFFFFFFFF );
+	CHECK( r.ReadVarint( value ) && value == 300 );
+	CHECK( r.ReadBytes( bytes, 3 ) && std::memcmp( bytes, "abc", 3 ) == 0 );
+	CHECK( r.Read( value, 2 ) && value == 2 );
+}
+
+// Values are masked to their width, so a wide value can't spill into the next field.
+TEST( bitstream_masks_values )
+{
+	bitstream::writer w;
+	w.Write( 0xFF, 4 );
+	w.Write( 0, 4 );
+	const std::vector<uint8_t> &data = w.Finish( );
+	CHECK( data.size( ) == 1 && data[0] == 0x0F );
+}
+
+TEST( bitstream_varint_sizes )
+{
+	const uint32_t values[] = { 0, 127, 128, 16383, 16384, 0xFFFFFFFF };
+	const size_t sizes[] = { 1, 1, 2, 2, 3, 5 };
+	for( size_t k = 0; k < 6; ++k )
+	{
+		bitstream::writer w;
+		w.WriteVarint( values[k] );
+		const std::vector<uint8_t> &data = w.Finish( );
+		CHECK( data.size( ) == sizes[k] );
+
+		bitstream::reader r( data.data( ), data.size( ) );
+		uint32_t value = 0;
+		CHECK( r.ReadVarint( value ) && value == values[k] );
+	}
+}
+
+TEST( bitstream_reads_stop_at_the_end )
+{
+	const uint8_t data[2] = { 0xFF, 0x80 };
+	bitstream::reader r( data, sizeof( data ) );
+	uint32_t value = 0;
+	CHECK( r.Read( value, 12 ) );
+	CHECK( !r.Read( value, 8 ) );
+
+	// a varint whose last byte is missing
+	bitstream::reader truncated( data, sizeof( data ) );
+	CHECK( !truncated.ReadVarint( value ) );
+
+	// more than five bytes can't be a 32 bits varint
+	const uint8_t endless[6] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 };
+	bitstream::reader overlong( endless, sizeof( endless ) );
+	CHECK( !overlong.ReadVarint( value ) );
+
+	char bytes[4];
+	bitstream::reader short_bytes( data, sizeof( data ) );
+	CHECK( !short_bytes.ReadBytes( bytes, 4 ) );
+}
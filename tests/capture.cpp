@@ -0,0 +1,112 @@
+#include "test.hpp"
+#include "capture.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <chrono>
+
+// File names are per process, so concurrent runs don't write over each other's.
+static std::string GetPath( const char *suffix )
+{
+	char path[96];
+	std::snprintf( path, sizeof( path ), "test-capture-%llu-%s.bin",
+		static_cast<unsigned long long>( std::chrono::steady_clock::now( ).time_since_epoch( ).count( ) ), suffix );
+	return path;
+}
+
+static std::string GetPayload( size_t index, size_t len )
+{
+	return std::string( len, static_cast<char>( 'a' + index % 26 ) );
+}
+
+TEST( capture_reads_back_records )
+{
+	std::string path = GetPath( "records" );
+	capture::writer w;
+	CHECK( w.Open( path, 4096 ) );
+	for( size_t k = 0; k < 10; ++k )
+	{
+		std::string payload = GetPayload( k, k * 3 + 1 );
+		w.Append( static_cast<uint32_t>( k ), static_cast<uint16_t>( 27015 + k ), payload.data( ), payload.size( ) );
+	}
+
+	CHECK( w.Records( ) == 10 && w.Dropped( ) == 0 );
+	w.Close( );
+
+	capture::reader r;
+	CHECK( r.Open( path ) );
+	CHECK( r.Remaining( ) == 10 );
+
+	const capture::record *rec = nullptr;
+	const uint8_t *data = nullptr;
+	for( size_t k = 0; k < 10; ++k )
+	{
+		CHECK( r.Next( rec, data ) );
+		CHECK( rec->host == k && rec->port == 27015 + k );
+		CHECK( std::string( reinterpret_cast<const char *>( data ), rec->size ) == GetPayload( k, k * 3 + 1 ) );
+	}
+
+	CHECK( !r.Next( rec, data ) );
+	r.Close( );
+	std::remove( path.c_str( ) );
+}
+
+// A full ring overwrites its oldest records, wrapping around, and keeps the newest in order.
+TEST( capture_ring_keeps_the_newest )
+{
+	std::string path = GetPath( "ring" );
+	capture::writer w;
+	CHECK( w.Open( path, 1024 ) );
+
+	const size_t total = 200, len = 40;
+	for( size_t k = 0; k < total; ++k )
+	{
+		std::string payload = GetPayload( k, len );
+		w.Append( static_cast<uint32_t>( k ), 0, payload.data( ), payload.size( ) );
+	}
+
+	// records too big for the whole ring are dropped
+	std::string huge( 2048, 'x' );
+	w.Append( 0, 0, huge.data( ), huge.size( ) );
+	CHECK( w.Records( ) == total && w.Dropped( ) == 1 );
+	w.Close( );
+
+	capture::reader r;
+	CHECK( r.Open( path ) );
+	uint64_t kept = r.Remaining( );
+	CHECK( kept > 0 && kept < total );
+
+	const capture::record *rec = nullptr;
+	const uint8_t *data = nullptr;
+	for( uint64_t k = total - kept; k < total; ++k )
+	{
+		CHECK( r.Next( rec, data ) );
+		CHECK( rec->host == k && rec->size == len );
+		CHECK( std::string( reinterpret_cast<const char *>( data ), rec->size ) == GetPayload( k, len ) );
+	}
+
+	CHECK( !r.Next( rec, data ) );
+	r.Close( );
+	std::remove( path.c_str( ) );
+}
+
+TEST( capture_rejects_bad_files )
+{
+	capture::writer w;
+	CHECK( !w.Open( GetPath( "small" ), 16 ) );
+
+	std::string path = GetPath( "garbage" );
+	std::FILE *file = std::fopen( path.c_str( ), "wb" );
+	CHECK( file != nullptr );
+	if( file != nullptr )
+	{
+		const char garbage[128] = "not a capture file";
+		std::fwrite( garbage, 1, sizeof( garbage ), file );
+		std::fclose( file );
+	}
+
+	capture::reader r;
+	CHECK( !r.Open( path ) );
+	CHECK( !r.Open( GetPath( "missing" ) ) );
+	std::remove( path.c_str( ) );
+}
@@ -0,0 +1,77 @@
+#include "test.hpp"
+#include "crc32c.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+typedef uint32_t ( *update_function )( uint32_t crc, const void *data, size_t len );
+
+static uint32_t Checksum( update_function update, const void *data, size_t len )
+{
+	return ~update( 0xFFFFFFFF, data, len );
+}
+
+// iSCSI read command PDU from RFC 3720 appendix B.4.
+static const uint8_t iscsi_read[48] = {
+	0x01, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x14, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x14, 0x00, 0x00, 0x00, 0x18,
+	0x28, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static void CheckKnownAnswers( update_function update )
+{
+	const char check[] = "123456789";
+	CHECK( Checksum( update, check, sizeof( check ) - 1 ) == 0xE3069283 );
+	CHECK( Checksum( update, check, 0 ) == 0 );
+
+	uint8_t data[32];
+	std::memset( data, 0, sizeof( data ) );
+	CHECK( Checksum( update, data, sizeof( data ) ) == 0x8A9136AA );
+
+	std::memset( data, 0xFF, sizeof( data ) );
+	CHECK( Checksum( update, data, sizeof( data ) ) == 0x62A8AB43 );
+
+	for( size_t k = 0; k < sizeof( data ); ++k )
+		data[k] = static_cast<uint8_t>( k );
+
+	CHECK( Checksum( update, data, sizeof( data ) ) == 0x46DD794E );
+
+	for( size_t k = 0; k < sizeof( data ); ++k )
+		data[k] = static_cast<uint8_t>( 31 - k );
+
+	CHECK( Checksum( update, data, sizeof( data ) ) == 0x113FDB5C );
+
+	CHECK( Checksum( update, iscsi_read, sizeof( iscsi_read ) ) == 0xD9963A56 );
+}
+
+TEST( crc32c_known_answers )
+{
+	CheckKnownAnswers( crc32c::Update );
+}
+
+TEST( crc32c_portable_known_answers )
+{
+	CheckKnownAnswers( crc32c::UpdatePortable );
+}
+
+// Every split point and misalignment has to give the same result as a single call.
+TEST( crc32c_incremental )
+{
+	std::vector<uint8_t> data( 301 );
+	for( size_t k = 0; k < data.size( ); ++k )
+		data[k] = static_cast<uint8_t>( k * 131 + 7 );
+
+	for( size_t offset = 0; offset < 8; ++offset )
+	{
+		size_t len = data.size( ) - offset;
+		uint32_t whole = Checksum( crc32c::UpdatePortable, data.data( ) + offset, len );
+		CHECK( Checksum( crc32c::Update, data.data( ) + offset, len ) == whole );
+
+		for( size_t split = 0; split <= len; split += 7 )
+		{
+			uint32_t crc = crc32c::Update( 0xFFFFFFFF, data.data( ) + offset, split );
+			crc = crc32c::Update( crc, data.data( ) + offset + split, len - split );
+			CHECK( ~crc == whole );
+		}
+	}
+}
@@ -0,0 +1,82 @@
+#include "test.hpp"
+#include "jitter.hpp"
+#include <string>
+
+static jitter::playout GetPlayout( )
+{
+	jitter::playout p;
+	p.tick_interval = 10.0;
+	p.min_delay = 5.0;
+	p.max_delay = 100.0;
+	p.factor = 3.0;
+	p.capacity = 4;
+	return p;
+}
+
+// Snapshots come out in tick order, and a tick at or before a released one is late.
+TEST( jitter_orders_snapshots )
+{
+	jitter::playout p = GetPlayout( );
+	jitter::buffer b;
+	CHECK( b.Add( p, 3, 30.0, "c", 1 ) );
+	CHECK( b.Add( p, 1, 31.0, "a", 1 ) );
+	CHECK( b.Add( p, 2, 32.0, "b", 1 ) );
+	CHECK( !b.Add( p, 2, 33.0, "b", 1 ) );
+
+	std::string data;
+	CHECK( b.Pop( data ) == 1 && data == "a" );
+	CHECK( !b.Add( p, 1, 34.0, "a", 1 ) );
+	CHECK( b.Pop( data ) == 2 && data == "b" );
+	CHECK( b.Pop( data ) == 3 && data == "c" );
+	CHECK( b.IsEmpty( ) && b.Late( ) == 2 );
+
+	for( uint32_t tick = 10; tick < 15; ++tick )
+		b.Add( p, tick, tick * 10.0, "x", 1 );
+
+	CHECK( b.Buffered( ) == 4 && b.Overflow( ) == 1 );
+}
+
+// The due time is the lowest transit plus the delay, which stays within its bounds.
+TEST( jitter_due_times )
+{
+	jitter::playout p = GetPlayout( );
+	jitter::buffer b;
+	b.Add( p, 0, 20.0, "", 0 );
+	CHECK( b.Due( p ) == 20.0 + p.min_delay );
+
+	b.Add( p, 1, 25.0, "", 0 );
+	CHECK( b.Due( p ) == 15.0 + p.min_delay );
+	CHECK( b.Delay( p ) >= p.min_delay && b.Delay( p ) <= p.max_delay );
+
+	// a new entry is only needed when the snapshot is due earlier than the queued one
+	CHECK( b.Schedule( p ) );
+	CHECK( b.IsScheduled( b.Due( p ) ) );
+	CHECK( !b.Schedule( p ) );
+	b.Add( p, 2, 100.0, "", 0 );
+	CHECK( !b.Schedule( p ) );
+	b.Unschedule( );
+	CHECK( b.Schedule( p ) );
+}
+
+TEST( jitter_schedule_pops_earliest )
+{
+	jitter::schedule due;
+	const double times[] = { 5.0, 1.0, 4.0, 2.0, 3.0 };
+	for( size_t k = 0; k < 5; ++k )
+	{
+		jitter::entry e;
+		e.due = times[k];
+		e.index = k;
+		e.generation = 0;
+		e.channel = 0;
+		due.Push( e );
+	}
+
+	for( double expected = 1.0; expected <= 5.0; expected += 1.0 )
+	{
+		CHECK( !due.IsEmpty( ) && due.Top( ).due == expected );
+		due.Pop( );
+	}
+
+	CHECK( due.IsEmpty( ) );
+}
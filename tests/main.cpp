@@ -0,0 +1,62 @@
+#include "test.hpp"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace test
+{
+
+struct entry
+{
+	const char *name;
+	function func;
+};
+
+// Function local so registrations from other translation units can't run before it exists.
+static std::vector<entry> &GetTests( )
+{
+	static std::vector<entry> tests;
+	return tests;
+}
+
+static size_t failures = 0;
+
+registration::registration( const char *name, function func )
+{
+	entry e = { name, func };
+	GetTests( ).push_back( e );
+}
+
+void Fail( const char *file, int line, const char *expression )
+{
+	std::printf( "  %s:%d: CHECK( %s ) failed\n", file, line, expression );
+	++failures;
+}
+
+}
+
+// Runs every test, or only the ones whose name starts with the first argument.
+int main( int argc, char **argv )
+{
+	const char *filter = argc > 1 ? argv[1] : "";
+	size_t ran = 0, failed = 0;
+	for( const test::entry &e : test::GetTests( ) )
+	{
+		if( std::strncmp( e.name, filter, std::strlen( filter ) ) != 0 )
+			continue;
+
+		size_t before = test::failures;
+		e.func( );
+		++ran;
+		if( test::failures != before )
+		{
+			std::printf( "FAIL %s\n", e.name );
+			++failed;
+		}
+		else
+			std::printf( "ok   %s\n", e.name );
+	}
+
+	std::printf( "%zu tests, %zu failed\n", ran, failed );
+	return failed == 0 && ran != 0 ? 0 : 1;
+}
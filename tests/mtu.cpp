@@ -0,0 +1,134 @@
+#include "test.hpp"
+#include "mtu.hpp"
+#include <cstring>
+
+#if defined __linux__
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#endif
+
+TEST( mtu_search_converges )
+{
+	const uint32_t path = 1400;
+	mtu::search s;
+	s.Start( 576, 1472 );
+	for( int k = 0; k < 32 && s.IsActive( ); ++k )
+	{
+		uint32_t size = s.Next( );
+		if( size <= path )
+			s.Acknowledged( size );
+		else
+			s.Lost( size );
+	}
+
+	CHECK( !s.IsActive( ) );
+	CHECK( s.Result( ) <= path && s.Result( ) + mtu::resolution > path );
+}
+
+// Late answers to sizes outside the remaining range don't move it.
+TEST( mtu_search_ignores_stale_answers )
+{
+	mtu::search s;
+	s.Start( 576, 1472 );
+	uint32_t first = s.Next( );
+	s.Lost( first );
+	s.Acknowledged( first );
+	CHECK( s.Result( ) == 576 );
+	CHECK( s.Next( ) < first );
+
+	s.Lost( 576 );
+	CHECK( s.IsActive( ) && s.Result( ) == 576 );
+}
+
+TEST( mtu_search_narrow_range )
+{
+	mtu::search s;
+	s.Start( 1000, 1000 + mtu::resolution - 1 );
+	CHECK( !s.IsActive( ) && s.Result( ) == 1000 );
+}
+
+static mtu::discovery GetPolicy( )
+{
+	mtu::discovery policy;
+	policy.minimum = 576;
+	policy.maximum = 1472;
+	policy.interval = 0;
+	policy.timeout = 100;
+	policy.attempts = 2;
+	return policy;
+}
+
+// Probes up to the path's size are acknowledged, larger ones time out after every attempt.
+TEST( mtu_prober_finds_the_path )
+{
+	const uint32_t path = 1200;
+	mtu::discovery policy = GetPolicy( );
+	mtu::prober probes;
+	enet_uint32 now = 1000;
+	bool done = false;
+	for( int k = 0; k < 200 && !done; ++k, now += 50 )
+		switch( probes.Update( policy, now, 10, 0x1234, 5, 16 ) )
+		{
+			case mtu::PROBE_SEND:
+				CHECK( ( probes.Token( ) & 0xFFFF ) == 5 );
+				CHECK( !probes.Acknowledge( probes.Size( ), probes.Token( ) + 1 ) );
+				if( probes.Size( ) <= path )
+					CHECK( probes.Acknowledge( probes.Size( ), probes.Token( ) ) );
+
+				break;
+
+			case mtu::PROBE_DONE:
+				done = true;
+				break;
+
+			case mtu::PROBE_IDLE:
+				break;
+		}
+
+	CHECK( done && !probes.IsRunning( ) );
+	CHECK( probes.Result( ) <= path && probes.Result( ) + mtu::resolution > path );
+	CHECK( probes.Lost( ) > 0 && probes.Sent( ) > probes.Lost( ) );
+
+	// searched once without an interval
+	CHECK( probes.Update( policy, now, 10, 0x1234, 5, 16 ) == mtu::PROBE_IDLE );
+	probes.Stop( true );
+	CHECK( probes.Update( policy, now, 10, 0x1234, 5, 16 ) == mtu::PROBE_SEND );
+}
+
+TEST( mtu_acknowledgement_parsing )
+{
+	uint8_t data[mtu::acknowledgement_size];
+	std::memset( data, 0, sizeof( data ) );
+	uint32_t size = 0, token = 0;
+	CHECK( !mtu::ParseAcknowledgement( data, sizeof( data ), size, token ) );
+	CHECK( !mtu::ParseAcknowledgement( data, 3, size, token ) );
+}
+
+#if defined __linux__
+
+// Restoring puts back what the socket had before the first ForbidFragmentation.
+TEST( mtu_fragmentation_restored )
+{
+	ENetSocket socket = enet_socket_create( ENET_SOCKET_TYPE_DATAGRAM );
+	CHECK( socket != ENET_SOCKET_NULL );
+
+	int before = -1, value = -1;
+	socklen_t len = sizeof( before );
+	CHECK( getsockopt( socket, IPPROTO_IP, IP_MTU_DISCOVER, &before, &len ) == 0 );
+
+	mtu::fragmentation previous;
+	previous.saved = false;
+	CHECK( mtu::ForbidFragmentation( socket, previous ) );
+	CHECK( mtu::ForbidFragmentation( socket, previous ) );
+	CHECK( getsockopt( socket, IPPROTO_IP, IP_MTU_DISCOVER, &value, &len ) == 0 && value == IP_PMTUDISC_PROBE );
+
+	CHECK( mtu::RestoreFragmentation( socket, previous ) );
+	CHECK( getsockopt( socket, IPPROTO_IP, IP_MTU_DISCOVER, &value, &len ) == 0 && value == before );
+	CHECK( !previous.saved );
+
+	enet_socket_destroy( socket );
+}
+
+#endif
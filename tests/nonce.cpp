@@ -0,0 +1,99 @@
+#include "test.hpp"
+#include "nonce.hpp"
+#include <vector>
+
+// A reliable packet held back by a retransmission still opens after many packets on
+// other channels and unreliable ones, which a single shared window would have pushed
+// out of range.
+TEST( nonce_delayed_reliable_packet )
+{
+	nonce::sender tx;
+	nonce::receiver rx;
+
+	uint64_t delayed = tx.Next( 0, true );
+	std::vector<uint64_t> others;
+	for( size_t k = 0; k < 200; ++k )
+	{
+		others.push_back( tx.Next( 1, true ) );
+		others.push_back( tx.Next( static_cast<uint8_t>( k % 4 ), false ) );
+	}
+
+	for( size_t k = 0; k < others.size( ); ++k )
+	{
+		uint8_t channel = k % 2 == 0 ? 1 : static_cast<uint8_t>( k / 2 % 4 );
+		bool reliable = k % 2 == 0;
+		CHECK( rx.Check( others[k], channel, reliable ) );
+		rx.Accept( others[k] );
+	}
+
+	CHECK( rx.Check( delayed, 0, true ) );
+	rx.Accept( delayed );
+
+	// and only once
+	CHECK( !rx.Check( delayed, 0, true ) );
+	CHECK( rx.Check( tx.Next( 0, true ), 0, true ) );
+}
+
+TEST( nonce_reliable_packets_are_consecutive )
+{
+	nonce::sender tx;
+	nonce::receiver rx;
+
+	uint64_t first = tx.Next( 2, true ), second = tx.Next( 2, true ), third = tx.Next( 2, true );
+	CHECK( nonce::GetSpace( first ) == nonce::GetSpace( 2, true ) && nonce::GetCounter( first ) == 1 );
+	CHECK( rx.Check( first, 2, true ) );
+	rx.Accept( first );
+
+	CHECK( !rx.Check( third, 2, true ) );
+	CHECK( !rx.Check( second, 3, true ) );
+	CHECK( !rx.Check( second, 2, false ) );
+	CHECK( rx.Check( second, 2, true ) );
+	rx.Accept( second );
+	CHECK( !rx.Check( first, 2, true ) );
+
+	// a packet that was never sent doesn't leave a gap
+	uint64_t cancelled = tx.Next( 2, true );
+	tx.Cancel( cancelled );
+	CHECK( tx.Next( 2, true ) == cancelled );
+}
+
+// The first reliable packet opened on a channel starts its sequence, earlier ones may
+// have been dropped before this end had its keys.
+TEST( nonce_reliable_sequence_starts_late )
+{
+	nonce::sender tx;
+	nonce::receiver rx;
+	tx.Next( 0, true );
+	tx.Next( 0, true );
+
+	uint64_t third = tx.Next( 0, true );
+	CHECK( rx.Check( third, 0, true ) );
+	rx.Accept( third );
+	CHECK( rx.Check( tx.Next( 0, true ), 0, true ) );
+}
+
+TEST( nonce_unordered_window )
+{
+	nonce::sender tx;
+	nonce::receiver rx;
+	std::vector<uint64_t> sent;
+	for( size_t k = 0; k < 100; ++k )
+		sent.push_back( tx.Next( 0, false ) );
+
+	// reordered within the window
+	CHECK( rx.Check( sent[50], 0, false ) );
+	rx.Accept( sent[50] );
+	CHECK( rx.Check( sent[10], 0, false ) );
+	rx.Accept( sent[10] );
+	CHECK( !rx.Check( sent[10], 0, false ) );
+
+	CHECK( rx.Check( sent[99], 0, false ) );
+	rx.Accept( sent[99] );
+	CHECK( !rx.Check( sent[20], 0, false ) );
+	CHECK( rx.Check( sent[60], 0, false ) );
+
+	// unreliable counters are shared by every channel and can't pose as reliable ones
+	CHECK( rx.Check( sent[98], 7, false ) );
+	CHECK( !rx.Check( sent[98] | static_cast<uint64_t>( 1 ) << nonce::counter_bits, 7, true ) );
+	CHECK( !rx.Check( 0, 0, false ) );
+}
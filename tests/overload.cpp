@@ -0,0 +1,60 @@
+#include "test.hpp"
+#include "overload.hpp"
+#include <vector>
+
+static overload::policy GetPolicy( bool shed_unreliable, bool coalesce )
+{
+	overload::policy settings = overload::policy( );
+	settings.max_pending = 4;
+	settings.drain_limit = 16;
+	settings.shed_unreliable = shed_unreliable;
+	settings.coalesce = coalesce;
+	return settings;
+}
+
+TEST( overload_measures_thresholds )
+{
+	overload::monitor load;
+	load.Enable( GetPolicy( false, true ) );
+
+	std::vector<ENetEvent> &batch = load.Batch( );
+	batch.resize( 3 );
+	CHECK( !load.Measure( 1000 ) );
+	CHECK( load.Pending( ) == 3 && load.Gap( ) == 0 );
+
+	load.Batch( ).resize( 4 );
+	load.CountDatagram( );
+	CHECK( load.Measure( 1250 ) );
+	CHECK( load.Pending( ) == 4 && load.Datagrams( ) == 1 && load.Gap( ) == 250 );
+
+	CHECK( load.Update( true ) );
+	CHECK( !load.Update( true ) );
+	CHECK( load.IsOverloaded( ) && load.Overloads( ) == 1 );
+
+	// the batch is reused, not reallocated
+	CHECK( load.Batch( ).empty( ) && load.Batch( ).capacity( ) >= 4 );
+}
+
+// Shedding drops every unreliable packet, coalescing keeps the first one it's offered
+// per key, the newest since batches are walked backwards.
+TEST( overload_shed_and_coalesce )
+{
+	overload::monitor load;
+	load.Enable( GetPolicy( true, true ) );
+	load.Measure( 1 );
+	CHECK( load.Drop( 1 ) && load.Drop( 2 ) && load.Drop( 1 ) );
+	CHECK( load.Shed( ) == 3 && load.Coalesced( ) == 0 );
+
+	load.Enable( GetPolicy( false, true ) );
+	load.Measure( 2 );
+	CHECK( !load.Drop( 1 ) && !load.Drop( 2 ) );
+	CHECK( load.Drop( 1 ) && load.Drop( 2 ) );
+	CHECK( load.Coalesced( ) == 2 );
+
+	// every measurement starts a new batch
+	load.Measure( 3 );
+	CHECK( !load.Drop( 1 ) );
+
+	load.Enable( GetPolicy( false, false ) );
+	CHECK( !load.IsShedding( ) && !load.Drop( 1 ) && !load.Drop( 1 ) );
+}
@@ -0,0 +1,30 @@
+#include "test.hpp"
+#include "pool.hpp"
+#include <atomic>
+#include <vector>
+
+// Every index runs exactly once per batch, and batches don't overlap.
+TEST( pool_runs_every_task_once )
+{
+	pool::workers workers( 3 );
+	CHECK( workers.Size( ) == 3 );
+
+	for( size_t round = 0; round < 50; ++round )
+	{
+		size_t count = round * 7 % 40;
+		std::vector<std::atomic<int>> runs( count );
+		for( std::atomic<int> &r : runs )
+			r = 0;
+
+		workers.Run( count, [&runs]( size_t k )
+		{
+			runs[k].fetch_add( 1 );
+		} );
+
+		bool once = true;
+		for( const std::atomic<int> &r : runs )
+			once = once && r.load( ) == 1;
+
+		CHECK( once );
+	}
+}
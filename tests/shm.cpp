@@ -0,0 +1,205 @@
+#include "test.hpp"
+#include "shm.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <chrono>
+#include <thread>
+
+#if !defined _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Segment names are per process, so concurrent runs don't take over each other's.
+static std::string GetName( const char *suffix )
+{
+	char name[64];
+	std::snprintf( name, sizeof( name ), "test-%llu-%s",
+		static_cast<unsigned long long>( std::chrono::steady_clock::now( ).time_since_epoch( ).count( ) ), suffix );
+	return name;
+}
+
+// Polls until an event comes up, the other end may not have caught up right away.
+static bool WaitEvent( shm::host &h, shm::event &ev, int milliseconds = 2000 )
+{
+	auto deadline = std::chrono::steady_clock::now( ) + std::chrono::milliseconds( milliseconds );
+	while( !h.Poll( ev ) )
+	{
+		if( std::chrono::steady_clock::now( ) >= deadline )
+			return false;
+
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+
+	return true;
+}
+
+static bool Connect( shm::host &server, shm::host &client, const std::string &name, uint32_t data )
+{
+	shm::event ev;
+	int32_t peer = client.Connect( name, data );
+	return peer >= 0 &&
+		WaitEvent( server, ev ) && ev.type == shm::EVENT_CONNECT && ev.data == data &&
+		WaitEvent( client, ev ) && ev.type == shm::EVENT_CONNECT && ev.peer == static_cast<size_t>( peer );
+}
+
+TEST( shm_rejects_bad_parameters )
+{
+	shm::host h;
+	CHECK( !h.Listen( GetName( "bad" ), 0, shm::default_ring_size ) );
+	CHECK( !h.Listen( GetName( "bad" ), 1, 100 ) );
+	CHECK( !h.Listen( GetName( "bad" ), shm::maximum_peers + 1, shm::default_ring_size ) );
+
+	shm::host client;
+	CHECK( client.Client( 1 ) );
+	CHECK( client.Connect( GetName( "missing" ), 0 ) < 0 );
+}
+
+TEST( shm_refuses_a_live_segment )
+{
+	std::string name = GetName( "duplicate" );
+	shm::host server;
+	CHECK( server.Listen( name, 1, 4096 ) );
+
+	{
+		shm::host duplicate;
+		CHECK( !duplicate.Listen( name, 1, 4096 ) );
+	}
+
+	// the failed attempt leaves the segment alone
+	shm::host client;
+	CHECK( client.Client( 1 ) );
+	CHECK( Connect( server, client, name, 1 ) );
+}
+
+#if !defined _WIN32
+
+TEST( shm_takes_over_a_stale_segment )
+{
+	std::string name = GetName( "stale" );
+
+	// a server that dies without closing leaves its segment behind
+	pid_t child = fork( );
+	if( child == 0 )
+	{
+		shm::host crashed;
+		_exit( crashed.Listen( name, 1, 4096 ) ? 0 : 1 );
+	}
+
+	int status = 0;
+	CHECK( child > 0 && waitpid( child, &status, 0 ) == child );
+	CHECK( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+
+	shm::host server, client;
+	CHECK( server.Listen( name, 1, 4096 ) );
+	CHECK( client.Client( 1 ) );
+	CHECK( Connect( server, client, name, 2 ) );
+}
+
+#endif
+
+TEST( shm_delivers_in_order )
+{
+	std::string name = GetName( "order" );
+	shm::host server, client;
+	CHECK( server.Listen( name, 2, 4096 ) );
+	CHECK( client.Client( 1 ) );
+	CHECK( Connect( server, client, name, 7 ) );
+
+	for( uint32_t k = 0; k < 16; ++k )
+	{
+		std::string payload( k * 13, static_cast<char>( 'a' + k ) );
+		CHECK( client.Send( 0, static_cast<uint8_t>( k ), k, payload.data( ), payload.size( ) ) );
+	}
+
+	shm::event ev;
+	for( uint32_t k = 0; k < 16; ++k )
+	{
+		CHECK( WaitEvent( server, ev ) );
+		CHECK( ev.type == shm::EVENT_RECEIVE );
+		CHECK( ev.channel == k && ev.flags == k );
+		CHECK( ev.payload == std::string( k * 13, static_cast<char>( 'a' + k ) ) );
+	}
+
+	CHECK( server.Send( ev.peer, 3, 0, "back", 4 ) );
+	CHECK( WaitEvent( client, ev ) );
+	CHECK( ev.type == shm::EVENT_RECEIVE && ev.payload == "back" );
+}
+
+// Records that don't fit before the end of the ring wrap around to its start, and a
+// full ring refuses writes until the reader catches up.
+TEST( shm_ring_wraps_and_fills )
+{
+	std::string name = GetName( "wrap" );
+	shm::host server, client;
+	CHECK( server.Listen( name, 1, 256 ) );
+	CHECK( client.Client( 1 ) );
+	CHECK( Connect( server, client, name, 0 ) );
+
+	std::string payload( 80, 'x' );
+	CHECK( !client.Send( 0, 0, 0, std::string( 256, 'y' ).data( ), 256 ) );
+
+	shm::event ev;
+	for( size_t round = 0; round < 20; ++round )
+	{
+		payload[0] = static_cast<char>( round );
+		CHECK( client.Send( 0, 0, 0, payload.data( ), payload.size( ) ) );
+		CHECK( client.Send( 0, 0, 0, payload.data( ), payload.size( ) ) );
+		CHECK( !client.Send( 0, 0, 0, payload.data( ), payload.size( ) ) );
+
+		for( size_t k = 0; k < 2; ++k )
+		{
+			CHECK( WaitEvent( server, ev ) );
+			CHECK( ev.type == shm::EVENT_RECEIVE && ev.payload == payload );
+		}
+	}
+}
+
+TEST( shm_disconnect_carries_data )
+{
+	std::string name = GetName( "disconnect" );
+	shm::host server, client;
+	CHECK( server.Listen( name, 1, 4096 ) );
+	CHECK( client.Client( 1 ) );
+	CHECK( Connect( server, client, name, 0 ) );
+
+	CHECK( client.Send( 0, 0, 0, "last", 4 ) );
+	client.Disconnect( 0, 42 );
+	CHECK( !client.IsConnected( 0 ) );
+
+	shm::event ev;
+	CHECK( WaitEvent( server, ev ) );
+	CHECK( ev.type == shm::EVENT_RECEIVE && ev.payload == "last" );
+	CHECK( WaitEvent( server, ev ) );
+	CHECK( ev.type == shm::EVENT_DISCONNECT && ev.data == 42 );
+	CHECK( WaitEvent( client, ev ) );
+	CHECK( ev.type == shm::EVENT_DISCONNECT );
+
+	// the slot is free again
+	CHECK( Connect( server, client, name, 1 ) );
+}
+
+// A client that stops polling loses its slot to the next one, and finds out once it
+// polls again.
+TEST( shm_reclaims_silent_clients )
+{
+	std::string name = GetName( "reclaim" );
+	shm::host server, silent, client;
+	CHECK( server.Listen( name, 1, 4096 ) );
+	server.SetTimeout( 4 * shm::beat_interval );
+	CHECK( silent.Client( 1 ) );
+	CHECK( client.Client( 1 ) );
+	CHECK( Connect( server, silent, name, 0 ) );
+	CHECK( client.Connect( name, 0 ) < 0 );
+
+	shm::event ev;
+	CHECK( WaitEvent( server, ev, 8 * shm::beat_interval ) );
+	CHECK( ev.type == shm::EVENT_DISCONNECT && ev.data == 0 );
+
+	CHECK( Connect( server, client, name, 2 ) );
+	CHECK( !silent.Send( 0, 0, 0, "late", 4 ) );
+	CHECK( silent.Poll( ev ) );
+	CHECK( ev.type == shm::EVENT_DISCONNECT );
+	CHECK( client.IsConnected( 0 ) );
+}
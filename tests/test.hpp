@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+// A minimal test runner: TEST defines a test function registered before main runs,
+// CHECK records a failure without stopping the test so every broken check is listed.
+namespace test
+{
+
+typedef void ( *function )( );
+
+struct registration
+{
+	registration( const char *name, function func );
+};
+
+void Fail( const char *file, int line, const char *expression );
+
+}
+
+#define TEST( name ) \
+	static void test_##name( ); \
+	static test::registration register_##name( #name, test_##name ); \
+	static void test_##name( )
+
+#define CHECK( expression ) \
+	do \
+	{ \
+		if( !( expression ) ) \
+			test::Fail( __FILE__, __LINE__, #expression ); \
+	} \
+	while( false )
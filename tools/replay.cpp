@@ -0,0 +1,242 @@
+// Replays a capture made with host:capture_start against a fresh ENetHost in this
+// process, and reports the CPU time servicing it costs per tick. Running the same
+// capture through two builds compares binding and protocol changes on real traffic.
+//
+// usage: replay <capture file> [options]
+//   --speed <factor>   replay speed relative to the capture, 0 to run ticks back to back
+//   --tick <ms>        tick length in milliseconds of capture time (default 15)
+//   --peers <count>    peer slots of the host (default 128)
+//   --channels <count> channel limit of the host (default 255)
+//   --crc32c           checksum datagrams with CRC32C, as host:checksum("crc32c")
+//   --range-coder      compress datagrams with ENet's range coder
+
+#include <enet/enet.h>
+#include "capture.hpp"
+#include "crc32c.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#if defined _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+struct options
+{
+	std::string path;
+	double speed;
+	uint64_t tick;
+	size_t peers;
+	size_t channels;
+	bool crc32c;
+	bool range_coder;
+};
+
+struct totals
+{
+	uint64_t connects;
+	uint64_t disconnects;
+	uint64_t receives;
+	uint64_t bytes;
+};
+
+// CPU time of the calling thread in microseconds, so time spent waiting isn't counted.
+static uint64_t GetThreadTime( )
+{
+#if defined _WIN32
+	FILETIME creation, exit, kernel, user;
+	if( GetThreadTimes( GetCurrentThread( ), &creation, &exit, &kernel, &user ) == 0 )
+		return 0;
+
+	uint64_t k = static_cast<uint64_t>( kernel.dwHighDateTime ) << 32 | kernel.dwLowDateTime;
+	uint64_t u = static_cast<uint64_t>( user.dwHighDateTime ) << 32 | user.dwLowDateTime;
+	return ( k + u ) / 10;
+#else
+	timespec ts;
+	clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+	return static_cast<uint64_t>( ts.tv_sec ) * 1000000 + static_cast<uint64_t>( ts.tv_nsec ) / 1000;
+#endif
+}
+
+static enet_uint32 ENET_CALLBACK ChecksumCRC32C( const ENetBuffer *buffers, size_t bufferCount )
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for( ; bufferCount > 0; --bufferCount, ++buffers )
+		crc = crc32c::Update( crc, buffers->data, buffers->dataLength );
+
+	return ENET_HOST_TO_NET_32( ~crc );
+}
+
+static bool ParseOptions( int argc, char **argv, options &opts )
+{
+	if( argc < 2 )
+		return false;
+
+	opts.path = argv[1];
+	opts.speed = 1.0;
+	opts.tick = 15000;
+	opts.peers = 128;
+	opts.channels = ENET_PROTOCOL_MAXIMUM_CHANNEL_COUNT;
+	opts.crc32c = false;
+	opts.range_coder = false;
+	for( int k = 2; k < argc; ++k )
+	{
+		std::string arg = argv[k];
+		bool has_value = k + 1 < argc;
+		if( arg == "--speed" && has_value )
+			opts.speed = std::atof( argv[++k] );
+		else if( arg == "--tick" && has_value )
+			opts.tick = static_cast<uint64_t>( std::atof( argv[++k] ) * 1000.0 );
+		else if( arg == "--peers" && has_value )
+			opts.peers = static_cast<size_t>( std::atoi( argv[++k] ) );
+		else if( arg == "--channels" && has_value )
+			opts.channels = static_cast<size_t>( std::atoi( argv[++k] ) );
+		else if( arg == "--crc32c" )
+			opts.crc32c = true;
+		else if( arg == "--range-coder" )
+			opts.range_coder = true;
+		else
+			return false;
+	}
+
+	return opts.speed >= 0.0 && opts.tick != 0 && opts.peers != 0 && opts.peers <= ENET_PROTOCOL_MAXIMUM_PEER_ID;
+}
+
+static void Service( ENetHost *host, totals &counts )
+{
+	ENetEvent ev;
+	while( enet_host_service( host, &ev, 0 ) > 0 )
+		switch( ev.type )
+		{
+			case ENET_EVENT_TYPE_CONNECT:
+				++counts.connects;
+				break;
+
+			case ENET_EVENT_TYPE_DISCONNECT:
+				++counts.disconnects;
+				break;
+
+			case ENET_EVENT_TYPE_RECEIVE:
+				++counts.receives;
+				counts.bytes += ev.packet->dataLength;
+				enet_packet_destroy( ev.packet );
+				break;
+
+			default:
+				break;
+		}
+}
+
+inline uint64_t GetPercentile( const std::vector<uint64_t> &sorted, double fraction )
+{
+	if( sorted.empty( ) )
+		return 0;
+
+	size_t index = static_cast<size_t>( fraction * static_cast<double>( sorted.size( ) - 1 ) + 0.5 );
+	return sorted[index];
+}
+
+int main( int argc, char **argv )
+{
+	options opts;
+	if( !ParseOptions( argc, argv, opts ) )
+	{
+		std::fprintf(
+			stderr,
+			"usage: %s <capture file> [--speed <factor>] [--tick <ms>] [--peers <count>] "
+			"[--channels <count>] [--crc32c] [--range-coder]\n",
+			argv[0]
+		);
+		return 1;
+	}
+
+	if( enet_initialize( ) != 0 )
+	{
+		std::fprintf( stderr, "failed to initialize ENet\n" );
+		return 1;
+	}
+
+	ENetAddress address = { ENET_HOST_ANY, ENET_PORT_ANY };
+	enet_address_set_host( &address, "127.0.0.1" );
+	ENetHost *host = enet_host_create( &address, opts.peers, opts.channels, 0, 0 );
+	if( host == nullptr || enet_socket_get_address( host->socket, &address ) != 0 )
+	{
+		std::fprintf( stderr, "failed to create ENetHost\n" );
+		return 1;
+	}
+
+	if( opts.crc32c )
+		host->checksum = ChecksumCRC32C;
+
+	if( opts.range_coder )
+		enet_host_compress_with_range_coder( host );
+
+	// back to back ticks replay the capture at its own pace, one tick of capture time per tick
+	capture::player play;
+	if( !play.Open( opts.path, address, opts.speed > 0.0 ? opts.speed : 1.0 ) )
+	{
+		std::fprintf( stderr, "failed to open capture file '%s'\n", opts.path.c_str( ) );
+		enet_host_destroy( host );
+		enet_deinitialize( );
+		return 1;
+	}
+
+	std::printf( "replaying %llu datagrams\n", static_cast<unsigned long long>( play.Remaining( ) ) );
+
+	totals counts = { 0, 0, 0, 0 };
+	std::vector<uint64_t> ticks;
+	auto started = std::chrono::steady_clock::now( );
+	for( uint64_t elapsed = opts.tick; !play.Finished( ); elapsed += opts.tick )
+	{
+		if( opts.speed > 0.0 )
+			std::this_thread::sleep_until( started + std::chrono::microseconds( elapsed ) );
+
+		play.Pump( 0, elapsed );
+
+		uint64_t before = GetThreadTime( );
+		Service( host, counts );
+		ticks.push_back( GetThreadTime( ) - before );
+	}
+
+	// let the last datagrams through the loopback before the final tick
+	std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+	uint64_t before = GetThreadTime( );
+	Service( host, counts );
+	ticks.push_back( GetThreadTime( ) - before );
+
+	uint64_t total = 0;
+	for( uint64_t t : ticks )
+		total += t;
+
+	std::sort( ticks.begin( ), ticks.end( ) );
+	std::printf( "sent %llu datagrams over %zu ticks\n", static_cast<unsigned long long>( play.Sent( ) ), ticks.size( ) );
+	std::printf(
+		"events: %llu connect, %llu disconnect, %llu receive (%llu bytes)\n",
+		static_cast<unsigned long long>( counts.connects ),
+		static_cast<unsigned long long>( counts.disconnects ),
+		static_cast<unsigned long long>( counts.receives ),
+		static_cast<unsigned long long>( counts.bytes )
+	);
+	std::printf(
+		"service CPU time per tick (us): mean %.1f, p50 %llu, p99 %llu, max %llu, total %llu\n",
+		static_cast<double>( total ) / static_cast<double>( ticks.size( ) ),
+		static_cast<unsigned long long>( GetPercentile( ticks, 0.5 ) ),
+		static_cast<unsigned long long>( GetPercentile( ticks, 0.99 ) ),
+		static_cast<unsigned long long>( ticks.back( ) ),
+		static_cast<unsigned long long>( total )
+	);
+
+	play.Close( );
+	enet_host_destroy( host );
+	enet_deinitialize( );
+	return 0;
+}